@@ -433,7 +433,7 @@ get_query_iter (MuQuery *query, const char* expr, int maxnum)
 
 	err = NULL;
 	iter = mu_query_run (query, expr,
-			     FALSE, MU_MSG_FIELD_ID_NONE, TRUE, maxnum, &err);
+			     MU_QUERY_FLAG_NONE, MU_MSG_FIELD_ID_NONE, TRUE, maxnum, &err);
 	if (!iter) {
 		mu_guile_g_error ("<internal error>", err);
 		g_clear_error (&err);
@@ -18,7 +18,9 @@
 **
 */
 
+#include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <string.h>
 #include <ctype.h>
@@ -27,6 +29,55 @@
 #include "mu-util.h"
 #include "mu-str.h"
 
+/*
+ * the contacts cache file consists of:
+ *   - a ContactsHeader;
+ *   - ContactsHeader._num ContactRecords, sorted by their e-mail
+ *     address (ignoring case);
+ *   - the string table, ContactsHeader._strsize bytes with the
+ *     '\0'-terminated addresses and names the records point to.
+ * All numbers are in host byte-order. We mmap the file and look up
+ * the contacts in it directly, so opening it does not depend on the
+ * number of contacts.
+ *
+ * The file is only written as a whole (when destroying a MuContacts
+ * with changes); until then, changes are appended to the journal
+ * (<cachefile>.journal), where each JournalEntry is followed by the
+ * address and the name (not '\0'-terminated). We replay the journal
+ * when opening the cache; that does not count as a change, so only
+ * the MuContacts that made changes (e.g. the one in the server)
+ * replaces the journal, not the ones that just read it (e.g. the
+ * one for 'mu cfind'). Those do convert a cache file in the old
+ * format, but leave the journal alone.
+ */
+#define CONTACTS_MAGIC		"mu-cntct"
+#define CONTACTS_VERSION	1
+#define JOURNAL_SUFFIX		".journal"
+#define NO_NAME			G_MAXUINT32
+
+struct _ContactsHeader {
+	char	_magic[8];
+	guint32 _version, _num, _strsize, _reserved;
+};
+typedef struct _ContactsHeader ContactsHeader;
+
+struct _ContactRecord {
+	guint32 _email, _name;  /* offsets in the string table; _name
+				 * is NO_NAME if there's none */
+	gint64	_tstamp;
+	guint32 _freq, _personal;
+};
+typedef struct _ContactRecord ContactRecord;
+
+struct _JournalEntry {
+	guint32 _emaillen, _namelen; /* _namelen is NO_NAME if there's
+				      * no name */
+	gint64	_tstamp;
+	guint32 _freq, _personal;
+};
+typedef struct _JournalEntry JournalEntry;
+
+/* for the old (GKeyFile-based) cache, which we import */
 #define EMAIL_KEY	"email"
 #define NAME_KEY	"name"
 #define TSTAMP_KEY	"tstamp"
@@ -39,48 +90,257 @@ struct _ContactInfo {
 	gchar *  _name, *_email;
 	gboolean _personal;
 	time_t   _tstamp;
+	guint32  _freq;     /* the number of times we've seen it */
+	guint64  _revision; /* when it was added or updated */
 };
 typedef struct _ContactInfo ContactInfo;
 
+static void clear_str (char* str);
 static void contact_info_destroy (ContactInfo *cinfo);
 static ContactInfo *contact_info_new (char *email, char *name,
 				      gboolean personal, time_t tstamp);
 
 struct _MuContacts {
-        GKeyFile      *_ccache;
-	gchar         *_path;
-
+	gchar         *_path, *_journal_path;
+
+	/* the mmapped cache file (or NULL); _shadowed has a bit for
+	 * each record, which is set if there's a newer version of it
+	 * in _hash */
+	GMappedFile   *_mfile;
+	const ContactRecord *_records;
+	const char    *_strings;
+	guint32        _num, _strsize;
+	guint8        *_shadowed;
+
+	/* the contacts that changed since the cache file was
+	 * written, lowercased address => ContactInfo; _num_new is
+	 * the number of those that are not in the cache file */
 	GHashTable    *_hash;
-	gboolean       _dirty;
+	size_t         _num_new;
+	gboolean       _dirty; /* whether _we_ changed anything */
+	gboolean       _legacy; /* the cache file is in the old format */
+
+	int            _journal; /* opened on the first change, or -1 */
+	gboolean       _journal_broken; /* don't append to it anymore */
+
+	/* the latest revision, and the one of the last
+	 * (re)load/clear, see mu_contacts_revision */
+	guint64        _revision, _reset;
 };
 
 
+/* revisions start at the current time (in microseconds), so those of
+ * an earlier process (probably) are older than ours */
+static void
+reset_revision (MuContacts *self)
+{
+	GTimeVal tv;
 
-static GKeyFile*
-load_key_file (const char *path)
+	g_get_current_time (&tv);
+	self->_revision = MAX (self->_revision + 1,
+			       (guint64)tv.tv_sec * G_USEC_PER_SEC +
+			       (guint64)tv.tv_usec);
+	self->_reset	= self->_revision;
+}
+
+
+static const char*
+record_string (MuContacts *self, guint32 offset)
+{
+	/* the string table ends with a '\0', see map_cache */
+	return offset < self->_strsize ? self->_strings + offset : NULL;
+}
+
+
+/* find the index of the record for addr (case-insensitively), or -1 */
+static gint64
+find_record (MuContacts *self, const char *addr)
+{
+	guint32 lower, upper;
+
+	lower = 0;
+	upper = self->_num;
+
+	while (lower < upper) {
+		guint32 mid;
+		const char *email;
+		int cmp;
+
+		mid   = lower + (upper - lower) / 2;
+		email = record_string (self, self->_records[mid]._email);
+		cmp   = g_ascii_strcasecmp (addr, email ? email : "");
+
+		if (cmp == 0)
+			return mid;
+		else if (cmp < 0)
+			upper = mid;
+		else
+			lower = mid + 1;
+	}
+
+	return -1;
+}
+
+
+static void
+unmap_cache (MuContacts *self)
+{
+	if (self->_mfile)
+		g_mapped_file_unref (self->_mfile);
+
+	g_free (self->_shadowed);
+
+	self->_mfile	= NULL;
+	self->_records	= NULL;
+	self->_strings	= NULL;
+	self->_shadowed = NULL;
+	self->_num	= self->_strsize = 0;
+}
+
+
+/* mmap the cache file, and check its header; *legacy receives TRUE
+ * if it's not a binary cache file at all (but, presumably, one in
+ * the old format) */
+static gboolean
+map_cache (MuContacts *self, gboolean *legacy)
 {
 	GError *err;
-	GKeyFile *keyfile;
-	gboolean file_exists;
+	const ContactsHeader *hdr;
+	const char *data;
+	gsize len;
 
-	err	    = NULL;
+	*legacy = FALSE;
 
-	/* of course this is racy, but it's only for giving more
-	 * meaningful errors to users */
-	file_exists = TRUE;
-	if (access(path, F_OK) != 0) {
-		if (errno != ENOENT) {
-			g_warning ("cannot open %s: %s", path, strerror(errno));
-			return NULL;
-		}
-		file_exists = FALSE;
+	if (access (self->_path, F_OK) != 0) {
+		if (errno == ENOENT)
+			return TRUE; /* no cache yet */
+		g_warning ("cannot open %s: %s", self->_path,
+			   strerror(errno));
+		return FALSE;
+	}
+
+	err = NULL;
+	self->_mfile = g_mapped_file_new (self->_path, FALSE, &err);
+	if (!self->_mfile) {
+		g_warning ("could not map %s: %s", self->_path,
+			   err ? err->message : "error");
+		g_clear_error (&err);
+		return FALSE;
+	}
+
+	data = g_mapped_file_get_contents (self->_mfile);
+	len  = g_mapped_file_get_length (self->_mfile);
+	hdr  = (const ContactsHeader*)data;
+
+	if (len < sizeof(ContactsHeader) ||
+	    memcmp (hdr->_magic, CONTACTS_MAGIC, sizeof(hdr->_magic)) != 0) {
+		*legacy = TRUE;
+		unmap_cache (self);
+		return TRUE;
+	}
+
+	if (hdr->_version != CONTACTS_VERSION ||
+	    (guint64)len != sizeof(ContactsHeader) +
+	    (guint64)hdr->_num * sizeof(ContactRecord) + hdr->_strsize ||
+	    (hdr->_strsize > 0 && data[len - 1] != '\0')) {
+		/* we'll write a new one when there are changes */
+		g_warning ("ignoring invalid contacts cache %s", self->_path);
+		unmap_cache (self);
+		return TRUE;
+	}
+
+	self->_num	= hdr->_num;
+	self->_strsize	= hdr->_strsize;
+	self->_records	= (const ContactRecord*)(data + sizeof(ContactsHeader));
+	self->_strings	= (const char*)(self->_records + self->_num);
+	self->_shadowed = g_new0 (guint8, self->_num / 8 + 1);
+
+	return TRUE;
+}
+
+
+/* insert a contact in the hash, replacing any earlier version of
+ * it, and shadowing the one in the cache file (if any) */
+static ContactInfo*
+insert_contact (MuContacts *self, ContactInfo *cinfo)
+{
+	char *key;
+
+	key = g_ascii_strdown (cinfo->_email, -1);
+
+	if (!g_hash_table_lookup (self->_hash, key)) {
+		gint64 idx;
+		idx = find_record (self, cinfo->_email);
+		if (idx >= 0)
+			self->_shadowed[idx / 8] |= 1 << (idx % 8);
+		else
+			++self->_num_new;
 	}
 
+	/* this frees any earlier version, and our key if there was
+	 * one already */
+	g_hash_table_insert (self->_hash, key, cinfo);
+
+	return cinfo;
+}
+
+
+static void
+replay_journal (MuContacts *self)
+{
+	gchar *data;
+	gsize len, pos;
+
+	if (!g_file_get_contents (self->_journal_path, &data, &len, NULL))
+		return; /* no journal */
+
+	for (pos = 0; len - pos >= sizeof(JournalEntry);) {
+
+		JournalEntry entry;
+		gsize namelen;
+		ContactInfo *cinfo;
+		char *email, *name;
+
+		memcpy (&entry, data + pos, sizeof(JournalEntry));
+		namelen = entry._namelen == NO_NAME ? 0 : entry._namelen;
+		if (entry._emaillen == 0 ||
+		    len - pos - sizeof(JournalEntry) <
+		    (gsize)entry._emaillen + namelen)
+			break;
+		pos += sizeof(JournalEntry);
+
+		email = g_strndup (data + pos, entry._emaillen);
+		pos  += entry._emaillen;
+		name  = entry._namelen == NO_NAME ? NULL :
+			g_strndup (data + pos, namelen);
+		pos  += namelen;
+
+		cinfo = contact_info_new (email, name, entry._personal ? TRUE :
+					  FALSE, (time_t)entry._tstamp);
+		cinfo->_freq	 = entry._freq;
+		cinfo->_revision = self->_reset;
+		insert_contact (self, cinfo);
+	}
+
+	/* ie., we crashed while writing it */
+	if (pos != len)
+		g_warning ("ignoring truncated entry in %s",
+			   self->_journal_path);
+
+	g_free (data);
+}
+
+
+static GKeyFile*
+load_key_file (const char *path)
+{
+	GError *err;
+	GKeyFile *keyfile;
+
 	err = NULL;
 	keyfile = g_key_file_new ();
 
-	if (file_exists && !g_key_file_load_from_file
-	    (keyfile, path, G_KEY_FILE_KEEP_COMMENTS, &err)) {
+	if (!g_key_file_load_from_file (keyfile, path, G_KEY_FILE_NONE, &err)) {
 		g_warning ("could not load keyfile %s: %s", path, err->message);
 		g_error_free (err);
 		g_key_file_free (keyfile);
@@ -123,48 +383,39 @@ get_values (GKeyFile *kfile, const gchar *group,
 }
 
 
+/* import a contacts cache in the old GKeyFile format; it is replaced
+ * by a binary one when we're destroyed */
 static gboolean
-deserialize_cache (MuContacts *self)
+import_key_file (MuContacts *self)
 {
+	GKeyFile *kfile;
 	gchar **groups;
 	gsize i, len;
 
-	groups = g_key_file_get_groups (self->_ccache, &len);
+	kfile = load_key_file (self->_path);
+	if (!kfile)
+		return FALSE;
+
+	groups = g_key_file_get_groups (kfile, &len);
 	for (i = 0; i != len; ++i) {
 		ContactInfo *cinfo;
 		char *name, *email;
 		size_t tstamp;
 		gboolean personal;
-		if (!get_values (self->_ccache, groups[i],
+		if (!get_values (kfile, groups[i],
 				 &email, &name, &personal, &tstamp))
 			continue; /* ignore this one... */
 
 		cinfo = contact_info_new (email, name, personal, tstamp);
-
-		/* note, we're using the groups[i], so don't free with g_strfreev */
-		g_hash_table_insert (self->_hash, groups[i],
-				     cinfo);
+		cinfo->_revision = self->_reset;
+		insert_contact (self, cinfo);
 	}
 
-	g_free (groups);
-	return TRUE;
-}
-
-static gboolean
-set_comment (GKeyFile *kfile)
-{
-	GError *err;
-	const char *comment =
-		" automatically generated -- do not edit";
-
-	err = NULL;
-	if (!g_key_file_set_comment (kfile, NULL, NULL, comment, &err)) {
-		g_warning ("could not write comment to keyfile: %s",
-			   err->message);
-		g_error_free (err);
-		return FALSE;
-	}
+	g_strfreev (groups);
+	g_key_file_free (kfile);
 
+	/* not a change; we only need to convert it */
+	self->_legacy = TRUE;
 	return TRUE;
 }
 
@@ -173,129 +424,286 @@ MuContacts*
 mu_contacts_new (const gchar *path)
 {
 	MuContacts *self;
+	gboolean legacy;
 
 	g_return_val_if_fail (path, NULL);
 	self = g_new0 (MuContacts, 1);
 
-	self->_path = g_strdup (path);
-	self->_hash = g_hash_table_new_full
+	self->_path	    = g_strdup (path);
+	self->_journal_path = g_strconcat (path, JOURNAL_SUFFIX, NULL);
+	self->_journal	    = -1;
+	self->_hash	    = g_hash_table_new_full
 		(g_str_hash, g_str_equal, g_free,
 		 (GDestroyNotify)contact_info_destroy);
 
-	self->_ccache  = load_key_file (path);
-	if (!self->_ccache || !set_comment (self->_ccache)) {
+	reset_revision (self);
+
+	if (!map_cache (self, &legacy) ||
+	    (legacy && !import_key_file (self))) {
 		mu_contacts_destroy (self);
 		return NULL;
 	}
-	deserialize_cache (self);
-	MU_WRITE_LOG("deserialized contacts from cache %s",
-		     path);
 
-	self->_dirty = FALSE;
+	replay_journal (self);
+	MU_WRITE_LOG("opened contacts cache %s", path);
+
 	return self;
 }
 
 
+static gboolean
+remove_file (const char *path)
+{
+	if (unlink (path) != 0 && errno != ENOENT) {
+		g_warning ("failed to remove %s: %s", path, strerror(errno));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+static void
+close_journal (MuContacts *self)
+{
+	if (self->_journal >= 0 && close (self->_journal) != 0)
+		g_warning ("failed to write %s: %s", self->_journal_path,
+			   strerror(errno));
+
+	self->_journal	      = -1;
+	self->_journal_broken = FALSE;
+}
+
+
 void
 mu_contacts_clear (MuContacts *self)
 {
 	g_return_if_fail (self);
 
-	if (self->_ccache)
-		g_key_file_free (self->_ccache);
-
 	g_hash_table_remove_all (self->_hash);
+	unmap_cache (self);
+	close_journal (self);
+
+	remove_file (self->_path);
+	remove_file (self->_journal_path);
+
+	self->_num_new = 0;
+	self->_dirty   = FALSE;
+	self->_legacy  = FALSE;
 
-	self->_ccache = g_key_file_new ();
-	self->_dirty = FALSE;
+	reset_revision (self);
 }
 
 
-/*
- * we use the e-mail address to create a key in the GKeyFile, but we
- * have to mutilate a bit so that it's (a) *cough* practically-unique
- * and (b) valid as a GKeyFile group name (ie., valid utf8, no control
- * chars, no '[' or ']')
- */
-static const char*
-encode_email_address (const char *addr)
+/* append an entry to the journal, with a single write, so that other
+ * processes replaying it see either all of it or nothing; if that
+ * fails, we stop appending to the journal (entries after a torn one
+ * would be lost anyway), and only write the cache file when we're
+ * destroyed */
+static void
+journal_append (MuContacts *self, ContactInfo *cinfo)
 {
-	static char enc[254 + 1]; /* max size for an e-mail addr */
-	char *cur;
+	JournalEntry entry;
+	GByteArray *buf;
+	ssize_t written;
 
-	if (!addr)
-		return FALSE;
+	if (self->_journal_broken)
+		return;
 
-	/* make sure chars are with {' ' .. '~'}, and not '[' ']' */
-	for (cur = strncpy(enc, addr, sizeof(enc)); *cur != '\0'; ++cur)
-		if (!isalnum(*cur)) {
-			*cur = 'A' +  (*cur % ('Z' - 'A'));
-		} else
-			*cur = tolower(*cur);
+	if (self->_journal < 0) {
+		self->_journal = open (self->_journal_path,
+				       O_WRONLY | O_APPEND | O_CREAT, 0644);
+		if (self->_journal < 0) {
+			g_warning ("cannot open %s: %s", self->_journal_path,
+				   strerror(errno));
+			self->_journal_broken = TRUE;
+			return;
+		}
+	}
+
+	memset (&entry, 0, sizeof(entry));
+	entry._emaillen = strlen (cinfo->_email);
+	entry._namelen	= cinfo->_name ? strlen (cinfo->_name) : NO_NAME;
+	entry._tstamp	= (gint64)cinfo->_tstamp;
+	entry._freq	= cinfo->_freq;
+	entry._personal = cinfo->_personal ? 1 : 0;
+
+	buf = g_byte_array_sized_new (sizeof(entry) + entry._emaillen +
+				      (cinfo->_name ? entry._namelen : 0));
+	g_byte_array_append (buf, (const guint8*)&entry, sizeof(entry));
+	g_byte_array_append (buf, (const guint8*)cinfo->_email,
+			     entry._emaillen);
+	if (cinfo->_name)
+		g_byte_array_append (buf, (const guint8*)cinfo->_name,
+				     entry._namelen);
+
+	written = write (self->_journal, buf->data, buf->len);
+	if (written != (ssize_t)buf->len) {
+		g_warning ("failed to write %s: %s", self->_journal_path,
+			   written < 0 ? strerror(errno) : "short write");
+		self->_journal_broken = TRUE;
+	}
 
-	return enc;
+	g_byte_array_free (buf, TRUE);
 }
 
+
+/* get the contact for email (which must be lowercased as key) into
+ * our hash, or NULL if we don't know it */
+static ContactInfo*
+lookup_contact (MuContacts *self, const char *email, const char *key)
+{
+	ContactInfo *cinfo;
+	const ContactRecord *rec;
+	const char *name;
+	gint64 idx;
+
+	cinfo = (ContactInfo*)g_hash_table_lookup (self->_hash, key);
+	if (cinfo)
+		return cinfo;
+
+	idx = find_record (self, email);
+	if (idx < 0)
+		return NULL;
+
+	rec   = &self->_records[idx];
+	name  = rec->_name == NO_NAME ? NULL : record_string (self, rec->_name);
+	cinfo = contact_info_new (g_strdup (record_string (self, rec->_email)),
+				  g_strdup (name), rec->_personal ? TRUE : FALSE,
+				  (time_t)rec->_tstamp);
+	cinfo->_freq	 = rec->_freq;
+	cinfo->_revision = self->_reset;
+
+	return insert_contact (self, cinfo);
+}
+
+
 gboolean
 mu_contacts_add (MuContacts *self, const char *addr, const char *name,
 		 gboolean personal, time_t tstamp)
 {
 	ContactInfo *cinfo;
-	const char *group;
+	char *email, *key;
 
 	g_return_val_if_fail (self, FALSE);
 	g_return_val_if_fail (addr, FALSE);
 
+	/* contact_info_new would clean it as well, but we need the
+	 * cleaned address to look it up */
+	email = g_strdup (addr);
+	clear_str (email);
+	if (!*email) {
+		g_free (email);
+		return FALSE;
+	}
+
+	key   = g_ascii_strdown (email, -1);
+
+	cinfo = lookup_contact (self, email, key);
+	g_free (key);
+
 	/* add the info, if either there is no info for this email
 	 * yet, *OR* the new one is more recent and does not have an
 	 * empty name */
-	group = encode_email_address (addr);
-
-	cinfo = (ContactInfo*) g_hash_table_lookup (self->_hash, group);
-	if (!cinfo || (cinfo->_tstamp < tstamp && !mu_str_is_empty(name))) {
-		ContactInfo *ci;
-		ci = contact_info_new (g_strdup(addr),
-				       name ? g_strdup(name) : NULL, personal,
-				       tstamp);
-		g_hash_table_insert (self->_hash, g_strdup(group), ci);
-		return self->_dirty = TRUE;
+	if (!cinfo) {
+		cinfo = insert_contact
+			(self, contact_info_new (email,
+						 name ? g_strdup(name) : NULL,
+						 personal, tstamp));
+		cinfo->_freq = 1;
+	} else {
+		g_free (email);
+
+		/* only the frequency changed; that does not need to
+		 * go to the journal */
+		++cinfo->_freq;
+		self->_dirty = TRUE;
+
+		if (cinfo->_tstamp >= tstamp || mu_str_is_empty(name))
+			return FALSE;
+
+		g_free (cinfo->_name);
+		cinfo->_name	 = g_strdup (name);
+		clear_str (cinfo->_name);
+		cinfo->_personal = personal;
+		cinfo->_tstamp	 = tstamp;
 	}
 
-	return FALSE;
+	cinfo->_revision = ++self->_revision;
+	journal_append (self, cinfo);
+
+	return self->_dirty = TRUE;
 }
 
 struct _EachContactData {
 	MuContactsForeachFunc	 _func;
 	gpointer		 _user_data;
 	GRegex			*_rx;
+	guint64			 _since;
 	size_t                   _num;
 };
 typedef struct _EachContactData	 EachContactData;
 
-static void /* email will never be NULL, but ci->_name may be */
-each_contact (const char *group, ContactInfo *ci, EachContactData *ecdata)
+static void /* email will never be NULL, but name may be */
+each_contact (const char *email, const char *name, gboolean personal,
+	      time_t tstamp, guint64 revision, EachContactData *ecdata)
 {
-	if (!ci->_email)
-		g_warning ("missing email: %u", (unsigned)ci->_tstamp);
+	/* ignore the contacts that did not change */
+	if (revision <= ecdata->_since)
+		return;
 
 	/* ignore this contact if we have a regexp, and it matches
 	 * neither email nor name (if we have a name) */
 	while (ecdata->_rx) { /* note, only once */
-		if (g_regex_match (ecdata->_rx, ci->_email, 0, NULL))
+		if (g_regex_match (ecdata->_rx, email, 0, NULL))
 			break; /* email matches? continue! */
-		if (!ci->_name)
+		if (!name)
 			return; /* email did not match, no name? ignore this one */
-		if (g_regex_match (ecdata->_rx, ci->_name, 0, NULL))
+		if (g_regex_match (ecdata->_rx, name, 0, NULL))
 			break; /* name matches? continue! */
 		return; /* nothing matched, ignore this one */
 	}
 
-	ecdata->_func (ci->_email, ci->_name, ci->_personal,
-		       ci->_tstamp, ecdata->_user_data);
+	ecdata->_func (email, name, personal, tstamp, ecdata->_user_data);
 
 	++ecdata->_num;
 }
 
+static void
+each_contact_info (const char *key, ContactInfo *ci, EachContactData *ecdata)
+{
+	each_contact (ci->_email, ci->_name, ci->_personal, ci->_tstamp,
+		      ci->_revision, ecdata);
+}
+
+static void
+foreach_contact (MuContacts *self, EachContactData *ecdata)
+{
+	guint32 u;
+
+	/* the records in the cache file are all of revision _reset */
+	for (u = 0; ecdata->_since < self->_reset && u != self->_num; ++u) {
+
+		const ContactRecord *rec;
+		const char *email, *name;
+
+		if (self->_shadowed[u / 8] & (1 << (u % 8)))
+			continue; /* we have a newer version in _hash */
+
+		rec   = &self->_records[u];
+		email = record_string (self, rec->_email);
+		if (!email)
+			continue;
+		name  = rec->_name == NO_NAME ? NULL :
+			record_string (self, rec->_name);
+
+		each_contact (email, name, rec->_personal ? TRUE : FALSE,
+			      (time_t)rec->_tstamp, self->_reset, ecdata);
+	}
+
+	g_hash_table_foreach (self->_hash, (GHFunc)each_contact_info, ecdata);
+}
+
 gboolean
 mu_contacts_foreach (MuContacts *self, MuContactsForeachFunc func,
 		     gpointer user_data, const char *pattern, size_t *num)
@@ -322,11 +730,10 @@ mu_contacts_foreach (MuContacts *self, MuContactsForeachFunc func,
 
 	ecdata._func	  = func;
 	ecdata._user_data = user_data;
+	ecdata._since     = 0;
 	ecdata._num       = 0;
 
-	g_hash_table_foreach (self->_hash,
-			      (GHFunc)each_contact,
-			      &ecdata);
+	foreach_contact (self, &ecdata);
 
 	if (ecdata._rx)
 		g_regex_unref (ecdata._rx);
@@ -337,46 +744,181 @@ mu_contacts_foreach (MuContacts *self, MuContactsForeachFunc func,
 	return TRUE;
 }
 
+
+guint64
+mu_contacts_revision (MuContacts *self)
+{
+	g_return_val_if_fail (self, 0);
+
+	return self->_revision;
+}
+
+
+gboolean
+mu_contacts_foreach_since (MuContacts *self, guint64 revision,
+			   MuContactsForeachFunc func, gpointer user_data,
+			   size_t *num)
+{
+	EachContactData ecdata;
+	gboolean known;
+
+	g_return_val_if_fail (self, FALSE);
+	g_return_val_if_fail (func, FALSE);
+
+	/* we only know what changed since the last (re)load/clear */
+	known = revision >= self->_reset && revision <= self->_revision;
+
+	ecdata._func	  = func;
+	ecdata._user_data = user_data;
+	ecdata._rx	  = NULL;
+	ecdata._since	  = known ? revision : 0;
+	ecdata._num	  = 0;
+
+	foreach_contact (self, &ecdata);
+
+	if (num)
+		*num = ecdata._num;
+
+	return known;
+}
+
+
+/* a contact for writing the cache file; the strings point to either
+ * the old cache file, or to the ContactInfos in the hash */
+struct _CacheEntry {
+	const char	*_email, *_name;
+	gint64		 _tstamp;
+	guint32		 _freq, _personal;
+};
+typedef struct _CacheEntry CacheEntry;
+
 static void
-each_keyval (const char *group, ContactInfo *cinfo, MuContacts *self)
+each_cache_entry (const char *key, ContactInfo *ci, GArray *entries)
 {
-	/* use set value so the string do not necessarily have to be
-	 * valid utf-8 */
-	if (cinfo->_name)
-		g_key_file_set_value (self->_ccache, group, NAME_KEY,
-				       cinfo->_name);
+	CacheEntry entry;
+
+	entry._email	= ci->_email;
+	entry._name	= ci->_name;
+	entry._tstamp	= (gint64)ci->_tstamp;
+	entry._freq	= ci->_freq;
+	entry._personal = ci->_personal ? 1 : 0;
+
+	g_array_append_val (entries, entry);
+}
+
+static int
+cmp_cache_entry (const CacheEntry *e1, const CacheEntry *e2)
+{
+	return g_ascii_strcasecmp (e1->_email, e2->_email);
+}
+
+static GArray*
+get_cache_entries (MuContacts *self)
+{
+	GArray *entries;
+	guint32 u;
+
+	entries = g_array_sized_new (FALSE, FALSE, sizeof(CacheEntry),
+				     self->_num + self->_num_new);
+
+	for (u = 0; u != self->_num; ++u) {
+
+		const ContactRecord *rec;
+		CacheEntry entry;
+
+		if (self->_shadowed[u / 8] & (1 << (u % 8)))
+			continue;
+
+		rec = &self->_records[u];
+		entry._email = record_string (self, rec->_email);
+		if (!entry._email)
+			continue;
+		entry._name	= rec->_name == NO_NAME ? NULL :
+			record_string (self, rec->_name);
+		entry._tstamp	= rec->_tstamp;
+		entry._freq	= rec->_freq;
+		entry._personal = rec->_personal;
+
+		g_array_append_val (entries, entry);
+	}
+
+	g_hash_table_foreach (self->_hash, (GHFunc)each_cache_entry, entries);
+	g_array_sort (entries, (GCompareFunc)cmp_cache_entry);
 
-	g_key_file_set_value (self->_ccache, group, EMAIL_KEY,
-			       cinfo->_email);
-	g_key_file_set_boolean (self->_ccache, group, PERSONAL_KEY,
-				cinfo->_personal);
-	g_key_file_set_integer (self->_ccache, group, TSTAMP_KEY,
-				(int)cinfo->_tstamp);
+	return entries;
 }
 
+
+/* write all the contacts to a new cache file, which replaces the old
+ * one and the journal */
 static gboolean
-serialize_cache (MuContacts *self)
+write_cache (MuContacts *self)
 {
-	gchar *data;
-	gsize len;
+	GArray *entries;
+	GByteArray *data;
+	GString *strings;
+	ContactsHeader hdr;
+	GError *err;
+	guint u;
 	gboolean rv;
 
-	g_hash_table_foreach (self->_hash, (GHFunc)each_keyval, self);
+	entries = get_cache_entries (self);
+	strings = g_string_sized_new (entries->len * 48);
 
-	/* Note: err arg is unused */
-	data = g_key_file_to_data (self->_ccache, &len, NULL);
-	if (len) {
-		GError *err;
-		err = NULL;
-		rv = g_file_set_contents (self->_path, data, len, &err);
-		if (!rv) {
-			g_warning ("failed to serialize cache to %s: %s",
-				   self->_path, err->message);
-			g_error_free (err);
-		}
-		g_free (data);
+	memset (&hdr, 0, sizeof(hdr));
+	memcpy (hdr._magic, CONTACTS_MAGIC, sizeof(hdr._magic));
+	hdr._version = CONTACTS_VERSION;
+	hdr._num     = entries->len;
+
+	data = g_byte_array_sized_new
+		(sizeof(ContactsHeader) + entries->len * sizeof(ContactRecord));
+	g_byte_array_append (data, (const guint8*)&hdr, sizeof(hdr));
+
+	for (u = 0; u != entries->len; ++u) {
+
+		CacheEntry *entry;
+		ContactRecord rec;
+
+		entry = &g_array_index (entries, CacheEntry, u);
+
+		memset (&rec, 0, sizeof(rec));
+		rec._email = strings->len;
+		g_string_append_len (strings, entry->_email,
+				     strlen (entry->_email) + 1);
+		if (entry->_name) {
+			rec._name = strings->len;
+			g_string_append_len (strings, entry->_name,
+					     strlen (entry->_name) + 1);
+		} else
+			rec._name = NO_NAME;
+
+		rec._tstamp   = entry->_tstamp;
+		rec._freq     = entry->_freq;
+		rec._personal = entry->_personal;
+
+		g_byte_array_append (data, (const guint8*)&rec, sizeof(rec));
 	}
 
+	/* now that we know the size of the string table */
+	((ContactsHeader*)data->data)->_strsize = strings->len;
+	g_byte_array_append (data, (const guint8*)strings->str, strings->len);
+
+	g_string_free (strings, TRUE);
+	g_array_free (entries, TRUE);
+
+	/* this writes to a temporary file, and renames it, so our
+	 * mmapped version is not affected */
+	err = NULL;
+	rv = g_file_set_contents (self->_path, (const char*)data->data,
+				  data->len, &err);
+	if (!rv) {
+		g_warning ("failed to serialize cache to %s: %s",
+			   self->_path, err->message);
+		g_error_free (err);
+	}
+
+	g_byte_array_free (data, TRUE);
+
 	return rv;
 }
 
@@ -386,16 +928,22 @@ mu_contacts_destroy (MuContacts *self)
 	if (!self)
 		return;
 
-	if (self->_ccache && self->_dirty) {
-		serialize_cache (self);
+	close_journal (self);
+
+	/* we only remove the journal when the cache file has all of
+	 * its changes, and we're the ones who made them; someone else
+	 * may still be appending to it */
+	if ((self->_dirty || self->_legacy) && write_cache (self)) {
+		if (self->_dirty)
+			remove_file (self->_journal_path);
 		MU_WRITE_LOG("serialized contacts cache %s",
 			     self->_path);
 	}
 
-	if (self->_ccache)
-		g_key_file_free (self->_ccache);
+	unmap_cache (self);
 
 	g_free (self->_path);
+	g_free (self->_journal_path);
 
 	if (self->_hash)
 		g_hash_table_destroy (self->_hash);
@@ -404,6 +952,14 @@ mu_contacts_destroy (MuContacts *self)
 }
 
 
+const gchar*
+mu_contacts_get_path (MuContacts *self)
+{
+	g_return_val_if_fail (self, NULL);
+
+	return self->_path;
+}
+
 
 static void
 clear_str (char* str)
@@ -432,7 +988,7 @@ contact_info_new (char *email, char *name, gboolean personal, time_t tstamp)
 	cinfo = g_slice_new (ContactInfo);
 
 	/* we need to clear the strings from control chars because
-	 * they could screw up the keyfile */
+	 * they could screw up the output */
 	clear_str (email);
 	clear_str (name);
 
@@ -440,6 +996,8 @@ contact_info_new (char *email, char *name, gboolean personal, time_t tstamp)
 	cinfo->_name     = name;
 	cinfo->_personal = personal;
 	cinfo->_tstamp   = tstamp;
+	cinfo->_freq     = 0;
+	cinfo->_revision = 0;
 
 	return cinfo;
 }
@@ -462,5 +1020,5 @@ mu_contacts_count (MuContacts *self)
 {
 	g_return_val_if_fail (self, 0);
 
-	return g_hash_table_size (self->_hash);
+	return self->_num + self->_num_new;
 }
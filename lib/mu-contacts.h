@@ -33,6 +33,11 @@ typedef struct _MuContacts MuContacts;
 /**
  * create a new MuContacts object; use mu_contacts_destroy when you no longer need it
  *
+ * The cache file is mmapped rather than parsed, so this does not
+ * depend on the number of contacts; a cache file in the old
+ * (GKeyFile) format is imported, and replaced when the object is
+ * destroyed.
+ *
  * @param ccachefile full path to the file with cached list of contacts
  *
  * @return a new MuContacts* if succeeded, NULL otherwise
@@ -43,8 +48,9 @@ MuContacts* mu_contacts_new (const gchar *ccachefile)
 
 /**
  * add a contacts; if there's a contact with this e-mail address
- * already, it will not updated unless the timestamp of this one is
- * higher and has a non-empty name
+ * (ignoring case) already, it will not updated unless the timestamp
+ * of this one is higher and has a non-empty name. Additions and
+ * updates are appended to a journal next to the cache file.
  *
  * @param contacts a contacts object
  * @param email e-mail address of the contact (not NULL)
@@ -59,7 +65,12 @@ gboolean mu_contacts_add (MuContacts *self, const char *email,
 			  const char* name, gboolean personal, time_t tstamp);
 
 /**
- * destroy the Contacts object
+ * destroy the Contacts object; if there were any changes, this writes
+ * a new cache file with all contacts, and removes the journal. Only
+ * changes through this object count, not the ones it read from the
+ * journal; so destroying an object that was only used for reading
+ * leaves the journal of other processes alone (it does replace a
+ * cache file in the old format with a new one, though).
  *
  * @param contacts a contacts object
  */
@@ -122,6 +133,39 @@ typedef void (*MuContactsForeachFunc) (const char *email, const char *name,
 gboolean mu_contacts_foreach (MuContacts *self, MuContactsForeachFunc func,
 			      gpointer user_data, const char* pattern, size_t *num);
 
+
+/**
+ * get the revision of the contacts, ie. a number that increases
+ * whenever a contact is added or updated. Revisions start at the time
+ * the contacts were loaded (or cleared), in microseconds, so they are
+ * also newer than those from earlier MuContacts objects.
+ *
+ * @param self a contacts object
+ *
+ * @return the revision
+ */
+guint64 mu_contacts_revision (MuContacts *self);
+
+
+/**
+ * call a function for each contact that was added or updated after
+ * some revision (see mu_contacts_revision)
+ *
+ * @param self contacts object
+ * @param revision an earlier revision, or 0 for all contacts
+ * @param func callback function to be called for each
+ * @param user_data user data to pass to the callback
+ * @param num receives the number of contacts found, or NULL
+ *
+ * @return TRUE if func was only called for the contacts that changed
+ * after revision, or FALSE if we don't know what changed since then
+ * (e.g., it's from before mu_contacts_clear), and func was called for
+ * all contacts
+ */
+gboolean mu_contacts_foreach_since (MuContacts *self, guint64 revision,
+				    MuContactsForeachFunc func,
+				    gpointer user_data, size_t *num);
+
 G_END_DECLS
 
 #endif /*__MU_CONTACTS_H__*/
@@ -18,146 +18,219 @@
 */
 
 #include <string.h> /* for memset */
-#include <math.h> /* for log, ceil */
 
 #include "mu-container.h"
-#include "mu-msg.h"
 #include "mu-msg-iter.h"
 
+#define CONTAINER(C) (mu_containers_get(self,(C)))
 
-/*
- * path data structure, to determine the thread paths mentioned above;
- * the path is filled as we're traversing the tree of MuContainers
- * (messages)
- */
-struct _Path {
-	int *_data;
-	guint _len;
+/* a slot in the message-id => container table; the message-id itself
+ * is in the container */
+struct _MuContainerSlot {
+	guint32 hash;
+	guint32 id; /* MU_CONTAINER_NONE for empty slots */
 };
-typedef struct _Path Path;
-
-static Path* path_new (guint initial);
-static void  path_destroy (Path *p);
-static void  path_inc (Path *p, guint index);
-static gchar* path_to_string (Path *p, const char* frmt);
+typedef struct _MuContainerSlot MuContainerSlot;
 
-MuContainer*
-mu_container_new (MuMsg *msg, guint docid, const char *msgid)
+MuContainers*
+mu_containers_new (guint reserve)
 {
-	MuContainer *c;
+	MuContainers *self;
 
-	g_return_val_if_fail (!msg || docid != 0, NULL);
+	self = g_slice_new0 (MuContainers);
 
-	c = g_slice_new0 (MuContainer);
-	if (msg)
-		c->msg = mu_msg_ref (msg);
+	/* container 0 is MU_CONTAINER_NONE, which we don't use */
+	self->_size  = MAX (reserve + 1, 16);
+	self->_items = g_new (MuContainer, self->_size);
+	self->_len   = 1;
 
-	c->docid = docid;
-	c->msgid = msgid;
+	/* keep the table at most half full */
+	for (self->_slot_num = 32; self->_slot_num < 2 * self->_size;
+	     self->_slot_num *= 2);
+	self->_slots = g_new0 (MuContainerSlot, self->_slot_num);
 
-	return c;
+	return self;
 }
 
+
 void
-mu_container_destroy (MuContainer *c)
+mu_containers_destroy (MuContainers *self)
 {
-	if (!c)
+	if (!self)
 		return;
 
-	if (c->msg)
-		mu_msg_unref (c->msg);
+	g_free (self->_items);
+	g_free (self->_slots);
 
-	g_slice_free (MuContainer, c);
+	g_slice_free (MuContainers, self);
 }
 
 
-static void
-set_parent (MuContainer *c, MuContainer *parent)
+/* find the slot for msgid; that's either the slot which has it, or
+ * the empty slot where it should go */
+static MuContainerSlot*
+find_slot (MuContainers *self, const char *msgid, guint32 hash)
 {
-	while (c) {
-		c->parent = parent;
-		c = c->next;
+	guint32 mask, u;
+
+	mask = self->_slot_num - 1;
+
+	for (u = hash & mask;; u = (u + 1) & mask) {
+
+		MuContainerSlot *slot;
+
+		slot = &self->_slots[u];
+		if (slot->id == MU_CONTAINER_NONE)
+			return slot;
+		if (slot->hash == hash &&
+		    strcmp (CONTAINER(slot->id)->msgid, msgid) == 0)
+			return slot;
 	}
 }
 
 
-G_GNUC_UNUSED static gboolean
-check_dup (MuContainer *c, GHashTable *hash)
+static void
+grow_slots (MuContainers *self)
+{
+	MuContainerSlot *old;
+	guint32 u, old_num, mask;
+
+	old	       = self->_slots;
+	old_num	       = self->_slot_num;
+
+	self->_slot_num = 2 * old_num;
+	self->_slots	= g_new0 (MuContainerSlot, self->_slot_num);
+	mask		= self->_slot_num - 1;
+
+	/* the keys are all different, so we only need to find empty
+	 * slots */
+	for (u = 0; u != old_num; ++u) {
+		guint32 v;
+		if (old[u].id == MU_CONTAINER_NONE)
+			continue;
+		for (v = old[u].hash & mask; self->_slots[v].id;
+		     v = (v + 1) & mask);
+		self->_slots[v] = old[u];
+	}
+
+	g_free (old);
+}
+
+
+guint32
+mu_containers_lookup (MuContainers *self, const char *msgid)
 {
-	if (g_hash_table_lookup (hash, c)) {
-		g_warning ("ALREADY!!");
-		mu_container_dump (c, TRUE);
-		g_assert (0);
-	} else
-		g_hash_table_insert (hash, c, GUINT_TO_POINTER(TRUE));
+	g_return_val_if_fail (self, MU_CONTAINER_NONE);
+	g_return_val_if_fail (msgid, MU_CONTAINER_NONE);
 
-	return TRUE;
+	return find_slot (self, msgid, g_str_hash (msgid))->id;
 }
 
 
-G_GNUC_UNUSED static void
-assert_no_duplicates (MuContainer *c)
+guint32
+mu_containers_add (MuContainers *self, guint docid, guint32 match,
+		   const char *sortkey, const char *msgid)
 {
-	GHashTable *hash;
+	MuContainer *c;
+	MuContainerSlot *slot;
+	guint32 id, hash;
+
+	g_return_val_if_fail (self, MU_CONTAINER_NONE);
+
+	if (self->_len == self->_size) {
+		self->_size *= 2;
+		self->_items = g_renew (MuContainer, self->_items,
+					self->_size);
+	}
+
+	if (2 * (self->_slot_used + 1) > self->_slot_num)
+		grow_slots (self);
+
+	id = self->_len++;
+	c  = CONTAINER(id);
+	memset (c, 0, sizeof(MuContainer));
+
+	c->docid   = docid;
+	c->match   = match;
+	c->sortkey = sortkey;
+	c->msgid   = msgid;
+
+	if (!msgid)
+		return id;
+
+	hash = g_str_hash (msgid);
+	slot = find_slot (self, msgid, hash);
+	if (slot->id == MU_CONTAINER_NONE)
+		++self->_slot_used;
 
-	hash = g_hash_table_new (g_direct_hash, g_direct_equal);
+	slot->hash = hash;
+	slot->id   = id;
+
+	return id;
+}
 
-	mu_container_foreach (c,
-			   (MuContainerForeachFunc)check_dup,
-			   hash);
 
-	g_hash_table_destroy (hash);
+static void
+set_parent (MuContainers *self, guint32 c, guint32 parent)
+{
+	while (c) {
+		CONTAINER(c)->parent = parent;
+		c = CONTAINER(c)->next;
+	}
 }
 
 
-MuContainer*
-mu_container_append_siblings (MuContainer *c, MuContainer *sibling)
+guint32
+mu_containers_append_siblings (MuContainers *self, guint32 c, guint32 sibling)
 {
-	g_assert (c);
+	MuContainer *head, *sib;
 
-	g_return_val_if_fail (c, NULL);
-	g_return_val_if_fail (sibling, NULL);
-	g_return_val_if_fail (c != sibling, NULL);
+	g_return_val_if_fail (self, MU_CONTAINER_NONE);
+	g_return_val_if_fail (c, MU_CONTAINER_NONE);
+	g_return_val_if_fail (sibling, MU_CONTAINER_NONE);
+	g_return_val_if_fail (c != sibling, MU_CONTAINER_NONE);
 
-	/* assert_no_duplicates (c); */
+	head = CONTAINER(c);
+	sib  = CONTAINER(sibling);
 
-	set_parent (sibling, c->parent);
+	set_parent (self, sibling, head->parent);
 
 	/* find the last sibling and append; first we try our cache
 	 * 'last', otherwise we need to walk the chain. We use a
 	 * cached last as to avoid walking the chain (which is
 	 * O(n*n)) */
-	if (c->last)
-		c->last->next = sibling;
+	if (head->last)
+		CONTAINER(head->last)->next = sibling;
 	else {
 		/* no 'last' cached, so walk the chain */
-		MuContainer *c2;
-		for (c2 = c; c2 && c2->next; c2 = c2->next);
-		c2->next = sibling;
+		guint32 c2;
+		for (c2 = c; CONTAINER(c2)->next; c2 = CONTAINER(c2)->next);
+		CONTAINER(c2)->next = sibling;
 	}
 	/* update the cached last */
-	c->last = sibling->last ? sibling->last : sibling;
-
-	/* assert_no_duplicates (c); */
+	head->last = sib->last ? sib->last : sibling;
 
 	return c;
 }
 
-MuContainer*
-mu_container_remove_sibling (MuContainer *c, MuContainer *sibling)
+
+guint32
+mu_containers_remove_sibling (MuContainers *self, guint32 c, guint32 sibling)
 {
-	MuContainer *cur, *prev;
+	guint32 cur, prev;
 
-	g_return_val_if_fail (c, NULL);
-	g_return_val_if_fail (sibling, NULL);
+	g_return_val_if_fail (self, MU_CONTAINER_NONE);
+	g_return_val_if_fail (c, MU_CONTAINER_NONE);
+	g_return_val_if_fail (sibling, MU_CONTAINER_NONE);
 
-	for (prev = NULL, cur = c; cur; cur = cur->next) {
+	for (prev = MU_CONTAINER_NONE, cur = c; cur;
+	     cur = CONTAINER(cur)->next) {
 
 		if (cur == sibling) {
 			if (!prev)
-				c = cur->next;
+				c = CONTAINER(cur)->next;
 			else
-				prev->next = cur->next;
+				CONTAINER(prev)->next = CONTAINER(cur)->next;
 			break;
 		}
 		prev = cur;
@@ -168,462 +241,306 @@ mu_container_remove_sibling (MuContainer *c, MuContainer *sibling)
 	 * TODO: we could actually do a better job updating last
 	 * rather than invalidating it. */
 	if (c)
-		c->last = NULL;
+		CONTAINER(c)->last = MU_CONTAINER_NONE;
 
 	return c;
 }
 
-MuContainer*
-mu_container_append_children (MuContainer *c, MuContainer *child)
+
+guint32
+mu_containers_append_children (MuContainers *self, guint32 c, guint32 child)
 {
-	g_return_val_if_fail (c, NULL);
-	g_return_val_if_fail (child, NULL);
-	g_return_val_if_fail (c != child, NULL);
+	MuContainer *parent;
 
-	/* assert_no_duplicates (c); */
+	g_return_val_if_fail (self, MU_CONTAINER_NONE);
+	g_return_val_if_fail (c, MU_CONTAINER_NONE);
+	g_return_val_if_fail (child, MU_CONTAINER_NONE);
+	g_return_val_if_fail (c != child, MU_CONTAINER_NONE);
 
-	set_parent (child, c);
-	if (!c->child)
-		c->child = child;
-	else
-		c->child = mu_container_append_siblings (c->child, child);
+	set_parent (self, child, c);
 
-	/* assert_no_duplicates (c->child); */
+	parent = CONTAINER(c);
+	if (!parent->child)
+		parent->child = child;
+	else
+		parent->child = mu_containers_append_siblings
+			(self, parent->child, child);
 
 	return c;
 }
 
 
-MuContainer*
-mu_container_remove_child (MuContainer *c, MuContainer *child)
+guint32
+mu_containers_remove_child (MuContainers *self, guint32 c, guint32 child)
 {
-	g_return_val_if_fail (c, NULL);
-	g_return_val_if_fail (child, NULL);
-
-	/* g_assert (!child->child); */
-	/* g_return_val_if_fail (!child->child, NULL); */
-	g_return_val_if_fail (c != child, NULL);
+	g_return_val_if_fail (self, MU_CONTAINER_NONE);
+	g_return_val_if_fail (c, MU_CONTAINER_NONE);
+	g_return_val_if_fail (child, MU_CONTAINER_NONE);
+	g_return_val_if_fail (c != child, MU_CONTAINER_NONE);
 
-	c->child = mu_container_remove_sibling (c->child, child);
+	CONTAINER(c)->child = mu_containers_remove_sibling
+		(self, CONTAINER(c)->child, child);
 
 	return c;
 }
 
-typedef void (*MuContainerPathForeachFunc) (MuContainer*, gpointer, Path*);
 
-static void
-mu_container_path_foreach_real (MuContainer *c, guint level, Path *path,
-				MuContainerPathForeachFunc func,
-				gpointer user_data)
+guint32
+mu_containers_splice_children (MuContainers *self, guint32 parent,
+			       guint32 child)
 {
-	if (!c)
-		return;
-
-	path_inc (path, level);
-	func (c, user_data, path);
-
-	/* children */
-	mu_container_path_foreach_real (c->child, level + 1, path,
-					func, user_data);
-
-	/* siblings */
-	mu_container_path_foreach_real (c->next, level, path, func, user_data);
-}
+	guint32 newchild;
 
-static void
-mu_container_path_foreach (MuContainer *c, MuContainerPathForeachFunc func,
-			gpointer user_data)
-{
-	Path *path;
+	g_return_val_if_fail (self, MU_CONTAINER_NONE);
+	g_return_val_if_fail (parent, MU_CONTAINER_NONE);
+	g_return_val_if_fail (child, MU_CONTAINER_NONE);
+	g_return_val_if_fail (parent != child, MU_CONTAINER_NONE);
 
-	path = path_new (100);
+	newchild		= CONTAINER(child)->child;
+	CONTAINER(child)->child = MU_CONTAINER_NONE;
 
-	mu_container_path_foreach_real (c, 0, path, func, user_data);
+	mu_containers_remove_child (self, parent, child);
 
-	path_destroy (path);
+	return mu_containers_append_children (self, parent, newchild);
 }
 
 
 gboolean
-mu_container_foreach (MuContainer *c, MuContainerForeachFunc func,
-		      gpointer user_data)
+mu_containers_foreach (MuContainers *self, guint32 c,
+		       MuContainersForeachFunc func, gpointer user_data)
 {
+	g_return_val_if_fail (self, FALSE);
 	g_return_val_if_fail (func, FALSE);
 
-	if (!c)
-		return TRUE;
-
-	if (!mu_container_foreach (c->child, func, user_data))
-		return FALSE; /* recurse into children */
-
-	/* recurse into siblings */
-	if (!mu_container_foreach (c->next, func, user_data))
-		return FALSE;
-
-	return func (c, user_data);
-}
-
-
-MuContainer*
-mu_container_splice_children (MuContainer *parent, MuContainer *child)
-{
-	MuContainer *newchild;
-
-	g_return_val_if_fail (parent, NULL);
-	g_return_val_if_fail (child, NULL);
-	g_return_val_if_fail (parent != child, NULL);
-
-	newchild = child->child;
-	child->child=NULL;
-
-	mu_container_remove_child (parent, child);
-
-	return mu_container_append_children (parent, newchild);
-}
-
-
-static GSList*
-mu_container_to_list (MuContainer *c)
-{
-	GSList *lst;
-
-	for (lst = NULL; c; c = c->next)
-		lst = g_slist_prepend (lst, c);
-
-	return lst;
-}
-
+	/* we only recurse for the children, so the depth of the
+	 * recursion is the depth of the tree, not the number of
+	 * siblings */
+	while (c) {
+		guint32 next;
 
-static MuContainer*
-mu_container_from_list (GSList *lst)
-{
-	MuContainer *c, *cur;
+		next = CONTAINER(c)->next;
 
-	if (!lst)
-		return NULL;
+		if (!mu_containers_foreach (self, CONTAINER(c)->child, func,
+					    user_data))
+			return FALSE;
+		if (!func (self, c, user_data))
+			return FALSE;
 
-	for (c = cur = (MuContainer*)lst->data; cur; lst = g_slist_next(lst)) {
-		cur->next = lst ? (MuContainer*)lst->data : NULL;
-		cur=cur->next;
+		c = next;
 	}
 
-	return c;
+	return TRUE;
 }
 
+
 struct _SortFuncData {
-	MuMsgFieldId         mfid;
-	gboolean             revert;
-	gpointer             user_data;
+	MuContainers	*self;
+	gboolean         revert;
+
+	guint32		*buf; /* scratch space for the siblings */
+	guint		 buflen;
 };
 typedef struct _SortFuncData SortFuncData;
 
 
 static int
-sort_func_wrapper (MuContainer *a, MuContainer *b, SortFuncData *data)
+sort_func_wrapper (const guint32 *a, const guint32 *b, SortFuncData *data)
 {
-	MuContainer *a1, *b1;
+	MuContainers *self;
+	guint32 a1, b1;
+
+	self = data->self;
 
 	/* use the first non-empty 'left child' message if this one
 	 * is */
-	for (a1 = a; a1->msg == NULL && a1->child != NULL; a1 = a1->child);
-	for (b1 = b; b1->msg == NULL && b1->child != NULL; b1 = b1->child);
+	for (a1 = *a; !CONTAINER(a1)->docid && CONTAINER(a1)->child;
+	     a1 = CONTAINER(a1)->child);
+	for (b1 = *b; !CONTAINER(b1)->docid && CONTAINER(b1)->child;
+	     b1 = CONTAINER(b1)->child);
 
 	if (a1 == b1)
 		return 0;
-	else if (!a1->msg)
+	else if (!CONTAINER(a1)->docid)
 		return 1;
-	else if (!b1->msg)
+	else if (!CONTAINER(b1)->docid)
 		return -1;
 
 	if (data->revert)
-		return mu_msg_cmp (b1->msg, a1->msg, data->mfid);
+		return g_strcmp0 (CONTAINER(b1)->sortkey,
+				  CONTAINER(a1)->sortkey);
 	else
-		return mu_msg_cmp (a1->msg, b1->msg, data->mfid);
+		return g_strcmp0 (CONTAINER(a1)->sortkey,
+				  CONTAINER(b1)->sortkey);
 }
 
-static MuContainer*
-container_sort_real (MuContainer *c, SortFuncData *sfdata)
+
+static guint32
+container_sort_real (guint32 c, SortFuncData *sfdata)
 {
-	GSList *lst;
-	MuContainer *cur;
+	MuContainers *self;
+	guint32 cur;
+	guint n, u;
 
 	if (!c)
-		return NULL;
+		return MU_CONTAINER_NONE;
+
+	self = sfdata->self;
+
+	for (n = 0, cur = c; cur; cur = CONTAINER(cur)->next, ++n)
+		if (CONTAINER(cur)->child)
+			CONTAINER(cur)->child = container_sort_real
+				(CONTAINER(cur)->child, sfdata);
+
+	/* sort siblings, in place; we can reuse the buffer, as the
+	 * children have been sorted already. Note, we put the siblings
+	 * in reverse order, so that the (stable) sort gives the same
+	 * order for equal elements as it always did */
+	if (n > sfdata->buflen) {
+		sfdata->buflen = MAX (n, 2 * sfdata->buflen);
+		sfdata->buf    = g_renew (guint32, sfdata->buf,
+					  sfdata->buflen);
+	}
+	for (u = n, cur = c; cur; cur = CONTAINER(cur)->next)
+		sfdata->buf[--u] = cur;
+
+	g_qsort_with_data (sfdata->buf, n, sizeof(guint32),
+			   (GCompareDataFunc)sort_func_wrapper, sfdata);
 
-	for (cur = c; cur; cur = cur->next)
-		if (cur->child)
-			cur->child = container_sort_real (cur->child, sfdata);
+	for (u = 0; u != n; ++u)
+		CONTAINER(sfdata->buf[u])->next =
+			(u + 1 < n) ? sfdata->buf[u + 1] : MU_CONTAINER_NONE;
 
-	/* sort siblings */
-	lst = mu_container_to_list (c);
-	lst = g_slist_sort_with_data(lst,
-				     (GCompareDataFunc)sort_func_wrapper,
-				     sfdata);
-	c = mu_container_from_list (lst);
-	g_slist_free (lst);
+	c = sfdata->buf[0];
+	CONTAINER(c)->last = sfdata->buf[n - 1];
 
 	return c;
 }
 
 
-MuContainer*
-mu_container_sort (MuContainer *c, MuMsgFieldId mfid, gboolean revert,
-		   gpointer user_data)
+guint32
+mu_containers_sort (MuContainers *self, guint32 c, gboolean revert)
 {
 	SortFuncData sfdata;
 
-	sfdata.mfid	 = mfid;
-	sfdata.revert	 = revert;
-	sfdata.user_data = user_data;
+	g_return_val_if_fail (self, MU_CONTAINER_NONE);
+	g_return_val_if_fail (c, MU_CONTAINER_NONE);
 
-	g_return_val_if_fail (c, NULL);
-	g_return_val_if_fail (mu_msg_field_id_is_valid(mfid), NULL);
+	sfdata.self   = self;
+	sfdata.revert = revert;
+	sfdata.buf    = NULL;
+	sfdata.buflen = 0;
 
-	return container_sort_real (c, &sfdata);
-}
+	c = container_sort_real (c, &sfdata);
 
+	g_free (sfdata.buf);
 
-static gboolean
-unequal (MuContainer *a, MuContainer *b)
-{
-	return a == b ? FALSE : TRUE;
-}
-
-
-gboolean
-mu_container_reachable (MuContainer *haystack, MuContainer *needle)
-{
-	g_return_val_if_fail (haystack, FALSE);
-	g_return_val_if_fail (needle, FALSE);
-
-	if (!mu_container_foreach
-	    (haystack, (MuContainerForeachFunc)unequal, needle))
-		return TRUE;
-
-	return FALSE;
+	return c;
 }
 
 
 static gboolean
-dump_container (MuContainer *c)
+dump_container (MuContainers *self, guint32 id)
 {
-	const gchar* subject;
+	MuContainer *c;
 
-	if (!c) {
+	if (!id) {
 		g_print ("<empty>\n");
 		return TRUE;
 	}
 
-	subject =  (c->msg) ? mu_msg_get_subject (c->msg) : "<none>";
+	c = CONTAINER(id);
 
-	g_print ("[%s][%s m:%p p:%p docid:%u %s]\n",c->msgid, subject, (void*)c,
-		 (void*)c->parent, c->docid,
-		 c->msg ? mu_msg_get_path (c->msg) : "");
+	g_print ("[%s][%s c:%u p:%u docid:%u]\n",
+		 c->msgid ? c->msgid : "<dup>",
+		 c->sortkey ? c->sortkey : "<none>",
+		 (unsigned)id, (unsigned)c->parent, c->docid);
 
 	return TRUE;
 }
 
 
 void
-mu_container_dump (MuContainer *c, gboolean recursive)
+mu_containers_dump (MuContainers *self, guint32 c, gboolean recursive)
 {
+	g_return_if_fail (self);
 	g_return_if_fail (c);
 
 	if (!recursive)
-		dump_container (c);
+		dump_container (self, c);
 	else
-		mu_container_foreach (c, (MuContainerForeachFunc)dump_container,
-				   NULL);
+		mu_containers_foreach
+			(self, c, (MuContainersForeachFunc)dump_container,
+			 NULL);
 }
 
 
 
-static Path*
-path_new (guint initial)
-{
-	Path *p;
-
-	p = g_slice_new0 (Path);
-
-	p->_data = g_new0 (int, initial);
-	p->_len  = initial;
-
-	return p;
-}
-
-static void
-path_destroy (Path *p)
-{
-	if (!p)
-		return;
+struct _NodeData {
+	MuContainers	*self;
+	GArray		*nodes;
+};
+typedef struct _NodeData NodeData;
 
-	g_free (p->_data);
-	g_slice_free (Path, p);
-}
 
 static void
-path_inc (Path *p, guint index)
+add_thread_nodes (NodeData *ndata, guint32 c, guint32 parent_node,
+		  guint32 level)
 {
-	if (index + 1 >= p->_len) {
-		p->_data = g_renew (int, p->_data, 2 * p->_len);
-		memset (&p->_data[p->_len], 0, p->_len);
-		p->_len *= 2;
-	}
+	MuContainers *self;
+	guint32 ordinal;
 
-	++p->_data[index];
-	p->_data[index + 1] = 0;
-}
+	self = ndata->self;
 
+	/* we only recurse for the children */
+	for (ordinal = 0; c; c = CONTAINER(c)->next, ++ordinal) {
 
-static gchar*
-path_to_string (Path *p, const char* frmt)
-{
-	char *str;
-	guint u;
-
-	if (!p->_data)
-		return NULL;
+		MuThreadNode node;
+		MuContainer *cont;
 
-	for (u = 0, str = NULL; p->_data[u] != 0; ++u) {
+		cont = CONTAINER(c);
 
-		char segm[16];
-		snprintf (segm, sizeof(segm), frmt, p->_data[u] - 1);
+		node.parent  = parent_node;
+		node.ordinal = ordinal;
+		node.level   = level;
+		node.match   = cont->docid ? cont->match : MU_THREAD_NODE_NONE;
+		node.thread  = 0; /* see mu-threader.c */
 
-		if (!str)
-			str = g_strdup (segm);
+		node.prop = 0;
+		/* 'root' means we're a child of the dummy root-container */
+		if (!cont->parent)
+			node.prop |= MU_MSG_ITER_THREAD_PROP_ROOT;
 		else {
-			gchar *tmp;
-			tmp = g_strdup_printf ("%s:%s", str, segm);
-			g_free (str);
-			str = tmp;
+			if (CONTAINER(cont->parent)->child == c)
+				node.prop |= MU_MSG_ITER_THREAD_PROP_FIRST_CHILD;
+			if (!CONTAINER(cont->parent)->docid)
+				node.prop |= MU_MSG_ITER_THREAD_PROP_EMPTY_PARENT;
 		}
-	}
+		if (cont->flags & MU_CONTAINER_FLAG_DUP)
+			node.prop |= MU_MSG_ITER_THREAD_PROP_DUP;
+		if (cont->child)
+			node.prop |= MU_MSG_ITER_THREAD_PROP_HAS_CHILD;
 
-	return str;
-}
+		g_array_append_val (ndata->nodes, node);
 
-static unsigned
-count_colons (const char *str)
-{
-	unsigned num;
-
-	num = 0;
-	while (str++ && *str)
-		if (*str == ':')
-			++num;
-
-	return num;
-}
-
-
-
-static MuMsgIterThreadInfo*
-thread_info_new (gchar *threadpath, gboolean root, gboolean child,
-		 gboolean empty_parent, gboolean has_child, gboolean is_dup)
-{
-	MuMsgIterThreadInfo *ti;
-
-	ti		     = g_slice_new (MuMsgIterThreadInfo);
-	ti->threadpath	     = threadpath;
-	ti->level            = count_colons (threadpath); /* hacky... */
-
-	ti->prop  = 0;
-	ti->prop |= root         ? MU_MSG_ITER_THREAD_PROP_ROOT         : 0;
-	ti->prop |= child        ? MU_MSG_ITER_THREAD_PROP_FIRST_CHILD  : 0;
-	ti->prop |= empty_parent ? MU_MSG_ITER_THREAD_PROP_EMPTY_PARENT : 0;
-	ti->prop |= is_dup       ? MU_MSG_ITER_THREAD_PROP_DUP          : 0;
-	ti->prop |= has_child    ? MU_MSG_ITER_THREAD_PROP_HAS_CHILD    : 0;
-
-	return ti;
-}
-
-static void
-thread_info_destroy (MuMsgIterThreadInfo *ti)
-{
-	if (ti) {
-		g_free (ti->threadpath);
-		g_slice_free (MuMsgIterThreadInfo, ti);
+		if (cont->child)
+			add_thread_nodes (ndata, cont->child,
+					  ndata->nodes->len - 1, level + 1);
 	}
 }
 
 
-struct _ThreadInfo {
-	GHashTable *hash;
-	const char *format;
-};
-typedef struct _ThreadInfo ThreadInfo;
-
-
-static void
-add_to_thread_info_hash (GHashTable *thread_info_hash, MuContainer *c,
-			 char *threadpath)
-{
-	gboolean is_root, first_child, empty_parent, is_dup, has_child;
-
-	/* 'root' means we're a child of the dummy root-container */
-	is_root = (c->parent == NULL);
-
-	first_child  = is_root ? FALSE : (c->parent->child == c);
-	empty_parent = is_root ? FALSE : (!c->parent->msg);
-	is_dup	     = c->flags & MU_CONTAINER_FLAG_DUP;
-	has_child    = c->child ? TRUE : FALSE;
-
-	g_hash_table_insert (thread_info_hash,
-			     GUINT_TO_POINTER(c->docid),
-			     thread_info_new (threadpath,
-					      is_root,
-					      first_child,
-					      empty_parent,
-					      has_child,
-					      is_dup));
-}
-
-/* device a format string that is the minimum size to fit up to
- * matchnum matches -- returns static memory */
-static const char*
-thread_segment_format_string (size_t matchnum)
-{
-	unsigned digitnum;
-	static char frmt[16];
-
-	/* get the number of digits needed in a hex-representation of
-	 * matchnum */
-	digitnum = (unsigned) (ceil (log(matchnum)/log(16)));
-	snprintf (frmt, sizeof(frmt), "%%0%ux", digitnum);
-
-	return frmt;
-}
-
-static gboolean
-add_thread_info (MuContainer *c, ThreadInfo *ti, Path *path)
-{
-	gchar *pathstr;
-
-	pathstr = path_to_string (path, ti->format);
-	add_to_thread_info_hash (ti->hash, c, pathstr);
-
-	return TRUE;
-}
-
-
-GHashTable*
-mu_container_thread_info_hash_new (MuContainer *root_set, size_t matchnum)
+GArray*
+mu_containers_thread_nodes_new (MuContainers *self, guint32 root_set)
 {
-	ThreadInfo ti;
-
-	g_return_val_if_fail (root_set, NULL);
-	g_return_val_if_fail (matchnum > 0, NULL);
+	NodeData ndata;
 
-	/* create hash docid => thread-info */
-	ti.hash = g_hash_table_new_full (g_direct_hash, g_direct_equal,
-					 NULL,
-					 (GDestroyNotify)thread_info_destroy);
+	g_return_val_if_fail (self, NULL);
 
-	ti.format     = thread_segment_format_string (matchnum);
+	ndata.self  = self;
+	ndata.nodes = g_array_sized_new (FALSE, FALSE, sizeof(MuThreadNode),
+					 mu_containers_num (self));
 
-	mu_container_path_foreach (root_set,
-				(MuContainerPathForeachFunc)add_thread_info,
-				&ti);
+	add_thread_nodes (&ndata, root_set, MU_THREAD_NODE_NONE, 0);
 
-	return ti.hash;
+	return ndata.nodes;
 }
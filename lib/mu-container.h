@@ -21,7 +21,7 @@
 #define __MU_CONTAINER_H__
 
 #include <glib.h>
-#include <mu-msg.h>
+#include <mu-threader.h>
 
 enum _MuContainerFlag {
 	MU_CONTAINER_FLAG_NONE    = 0,
@@ -31,178 +31,248 @@ enum _MuContainerFlag {
 };
 typedef enum _MuContainerFlag MuContainerFlag;
 
+/* containers live in a MuContainers arena, and refer to each other
+ * by their index in it; MU_CONTAINER_NONE means 'no container' */
+#define MU_CONTAINER_NONE 0
+
 /*
  * MuContainer data structure, as seen in JWZs document:
  *     http://www.jwz.org/doc/threading.html
  */
 struct _MuContainer {
-	struct _MuContainer *parent, *child, *next;
+	guint32             parent, child, next;
 
-	/* note: we cache the last of the string of next->next->...
-	 * `mu_container_append_siblings' shows up high in the
+	/* note: for the first of a list of siblings, we cache the
+	 * last of the string of next->next->...
+	 * `mu_containers_append_siblings' shows up high in the
 	 * profiles since it needs to walk to the end, and this give
 	 * O(n*n) behavior.
 	 * */
-	struct _MuContainer *last;
+	guint32             last;
 
+	MuContainerFlag     flags;
+	unsigned            docid; /* 0 for containers without a message */
+	guint32             match; /* index of the message in the matches */
 
-	MuMsg               *msg;
+	const char          *sortkey;
 	const char          *msgid;
+};
+typedef struct _MuContainer MuContainer;
 
-	unsigned            docid;
-	MuContainerFlag     flags;
 
+/*
+ * MuContainers is an arena of MuContainer structures, ie. they're
+ * all in one contiguous block of memory, with a table to find them by
+ * their message-id. Note that adding a container may move the block,
+ * so any MuContainer* you got from mu_containers_get is invalidated
+ * by mu_containers_add.
+ *
+ * The arena does not copy the message-ids and sort keys; they must
+ * remain valid for as long as the arena is in use.
+ */
+struct _MuContainers {
+	/* private */
+	MuContainer	*_items;
+	guint32		 _len, _size;
+
+	struct _MuContainerSlot *_slots; /* open-addressing msgid table */
+	guint32		 _slot_num, _slot_used;
 };
-typedef struct _MuContainer MuContainer;
+typedef struct _MuContainers MuContainers;
 
 
 /**
- * create a new Container object
+ * create a new container arena
  *
- * @param msg a MuMsg, or NULL; when it's NULL, docid should be 0
- * @param docid a Xapian docid, or 0
- * @param msgid a message id, or NULL
+ * @param reserve the number of containers to reserve space for
  *
- * @return a new Container instance, or NULL in case of error; free
- * with mu_container_destroy
+ * @return a new MuContainers instance; free with mu_containers_destroy
  */
-MuContainer* mu_container_new (MuMsg *msg, guint docid, const char* msgid);
+MuContainers* mu_containers_new (guint reserve) G_GNUC_WARN_UNUSED_RESULT;
 
 
 /**
- * free a Container object
+ * destroy a container arena, and all containers in it
  *
- * @param c a Container object, or NULL
+ * @param self a MuContainers instance, or NULL
  */
-void       mu_container_destroy (MuContainer *c);
+void mu_containers_destroy (MuContainers *self);
 
 
+/**
+ * get a container from the arena
+ *
+ * @param self a MuContainers instance
+ * @param c a container id (but not MU_CONTAINER_NONE)
+ *
+ * @return the container; this pointer is valid until the next
+ * mu_containers_add
+ */
+#define mu_containers_get(self,c) (&(self)->_items[(c)])
+
+
+/**
+ * add a new container to the arena, and register it under its
+ * message-id; if there was another container registered under the
+ * same message-id, it is replaced (but remains in the arena)
+ *
+ * @param self a MuContainers instance
+ * @param docid the Xapian docid of the message, or 0 for a container
+ * without a message
+ * @param match the index of the message in the set of matches (ignored
+ * if there is no message)
+ * @param sortkey the sort key for the message, or NULL
+ * @param msgid a message id, or NULL if the container should not be
+ * registered (for duplicates, and for the empty parents created when
+ * grouping by subject)
+ *
+ * @return the id of the new container
+ */
+guint32 mu_containers_add (MuContainers *self, guint docid, guint32 match,
+			   const char *sortkey, const char* msgid);
+
+
+/**
+ * find the container registered under some message-id
+ *
+ * @param self a MuContainers instance
+ * @param msgid a message-id
+ *
+ * @return the container id, or MU_CONTAINER_NONE if it was not found
+ */
+guint32 mu_containers_lookup (MuContainers *self, const char *msgid);
+
+
+/**
+ * get the number of containers in the arena
+ *
+ * @param self a MuContainers instance
+ *
+ * @return the number of containers; the container ids are 1 .. this
+ * number (inclusive)
+ */
+#define mu_containers_num(self) ((self)->_len - 1)
+
 
 /**
  * append new child(ren) to this container; the child(ren) container's
- * parent pointer will point to this one
+ * parent will be this one
  *
- * @param c a Container instance
+ * @param self a MuContainers instance
+ * @param c a container
  * @param child a child
  *
- * @return the Container instance with a child added
+ * @return the container with a child added
  */
-MuContainer* mu_container_append_children (MuContainer *c, MuContainer *child);
+guint32 mu_containers_append_children (MuContainers *self, guint32 c,
+				       guint32 child);
 
 /**
  * append a new sibling to this (list of) containers; all the siblings
  * will get the same parent that @c has
  *
- * @param c a container instance
+ * @param self a MuContainers instance
+ * @param c a container
  * @param sibling a sibling
  *
  * @return the container (list) with the sibling(s) appended
  */
-MuContainer* mu_container_append_siblings (MuContainer *c, MuContainer *sibling);
+guint32 mu_containers_append_siblings (MuContainers *self, guint32 c,
+				       guint32 sibling);
 
 /**
  * remove a _single_ child container from a container
  *
- * @param c a container instance
+ * @param self a MuContainers instance
+ * @param c a container
  * @param child the child container to remove
  *
  * @return the container with the child removed; if the container did
  * have this child, nothing changes
  */
-MuContainer* mu_container_remove_child (MuContainer *c, MuContainer *child);
+guint32 mu_containers_remove_child (MuContainers *self, guint32 c,
+				    guint32 child);
 
 /**
  * remove a _single_ sibling container from a container
  *
- * @param c a container instance
+ * @param self a MuContainers instance
+ * @param c a container
  * @param sibling the sibling container to remove
  *
  * @return the container with the sibling removed; if the container did
  * have this sibling, nothing changes
  */
-MuContainer* mu_container_remove_sibling (MuContainer *c, MuContainer *sibling);
+guint32 mu_containers_remove_sibling (MuContainers *self, guint32 c,
+				      guint32 sibling);
 
 
 /**
  * promote child's children to be parent's children and remove child
  *
- * @param parent a container instance
+ * @param self a MuContainers instance
+ * @param parent a container
  * @param child a child of this container
  *
  * @return the new container with it's children's children promoted
  */
-MuContainer* mu_container_splice_children (MuContainer *parent,
-					   MuContainer *child);
+guint32 mu_containers_splice_children (MuContainers *self, guint32 parent,
+				       guint32 child);
 
-typedef gboolean (*MuContainerForeachFunc) (MuContainer*, gpointer);
+typedef gboolean (*MuContainersForeachFunc) (MuContainers*, guint32,
+					     gpointer);
 
 /**
- * execute some function on all siblings an children of some container
- * (recursively) until all children have been visited or the callback
- * function returns FALSE
+ * execute some function on all siblings and children of some
+ * container (recursively), children before their parents, until all
+ * of them have been visited or the callback function returns FALSE
  *
+ * @param self a MuContainers instance
  * @param c a container
  * @param func a function to call for each container
  * @param user_data a pointer to pass to the callback function
  *
- * @return
+ * @return FALSE if the callback function returned FALSE, TRUE
+ * otherwise
  */
-gboolean   mu_container_foreach (MuContainer *c,
-				 MuContainerForeachFunc func,
-				 gpointer user_data);
-
-/**
- * check wither container needle is a child or sibling (recursively)
- * of container haystack
- *
- * @param haystack a container
- * @param needle a container
- *
- * @return TRUE if needle is reachable from haystack, FALSE otherwise
- */
-gboolean   mu_container_reachable (MuContainer *haystack, MuContainer *needle);
+gboolean mu_containers_foreach (MuContainers *self, guint32 c,
+				MuContainersForeachFunc func,
+				gpointer user_data);
 
 
 /**
  * dump the container to stdout (for debugging)
  *
+ * @param self a MuContainers instance
  * @param c a container
  * @param recursive whether to include siblings, children
  */
-void       mu_container_dump (MuContainer *c, gboolean recursive);
+void mu_containers_dump (MuContainers *self, guint32 c, gboolean recursive);
 
 
-typedef int (*MuContainerCmpFunc) (MuContainer *c1, MuContainer *c2,
-				   gpointer user_data);
-
 /**
- * sort the tree of MuContainers, recursively; ie. each of the list of
- * siblings (children) will be sorted according to @func; if the
+ * sort the tree of containers, recursively; ie. each of the list of
+ * siblings (children) will be sorted by their sort keys; if the
  * container is empty, the first non-empty 'leftmost' child is used.
  *
+ * @param self a MuContainers instance
  * @param c a container
- * @param mfid the field to sort by
- * @param revert if TRUE, revert the sorting order *
- * @param user_data a user pointer to pass to the sorting function
+ * @param revert if TRUE, revert the sorting order
  *
- * @return a sorted container
+ * @return the first container of the sorted list
  */
-MuContainer* mu_container_sort (MuContainer *c, MuMsgFieldId mfid,
-				gboolean revert,
-				gpointer user_data);
+guint32 mu_containers_sort (MuContainers *self, guint32 c, gboolean revert);
 
 
 /**
- * create a hashtable with maps document-ids to information about them,
- * ie. Xapian docid => MuMsgIterThreadInfo
+ * get the thread structure for the tree of containers, as an array
+ * of MuThreadNode, in thread order (see mu_threader_calculate)
  *
- * @param root_set the containers @param matchnum the number of
- * matches in the list (this is needed to determine the shortest
- * possible collation keys ('threadpaths') for the messages
+ * @param self a MuContainers instance
+ * @param root_set the containers
  *
- * @return a hash; free with g_hash_table_destroy
+ * @return a GArray of MuThreadNode; free with g_array_free
  */
-GHashTable* mu_container_thread_info_hash_new (MuContainer *root_set,
-					       size_t matchnum);
+GArray* mu_containers_thread_nodes_new (MuContainers *self, guint32 root_set);
 
 #endif /*__MU_CONTAINER_H__*/
@@ -0,0 +1,276 @@
+/* -*-mode: c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-*/
+/*
+** Copyright (C) 2012 Dirk-Jan C. Binnema <djcb@djcbsoftware.nl>
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of the GNU General Public License as published by the
+** Free Software Foundation; either version 3, or (at your option) any
+** later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software Foundation,
+** Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+**
+*/
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "mu-msg-cache.h"
+#include "mu-msg-priv.h"
+
+struct _CacheEntry {
+	char		*path;
+	MuMsgFile	*file;
+	size_t		 size; /* of the message file, in bytes */
+};
+typedef struct _CacheEntry CacheEntry;
+
+struct _MuMsgCache {
+	GHashTable	*hash;  /* path => GList* link in lru */
+	GQueue		*lru;   /* CacheEntry*, most recently used first */
+
+	size_t		 size, maxsize;
+	unsigned	 hits, misses;
+};
+
+/* the sizes only count the message files, not the memory for the
+ * parsed messages; each of those takes some more, even for the
+ * smallest files, so we also limit the number of entries */
+#define MSG_CACHE_MAX_ENTRIES 1000
+
+/* protects all message caches */
+G_LOCK_DEFINE_STATIC (msg_cache);
+
+
+MuMsgCache*
+mu_msg_cache_new (size_t maxsize)
+{
+	MuMsgCache *self;
+
+	self = g_slice_new0 (MuMsgCache);
+
+	self->hash    = g_hash_table_new (g_str_hash, g_str_equal);
+	self->lru     = g_queue_new ();
+	self->maxsize = maxsize;
+
+	return self;
+}
+
+
+static void
+cache_entry_destroy (CacheEntry *entry)
+{
+	g_free (entry->path);
+	mu_msg_file_destroy (entry->file);
+	g_slice_free (CacheEntry, entry);
+}
+
+
+void
+mu_msg_cache_destroy (MuMsgCache *self)
+{
+	CacheEntry *entry;
+
+	if (!self)
+		return;
+
+	while ((entry = (CacheEntry*)g_queue_pop_head (self->lru)))
+		cache_entry_destroy (entry);
+
+	g_hash_table_destroy (self->hash);
+	g_queue_free (self->lru);
+
+	g_slice_free (MuMsgCache, self);
+}
+
+
+/* take an entry out of the cache; call with the lock held */
+static CacheEntry*
+take_entry (MuMsgCache *self, const char *path)
+{
+	GList *link;
+	CacheEntry *entry;
+
+	link = (GList*)g_hash_table_lookup (self->hash, path);
+	if (!link)
+		return NULL;
+
+	entry = (CacheEntry*)link->data;
+
+	g_hash_table_remove (self->hash, entry->path);
+	g_queue_delete_link (self->lru, link);
+	self->size -= entry->size;
+
+	return entry;
+}
+
+
+/* add an entry to the cache, replacing the one for the same path (if
+ * any); call with the lock held */
+static void
+put_entry (MuMsgCache *self, CacheEntry *entry)
+{
+	CacheEntry *old;
+
+	if ((old = take_entry (self, entry->path)))
+		cache_entry_destroy (old);
+
+	if (entry->size > self->maxsize) {
+		cache_entry_destroy (entry);
+		return;
+	}
+
+	/* make room */
+	while (self->size + entry->size > self->maxsize ||
+	       g_queue_get_length (self->lru) >= MSG_CACHE_MAX_ENTRIES)
+		cache_entry_destroy
+			(take_entry (self, ((CacheEntry*)g_queue_peek_tail
+					    (self->lru))->path));
+
+	g_queue_push_head (self->lru, entry);
+	g_hash_table_insert (self->hash, entry->path,
+			     g_queue_peek_head_link (self->lru));
+	self->size += entry->size;
+}
+
+
+static CacheEntry*
+cache_entry_new (const char *path, MuMsgFile *file)
+{
+	CacheEntry *entry;
+
+	entry	    = g_slice_new (CacheEntry);
+	entry->path = g_strdup (path);
+	entry->file = file;
+	entry->size = file->_size;
+
+	return entry;
+}
+
+
+/* is the parsed file still up to date? */
+static gboolean
+is_fresh (const char *path, MuMsgFile *file)
+{
+	struct stat statbuf;
+
+	if (stat (path, &statbuf) != 0)
+		return FALSE;
+
+	return statbuf.st_mtime == file->_timestamp &&
+		(size_t)statbuf.st_size == file->_size;
+}
+
+
+gboolean
+mu_msg_cache_load (MuMsgCache *self, MuMsg *msg, GError **err)
+{
+	CacheEntry *entry;
+	const char *path;
+
+	g_return_val_if_fail (self, FALSE);
+	g_return_val_if_fail (msg, FALSE);
+
+	if (msg->_file || !(path = mu_msg_get_path (msg)))
+		return mu_msg_load_msg_file (msg, err);
+
+	G_LOCK (msg_cache);
+	entry = take_entry (self, path);
+	G_UNLOCK (msg_cache);
+
+	/* the file was modified after we parsed it? */
+	if (entry && !is_fresh (path, entry->file)) {
+		cache_entry_destroy (entry);
+		entry = NULL;
+	}
+
+	G_LOCK (msg_cache);
+	if (entry)
+		++self->hits;
+	else
+		++self->misses;
+	G_UNLOCK (msg_cache);
+
+	if (!entry)
+		return mu_msg_load_msg_file (msg, err);
+
+	msg->_file  = entry->file;
+	entry->file = NULL;
+	cache_entry_destroy (entry);
+
+	return TRUE;
+}
+
+
+void
+mu_msg_cache_unload (MuMsgCache *self, MuMsg *msg)
+{
+	CacheEntry *entry;
+
+	g_return_if_fail (self);
+	g_return_if_fail (msg);
+
+	/* without a document, we could not find the path for loading
+	 * it again */
+	if (!msg->_file || !msg->_doc)
+		return;
+
+	entry	   = cache_entry_new (mu_msg_get_path (msg), msg->_file);
+	msg->_file = NULL;
+
+	G_LOCK (msg_cache);
+	put_entry (self, entry);
+	G_UNLOCK (msg_cache);
+}
+
+
+gboolean
+mu_msg_cache_prefetch (MuMsgCache *self, const char *path, GError **err)
+{
+	MuMsgFile *file;
+	gboolean cached;
+
+	g_return_val_if_fail (self, FALSE);
+	g_return_val_if_fail (path, FALSE);
+
+	G_LOCK (msg_cache);
+	cached = g_hash_table_lookup (self->hash, path) != NULL;
+	G_UNLOCK (msg_cache);
+
+	if (cached)
+		return TRUE;
+
+	if (!(file = mu_msg_file_new (path, NULL, err)))
+		return FALSE;
+
+	G_LOCK (msg_cache);
+	put_entry (self, cache_entry_new (path, file));
+	G_UNLOCK (msg_cache);
+
+	return TRUE;
+}
+
+
+void
+mu_msg_cache_stats (MuMsgCache *self, unsigned *hits, unsigned *misses,
+		    size_t *size)
+{
+	g_return_if_fail (self);
+
+	G_LOCK (msg_cache);
+
+	if (hits)
+		*hits = self->hits;
+	if (misses)
+		*misses = self->misses;
+	if (size)
+		*size = self->size;
+
+	G_UNLOCK (msg_cache);
+}
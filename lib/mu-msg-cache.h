@@ -0,0 +1,116 @@
+/* -*-mode: c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-*/
+/*
+** Copyright (C) 2012 Dirk-Jan C. Binnema <djcb@djcbsoftware.nl>
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of the GNU General Public License as published by the
+** Free Software Foundation; either version 3, or (at your option) any
+** later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software Foundation,
+** Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+**
+*/
+
+#ifndef __MU_MSG_CACHE_H__
+#define __MU_MSG_CACHE_H__
+
+#include <glib.h>
+#include <mu-msg.h>
+
+G_BEGIN_DECLS
+
+/*
+ * MuMsgCache is a size-bounded LRU cache for parsed message files,
+ * so that we don't need to parse the same file again when using the
+ * same message a few times in a row (e.g., viewing it, then saving
+ * an attachment). Entries are keyed by the path of the message, and
+ * are only used if the file was not modified since it was parsed.
+ *
+ * A message file is used by only one message at a time: loading
+ * takes it from the cache, and unloading puts it back. This makes it
+ * safe to use the cache from different threads, e.g. to parse some
+ * files in the background (mu_msg_cache_prefetch).
+ */
+struct _MuMsgCache;
+typedef struct _MuMsgCache MuMsgCache;
+
+
+/**
+ * create a new message cache
+ *
+ * @param maxsize the maximum total size of the cached message files,
+ * in bytes; when adding one would exceed this (or the maximum number
+ * of entries), the least recently used ones are removed. Note that
+ * this is the size of the files, not of the memory the parsed
+ * messages take.
+ *
+ * @return a new MuMsgCache; free with mu_msg_cache_destroy
+ */
+MuMsgCache* mu_msg_cache_new (size_t maxsize)
+	G_GNUC_WARN_UNUSED_RESULT;
+
+/**
+ * destroy a message cache
+ *
+ * @param self a MuMsgCache, or NULL
+ */
+void mu_msg_cache_destroy (MuMsgCache *self);
+
+/**
+ * load the message file for a message, like mu_msg_load_msg_file,
+ * but take the parsed file from the cache if we have it
+ *
+ * @param self a MuMsgCache
+ * @param msg a message
+ * @param err receives error information, if any
+ *
+ * @return TRUE if it succeeded, FALSE otherwise
+ */
+gboolean mu_msg_cache_load (MuMsgCache *self, MuMsg *msg, GError **err);
+
+/**
+ * unload the message file for a message, like mu_msg_unload_msg_file,
+ * but put it in the cache for the next time. After this, the message
+ * can only get at its fields through the database (or by loading the
+ * file again).
+ *
+ * @param self a MuMsgCache
+ * @param msg a message
+ */
+void mu_msg_cache_unload (MuMsgCache *self, MuMsg *msg);
+
+/**
+ * parse the message file at some path, and add it to the cache,
+ * unless it's already there. This can be called from another thread.
+ *
+ * @param self a MuMsgCache
+ * @param path full path to the message file
+ * @param err receives error information, if any
+ *
+ * @return TRUE if the file is in the cache, FALSE otherwise
+ */
+gboolean mu_msg_cache_prefetch (MuMsgCache *self, const char *path,
+				GError **err);
+
+/**
+ * get some statistics about the cache
+ *
+ * @param self a MuMsgCache
+ * @param hits receives the number of cache hits, or NULL
+ * @param misses receives the number of cache misses, or NULL
+ * @param size receives the total size of the cached message files in
+ * bytes, or NULL
+ */
+void mu_msg_cache_stats (MuMsgCache *self, unsigned *hits,
+			 unsigned *misses, size_t *size);
+
+G_END_DECLS
+
+#endif /*__MU_MSG_CACHE_H__*/
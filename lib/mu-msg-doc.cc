@@ -83,6 +83,21 @@ mu_msg_doc_get_str_field (MuMsgDoc *self, MuMsgFieldId mfid)
 }
 
 
+gchar*
+mu_msg_doc_get_sort_key (MuMsgDoc *self, MuMsgFieldId mfid)
+{
+	g_return_val_if_fail (self, NULL);
+	g_return_val_if_fail (mu_msg_field_has_sort_key(mfid), NULL);
+
+	try {
+		const std::string s (self->doc().get_value
+				     (mu_msg_field_sort_slot(mfid)));
+		return s.empty() ? NULL : g_strdup (s.c_str());
+
+	} MU_XAPIAN_CATCH_BLOCK_RETURN(NULL);
+}
+
+
 GSList*
 mu_msg_doc_get_str_list_field (MuMsgDoc *self, MuMsgFieldId mfid)
 {
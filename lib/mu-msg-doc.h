@@ -78,6 +78,19 @@ GSList* mu_msg_doc_get_str_list_field (MuMsgDoc *self, MuMsgFieldId mfid)
     G_GNUC_WARN_UNUSED_RESULT;
 
 
+/**
+ * get the pre-calculated sort key for some field from the msgdoc
+ * (see mu_msg_field_has_sort_key)
+ *
+ * @param self a MuMsgDoc instance
+ * @param mfid a MuMsgFieldId for a field with a sort key
+ *
+ * @return the sort key, or NULL if there is none. free with g_free
+ */
+gchar* mu_msg_doc_get_sort_key (MuMsgDoc *self, MuMsgFieldId mfid)
+          G_GNUC_WARN_UNUSED_RESULT;
+
+
 /**
  *
  * get a numeric parameter from the msgdoc
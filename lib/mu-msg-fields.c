@@ -427,6 +427,28 @@ mu_msg_field_shortcut (MuMsgFieldId id)
 }
 
 
+unsigned
+mu_msg_field_sort_slot (MuMsgFieldId id)
+{
+	g_return_val_if_fail (mu_msg_field_id_is_valid(id),0);
+
+	switch (id) {
+	case MU_MSG_FIELD_ID_SUBJECT: return MU_MSG_SORT_KEY_SLOT_SUBJECT;
+	case MU_MSG_FIELD_ID_FROM:    return MU_MSG_SORT_KEY_SLOT_FROM;
+	case MU_MSG_FIELD_ID_TO:      return MU_MSG_SORT_KEY_SLOT_TO;
+	default:		      return (unsigned)id;
+	}
+}
+
+
+gboolean
+mu_msg_field_has_sort_key (MuMsgFieldId id)
+{
+	g_return_val_if_fail (mu_msg_field_id_is_valid(id),FALSE);
+	return mu_msg_field_sort_slot (id) != (unsigned)id;
+}
+
+
 char
 mu_msg_field_xapian_prefix (MuMsgFieldId id)
 {
@@ -74,6 +74,48 @@ static const MuMsgFieldId MU_MSG_FIELD_ID_NONE = (MuMsgFieldId)-1;
 #define mu_msg_field_id_is_valid(MFID) \
 	((MFID) < MU_MSG_FIELD_ID_NUM)
 
+/* for some fields, we store a pre-calculated sort key in the database
+ * (see mu_msg_get_sort_key); these live in the value slots after the
+ * ones for the fields themselves */
+enum _MuMsgSortKeySlot {
+	MU_MSG_SORT_KEY_SLOT_SUBJECT = MU_MSG_FIELD_ID_NUM,
+	MU_MSG_SORT_KEY_SLOT_FROM,
+	MU_MSG_SORT_KEY_SLOT_TO,
+
+	MU_MSG_SORT_KEY_SLOT_END
+};
+#define MU_MSG_SORT_KEY_NUM (MU_MSG_SORT_KEY_SLOT_END - MU_MSG_FIELD_ID_NUM)
+
+/* each message gets a thread-id, which is the same for all messages in
+ * a thread: it's the thread-id of its parent (the last message-id in
+ * References: or In-Reply-To:), if that is in the store already;
+ * otherwise, a hash of the first message-id in References: (the root
+ * of the thread), or of the message's own message-id if there are
+ * none. It is stored in the value slot after the sort keys, and as a
+ * term with the prefix below, so we can find all the messages in a
+ * thread without threading.
+ *
+ * Note that a reply that was indexed before its parent, and whose
+ * references do not go back to the root of the thread, can still get
+ * a different thread-id than the rest of the thread */
+#define MU_MSG_THREAD_ID_SLOT	MU_MSG_SORT_KEY_SLOT_END
+#define MU_MSG_THREAD_ID_PREFIX	'W'
+
+/* each message with a message-id also gets a duplicate key: a hash of
+ * its message-id followed by a hash of its normalized body (ignoring
+ * whitespace); copies of the same message (e.g., the same message in
+ * different Gmail 'labels') have the same key. It is stored in the
+ * value slot after the thread-id (so queries can collapse on it, see
+ * MU_QUERY_FLAG_SKIP_DUPS) and as a term with the prefix below */
+#define MU_MSG_DUP_KEY_SLOT	(MU_MSG_THREAD_ID_SLOT + 1)
+#define MU_MSG_DUP_KEY_PREFIX	'K'
+
+/* in a date-ordered database (see mu_store_reorder_by_date), the
+ * docids go up with the message dates, except for the messages that
+ * were added later with an older date than the ones before them (or
+ * whose date changed); those get the term below */
+#define MU_MSG_LATE_TERM	"Olate"
+
 /* don't change the order, add new types at the end (before _NUM)*/
 enum _MuMsgFieldType {
 	MU_MSG_FIELD_TYPE_STRING,
@@ -121,6 +163,27 @@ const char*  mu_msg_field_name (MuMsgFieldId id) G_GNUC_PURE;
  */
 char mu_msg_field_shortcut (MuMsgFieldId id) G_GNUC_PURE;
 
+/**
+ * get the value slot to use when sorting by some field; for fields
+ * with a pre-calculated sort key, this is the slot for that key,
+ * otherwise it's the slot for the field itself.
+ *
+ * @param id a MuMsgFieldId
+ *
+ * @return the value slot number
+ */
+unsigned mu_msg_field_sort_slot (MuMsgFieldId id) G_GNUC_PURE;
+
+/**
+ * does this field have a pre-calculated sort key in the database?
+ *
+ * @param id a MuMsgFieldId
+ *
+ * @return TRUE if it has one, FALSE otherwise
+ */
+gboolean mu_msg_field_has_sort_key (MuMsgFieldId id) G_GNUC_PURE;
+
+
 /**
  * get the xapian prefix of the field -- that is, the prefix used in
  * the Xapian database to identify the field
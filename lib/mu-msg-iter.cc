@@ -19,61 +19,214 @@
 */
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <iostream>
 #include <string.h>
 #include <errno.h>
 #include <algorithm>
 #include <xapian.h>
 #include <string>
+#include <vector>
 
 #include "mu-util.h"
 #include "mu-msg.h"
 #include "mu-msg-iter.h"
 #include "mu-threader.h"
+#include "mu-date.h"
 
 /* just a guess... */
 #define MAX_FETCH_SIZE 10000
 
-class ThreadKeyMaker: public Xapian::KeyMaker {
-public:
-	ThreadKeyMaker (GHashTable *threadinfo): _threadinfo(threadinfo) {}
-	virtual std::string operator()(const Xapian::Document &doc) const  {
-		MuMsgIterThreadInfo *ti;
-		ti = (MuMsgIterThreadInfo*)g_hash_table_lookup
-			(_threadinfo,
-			 GUINT_TO_POINTER(doc.get_docid()));
-		return std::string (ti && ti->threadpath ? ti->threadpath : "");
+/* for the strings in the threader's input */
+#define THREAD_INPUT_CHUNK_SIZE 16384
+
+
+typedef void (*ThreadInputSetter) (MuThreaderMsg *msg, const std::string& val,
+				   GStringChunk *chunk);
+
+static void
+set_thread_msgid (MuThreaderMsg *msg, const std::string& val,
+		  GStringChunk *chunk)
+{
+	msg->msgid = g_string_chunk_insert_len (chunk, val.data(), val.size());
+}
+
+/* the references are stored as a comma-separated list; we turn that
+ * into a series of 0-terminated strings */
+static void
+set_thread_refs (MuThreaderMsg *msg, const std::string& val,
+		 GStringChunk *chunk)
+{
+	char *refs;
+	size_t u;
+
+	refs = g_string_chunk_insert_len (chunk, val.data(), val.size());
+	for (u = 0, msg->refnum = 1; u != val.size(); ++u)
+		if (refs[u] == ',') {
+			refs[u] = '\0';
+			++msg->refnum;
+		}
+	msg->refs = refs;
+}
+
+static void
+set_thread_sortkey (MuThreaderMsg *msg, const std::string& val,
+		    GStringChunk *chunk)
+{
+	msg->sortkey = g_string_chunk_insert_len (chunk, val.data(),
+						  val.size());
+}
+
+static void
+set_thread_from (MuThreaderMsg *msg, const std::string& val,
+		 GStringChunk *chunk)
+{
+	msg->from = g_string_chunk_insert_len (chunk, val.data(), val.size());
+}
+
+/* the date is stored as a YYYYMMDDHHMMSS string */
+static void
+set_thread_date (MuThreaderMsg *msg, const std::string& val,
+		 GStringChunk *chunk)
+{
+	msg->date = g_ascii_strtoull (val.c_str(), NULL, 10);
+}
+
+static void
+set_thread_flags (MuThreaderMsg *msg, const std::string& val,
+		  GStringChunk *chunk)
+{
+	msg->flags = (guint32)Xapian::sortable_unserialise (val);
+}
+
+static void
+set_thread_size (MuThreaderMsg *msg, const std::string& val,
+		 GStringChunk *chunk)
+{
+	msg->size = (guint32)Xapian::sortable_unserialise (val);
+}
+
+static void
+set_thread_subject (MuThreaderMsg *msg, const std::string& val,
+		    GStringChunk *chunk)
+{
+	msg->subject = g_string_chunk_insert_len (chunk, val.data(),
+						  val.size());
+}
+
+/* numbers are stored with Xapian::sortable_serialise, which may
+ * contain 0-bytes; so we turn them into fixed-width hex strings, which
+ * sort the same way (the numeric fields are never negative) */
+static void
+set_thread_sortkey_num (MuThreaderMsg *msg, const std::string& val,
+			GStringChunk *chunk)
+{
+	char buf[32];
+
+	snprintf (buf, sizeof(buf), "%016" G_GINT64_MODIFIER "x",
+		  (guint64)Xapian::sortable_unserialise (val));
+	msg->sortkey = g_string_chunk_insert (chunk, buf);
+}
+
+
+struct ThreadInputDocidLess {
+	ThreadInputDocidLess (const std::vector<MuThreaderMsg>& msgs):
+		_msgs(msgs) {}
+	bool operator() (guint32 a, guint32 b) const {
+		return _msgs[a].docid < _msgs[b].docid;
 	}
 private:
-	GHashTable *_threadinfo;
+	const std::vector<MuThreaderMsg>& _msgs;
 };
 
 
-struct _MuMsgIter {
-public:
-	_MuMsgIter (Xapian::Enquire &enq, size_t maxnum,
-		    gboolean threads, MuMsgFieldId sortfield, bool revert):
-		   _enq(enq), _thread_hash (0), _msg(0) {
+/* read the values in @slot for the messages in @order (which are
+ * sorted by docid); instead of getting the documents one-by-one, we
+ * walk over the stream of all values in the slot, which has them
+ * together on disk */
+static void
+read_thread_input (const Xapian::Database& db, Xapian::valueno slot,
+		   std::vector<MuThreaderMsg>& msgs,
+		   const std::vector<guint32>& order,
+		   ThreadInputSetter setter, GStringChunk *chunk)
+{
+	Xapian::ValueIterator cur (db.valuestream_begin (slot));
+	const Xapian::ValueIterator end (db.valuestream_end (slot));
 
-		_matches = _enq.get_mset (0, maxnum);
+	for (std::vector<guint32>::const_iterator u = order.begin();
+	     u != order.end() && cur != end; ++u) {
+
+		MuThreaderMsg *msg (&msgs[*u]);
+
+		cur.skip_to (msg->docid);
+		if (cur != end && cur.get_docid() == msg->docid)
+			setter (msg, *cur, chunk);
+	}
+}
+
+
+/* for sorting matches by date, newest first; for the same date, the
+ * lowest docid (ie., the highest match index) first, like Xapian's
+ * sort by value does */
+typedef std::pair<std::string, guint32> MatchDate;
+struct MatchDateNewer {
+	bool operator() (const MatchDate& a, const MatchDate& b) const {
+		return a.first == b.first ? a.second > b.second :
+			a.first > b.first;
+	}
+};
+
+/* for reading the dates in docid order (see set_date_order) */
+struct MatchDocidLess {
+	MatchDocidLess (const std::vector<Xapian::docid>& docids):
+		_docids(docids) {}
+	bool operator() (guint32 a, guint32 b) const {
+		return _docids[a] < _docids[b];
+	}
+private:
+	const std::vector<Xapian::docid>& _docids;
+};
 
-		/* when threading, we calculate the threads for the
-		 * set of matches, then requery/sort based on the
-		 * threading */
-		if (threads && !_matches.empty()) {
 
-			_matches.fetch();
-			_thread_hash = mu_threader_calculate
-				(this, _matches.size(), sortfield,
-				 revert ? TRUE: FALSE);
+/* a stream over the values in one slot, and the last value we read
+ * from it */
+struct SlotStream {
+	SlotStream (): docid(0) {}
+	Xapian::ValueIterator	cur;
+	Xapian::docid		docid; /* of value, or 0 if none */
+	std::string		value;
+};
 
-			ThreadKeyMaker keymaker(_thread_hash);
 
-			enq.set_sort_by_key (&keymaker, false);
+struct _MuMsgIter {
+public:
+	_MuMsgIter (Xapian::Enquire &enq, const Xapian::Database& db,
+		    size_t maxnum, MuMsgIterFlags flags, MuMsgFieldId sortfield,
+		    bool revert):
+		   _enq(enq), _db(db), _thread_nodes (0), _thread_aggrs (0),
+		   _thread_pos (0),
+		   _thread_chunk (0), _order_pos (0), _msg(0),
+		   _fields(0) {
+
+		/* the 'late' messages are the only ones that can be
+		 * out of date order; so the newest maxnum are among
+		 * the maxnum + late highest docids */
+		if (flags & MU_MSG_ITER_FLAG_NEWEST_BY_DOCID) {
+			_matches = _enq.get_mset
+				(0, maxnum + db.get_termfreq (MU_MSG_LATE_TERM));
+			set_date_order (maxnum);
+		} else
 			_matches = _enq.get_mset (0, maxnum);
+
+		/* when threading, we calculate the threads for the
+		 * set of matches; after that, we iterate over the
+		 * matches in thread order */
+		if ((flags & MU_MSG_ITER_FLAG_THREADS) && !_matches.empty()) {
+			calculate_threads (db, flags, sortfield, revert);
+			set_thread_order ();
 		}
 
-		_cursor	 = _matches.begin();
+		reset ();
 
 		/* this seems to make search slightly faster, some
 		 * non-scientific testing suggests. 5-10% or so */
@@ -82,8 +235,12 @@ public:
 	}
 
 	~_MuMsgIter () {
-		if (_thread_hash)
-			g_hash_table_destroy (_thread_hash);
+		if (_thread_nodes)
+			g_array_free (_thread_nodes, TRUE);
+		if (_thread_aggrs)
+			g_array_free (_thread_aggrs, TRUE);
+		if (_thread_chunk)
+			g_string_chunk_free (_thread_chunk);
 
 		set_msg (NULL);
 	}
@@ -92,10 +249,104 @@ public:
 	Xapian::MSet& matches() { return _matches; }
 
 	Xapian::MSet::const_iterator cursor () const { return _cursor; }
-	void set_cursor (Xapian::MSetIterator cur) { _cursor = cur; }
-	void cursor_next () { ++_cursor; }
 
-	GHashTable *thread_hash () { return _thread_hash; }
+	void reset () {
+		_thread_pos = _order_pos = 0;
+		if (_thread_nodes)
+			set_thread_cursor ();
+		else if (!_match_order.empty())
+			set_order_cursor ();
+		else
+			set_cursor (_matches.begin());
+	}
+	void next () {
+		if (_thread_nodes) {
+			++_thread_pos;
+			set_thread_cursor ();
+		} else if (!_match_order.empty()) {
+			++_order_pos;
+			set_order_cursor ();
+		} else
+			set_cursor (++_cursor);
+	}
+	bool is_done () const {
+		if (_thread_nodes)
+			return _thread_pos == _thread_order.size();
+		else if (!_match_order.empty())
+			return _order_pos == _match_order.size();
+		else
+			return _cursor == _matches.end();
+	}
+
+	/* the fields (bitmask of 1 << mfid) we can get through value() */
+	void set_fields (guint32 fields) {
+		_fields = fields;
+		for (unsigned u = 0; u != MU_MSG_FIELD_ID_NUM; ++u)
+			_streams[u] = SlotStream();
+	}
+	bool has_field (MuMsgFieldId mfid) const {
+		return _fields & (1 << mfid);
+	}
+
+	/* get the value for one of the declared fields; like
+	 * read_thread_input, we get it from the stream of values in
+	 * its slot rather than from the document. The value is owned
+	 * by the stream, and remains valid until we read the next
+	 * one from it */
+	const std::string& value (MuMsgFieldId mfid) {
+		SlotStream& stream (_streams[mfid]);
+		const Xapian::ValueIterator end;
+		const Xapian::docid docid (*_cursor);
+
+		if (stream.docid == docid)
+			return stream.value;
+
+		/* streams only go forward, but the matches need not
+		 * be in docid order */
+		if (stream.cur == end || stream.cur.get_docid() > docid)
+			stream.cur = _db.valuestream_begin
+				((Xapian::valueno)mfid);
+
+		stream.cur.skip_to (docid);
+		if (stream.cur != end && stream.cur.get_docid() == docid)
+			stream.value = *stream.cur;
+		else
+			stream.value.clear ();
+
+		stream.docid = docid;
+		return stream.value;
+	}
+
+	bool has_threads () const { return _thread_nodes != NULL; }
+
+	/* get the thread info for the current message; the thread
+	 * path is only built when we need it */
+	const MuMsgIterThreadInfo* thread_info () {
+		MuMsgIterThreadInfo *ti;
+		const MuThreadNode *node;
+		guint32 nodeidx;
+
+		ti = &_thread_info[_thread_pos];
+		if (ti->threadpath)
+			return ti;
+
+		if (!_thread_chunk)
+			_thread_chunk = g_string_chunk_new (8192);
+
+		nodeidx	       = _thread_order[_thread_pos];
+		node	       = &g_array_index (_thread_nodes, MuThreadNode,
+						 nodeidx);
+		ti->threadpath = (gchar*)mu_threader_path
+			(_thread_nodes, nodeidx, _matches.size(),
+			 _thread_chunk);
+		ti->level      = node->level;
+		ti->prop       = node->prop;
+		ti->aggr       = g_array_index (_thread_aggrs,
+						MuMsgIterThreadAggr,
+						node->thread);
+
+		return ti;
+	}
 
 	MuMsg *msg() { return _msg; }
 	MuMsg *set_msg (MuMsg *msg) {
@@ -105,31 +356,208 @@ public:
 	}
 
 private:
+	/* the threader only needs a few values for each message,
+	 * which we read from the value slots, without getting the
+	 * documents */
+	void calculate_threads (const Xapian::Database& db,
+				MuMsgIterFlags flags, MuMsgFieldId sortfield,
+				bool revert) {
+
+		std::vector<MuThreaderMsg> msgs (_matches.size());
+		std::vector<guint32> order (_matches.size()), nomsgid;
+		GStringChunk *chunk;
+		unsigned tflags;
+
+		tflags = MU_THREADER_FLAG_NONE;
+		if (sortfield != MU_MSG_FIELD_ID_NONE)
+			tflags |= MU_THREADER_FLAG_SORT;
+		if (revert)
+			tflags |= MU_THREADER_FLAG_REVERT;
+		if (flags & MU_MSG_ITER_FLAG_GROUP_SUBJECTS)
+			tflags |= MU_THREADER_FLAG_GROUP_SUBJECTS;
+		if (flags & MU_MSG_ITER_FLAG_SORT_BY_ACTIVITY)
+			tflags |= MU_THREADER_FLAG_SORT_BY_ACTIVITY;
+
+		for (guint32 u = 0; u != _matches.size(); ++u) {
+			memset (&msgs[u], 0, sizeof(MuThreaderMsg));
+			msgs[u].docid = *_matches[u];
+			order[u]      = u;
+		}
+		std::sort (order.begin(), order.end(),
+			   ThreadInputDocidLess (msgs));
+
+		chunk = g_string_chunk_new (THREAD_INPUT_CHUNK_SIZE);
+		try {
+			read_thread_input (db, MU_MSG_FIELD_ID_MSGID, msgs,
+					   order, set_thread_msgid, chunk);
+			read_thread_input (db, MU_MSG_FIELD_ID_REFS, msgs,
+					   order, set_thread_refs, chunk);
+
+			/* use the path for messages without a
+			 * message-id */
+			for (guint32 u = 0; u != order.size(); ++u)
+				if (!msgs[order[u]].msgid)
+					nomsgid.push_back (order[u]);
+			if (!nomsgid.empty())
+				read_thread_input (db, MU_MSG_FIELD_ID_PATH,
+						   msgs, nomsgid,
+						   set_thread_msgid, chunk);
+
+			if (sortfield != MU_MSG_FIELD_ID_NONE)
+				read_thread_input
+					(db, mu_msg_field_sort_slot (sortfield),
+					 msgs, order,
+					 (mu_msg_field_is_numeric (sortfield) &&
+					  sortfield != MU_MSG_FIELD_ID_DATE) ?
+					 set_thread_sortkey_num :
+					 set_thread_sortkey, chunk);
+
+			if (tflags & MU_THREADER_FLAG_GROUP_SUBJECTS)
+				read_thread_input (db, MU_MSG_FIELD_ID_SUBJECT,
+						   msgs, order,
+						   set_thread_subject, chunk);
+
+			/* for the thread aggregates */
+			read_thread_input (db, MU_MSG_FIELD_ID_DATE, msgs,
+					   order, set_thread_date, chunk);
+			read_thread_input (db, MU_MSG_FIELD_ID_FLAGS, msgs,
+					   order, set_thread_flags, chunk);
+			read_thread_input (db, MU_MSG_FIELD_ID_SIZE, msgs,
+					   order, set_thread_size, chunk);
+			read_thread_input (db, MU_MSG_FIELD_ID_FROM, msgs,
+					   order, set_thread_from, chunk);
+
+			std::vector<guint32>().swap (order);
+			_thread_nodes = mu_threader_calculate
+				(&msgs[0], msgs.size(), (MuThreaderFlags)tflags,
+				 &_thread_aggrs);
+
+		} catch (...) {
+			g_string_chunk_free (chunk);
+			throw;
+		}
+
+		g_string_chunk_free (chunk);
+	}
+
+	void set_cursor (Xapian::MSetIterator cur) {
+		_cursor = cur;
+	}
+
+	void set_thread_cursor () {
+		if (_thread_pos < _thread_order.size()) {
+			const MuThreadNode *node;
+			node = &g_array_index (_thread_nodes, MuThreadNode,
+					       _thread_order[_thread_pos]);
+			set_cursor (_matches[node->match]);
+		} else
+			set_cursor (_matches.end());
+	}
+
+	void set_order_cursor () {
+		if (_order_pos < _match_order.size())
+			set_cursor (_matches[_match_order[_order_pos]]);
+		else
+			set_cursor (_matches.end());
+	}
+
+	/* sort the matches by date, and keep the newest maxnum; as in
+	 * read_thread_input, we get the dates from the value stream,
+	 * in docid order, rather than from each of the documents */
+	void set_date_order (size_t maxnum) {
+		std::vector<MatchDate> dates;
+		std::vector<Xapian::docid> docids;
+		std::vector<guint32> order;
+
+		if (_matches.empty())
+			return;
+
+		dates.resize (_matches.size());
+		docids.resize (_matches.size());
+		order.resize (_matches.size());
+		for (guint32 u = 0; u != _matches.size(); ++u) {
+			dates[u].second = u;
+			docids[u]       = *_matches[u];
+			order[u]        = u;
+		}
+		std::sort (order.begin(), order.end(), MatchDocidLess (docids));
+
+		Xapian::ValueIterator cur
+			(_db.valuestream_begin (MU_MSG_FIELD_ID_DATE));
+		const Xapian::ValueIterator end
+			(_db.valuestream_end (MU_MSG_FIELD_ID_DATE));
+		for (std::vector<guint32>::const_iterator u = order.begin();
+		     u != order.end() && cur != end; ++u) {
+			cur.skip_to (docids[*u]);
+			if (cur != end && cur.get_docid() == docids[*u])
+				dates[*u].first = *cur;
+		}
+
+		std::sort (dates.begin(), dates.end(), MatchDateNewer());
+
+		_match_order.reserve (std::min (maxnum, dates.size()));
+		for (size_t u = 0; u != dates.size() && u != maxnum; ++u)
+			_match_order.push_back (dates[u].second);
+	}
+
+	/* the nodes are in thread order already; we only need the
+	 * ones that have a message */
+	void set_thread_order () {
+		_thread_order.reserve (_matches.size());
+		for (guint32 u = 0; u != _thread_nodes->len; ++u)
+			if (g_array_index (_thread_nodes, MuThreadNode,
+					   u).match != MU_THREAD_NODE_NONE)
+				_thread_order.push_back (u);
+
+		MuMsgIterThreadInfo empty;
+		memset (&empty, 0, sizeof(empty));
+		_thread_info.assign (_thread_order.size(), empty);
+	}
+
 	const Xapian::Enquire		_enq;
+	const Xapian::Database		_db;
 	Xapian::MSet			_matches;
 	Xapian::MSet::const_iterator	_cursor;
 
-	GHashTable      *_thread_hash;
+	GArray				*_thread_nodes;
+	GArray				*_thread_aggrs;
+	std::vector<guint32>		 _thread_order; /* node indices */
+	size_t				 _thread_pos;
+	std::vector<MuMsgIterThreadInfo> _thread_info;
+	GStringChunk			*_thread_chunk;
+
+	std::vector<guint32>		 _match_order; /* match indices */
+	size_t				 _order_pos;
+
 	MuMsg		*_msg;
+
+	guint32		 _fields;
+	SlotStream	 _streams[MU_MSG_FIELD_ID_NUM];
 };
 
 
 
 MuMsgIter*
-mu_msg_iter_new (XapianEnquire *enq, size_t maxnum,
-		 gboolean threads, MuMsgFieldId sortfield, gboolean revert,
+mu_msg_iter_new (XapianEnquire *enq, XapianDatabase *db, size_t maxnum,
+		 MuMsgIterFlags flags, MuMsgFieldId sortfield, gboolean revert,
 		 GError **err)
 {
 	g_return_val_if_fail (enq, NULL);
+	g_return_val_if_fail (db, NULL);
 	/* sortfield should be set to .._NONE when we're not threading */
-	g_return_val_if_fail (threads || sortfield == MU_MSG_FIELD_ID_NONE,
-			      NULL);
+	g_return_val_if_fail ((flags & MU_MSG_ITER_FLAG_THREADS) ||
+			      sortfield == MU_MSG_FIELD_ID_NONE, NULL);
 	g_return_val_if_fail (mu_msg_field_id_is_valid (sortfield) ||
 			      sortfield == MU_MSG_FIELD_ID_NONE,
 			      FALSE);
+	g_return_val_if_fail (!(flags & MU_MSG_ITER_FLAG_NEWEST_BY_DOCID) ||
+			      (!(flags & MU_MSG_ITER_FLAG_THREADS) &&
+			       maxnum > 0), NULL);
 	try {
-		return new MuMsgIter ((Xapian::Enquire&)*enq, maxnum, threads,
-				      sortfield, revert ? true : false);
+		return new MuMsgIter ((Xapian::Enquire&)*enq,
+				      (const Xapian::Database&)*db,
+				      maxnum, flags, sortfield,
+				      revert ? true : false);
 
 	} catch (const Xapian::DatabaseModifiedError &dbmex) {
 		mu_util_g_set_error (err, MU_ERROR_XAPIAN_MODIFIED,
@@ -178,7 +606,7 @@ mu_msg_iter_reset (MuMsgIter *iter)
 	iter->set_msg (NULL);
 
 	try {
-		iter->set_cursor(iter->matches().begin());
+		iter->reset ();
 
 	} MU_XAPIAN_CATCH_BLOCK_RETURN (FALSE);
 
@@ -197,8 +625,8 @@ mu_msg_iter_next (MuMsgIter *iter)
 		return FALSE;
 
 	try {
-		iter->cursor_next();
-		return iter->cursor() == iter->matches().end() ? FALSE:TRUE;
+		iter->next ();
+		return iter->is_done () ? FALSE : TRUE;
 
 	} MU_XAPIAN_CATCH_BLOCK_RETURN(FALSE);
 }
@@ -210,7 +638,7 @@ mu_msg_iter_is_done (MuMsgIter *iter)
 	g_return_val_if_fail (iter, TRUE);
 
 	try {
-		return iter->cursor() == iter->matches().end() ? TRUE : FALSE;
+		return iter->is_done () ? TRUE : FALSE;
 
 	} MU_XAPIAN_CATCH_BLOCK_RETURN (TRUE);
 }
@@ -224,31 +652,85 @@ mu_msg_iter_get_docid (MuMsgIter *iter)
 	g_return_val_if_fail (!mu_msg_iter_is_done(iter),
 			      (unsigned int)-1);
 	try {
-		return iter->cursor().get_document().get_docid();
+		/* no need to get the document for this */
+		return *iter->cursor();
 
 	} MU_XAPIAN_CATCH_BLOCK_RETURN (0);
 }
 
 
+gboolean
+mu_msg_iter_set_fields (MuMsgIter *iter, const MuMsgFieldId *mfids,
+			unsigned num)
+{
+	unsigned u;
+	guint32 fields;
 
-const MuMsgIterThreadInfo*
-mu_msg_iter_get_thread_info (MuMsgIter *iter)
+	g_return_val_if_fail (iter, FALSE);
+	g_return_val_if_fail (mfids || num == 0, FALSE);
+
+	for (u = 0, fields = 0; u != num; ++u) {
+		g_return_val_if_fail (mu_msg_field_id_is_valid (mfids[u]),
+				      FALSE);
+		g_return_val_if_fail (mu_msg_field_xapian_value (mfids[u]),
+				      FALSE);
+		fields |= 1 << mfids[u];
+	}
+
+	iter->set_fields (fields);
+
+	return TRUE;
+}
+
+
+const char*
+mu_msg_iter_get_field_str (MuMsgIter *iter, MuMsgFieldId mfid)
 {
 	g_return_val_if_fail (!mu_msg_iter_is_done(iter), NULL);
-	g_return_val_if_fail (iter->thread_hash(), NULL);
+	g_return_val_if_fail (mu_msg_field_id_is_valid (mfid), NULL);
+	g_return_val_if_fail (iter->has_field (mfid), NULL);
+
+	try {
+		const std::string& s (iter->value (mfid));
+		return s.empty() ? NULL : s.c_str();
+
+	} MU_XAPIAN_CATCH_BLOCK_RETURN (NULL);
+}
 
+
+gint64
+mu_msg_iter_get_field_numeric (MuMsgIter *iter, MuMsgFieldId mfid)
+{
+	g_return_val_if_fail (!mu_msg_iter_is_done(iter), -1);
+	g_return_val_if_fail (mu_msg_field_is_numeric (mfid), -1);
+	g_return_val_if_fail (iter->has_field (mfid), -1);
+
+	/* see mu_msg_doc_get_num_field; dates are stored as
+	 * strings */
 	try {
-		const MuMsgIterThreadInfo *ti;
-		unsigned int docid;
+		const std::string& s (iter->value (mfid));
+		if (s.empty())
+			return 0;
+		else if (mfid == MU_MSG_FIELD_ID_DATE)
+			return static_cast<gint64>
+				(mu_date_str_to_time_t (s.c_str(), FALSE/*utc*/));
+		else
+			return static_cast<gint64>
+				(Xapian::sortable_unserialise(s));
+
+	} MU_XAPIAN_CATCH_BLOCK_RETURN (-1);
+}
 
-		docid = mu_msg_iter_get_docid (iter);
-		ti    = (const MuMsgIterThreadInfo*)g_hash_table_lookup
-			(iter->thread_hash(), GUINT_TO_POINTER(docid));
 
-		if (!ti)
-			g_printerr ("no ti for %u\n", docid);
 
-		return ti;
+const MuMsgIterThreadInfo*
+mu_msg_iter_get_thread_info (MuMsgIter *iter)
+{
+	g_return_val_if_fail (!mu_msg_iter_is_done(iter), NULL);
+	g_return_val_if_fail (iter->has_threads(), NULL);
+
+	try {
+		return iter->thread_info ();
 
 	} MU_XAPIAN_CATCH_BLOCK_RETURN (NULL);
 }
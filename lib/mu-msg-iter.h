@@ -22,6 +22,7 @@
 
 #include <glib.h>
 #include <mu-msg.h>
+#include <mu-store.h> /* for XapianDatabase */
 
 G_BEGIN_DECLS
 
@@ -37,24 +38,44 @@ struct _MuMsgIter;
 typedef struct _MuMsgIter MuMsgIter;
 
 
+enum _MuMsgIterFlags {
+	MU_MSG_ITER_FLAG_NONE		= 0,
+	/* calculate message threads */
+	MU_MSG_ITER_FLAG_THREADS	= 1 << 0,
+	/* when calculating threads, also group threads by subject */
+	MU_MSG_ITER_FLAG_GROUP_SUBJECTS	= 1 << 1,
+	/* when calculating threads, sort the threads by their newest
+	 * message */
+	MU_MSG_ITER_FLAG_SORT_BY_ACTIVITY = 1 << 2,
+	/* the matches are in descending docid order, from a date-ordered
+	 * database (see mu_store_reorder_by_date); get enough of them
+	 * to include the newest maxnum, and iterate over those, newest
+	 * first (not for threads) */
+	MU_MSG_ITER_FLAG_NEWEST_BY_DOCID = 1 << 3
+};
+typedef enum _MuMsgIterFlags MuMsgIterFlags;
+
+
 /**
  * create a new MuMsgIter -- basically, an iterator over the search
  * results
  *
  * @param enq a Xapian::Enquire* cast to XapianEnquire* (because this
  * is C, not C++),providing access to search results
+ * @param db the Xapian::Database* (cast to XapianDatabase*) the query
+ * runs against; the threading information is read from it directly
  * @param batchsize how many results to retrieve at once
- * @param threads whether to calculate threads
- * @param sorting field when using threads; note, when 'threads' is
- * FALSE, this should be MU_MSG_FIELD_ID_NONE
+ * @param flags bitwise OR of MuMsgIterFlags
+ * @param sorting field when using threads; note, when not threading,
+ * this should be MU_MSG_FIELD_ID_NONE
  * @param if TRUE, revert the sorting order
  * @param err receives error information. if the error is MU_ERROR_XAPIAN_MODIFIED,
  * the database should be reloaded.
  *
  * @return a new MuMsgIter, or NULL in case of error
  */
-MuMsgIter *mu_msg_iter_new (XapianEnquire *enq,
-			    size_t batchsize, gboolean threads,
+MuMsgIter *mu_msg_iter_new (XapianEnquire *enq, XapianDatabase *db,
+			    size_t batchsize, MuMsgIterFlags flags,
 			    MuMsgFieldId threadsortfield,
 			    gboolean revert,
 			    GError **err) G_GNUC_WARN_UNUSED_RESULT;
@@ -123,6 +144,72 @@ MuMsg* mu_msg_iter_get_msg_floating (MuMsgIter *iter)
 unsigned int     mu_msg_iter_get_docid         (MuMsgIter *iter);
 
 
+/**
+ * declare the fields you want to retrieve for the messages in this
+ * iterator with mu_msg_iter_get_field_str and
+ * mu_msg_iter_get_field_numeric. Those functions get the values
+ * straight from the database, without creating a MuMsg, which is
+ * much faster when you only need a few header fields. Only fields that
+ * are stored as values in the database (see mu_msg_field_xapian_value)
+ * can be used.
+ *
+ * @param iter a valid MuMsgIter iterator
+ * @param mfids an array of field ids
+ * @param num the number of elements in mfids
+ *
+ * @return TRUE if it succeeded, FALSE otherwise
+ */
+gboolean mu_msg_iter_set_fields (MuMsgIter *iter, const MuMsgFieldId *mfids,
+				 unsigned num);
+
+/**
+ * get the value of a string field for the current message; the field
+ * must have been declared with mu_msg_iter_set_fields. For
+ * string-list fields, you get the comma-separated list.
+ *
+ * @param iter a valid MuMsgIter iterator
+ * @param mfid the field id
+ *
+ * @return the value (don't free), or NULL if it is empty or in case of
+ * error. The value is owned by the iterator, and is valid until the
+ * iterator is moved or destroyed.
+ */
+const char* mu_msg_iter_get_field_str (MuMsgIter *iter, MuMsgFieldId mfid);
+
+/**
+ * get the value of a numeric field for the current message; the field
+ * must have been declared with mu_msg_iter_set_fields.
+ *
+ * @param iter a valid MuMsgIter iterator
+ * @param mfid the field id
+ *
+ * @return the value, or -1 in case of error
+ */
+gint64 mu_msg_iter_get_field_numeric (MuMsgIter *iter, MuMsgFieldId mfid);
+
+/**
+ * like mu_msg_append_sexp_fields, but for the current message of the
+ * iterator, with the values from mu_msg_iter_get_field_str and
+ * mu_msg_iter_get_field_numeric, so no MuMsg is needed. The fields
+ * must have been declared with mu_msg_iter_set_fields; tags are not
+ * stored as a value, so for those the message is still loaded.
+ *
+ * @param iter a valid MuMsgIter iterator
+ * @param gstr the GString to append to
+ * @param docid the docid for this message, or 0
+ * @param ti thread info for the current message, or NULL
+ * @param mfids the fields to include (see mu_msg_to_sexp_fields)
+ * @param num the number of elements in mfids
+ *
+ * @return TRUE if it succeeded, FALSE otherwise
+ */
+gboolean mu_msg_iter_append_sexp_fields (MuMsgIter *iter, GString *gstr,
+					 unsigned docid,
+					 const struct _MuMsgIterThreadInfo *ti,
+					 const MuMsgFieldId *mfids,
+					 unsigned num);
+
+
 /**
  * calculate the message threads
  *
@@ -142,12 +229,24 @@ enum _MuMsgIterThreadProp {
 };
 typedef guint8 MuMsgIterThreadProp;
 
+/* information about a whole thread */
+struct _MuMsgIterThreadAggr {
+	guint	msgnum;		/* number of messages in the thread */
+	guint	unread;		/* ... of which are unread */
+	guint	flagged;	/* ... of which are flagged */
+	guint	participants;	/* number of different senders */
+	time_t	oldest, newest;	/* dates of the oldest, newest message */
+	guint64 size;		/* total size of the messages */
+};
+typedef struct _MuMsgIterThreadAggr MuMsgIterThreadAggr;
+
 struct _MuMsgIterThreadInfo {
 	gchar *threadpath; /* a string decribing the thread-path in
 			    * such a way that we can sort by this
 			    * string to get the right order. */
 	guint level;       /* thread-depth -- [0...] */
 	MuMsgIterThreadProp prop;
+	MuMsgIterThreadAggr aggr; /* for the thread this message is in */
 };
 typedef struct _MuMsgIterThreadInfo MuMsgIterThreadInfo;
 
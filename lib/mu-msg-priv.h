@@ -61,6 +61,9 @@ struct _MuMsg {
 	 */
 	GSList          *_free_later_str;
 	GSList          *_free_later_lst;
+
+	/* the sort keys, once we've retrieved them */
+	gchar		*_sort_keys[MU_MSG_SORT_KEY_NUM];
 };
 
 
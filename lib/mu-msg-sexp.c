@@ -24,22 +24,53 @@
 #include "mu-msg-part.h"
 #include "mu-maildir.h"
 
+/* the keywords, with the tab before and the space after them; these
+ * are all string literals, so there's no formatting at runtime */
+#define SEXP_KEYWORD(KW) "\t:" KW " "
+
+
+/* append an unsigned number, without the overhead of printf */
 static void
-append_sexp_attr_list (GString *gstr, const char* elm, const GSList *lst)
+append_uint (GString *gstr, guint64 u)
+{
+	char buf[24], *cur;
+
+	cur  = buf + sizeof(buf);
+	do {
+		*--cur = '0' + (char)(u % 10);
+		u /= 10;
+	} while (u > 0);
+
+	g_string_append_len (gstr, cur, buf + sizeof(buf) - cur);
+}
+
+
+/* append time t as an emacs time, ie. (<high> <low> 0) */
+static void
+append_time (GString *gstr, time_t t)
+{
+	g_string_append_c (gstr, '(');
+	append_uint (gstr, (unsigned)(t >> 16));
+	g_string_append_c (gstr, ' ');
+	append_uint (gstr, (unsigned)(t & 0xffff));
+	g_string_append (gstr, " 0)");
+}
+
+
+static void
+append_sexp_attr_list (GString *gstr, const char* kw, const GSList *lst)
 {
 	const GSList *cur;
 
 	if (!lst)
 		return; /* empty list, don't include */
 
-	g_string_append_printf (gstr, "\t:%s ( ", elm);
+	g_string_append (gstr, kw);
+	g_string_append (gstr, "( ");
 
 	for (cur = lst; cur; cur = g_slist_next(cur)) {
-		char *str;
-		str = mu_str_escape_c_literal
-			((const gchar*)cur->data, TRUE);
-		g_string_append_printf (gstr, "%s ", str);
-		g_free (str);
+		mu_str_append_c_literal (gstr, (const gchar*)cur->data, TRUE);
+		g_string_append_c (gstr, ' ');
 	}
 
 	g_string_append (gstr, ")\n");
@@ -47,17 +78,14 @@ append_sexp_attr_list (GString *gstr, const char* elm, const GSList *lst)
 
 
 static void
-append_sexp_attr (GString *gstr, const char* elm, const char *str)
+append_sexp_attr (GString *gstr, const char* kw, const char *str)
 {
-	gchar *esc;
-
-	if (!str || strlen(str) == 0)
+	if (!str || !*str)
 		return; /* empty: don't include */
 
-	esc = mu_str_escape_c_literal (str, TRUE);
-
-	g_string_append_printf (gstr, "\t:%s %s\n", elm, esc);
-	g_free (esc);
+	g_string_append (gstr, kw);
+	mu_str_append_c_literal (gstr, str, TRUE);
+	g_string_append_c (gstr, '\n');
 }
 
 
@@ -68,24 +96,26 @@ struct _ContactData {
 };
 typedef struct _ContactData ContactData;
 
-static gchar*
-get_name_addr_pair (MuMsgContact *c)
+static void
+append_name_addr_pair (GString *gstr, MuMsgContact *c)
 {
-	gchar *name, *addr, *pair;
-
-	name = (char*)mu_msg_contact_name(c);
-	addr = (char*)mu_msg_contact_address(c);
+	const char *name, *addr;
 
-	name = name ? mu_str_escape_c_literal (name, TRUE) : NULL;
-	addr = addr ? mu_str_escape_c_literal (addr, TRUE) : NULL;
+	name = mu_msg_contact_name(c);
+	addr = mu_msg_contact_address(c);
 
-	pair = g_strdup_printf ("(%s . %s)",
-				name ? name : "nil",
-				addr ? addr : "nil");
-	g_free (name);
-	g_free (addr);
+	g_string_append_c (gstr, '(');
+	if (name)
+		mu_str_append_c_literal (gstr, name, TRUE);
+	else
+		g_string_append (gstr, "nil");
 
-	return pair;
+	g_string_append (gstr, " . ");
+	if (addr)
+		mu_str_append_c_literal (gstr, addr, TRUE);
+	else
+		g_string_append (gstr, "nil");
+	g_string_append_c (gstr, ')');
 }
 
 static void
@@ -101,7 +131,6 @@ add_prefix_maybe (GString *gstr, gboolean *field, const char *prefix)
 static gboolean
 each_contact (MuMsgContact *c, ContactData *cdata)
 {
-	char *pair;
 	MuMsgContactType ctype;
 
 	ctype = mu_msg_contact_type (c);
@@ -114,29 +143,30 @@ each_contact (MuMsgContact *c, ContactData *cdata)
 	switch (ctype) {
 
 	case MU_MSG_CONTACT_TYPE_FROM:
-		add_prefix_maybe (cdata->gstr, &cdata->from, "\t:from (");
+		add_prefix_maybe (cdata->gstr, &cdata->from,
+				  SEXP_KEYWORD("from") "(");
 		break;
 	case MU_MSG_CONTACT_TYPE_TO:
-		add_prefix_maybe (cdata->gstr, &cdata->to, "\t:to (");
+		add_prefix_maybe (cdata->gstr, &cdata->to,
+				  SEXP_KEYWORD("to") "(");
 		break;
 	case MU_MSG_CONTACT_TYPE_CC:
-		add_prefix_maybe (cdata->gstr, &cdata->cc, "\t:cc (");
+		add_prefix_maybe (cdata->gstr, &cdata->cc,
+				  SEXP_KEYWORD("cc") "(");
 		break;
 	case MU_MSG_CONTACT_TYPE_BCC:
-		add_prefix_maybe (cdata->gstr, &cdata->bcc, "\t:bcc (");
+		add_prefix_maybe (cdata->gstr, &cdata->bcc,
+				  SEXP_KEYWORD("bcc") "(");
 		break;
 	case MU_MSG_CONTACT_TYPE_REPLY_TO:
 		add_prefix_maybe (cdata->gstr, &cdata->reply_to,
-				  "\t:reply-to (");
+				  SEXP_KEYWORD("reply-to") "(");
 		break;
 	default: g_return_val_if_reached (FALSE);
 	}
 
 	cdata->prev_ctype = ctype;
-
-	pair = get_name_addr_pair (c);
-	g_string_append (cdata->gstr, pair);
-	g_free (pair);
+	append_name_addr_pair (cdata->gstr, c);
 
 	return TRUE;
 }
@@ -159,9 +189,54 @@ append_sexp_contacts (GString *gstr, MuMsg *msg)
 		gstr = g_string_append (gstr, ")\n");
 }
 
+
+static void
+append_sexp_contacts_of_type (GString *gstr, MuMsg *msg,
+			      MuMsgContactType ctype)
+{
+	ContactData cdata;
+
+	cdata.from	 = cdata.to = cdata.cc = cdata.bcc
+		         = cdata.reply_to = FALSE;
+	cdata.gstr	 = gstr;
+	cdata.prev_ctype = (unsigned)-1;
+
+	mu_msg_contact_foreach_type (msg, ctype,
+				     (MuMsgContactForeachFunc)each_contact,
+				     &cdata);
+
+	if (cdata.prev_ctype != (unsigned)-1)
+		gstr = g_string_append (gstr, ")\n");
+}
+
+/* like append_sexp_contacts_of_type, but for the address list as
+ * stored in the database */
+static void
+append_sexp_contacts_str (GString *gstr, const char *addrs,
+			  MuMsgContactType ctype)
+{
+	ContactData cdata;
+
+	if (!addrs)
+		return;
+
+	cdata.from	 = cdata.to = cdata.cc = cdata.bcc
+		         = cdata.reply_to = FALSE;
+	cdata.gstr	 = gstr;
+	cdata.prev_ctype = (unsigned)-1;
+
+	mu_msg_contact_foreach_str (addrs, ctype,
+				    (MuMsgContactForeachFunc)each_contact,
+				    &cdata);
+
+	if (cdata.prev_ctype != (unsigned)-1)
+		gstr = g_string_append (gstr, ")\n");
+}
+
 struct _FlagData {
-	char *flagstr;
+	GString *gstr;
 	MuFlags msgflags;
+	gboolean any;
 };
 typedef struct _FlagData FlagData;
 
@@ -171,30 +246,27 @@ each_flag (MuFlags flag, FlagData *fdata)
 	if (!(flag & fdata->msgflags))
 		return;
 
-	if (!fdata->flagstr)
-		fdata->flagstr = g_strdup (mu_flag_name(flag));
-	else {
-		gchar *tmp;
-		tmp = g_strconcat (fdata->flagstr, " ",
-				   mu_flag_name(flag), NULL);
-		g_free (fdata->flagstr);
-		fdata->flagstr = tmp;
-	}
+	if (!fdata->any)
+		g_string_append (fdata->gstr, SEXP_KEYWORD("flags") "(");
+	else
+		g_string_append_c (fdata->gstr, ' ');
+
+	g_string_append (fdata->gstr, mu_flag_name(flag));
+	fdata->any = TRUE;
 }
 
 static void
-append_sexp_flags (GString *gstr, MuMsg *msg)
+append_sexp_flags (GString *gstr, MuFlags flags)
 {
 	FlagData fdata;
 
-	fdata.msgflags = mu_msg_get_flags (msg);
-	fdata.flagstr  = NULL;
+	fdata.gstr     = gstr;
+	fdata.msgflags = flags;
+	fdata.any      = FALSE;
 
 	mu_flags_foreach ((MuFlagsForeachFunc)each_flag, &fdata);
-	if (fdata.flagstr)
-		g_string_append_printf (gstr, "\t:flags (%s)\n",
-					fdata.flagstr);
-	g_free (fdata.flagstr);
+	if (fdata.any)
+		g_string_append (gstr, ")\n");
 }
 
 static char*
@@ -352,21 +424,66 @@ append_sexp_parts (GString *gstr, MuMsg *msg, MuMsgOptions opts)
 	}
 }
 
+static void
+append_thread_info_plist (GString *gstr, const MuMsgIterThreadInfo *ti)
+{
+	const MuMsgIterThreadAggr *aggr;
+
+	aggr = &ti->aggr;
+
+	/* the thread path needs no escaping */
+	g_string_append (gstr, "(:path \"");
+	g_string_append (gstr, ti->threadpath);
+	g_string_append (gstr, "\":level ");
+	append_uint (gstr, ti->level);
+
+	if (ti->prop & MU_MSG_ITER_THREAD_PROP_FIRST_CHILD)
+		g_string_append (gstr, " :first-child t");
+	if (ti->prop & MU_MSG_ITER_THREAD_PROP_EMPTY_PARENT)
+		g_string_append (gstr, " :empty-parent t");
+	if (ti->prop & MU_MSG_ITER_THREAD_PROP_DUP)
+		g_string_append (gstr, " :duplicate t");
+	if (ti->prop & MU_MSG_ITER_THREAD_PROP_HAS_CHILD)
+		g_string_append (gstr, " :has-child t");
+
+	g_string_append (gstr, "\n\t\t:msgnum ");
+	append_uint (gstr, aggr->msgnum);
+	g_string_append (gstr, " :unread ");
+	append_uint (gstr, aggr->unread);
+	g_string_append (gstr, " :flagged ");
+	append_uint (gstr, aggr->flagged);
+	g_string_append (gstr, " :participants ");
+	append_uint (gstr, aggr->participants);
+
+	g_string_append (gstr, "\n\t\t:oldest ");
+	append_time (gstr, aggr->oldest);
+	g_string_append (gstr, " :newest ");
+	append_time (gstr, aggr->newest);
+	g_string_append (gstr, " :size ");
+	append_uint (gstr, aggr->size);
+	g_string_append_c (gstr, ')');
+}
+
 static void
 append_sexp_thread_info (GString *gstr, const MuMsgIterThreadInfo *ti)
 {
-	g_string_append_printf
-		(gstr, "\t:thread (:path \"%s\":level %u%s%s%s%s)\n",
-		 ti->threadpath,
-		 ti->level,
-		 ti->prop & MU_MSG_ITER_THREAD_PROP_FIRST_CHILD  ?
-		 " :first-child t" : "",
-		 ti->prop & MU_MSG_ITER_THREAD_PROP_EMPTY_PARENT ?
-		 " :empty-parent t" : "",
-		 ti->prop & MU_MSG_ITER_THREAD_PROP_DUP          ?
-		 " :duplicate t" : "",
-		 ti->prop & MU_MSG_ITER_THREAD_PROP_HAS_CHILD    ?
-		 " :has-child t" : "");
+	g_string_append (gstr, "\t:thread ");
+	append_thread_info_plist (gstr, ti);
+	g_string_append (gstr, "\n");
+}
+
+
+char*
+mu_msg_thread_info_to_sexp (const MuMsgIterThreadInfo *ti)
+{
+	GString *gstr;
+
+	g_return_val_if_fail (ti, NULL);
+
+	gstr = g_string_sized_new (256);
+	append_thread_info_plist (gstr, ti);
+
+	return g_string_free (gstr, FALSE);
 }
 
 
@@ -386,36 +503,52 @@ append_message_file_parts (GString *gstr, MuMsg *msg, MuMsgOptions opts)
 	append_sexp_parts (gstr, msg, opts);
 	append_sexp_contacts (gstr, msg);
 
-	append_sexp_attr_list (gstr, "references",
+	append_sexp_attr_list (gstr, SEXP_KEYWORD("references"),
 			       mu_msg_get_references (msg));
-	append_sexp_attr (gstr, "in-reply-to",
+	append_sexp_attr (gstr, SEXP_KEYWORD("in-reply-to"),
 			  mu_msg_get_header (msg, "In-Reply-To"));
-	append_sexp_attr (gstr, "body-txt",
+	append_sexp_attr (gstr, SEXP_KEYWORD("body-txt"),
 			  mu_msg_get_body_text(msg, opts));
-	append_sexp_attr (gstr, "body-html",
+	append_sexp_attr (gstr, SEXP_KEYWORD("body-html"),
 			  mu_msg_get_body_html(msg, opts));
 }
 
 static void
-append_sexp_date_and_size (GString *gstr, MuMsg *msg)
+append_sexp_date (GString *gstr, time_t t)
 {
-	time_t t;
-	size_t s;
-
-	t = mu_msg_get_date (msg);
 	if (t == (time_t)-1)  /* invalid date? */
 		t = 0;
 
-	s = mu_msg_get_size (msg);
+	g_string_append (gstr, SEXP_KEYWORD("date"));
+	append_time (gstr, t);
+	g_string_append_c (gstr, '\n');
+}
+
+static void
+append_sexp_size (GString *gstr, size_t s)
+{
 	if (s == (size_t)-1)   /* invalid size? */
 		s = 0;
 
-	g_string_append_printf
-		(gstr,
-		 "\t:date (%u %u 0)\n\t:size %u\n",
-		 (unsigned)(t >> 16),
-		 (unsigned)(t & 0xffff),
-		 (unsigned)s);
+	g_string_append (gstr, SEXP_KEYWORD("size"));
+	append_uint (gstr, (unsigned)s);
+	g_string_append_c (gstr, '\n');
+}
+
+static void
+append_sexp_date_and_size (GString *gstr, MuMsg *msg)
+{
+	append_sexp_date (gstr, mu_msg_get_date (msg));
+	append_sexp_size (gstr, mu_msg_get_size (msg));
+}
+
+
+static void
+append_sexp_prio (GString *gstr, MuMsgPrio prio)
+{
+	g_string_append (gstr, SEXP_KEYWORD("priority"));
+	g_string_append (gstr, mu_msg_prio_name (prio));
+	g_string_append_c (gstr, '\n');
 }
 
 
@@ -423,49 +556,51 @@ static void
 append_sexp_tags (GString *gstr, MuMsg *msg)
 {
 	const GSList *tags, *t;
-	gchar *tagesc;
-	GString *tagstr = g_string_new("");
 
 	tags = mu_msg_get_tags (msg);
+	if (!tags)
+		return;
 
-	for(t = tags; t; t = t->next) {
+	g_string_append (gstr, SEXP_KEYWORD("tags") "(");
+	for (t = tags; t; t = t->next) {
 		if (t != tags)
-			g_string_append(tagstr, " ");
+			g_string_append_c (gstr, ' ');
+		mu_str_append_c_literal (gstr, (const gchar*)t->data, TRUE);
+	}
+	g_string_append (gstr, ")\n");
+}
 
-		tagesc = mu_str_escape_c_literal((const gchar *)t->data, TRUE);
-		g_string_append(tagstr, tagesc);
 
-		g_free(tagesc);
+static void
+append_sexp_start (GString *gstr, unsigned docid,
+		   const MuMsgIterThreadInfo *ti)
+{
+	g_string_append (gstr, "(\n");
+
+	if (docid != 0) {
+		g_string_append (gstr, SEXP_KEYWORD("docid"));
+		append_uint (gstr, docid);
+		g_string_append_c (gstr, '\n');
 	}
 
-	if (tagstr->len > 0)
-		g_string_append_printf (gstr, "\t:tags (%s)\n",
-					tagstr->str);
-	g_string_free (tagstr, TRUE);
+	if (ti)
+		append_sexp_thread_info (gstr, ti);
 }
 
 
-char*
-mu_msg_to_sexp (MuMsg *msg, unsigned docid, const MuMsgIterThreadInfo *ti,
-		MuMsgOptions opts)
+gboolean
+mu_msg_append_sexp (MuMsg *msg, GString *gstr, unsigned docid,
+		    const MuMsgIterThreadInfo *ti, MuMsgOptions opts)
 {
-	GString *gstr;
-
-	g_return_val_if_fail (msg, NULL);
+	g_return_val_if_fail (msg, FALSE);
+	g_return_val_if_fail (gstr, FALSE);
 	g_return_val_if_fail (!((opts & MU_MSG_OPTION_HEADERS_ONLY) &&
-				(opts & MU_MSG_OPTION_EXTRACT_IMAGES)),NULL);
-	gstr = g_string_sized_new
-		((opts & MU_MSG_OPTION_HEADERS_ONLY) ?  1024 : 8192);
+				(opts & MU_MSG_OPTION_EXTRACT_IMAGES)), FALSE);
 
-	if (docid == 0)
-		g_string_append (gstr, "(\n");
-	else
-		g_string_append_printf (gstr, "(\n\t:docid %u\n", docid);
+	append_sexp_start (gstr, docid, ti);
 
-	if (ti)
-		append_sexp_thread_info (gstr, ti);
-
-	append_sexp_attr (gstr, "subject", mu_msg_get_subject (msg));
+	append_sexp_attr (gstr, SEXP_KEYWORD("subject"),
+			  mu_msg_get_subject (msg));
 
 	/* in the no-headers-only case (see below) we get a more
 	 * complete list of contacts, so no need to get them here if
@@ -475,12 +610,13 @@ mu_msg_to_sexp (MuMsg *msg, unsigned docid, const MuMsgIterThreadInfo *ti,
 
 	append_sexp_date_and_size (gstr, msg);
 
-	append_sexp_attr (gstr, "message-id", mu_msg_get_msgid (msg));
-	append_sexp_attr (gstr, "path",	 mu_msg_get_path (msg));
-	append_sexp_attr (gstr, "maildir", mu_msg_get_maildir (msg));
-	g_string_append_printf (gstr, "\t:priority %s\n",
-				mu_msg_prio_name(mu_msg_get_prio(msg)));
-	append_sexp_flags (gstr, msg);
+	append_sexp_attr (gstr, SEXP_KEYWORD("message-id"),
+			  mu_msg_get_msgid (msg));
+	append_sexp_attr (gstr, SEXP_KEYWORD("path"), mu_msg_get_path (msg));
+	append_sexp_attr (gstr, SEXP_KEYWORD("maildir"),
+			  mu_msg_get_maildir (msg));
+	append_sexp_prio  (gstr, mu_msg_get_prio (msg));
+	append_sexp_flags (gstr, mu_msg_get_flags (msg));
 	append_sexp_tags  (gstr, msg);
 
 	/* headers are retrieved from the database, views from the
@@ -490,5 +626,212 @@ mu_msg_to_sexp (MuMsg *msg, unsigned docid, const MuMsgIterThreadInfo *ti,
 		append_message_file_parts (gstr, msg, opts);
 
 	g_string_append (gstr, ")\n");
+	return TRUE;
+}
+
+
+char*
+mu_msg_to_sexp (MuMsg *msg, unsigned docid, const MuMsgIterThreadInfo *ti,
+		MuMsgOptions opts)
+{
+	GString *gstr;
+
+	g_return_val_if_fail (msg, NULL);
+	g_return_val_if_fail (!((opts & MU_MSG_OPTION_HEADERS_ONLY) &&
+				(opts & MU_MSG_OPTION_EXTRACT_IMAGES)),NULL);
+	gstr = g_string_sized_new
+		((opts & MU_MSG_OPTION_HEADERS_ONLY) ?  1024 : 8192);
+
+	mu_msg_append_sexp (msg, gstr, docid, ti, opts);
+
+	return g_string_free (gstr, FALSE);
+}
+
+
+gboolean
+mu_msg_append_sexp_fields (MuMsg *msg, GString *gstr, unsigned docid,
+			   const MuMsgIterThreadInfo *ti,
+			   const MuMsgFieldId *mfids, unsigned num)
+{
+	unsigned u;
+
+	g_return_val_if_fail (msg, FALSE);
+	g_return_val_if_fail (gstr, FALSE);
+	g_return_val_if_fail (mfids || num == 0, FALSE);
+
+	append_sexp_start (gstr, docid, ti);
+
+	/* we only get the fields we need; for messages from the
+	 * database, the others are never read */
+	for (u = 0; u != num; ++u)
+		switch (mfids[u]) {
+		case MU_MSG_FIELD_ID_SUBJECT:
+			append_sexp_attr (gstr, SEXP_KEYWORD("subject"),
+					  mu_msg_get_subject (msg));
+			break;
+		case MU_MSG_FIELD_ID_FROM:
+			append_sexp_contacts_of_type
+				(gstr, msg, MU_MSG_CONTACT_TYPE_FROM);
+			break;
+		case MU_MSG_FIELD_ID_TO:
+			append_sexp_contacts_of_type
+				(gstr, msg, MU_MSG_CONTACT_TYPE_TO);
+			break;
+		case MU_MSG_FIELD_ID_CC:
+			append_sexp_contacts_of_type
+				(gstr, msg, MU_MSG_CONTACT_TYPE_CC);
+			break;
+		case MU_MSG_FIELD_ID_BCC:
+			append_sexp_contacts_of_type
+				(gstr, msg, MU_MSG_CONTACT_TYPE_BCC);
+			break;
+		case MU_MSG_FIELD_ID_DATE:
+			append_sexp_date (gstr, mu_msg_get_date (msg));
+			break;
+		case MU_MSG_FIELD_ID_SIZE:
+			append_sexp_size (gstr, mu_msg_get_size (msg));
+			break;
+		case MU_MSG_FIELD_ID_MSGID:
+			append_sexp_attr (gstr, SEXP_KEYWORD("message-id"),
+					  mu_msg_get_msgid (msg));
+			break;
+		case MU_MSG_FIELD_ID_PATH:
+			append_sexp_attr (gstr, SEXP_KEYWORD("path"),
+					  mu_msg_get_path (msg));
+			break;
+		case MU_MSG_FIELD_ID_MAILDIR:
+			append_sexp_attr (gstr, SEXP_KEYWORD("maildir"),
+					  mu_msg_get_maildir (msg));
+			break;
+		case MU_MSG_FIELD_ID_PRIO:
+			append_sexp_prio (gstr, mu_msg_get_prio (msg));
+			break;
+		case MU_MSG_FIELD_ID_FLAGS:
+			append_sexp_flags (gstr, mu_msg_get_flags (msg));
+			break;
+		case MU_MSG_FIELD_ID_TAGS:
+			append_sexp_tags (gstr, msg);
+			break;
+		default:
+			break; /* not supported */
+		}
+
+	g_string_append (gstr, ")\n");
+	return TRUE;
+}
+
+
+static void
+append_sexp_iter_str (GString *gstr, const char *kw, MuMsgIter *iter,
+		      MuMsgFieldId mfid)
+{
+	append_sexp_attr (gstr, kw, mu_msg_iter_get_field_str (iter, mfid));
+}
+
+static void
+append_sexp_iter_contacts (GString *gstr, MuMsgIter *iter, MuMsgFieldId mfid,
+			   MuMsgContactType ctype)
+{
+	append_sexp_contacts_str (gstr, mu_msg_iter_get_field_str (iter, mfid),
+				  ctype);
+}
+
+
+gboolean
+mu_msg_iter_append_sexp_fields (MuMsgIter *iter, GString *gstr,
+				unsigned docid, const MuMsgIterThreadInfo *ti,
+				const MuMsgFieldId *mfids, unsigned num)
+{
+	unsigned u;
+
+	g_return_val_if_fail (iter, FALSE);
+	g_return_val_if_fail (gstr, FALSE);
+	g_return_val_if_fail (mfids || num == 0, FALSE);
+
+	append_sexp_start (gstr, docid, ti);
+
+	/* the same as mu_msg_append_sexp_fields, but with the values
+	 * straight from the iterator; only tags are not stored as a
+	 * value, so for those we still need the message */
+	for (u = 0; u != num; ++u)
+		switch (mfids[u]) {
+		case MU_MSG_FIELD_ID_SUBJECT:
+			append_sexp_iter_str (gstr, SEXP_KEYWORD("subject"),
+					      iter, mfids[u]);
+			break;
+		case MU_MSG_FIELD_ID_FROM:
+			append_sexp_iter_contacts
+				(gstr, iter, mfids[u], MU_MSG_CONTACT_TYPE_FROM);
+			break;
+		case MU_MSG_FIELD_ID_TO:
+			append_sexp_iter_contacts
+				(gstr, iter, mfids[u], MU_MSG_CONTACT_TYPE_TO);
+			break;
+		case MU_MSG_FIELD_ID_CC:
+			append_sexp_iter_contacts
+				(gstr, iter, mfids[u], MU_MSG_CONTACT_TYPE_CC);
+			break;
+		case MU_MSG_FIELD_ID_BCC:
+			append_sexp_iter_contacts
+				(gstr, iter, mfids[u], MU_MSG_CONTACT_TYPE_BCC);
+			break;
+		case MU_MSG_FIELD_ID_DATE:
+			append_sexp_date
+				(gstr, (time_t)mu_msg_iter_get_field_numeric
+				 (iter, mfids[u]));
+			break;
+		case MU_MSG_FIELD_ID_SIZE:
+			append_sexp_size
+				(gstr, (size_t)mu_msg_iter_get_field_numeric
+				 (iter, mfids[u]));
+			break;
+		case MU_MSG_FIELD_ID_MSGID:
+			append_sexp_iter_str (gstr, SEXP_KEYWORD("message-id"),
+					      iter, mfids[u]);
+			break;
+		case MU_MSG_FIELD_ID_PATH:
+			append_sexp_iter_str (gstr, SEXP_KEYWORD("path"),
+					      iter, mfids[u]);
+			break;
+		case MU_MSG_FIELD_ID_MAILDIR:
+			append_sexp_iter_str (gstr, SEXP_KEYWORD("maildir"),
+					      iter, mfids[u]);
+			break;
+		case MU_MSG_FIELD_ID_PRIO:
+			append_sexp_prio
+				(gstr, (MuMsgPrio)mu_msg_iter_get_field_numeric
+				 (iter, mfids[u]));
+			break;
+		case MU_MSG_FIELD_ID_FLAGS:
+			append_sexp_flags
+				(gstr, (MuFlags)mu_msg_iter_get_field_numeric
+				 (iter, mfids[u]));
+			break;
+		case MU_MSG_FIELD_ID_TAGS:
+			append_sexp_tags
+				(gstr, mu_msg_iter_get_msg_floating (iter));
+			break;
+		default:
+			break; /* not supported */
+		}
+
+	g_string_append (gstr, ")\n");
+	return TRUE;
+}
+
+
+char*
+mu_msg_to_sexp_fields (MuMsg *msg, unsigned docid,
+		       const MuMsgIterThreadInfo *ti,
+		       const MuMsgFieldId *mfids, unsigned num)
+{
+	GString *gstr;
+
+	g_return_val_if_fail (msg, NULL);
+	g_return_val_if_fail (mfids || num == 0, NULL);
+
+	gstr = g_string_sized_new (256);
+	mu_msg_append_sexp_fields (msg, gstr, docid, ti, mfids, num);
+
 	return g_string_free (gstr, FALSE);
 }
@@ -137,6 +137,9 @@ mu_msg_destroy (MuMsg *self)
 	mu_msg_doc_destroy  (self->_doc);
 
 	{ /* cleanup the strings / lists we stored */
+		int i;
+		for (i = 0; i != MU_MSG_SORT_KEY_NUM; ++i)
+			g_free (self->_sort_keys[i]);
 	 	mu_str_free_list (self->_free_later_str);
 		g_slist_foreach (self->_free_later_lst,
 				 (GFunc)mu_str_free_list, NULL);
@@ -639,6 +642,117 @@ address_list_foreach (InternetAddressList *addrlist, MuMsgContactType ctype,
 }
 
 
+/* the longest name and address we parse ourselves */
+#define PLAIN_CONTACT_MAX 256
+
+/* parse the next address in a 'plain' list of addresses at *cur into
+ * name and addr, ie. one that's like "Foo Bar <foo@bar.cuux>", "\"Bar,
+ * Cuux\" <cuux@bar.cuux>" or "foo@bar.cuux" (which is what the store
+ * has for most messages); returns FALSE if it's not plain, e.g. with
+ * comments, groups or encoded words. */
+static gboolean
+next_plain_address (const char **cur, char *name, char *addr)
+{
+	const char *c;
+	size_t n, a;
+
+	c = *cur;
+	n = a = 0;
+	while (g_ascii_isspace (*c))
+		++c;
+
+	if (*c == '"') {
+		for (++c; *c != '"'; ++c) {
+			if (*c == '\\' && c[1])
+				++c;
+			if (!*c || (*c == '=' && c[1] == '?') ||
+			    n == PLAIN_CONTACT_MAX - 1)
+				return FALSE;
+			name[n++] = *c;
+		}
+		++c;
+		while (g_ascii_isspace (*c))
+			++c;
+		if (*c != '<')
+			return FALSE;
+	} else
+		for (; *c && *c != '<' && *c != ','; ++c) {
+			if (strchr ("\"():;[]\\", *c) ||
+			    (*c == '=' && c[1] == '?') ||
+			    n == PLAIN_CONTACT_MAX - 1)
+				return FALSE;
+			name[n++] = *c;
+		}
+
+	while (n > 0 && g_ascii_isspace (name[n - 1]))
+		--n;
+
+	if (*c == '<') {
+		for (++c; *c != '>'; ++c) {
+			if (!*c || g_ascii_isspace (*c) || strchr ("<,\"", *c) ||
+			    a == PLAIN_CONTACT_MAX - 1)
+				return FALSE;
+			addr[a++] = *c;
+		}
+		++c;
+	} else { /* no name, just the address */
+		if (!memchr (name, '@', n))
+			return FALSE;
+		for (; a != n; ++a) {
+			if (g_ascii_isspace (name[a]))
+				return FALSE;
+			addr[a] = name[a];
+		}
+		n = 0;
+	}
+
+	while (g_ascii_isspace (*c))
+		++c;
+	if (*c == ',')
+		++c;
+	else if (*c)
+		return FALSE;
+
+	if (a == 0)
+		return FALSE;
+
+	name[n] = addr[a] = '\0';
+	*cur	= c;
+
+	return TRUE;
+}
+
+
+/* call func for each of a plain list of addresses (see
+ * next_plain_address), using the stack for the names and addresses;
+ * returns FALSE (without calling func) if it's not a plain list */
+static gboolean
+plain_addresses_foreach (const char *addrs, MuMsgContactType ctype,
+			 MuMsgContactForeachFunc func, gpointer user_data)
+{
+	char name[PLAIN_CONTACT_MAX], addr[PLAIN_CONTACT_MAX];
+	const char *cur;
+	MuMsgContact contact;
+
+	/* check all of them first, so we don't call func twice for
+	 * some when falling back to GMime */
+	for (cur = addrs; *cur;)
+		if (!next_plain_address (&cur, name, addr))
+			return FALSE;
+
+	contact.type = ctype;
+	for (cur = addrs; *cur;) {
+		next_plain_address (&cur, name, addr);
+		contact.name	= *name ? name : NULL;
+		contact.address = addr;
+		if (!func (&contact, user_data))
+			break;
+	}
+
+	return TRUE;
+}
+
+
 static void
 addresses_foreach (const char* addrs, MuMsgContactType ctype,
 		   MuMsgContactForeachFunc func, gpointer user_data)
@@ -648,6 +762,10 @@ addresses_foreach (const char* addrs, MuMsgContactType ctype,
 	if (!addrs)
 		return;
 
+	/* most of them are plain; no need for GMime then */
+	if (plain_addresses_foreach (addrs, ctype, func, user_data))
+		return;
+
 	addrlist = internet_address_list_parse_string (addrs);
 	if (addrlist) {
 		address_list_foreach (addrlist, ctype, func, user_data);
@@ -719,45 +837,111 @@ mu_msg_contact_foreach (MuMsg *msg, MuMsgContactForeachFunc func,
 }
 
 
+struct _ContactFilter {
+	MuMsgContactType	 ctype;
+	MuMsgContactForeachFunc	 func;
+	gpointer		 user_data;
+};
+typedef struct _ContactFilter ContactFilter;
 
-static int
-cmp_str (const char *s1, const char *s2)
+static gboolean
+each_contact_of_type (MuMsgContact *contact, ContactFilter *filter)
 {
-	if (s1 == s2)
-		return 0;
-	else if (!s1)
-		return -1;
-	else if (!s2)
-		return 1;
+	if (mu_msg_contact_type (contact) != filter->ctype)
+		return TRUE;
+
+	return filter->func (contact, filter->user_data);
+}
+
 
-	/* optimization 1: ascii */
-	if (isascii(s1[0]) && isascii(s2[0])) {
-		int diff;
-		diff = tolower(s1[0]) - tolower(s2[0]);
-		if (diff != 0)
-			return diff;
+void
+mu_msg_contact_foreach_type (MuMsg *msg, MuMsgContactType ctype,
+			     MuMsgContactForeachFunc func, gpointer user_data)
+{
+	ContactFilter filter;
+
+	g_return_if_fail (msg);
+	g_return_if_fail (func);
+
+	/* for messages from the database, we only need to get the one
+	 * field */
+	if (!msg->_file && msg->_doc) {
+		const char *addrs;
+		switch (ctype) {
+		case MU_MSG_CONTACT_TYPE_FROM: addrs = mu_msg_get_from (msg); break;
+		case MU_MSG_CONTACT_TYPE_TO:   addrs = mu_msg_get_to (msg); break;
+		case MU_MSG_CONTACT_TYPE_CC:   addrs = mu_msg_get_cc (msg); break;
+		case MU_MSG_CONTACT_TYPE_BCC:  addrs = mu_msg_get_bcc (msg); break;
+		default:		       addrs = NULL;
+		}
+		addresses_foreach (addrs, ctype, func, user_data);
+		return;
 	}
 
-	/* utf 8 */
-	{
-		char *u1, *u2;
-		int diff;
+	filter.ctype	 = ctype;
+	filter.func	 = func;
+	filter.user_data = user_data;
 
-		u1 = g_utf8_strdown (s1, -1);
-		u2 = g_utf8_strdown (s2, -1);
+	mu_msg_contact_foreach
+		(msg, (MuMsgContactForeachFunc)each_contact_of_type, &filter);
+}
 
-		diff = g_utf8_collate (u1, u2);
 
-		g_free (u1);
-		g_free (u2);
+void
+mu_msg_contact_foreach_str (const char *addrs, MuMsgContactType ctype,
+			    MuMsgContactForeachFunc func, gpointer user_data)
+{
+	g_return_if_fail (func);
 
-		return diff;
-	}
+	addresses_foreach (addrs, ctype, func, user_data);
+}
+
+
+
+static char*
+calculate_sort_key (MuMsg *self, MuMsgFieldId mfid)
+{
+	const char *str;
+
+	str = get_str_field (self, mfid);
+	if (!str)
+		str = "";
+	else if (mfid == MU_MSG_FIELD_ID_SUBJECT)
+		str = mu_str_subject_normalize (str);
+	else
+		str = mu_str_display_contact_s (str);
+
+	return mu_str_collate_key (str);
+}
+
+
+const char*
+mu_msg_get_sort_key (MuMsg *self, MuMsgFieldId mfid)
+{
+	char **key;
+
+	g_return_val_if_fail (self, NULL);
+	g_return_val_if_fail (mu_msg_field_has_sort_key (mfid), NULL);
+
+	key = &self->_sort_keys[mu_msg_field_sort_slot (mfid) -
+				MU_MSG_FIELD_ID_NUM];
+	if (*key)
+		return *key;
+
+	if (self->_doc)
+		*key = mu_msg_doc_get_sort_key (self->_doc, mfid);
+
+	/* no key in the database (e.g., an empty field); calculate
+	 * it */
+	if (!*key)
+		*key = calculate_sort_key (self, mfid);
+
+	return *key;
 }
 
 
 static int
-cmp_subject (const char* s1, const char *s2)
+cmp_str (const char *s1, const char *s2)
 {
 	if (s1 == s2)
 		return 0;
@@ -766,9 +950,7 @@ cmp_subject (const char* s1, const char *s2)
 	else if (!s2)
 		return 1;
 
-	return cmp_str (
-		mu_str_subject_normalize (s1),
-		mu_str_subject_normalize (s2));
+	return strcmp (s1, s2);
 }
 
 
@@ -779,6 +961,12 @@ mu_msg_cmp (MuMsg *m1, MuMsg *m2, MuMsgFieldId mfid)
 	g_return_val_if_fail (m2, 0);
 	g_return_val_if_fail (mu_msg_field_id_is_valid(mfid), 0);
 
+	/* subject and contacts have pre-calculated sort keys, which
+	 * we can compare bytewise */
+	if (mu_msg_field_has_sort_key (mfid))
+		return cmp_str (mu_msg_get_sort_key (m1, mfid),
+				mu_msg_get_sort_key (m2, mfid));
+
 	/* even though date is a numeric field, we can sort it by its
 	 * string repr. in the database, which is much faster */
 	if (mfid == MU_MSG_FIELD_ID_DATE ||
@@ -786,10 +974,6 @@ mu_msg_cmp (MuMsg *m1, MuMsg *m2, MuMsgFieldId mfid)
 		return cmp_str (get_str_field (m1, mfid),
 				get_str_field (m2, mfid));
 
-	if (mfid == MU_MSG_FIELD_ID_SUBJECT)
-		return cmp_subject (get_str_field (m1, mfid),
-				    get_str_field (m2, mfid));
-
 	/* TODO: note, we cast (potentially > MAXINT to int) */
 	if (mu_msg_field_is_numeric (mfid))
 		return get_num_field(m1, mfid) - get_num_field(m2, mfid);
@@ -870,31 +1054,46 @@ get_target_mdir (MuMsg *msg, const char *target_maildir, GError **err)
  * ie. msg in 'new/' will go to new/, one in cur/ goes to cur/. be
  * super-paranoid here...
  */
-gboolean
-mu_msg_move_to_maildir (MuMsg *self, const char *maildir,
-			MuFlags flags, gboolean ignore_dups, GError **err)
+char*
+mu_msg_move_file_to_maildir (MuMsg *self, const char *maildir,
+			     MuFlags flags, gboolean ignore_dups, GError **err)
 {
 	char *newfullpath;
 	char *targetmdir;
 
-	g_return_val_if_fail (self, FALSE);
-	g_return_val_if_fail (maildir, FALSE);     /* i.e. "/inbox" */
+	g_return_val_if_fail (self, NULL);
+	g_return_val_if_fail (maildir, NULL);     /* i.e. "/inbox" */
 
 	/* targetmdir is the full path to maildir, i.e.,
 	 * /home/foo/Maildir/inbox */
 	targetmdir = get_target_mdir (self, maildir, err);
 	if (!targetmdir)
-		return FALSE;
+		return NULL;
 
 	newfullpath = mu_maildir_move_message (mu_msg_get_path (self),
 					       targetmdir, flags,
 					       ignore_dups, err);
+	g_free (targetmdir);
+
+	return newfullpath;
+}
+
+
+gboolean
+mu_msg_move_to_maildir (MuMsg *self, const char *maildir,
+			MuFlags flags, gboolean ignore_dups, GError **err)
+{
+	char *newfullpath;
+
+	g_return_val_if_fail (self, FALSE);
+	g_return_val_if_fail (maildir, FALSE);     /* i.e. "/inbox" */
+
+	newfullpath = mu_msg_move_file_to_maildir (self, maildir, flags,
+						   ignore_dups, err);
 	/* update the message path and the flags; they may have
 	 * changed */
-	if (!newfullpath) {
-		g_free (targetmdir);
+	if (!newfullpath)
 		return FALSE;
-	}
 
 	/* clear the old backends */
 	mu_msg_doc_destroy  (self->_doc);
@@ -904,7 +1103,7 @@ mu_msg_move_to_maildir (MuMsg *self, const char *maildir,
 
 	/* and create a new one */
 	self->_file = mu_msg_file_new (newfullpath, maildir, err);
-	g_free (targetmdir);
+	g_free (newfullpath);
 
 	return self->_file ? TRUE : FALSE;
 }
@@ -402,6 +402,21 @@ const GSList* mu_msg_get_references (MuMsg *msg);
 const GSList* mu_msg_get_tags (MuMsg *self);
 
 
+/**
+ * get the sort key for some field in this message, ie. a string that
+ * can be compared with strcmp to sort messages by that field. For
+ * the subject, this is based on the subject without any Re:/Fwd:
+ * prefixes, for contacts it's based on the display name. Messages from
+ * the database use the key stored there; for others, it's calculated.
+ *
+ * @param msg a valid MuMsg
+ * @param mfid a field for which mu_msg_field_has_sort_key is TRUE
+ *
+ * @return the sort key (or NULL in case of error); don't free
+ */
+const char* mu_msg_get_sort_key (MuMsg *msg, MuMsgFieldId mfid);
+
+
 /**
  * compare two messages for sorting
  *
@@ -455,6 +470,76 @@ char* mu_msg_to_sexp (MuMsg *msg, unsigned docid,
 		      MuMsgOptions ops)
 	G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
 
+/**
+ * like mu_msg_to_sexp, but append the sexp to a GString; this way,
+ * the same buffer can be re-used for many messages. The sexp itself
+ * is written straight into the buffer, without intermediate strings;
+ * the message does allocate the values it gets from the database,
+ * and address lists that are not plain are parsed with GMime (see
+ * mu_msg_contact_foreach_str).
+ *
+ * @param msg a valid message
+ * @param gstr the GString to append to
+ * @param docid the docid for this message, or 0
+ * @param ti thread info for the current message, or NULL
+ * @param opts options, as for mu_msg_to_sexp
+ *
+ * @return TRUE if it succeeded, FALSE otherwise
+ */
+gboolean mu_msg_append_sexp (MuMsg *msg, GString *gstr, unsigned docid,
+			     const struct _MuMsgIterThreadInfo *ti,
+			     MuMsgOptions ops);
+
+/**
+ * convert some of the fields of the msg to a Lisp symbolic
+ * expression, in the same way as mu_msg_to_sexp with
+ * MU_MSG_OPTION_HEADERS_ONLY does for all of them. For a message from
+ * the database, only the values for those fields are read.
+ *
+ * @param msg a valid message
+ * @param docid the docid for this message, or 0
+ * @param ti thread info for the current message, or NULL
+ * @param mfids the fields to include, in this order; supported are
+ * subject, from, to, cc, bcc, date, size, msgid, path, maildir,
+ * prio, flags and tags; others are ignored
+ * @param num the number of elements in mfids
+ *
+ * @return a string with the sexp (free with g_free) or NULL in case of error
+ */
+char* mu_msg_to_sexp_fields (MuMsg *msg, unsigned docid,
+			     const struct _MuMsgIterThreadInfo *ti,
+			     const MuMsgFieldId *mfids, unsigned num)
+	G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+
+/**
+ * like mu_msg_to_sexp_fields, but append the sexp to a GString (see
+ * mu_msg_append_sexp)
+ *
+ * @param msg a valid message
+ * @param gstr the GString to append to
+ * @param docid the docid for this message, or 0
+ * @param ti thread info for the current message, or NULL
+ * @param mfids the fields to include (see mu_msg_to_sexp_fields)
+ * @param num the number of elements in mfids
+ *
+ * @return TRUE if it succeeded, FALSE otherwise
+ */
+gboolean mu_msg_append_sexp_fields (MuMsg *msg, GString *gstr,
+				    unsigned docid,
+				    const struct _MuMsgIterThreadInfo *ti,
+				    const MuMsgFieldId *mfids, unsigned num);
+
+/**
+ * convert thread info to a Lisp symbolic expression, ie. the plist
+ * that mu_msg_to_sexp uses for :thread
+ *
+ * @param ti thread info
+ *
+ * @return a string with the sexp (free with g_free) or NULL in case of error
+ */
+char* mu_msg_thread_info_to_sexp (const struct _MuMsgIterThreadInfo *ti)
+	G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+
 /**
  * move a message to another maildir; note that this does _not_ update
  * the database
@@ -476,6 +561,28 @@ gboolean mu_msg_move_to_maildir (MuMsg *msg, const char *maildir,
 				 GError **err);
 
 
+/**
+ * move the file of a message to another maildir, like
+ * mu_msg_move_to_maildir, but without updating the message itself;
+ * this saves parsing the message file again
+ *
+ * @param msg a message with an existing file system path in an actual
+ * maildir
+ * @param maildir the subdir where the message should go, relative to
+ * rootmaildir. e.g. "/archive"
+ * @param flags to set for the target (influences the filename, path)
+ * @param silently ignore the src=target case
+ * @param err (may be NULL) may contain error information
+ *
+ * @return the new path of the message file (free with g_free), or NULL
+ * in case of error
+ */
+char* mu_msg_move_file_to_maildir (MuMsg *msg, const char *maildir,
+				   MuFlags flags, gboolean ignore_dups,
+				   GError **err)
+	G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+
+
 enum _MuMsgContactType {  /* Reply-To:? */
 	MU_MSG_CONTACT_TYPE_TO    = 0,
 	MU_MSG_CONTACT_TYPE_FROM,
@@ -576,6 +683,40 @@ typedef gboolean  (*MuMsgContactForeachFunc) (MuMsgContact* contact,
 void mu_msg_contact_foreach (MuMsg *msg, MuMsgContactForeachFunc func,
 			     gpointer user_data);
 
+/**
+ * call a function for each of the contacts of one type in a message;
+ * for messages from the database, only the field for that type is
+ * read
+ *
+ * @param msg a valid MuMsgGMime* instance
+ * @param ctype the contact type
+ * @param func a callback function to call for each contact; when
+ * the callback does not return TRUE, it won't be called again
+ * @param user_data a user-provide pointer that will be passed to the callback
+ *
+ */
+void mu_msg_contact_foreach_type (MuMsg *msg, MuMsgContactType ctype,
+				  MuMsgContactForeachFunc func,
+				  gpointer user_data);
+
+/**
+ * call a function for each of the contacts in a list of addresses,
+ * such as the value of the from, to, cc and bcc fields in the
+ * database. Plain lists (e.g. "Foo Bar <foo@bar.cuux>, \"Bar, Cuux\"
+ * <cuux@bar.cuux>") are parsed without allocating any memory; others
+ * (with comments, groups, encoded words, or very long names) are
+ * parsed with GMime
+ *
+ * @param addrs the list of addresses, or NULL
+ * @param ctype the contact type for the contacts
+ * @param func a callback function to call for each contact; when
+ * the callback does not return TRUE, it won't be called again
+ * @param user_data a user-provide pointer that will be passed to the callback
+ */
+void mu_msg_contact_foreach_str (const char *addrs, MuMsgContactType ctype,
+				 MuMsgContactForeachFunc func,
+				 gpointer user_data);
+
 G_END_DECLS
 
 #endif /*__MU_MSG_H__*/
@@ -0,0 +1,464 @@
+/* -*-mode: c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-*/
+/*
+** Copyright (C) 2012 Dirk-Jan C. Binnema <djcb@djcbsoftware.nl>
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of the GNU General Public License as published by the
+** Free Software Foundation; either version 3, or (at your option) any
+** later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software Foundation,
+** Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+**
+*/
+#include <string.h>
+
+#include "mu-query-cache.h"
+
+struct _CacheEntry {
+	char	*key;
+	GArray	*items;
+	size_t	 size; /* approximate size in bytes */
+};
+typedef struct _CacheEntry CacheEntry;
+
+struct _MuQueryCache {
+	GHashTable	*hash;  /* key => GList* link in lru */
+	GQueue		*lru;   /* CacheEntry*, most recently used first */
+
+	guint64		 revision;
+	size_t		 size, maxsize;
+	unsigned	 hits, misses;
+};
+
+
+MuQueryCache*
+mu_query_cache_new (size_t maxsize)
+{
+	MuQueryCache *self;
+
+	self = g_slice_new0 (MuQueryCache);
+
+	self->hash    = g_hash_table_new (g_str_hash, g_str_equal);
+	self->lru     = g_queue_new ();
+	self->maxsize = maxsize;
+
+	return self;
+}
+
+
+static void
+cache_entry_destroy (CacheEntry *entry)
+{
+	g_free (entry->key);
+	mu_query_cache_items_free (entry->items);
+	g_slice_free (CacheEntry, entry);
+}
+
+
+void
+mu_query_cache_destroy (MuQueryCache *self)
+{
+	if (!self)
+		return;
+
+	mu_query_cache_clear (self);
+
+	g_hash_table_destroy (self->hash);
+	g_queue_free (self->lru);
+
+	g_slice_free (MuQueryCache, self);
+}
+
+
+GArray*
+mu_query_cache_items_new (guint reserve)
+{
+	return g_array_sized_new (FALSE, FALSE, sizeof(MuQueryCacheItem),
+				  reserve);
+}
+
+
+void
+mu_query_cache_items_append (GArray *items, unsigned docid,
+			     const MuMsgIterThreadInfo *ti)
+{
+	MuQueryCacheItem item;
+
+	g_return_if_fail (items);
+
+	item.docid = docid;
+	if (ti) {
+		item.ti		   = *ti;
+		item.ti.threadpath = g_strdup (ti->threadpath);
+	} else
+		memset (&item.ti, 0, sizeof(item.ti));
+
+	g_array_append_val (items, item);
+}
+
+
+void
+mu_query_cache_items_free (GArray *items)
+{
+	guint u;
+
+	if (!items)
+		return;
+
+	for (u = 0; u != items->len; ++u)
+		g_free (g_array_index (items, MuQueryCacheItem, u).ti.threadpath);
+
+	g_array_free (items, TRUE);
+}
+
+
+static gboolean
+thread_info_equal (const MuMsgIterThreadInfo *ti1,
+		   const MuMsgIterThreadInfo *ti2)
+{
+	return g_strcmp0 (ti1->threadpath, ti2->threadpath) == 0 &&
+		ti1->level == ti2->level && ti1->prop == ti2->prop &&
+		memcmp (&ti1->aggr, &ti2->aggr, sizeof(ti1->aggr)) == 0;
+}
+
+
+/* find the longest increasing subsequence of @seq (of length @len),
+ * and mark its elements in @keep */
+static void
+longest_increasing (const guint32 *seq, guint32 len, gboolean *keep)
+{
+	guint32 *tails, *prev, u, n;
+
+	tails = g_new (guint32, len + 1); /* index of the smallest tail
+					   * of a subsequence of length
+					   * n + 1 */
+	prev  = g_new (guint32, len);
+
+	for (u = n = 0; u != len; ++u) {
+
+		guint32 lo, hi;
+
+		/* binary search for the first tail >= seq[u] */
+		for (lo = 0, hi = n; lo < hi;) {
+			guint32 mid;
+			mid = lo + (hi - lo) / 2;
+			if (seq[tails[mid]] < seq[u])
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		prev[u]	  = lo > 0 ? tails[lo - 1] : G_MAXUINT32;
+		tails[lo] = u;
+		if (lo == n)
+			++n;
+	}
+
+	for (u = n ? tails[n - 1] : G_MAXUINT32; u != G_MAXUINT32;
+	     u = prev[u])
+		keep[u] = TRUE;
+
+	g_free (tails);
+	g_free (prev);
+}
+
+
+/* for the items in both @olditems and @newitems, determine whether
+ * they can stay where they are: we take the longest subsequence of
+ * them that is in the same order in both, and which have the same
+ * thread info */
+static gboolean*
+items_in_place (const GArray *olditems, const GArray *newitems,
+		GHashTable *oldpos)
+{
+	guint32 *seq, *seqidx, seqlen, u;
+	gboolean *keep, *inplace;
+
+	seq	= g_new (guint32, newitems->len); /* old positions */
+	seqidx	= g_new (guint32, newitems->len); /* new positions */
+	keep	= g_new0 (gboolean, newitems->len);
+	inplace = g_new0 (gboolean, newitems->len);
+
+	for (u = seqlen = 0; u != newitems->len; ++u) {
+		guint32 pos;
+		pos = GPOINTER_TO_UINT
+			(g_hash_table_lookup
+			 (oldpos, GUINT_TO_POINTER
+			  (g_array_index (newitems, MuQueryCacheItem,
+					  u).docid)));
+		if (pos == 0)
+			continue;
+		seq[seqlen]    = pos - 1;
+		seqidx[seqlen] = u;
+		++seqlen;
+	}
+
+	longest_increasing (seq, seqlen, keep);
+
+	for (u = 0; u != seqlen; ++u)
+		inplace[seqidx[u]] = keep[u] && thread_info_equal
+			(&g_array_index (olditems, MuQueryCacheItem,
+					 seq[u]).ti,
+			 &g_array_index (newitems, MuQueryCacheItem,
+					 seqidx[u]).ti);
+	g_free (seq);
+	g_free (seqidx);
+	g_free (keep);
+
+	return inplace;
+}
+
+
+static GHashTable*
+docid_table (const GArray *items, gboolean is_cache_items)
+{
+	GHashTable *hash;
+	guint32 u;
+
+	/* docid => position + 1 */
+	hash = g_hash_table_new (g_direct_hash, g_direct_equal);
+	for (u = 0; u != items->len; ++u)
+		g_hash_table_insert
+			(hash, GUINT_TO_POINTER
+			 (is_cache_items ?
+			  g_array_index (items, MuQueryCacheItem, u).docid :
+			  g_array_index (items, unsigned, u)),
+			 GUINT_TO_POINTER(u + 1));
+
+	return hash;
+}
+
+
+unsigned
+mu_query_cache_items_diff (const GArray *olditems, const GArray *newitems,
+			   const GArray *changed, MuQueryCacheDiffFunc func,
+			   gpointer user_data)
+{
+	GHashTable *oldpos, *newpos, *changes;
+	gboolean *inplace;
+	guint32 u;
+	unsigned diffs;
+
+	g_return_val_if_fail (olditems, 0);
+	g_return_val_if_fail (newitems, 0);
+	g_return_val_if_fail (changed, 0);
+	g_return_val_if_fail (func, 0);
+
+	oldpos	= docid_table (olditems, TRUE);
+	newpos	= docid_table (newitems, TRUE);
+	changes = docid_table (changed, FALSE);
+
+	diffs = 0;
+	for (u = 0; u != olditems->len; ++u) {
+		const MuQueryCacheItem *item;
+		item = &g_array_index (olditems, MuQueryCacheItem, u);
+		if (!g_hash_table_lookup (newpos,
+					  GUINT_TO_POINTER(item->docid))) {
+			func (MU_QUERY_CACHE_DIFF_REMOVE, item, 0, user_data);
+			++diffs;
+		}
+	}
+
+	inplace = items_in_place (olditems, newitems, oldpos);
+	for (u = 0; u != newitems->len; ++u) {
+
+		const MuQueryCacheItem *item;
+		MuQueryCacheDiffOp op;
+		unsigned after;
+
+		item  = &g_array_index (newitems, MuQueryCacheItem, u);
+		after = u == 0 ? 0 :
+			g_array_index (newitems, MuQueryCacheItem, u - 1).docid;
+
+		if (!g_hash_table_lookup (oldpos,
+					  GUINT_TO_POINTER(item->docid)))
+			op = MU_QUERY_CACHE_DIFF_INSERT;
+		else if (g_hash_table_lookup (changes,
+					      GUINT_TO_POINTER(item->docid)))
+			op = inplace[u] ? MU_QUERY_CACHE_DIFF_UPDATE :
+				MU_QUERY_CACHE_DIFF_INSERT;
+		else if (!inplace[u])
+			op = MU_QUERY_CACHE_DIFF_MOVE;
+		else
+			continue; /* nothing changed */
+
+		func (op, item, after, user_data);
+		++diffs;
+	}
+
+	g_free (inplace);
+	g_hash_table_destroy (oldpos);
+	g_hash_table_destroy (newpos);
+	g_hash_table_destroy (changes);
+
+	return diffs;
+}
+
+
+static size_t
+items_size (GArray *items)
+{
+	guint u;
+	size_t size;
+
+	size = items->len * sizeof(MuQueryCacheItem);
+	for (u = 0; u != items->len; ++u) {
+		const char *path;
+		path = g_array_index (items, MuQueryCacheItem, u).ti.threadpath;
+		if (path)
+			size += strlen (path) + 1;
+	}
+
+	return size;
+}
+
+
+void
+mu_query_cache_clear (MuQueryCache *self)
+{
+	CacheEntry *entry;
+
+	g_return_if_fail (self);
+
+	g_hash_table_remove_all (self->hash);
+	while ((entry = (CacheEntry*)g_queue_pop_head (self->lru)))
+		cache_entry_destroy (entry);
+
+	self->size = 0;
+}
+
+
+/* if the database changed since the entries were cached, they're all
+ * stale */
+static void
+check_revision (MuQueryCache *self, guint64 revision)
+{
+	if (revision == self->revision)
+		return;
+
+	mu_query_cache_clear (self);
+	self->revision = revision;
+}
+
+
+static char*
+get_key (const char *query, MuMsgFieldId sortfield, gboolean reverse,
+	 MuQueryFlags flags, int maxnum)
+{
+	return g_strdup_printf ("%u:%c%x:%d:%s", (unsigned)sortfield,
+				reverse ? 'r' : '-', (unsigned)flags,
+				maxnum, query);
+}
+
+
+static void
+remove_link (MuQueryCache *self, GList *link)
+{
+	CacheEntry *entry;
+
+	entry = (CacheEntry*)link->data;
+
+	g_hash_table_remove (self->hash, entry->key);
+	g_queue_delete_link (self->lru, link);
+
+	self->size -= entry->size;
+	cache_entry_destroy (entry);
+}
+
+
+const GArray*
+mu_query_cache_lookup (MuQueryCache *self, guint64 revision,
+		       const char *query, MuMsgFieldId sortfield,
+		       gboolean reverse, MuQueryFlags flags, int maxnum)
+{
+	GList *link;
+	char *key;
+
+	g_return_val_if_fail (self, NULL);
+	g_return_val_if_fail (query, NULL);
+
+	check_revision (self, revision);
+
+	key  = get_key (query, sortfield, reverse, flags, maxnum);
+	link = (GList*)g_hash_table_lookup (self->hash, key);
+	g_free (key);
+
+	if (!link) {
+		++self->misses;
+		return NULL;
+	}
+
+	++self->hits;
+
+	/* move to the front */
+	g_queue_unlink (self->lru, link);
+	g_queue_push_head_link (self->lru, link);
+
+	return ((CacheEntry*)link->data)->items;
+}
+
+
+gboolean
+mu_query_cache_insert (MuQueryCache *self, guint64 revision,
+		       const char *query, MuMsgFieldId sortfield,
+		       gboolean reverse, MuQueryFlags flags,
+		       int maxnum, GArray *items)
+{
+	CacheEntry *entry;
+	GList *link;
+
+	g_return_val_if_fail (self, FALSE);
+	g_return_val_if_fail (query, FALSE);
+	g_return_val_if_fail (items, FALSE);
+
+	check_revision (self, revision);
+
+	entry	     = g_slice_new (CacheEntry);
+	entry->key   = get_key (query, sortfield, reverse, flags, maxnum);
+	entry->items = items;
+	entry->size  = sizeof(CacheEntry) + strlen (entry->key) + 1 +
+		items_size (items);
+
+	/* remove the old one for this key, if any */
+	link = (GList*)g_hash_table_lookup (self->hash, entry->key);
+	if (link)
+		remove_link (self, link);
+
+	if (entry->size > self->maxsize) {
+		cache_entry_destroy (entry);
+		return FALSE;
+	}
+
+	/* make room */
+	while (self->size + entry->size > self->maxsize)
+		remove_link (self, g_queue_peek_tail_link (self->lru));
+
+	g_queue_push_head (self->lru, entry);
+	g_hash_table_insert (self->hash, entry->key,
+			     g_queue_peek_head_link (self->lru));
+	self->size += entry->size;
+
+	return TRUE;
+}
+
+
+void
+mu_query_cache_stats (MuQueryCache *self, unsigned *hits, unsigned *misses,
+		      size_t *size)
+{
+	g_return_if_fail (self);
+
+	if (hits)
+		*hits = self->hits;
+	if (misses)
+		*misses = self->misses;
+	if (size)
+		*size = self->size;
+}
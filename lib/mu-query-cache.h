@@ -0,0 +1,215 @@
+/* -*-mode: c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-*/
+/*
+** Copyright (C) 2012 Dirk-Jan C. Binnema <djcb@djcbsoftware.nl>
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of the GNU General Public License as published by the
+** Free Software Foundation; either version 3, or (at your option) any
+** later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software Foundation,
+** Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+**
+*/
+
+#ifndef __MU_QUERY_CACHE_H__
+#define __MU_QUERY_CACHE_H__
+
+#include <glib.h>
+#include <mu-msg-fields.h>
+#include <mu-msg-iter.h>
+#include <mu-query.h>
+
+G_BEGIN_DECLS
+
+/*
+ * MuQueryCache is a size-bounded LRU cache for query results, ie.,
+ * the (ordered) docids and thread information for the matches of some
+ * query with some parameters. All entries are tied to a database
+ * revision (see mu_store_revision); when the revision changes, the
+ * cache is emptied.
+ */
+struct _MuQueryCache;
+typedef struct _MuQueryCache MuQueryCache;
+
+/* one cached match */
+struct _MuQueryCacheItem {
+	unsigned		docid;
+	MuMsgIterThreadInfo	ti; /* ti.threadpath == NULL if there
+				     * is no thread info */
+};
+typedef struct _MuQueryCacheItem MuQueryCacheItem;
+
+
+/**
+ * create a new query-cache
+ *
+ * @param maxsize the (approximate) maximum number of bytes the cached
+ * data may take; when adding an entry would exceed this, the least
+ * recently used ones are removed.
+ *
+ * @return a new MuQueryCache; free with mu_query_cache_destroy
+ */
+MuQueryCache* mu_query_cache_new (size_t maxsize)
+	G_GNUC_WARN_UNUSED_RESULT;
+
+/**
+ * destroy a query-cache
+ *
+ * @param self a MuQueryCache, or NULL
+ */
+void mu_query_cache_destroy (MuQueryCache *self);
+
+
+/**
+ * create a new, empty array of MuQueryCacheItems, to be filled and
+ * passed to mu_query_cache_insert
+ *
+ * @param reserve number of items to reserve space for
+ *
+ * @return a new GArray; free with mu_query_cache_items_free
+ */
+GArray *mu_query_cache_items_new (guint reserve)
+	G_GNUC_WARN_UNUSED_RESULT;
+
+/**
+ * append an item to an items array
+ *
+ * @param items a GArray from mu_query_cache_items_new
+ * @param docid a docid
+ * @param ti thread info for the message, or NULL
+ */
+void mu_query_cache_items_append (GArray *items, unsigned docid,
+				  const MuMsgIterThreadInfo *ti);
+
+/**
+ * free an items array
+ *
+ * @param items a GArray from mu_query_cache_items_new, or NULL
+ */
+void mu_query_cache_items_free (GArray *items);
+
+
+enum _MuQueryCacheDiffOp {
+	/* the item is no longer in the result */
+	MU_QUERY_CACHE_DIFF_REMOVE,
+	/* the item changed, but it's in the same place */
+	MU_QUERY_CACHE_DIFF_UPDATE,
+	/* the item is new, or it changed and moved; it goes after
+	 * some other item */
+	MU_QUERY_CACHE_DIFF_INSERT,
+	/* the item did not change, but it moved, or it has different
+	 * thread info; it goes after some other item */
+	MU_QUERY_CACHE_DIFF_MOVE
+};
+typedef enum _MuQueryCacheDiffOp MuQueryCacheDiffOp;
+
+/**
+ * callback function for mu_query_cache_items_diff
+ *
+ * @param op what happened to the item
+ * @param item the item; for MU_QUERY_CACHE_DIFF_REMOVE, the old one,
+ * otherwise the new one
+ * @param after the docid of the item it goes after (in the new
+ * result), or 0 if it's the first
+ * @param user_data user-provided data
+ */
+typedef void (*MuQueryCacheDiffFunc) (MuQueryCacheDiffOp op,
+				      const MuQueryCacheItem *item,
+				      unsigned after, gpointer user_data);
+
+/**
+ * get the differences between an old and a new result for the same
+ * query, ie. what needs to happen to turn the old one into the new
+ * one. First, the callback is called for the removed items; then, for
+ * the others that changed, in their new order. Items that did not
+ * change and stay in place are skipped; of the items in both results,
+ * we leave the biggest set in place that's still in the same order.
+ *
+ * @param olditems a GArray of MuQueryCacheItem
+ * @param newitems a GArray of MuQueryCacheItem
+ * @param changed a GArray of the docids (unsigned) of messages that
+ * changed (see mu_store_changes_since)
+ * @param func a function to call for each difference
+ * @param user_data user-provided data, passed to func
+ *
+ * @return the number of differences
+ */
+unsigned mu_query_cache_items_diff (const GArray *olditems,
+				    const GArray *newitems,
+				    const GArray *changed,
+				    MuQueryCacheDiffFunc func,
+				    gpointer user_data);
+
+
+/**
+ * look up a cached query result
+ *
+ * @param self a MuQueryCache
+ * @param revision the current revision of the database
+ * @param query the query string
+ * @param sortfield the sort field
+ * @param reverse whether to sort in reverse order
+ * @param flags the MuQueryFlags for the query
+ * @param maxnum the maximum number of results
+ *
+ * @return a GArray of MuQueryCacheItem, or NULL if there was no
+ * entry for this query at this revision. The array is owned by the
+ * cache, and remains valid until the next call to
+ * mu_query_cache_insert or mu_query_cache_clear.
+ */
+const GArray* mu_query_cache_lookup (MuQueryCache *self, guint64 revision,
+				     const char *query, MuMsgFieldId sortfield,
+				     gboolean reverse, MuQueryFlags flags,
+				     int maxnum);
+
+/**
+ * add a query result to the cache, replacing any existing one for the
+ * same query.
+ *
+ * @param self a MuQueryCache
+ * @param revision the database revision the result was obtained at
+ * @param query the query string
+ * @param sortfield the sort field
+ * @param reverse whether to sort in reverse order
+ * @param flags the MuQueryFlags for the query
+ * @param maxnum the maximum number of results
+ * @param items a GArray from mu_query_cache_items_new; the cache takes
+ * ownership of it
+ *
+ * @return TRUE if the result was cached, FALSE if it was too big for
+ * the cache
+ */
+gboolean mu_query_cache_insert (MuQueryCache *self, guint64 revision,
+				const char *query, MuMsgFieldId sortfield,
+				gboolean reverse, MuQueryFlags flags,
+				int maxnum, GArray *items);
+
+/**
+ * remove all entries from the cache
+ *
+ * @param self a MuQueryCache
+ */
+void mu_query_cache_clear (MuQueryCache *self);
+
+/**
+ * get some statistics about the cache
+ *
+ * @param self a MuQueryCache
+ * @param hits receives the number of cache hits, or NULL
+ * @param misses receives the number of cache misses, or NULL
+ * @param size receives the (approximate) size of the cached data in
+ * bytes, or NULL
+ */
+void mu_query_cache_stats (MuQueryCache *self, unsigned *hits,
+			   unsigned *misses, size_t *size);
+
+G_END_DECLS
+
+#endif /*__MU_QUERY_CACHE_H__*/
@@ -19,6 +19,10 @@
 
 #include <stdexcept>
 #include <string>
+#include <map>
+#include <set>
+#include <vector>
+#include <algorithm>
 #include <cctype>
 #include <cstring>
 #include <stdlib.h>
@@ -34,6 +38,8 @@
 #include "mu-util.h"
 #include "mu-str.h"
 #include "mu-date.h"
+#include "mu-flags.h"
+#include "mu-msg-prio.h"
 
 /*
  * custom parser for date ranges
@@ -302,6 +308,19 @@ mu_query_destroy (MuQuery *self)
 }
 
 
+gboolean
+mu_query_reopen (MuQuery *self, GError **err)
+{
+	g_return_val_if_fail (self, FALSE);
+
+	try {
+		self->db().reopen();
+		return TRUE;
+
+	} MU_XAPIAN_CATCH_BLOCK_G_ERROR_RETURN (err, MU_ERROR_XAPIAN, FALSE);
+}
+
+
 /* preprocess a query to make them a bit more promiscuous */
 char*
 mu_query_preprocess (const char *query, GError **err)
@@ -342,7 +361,7 @@ mu_query_preprocess (const char *query, GError **err)
  * exception is raised. We try to reopen the database, and run the
  * query again. */
 static MuMsgIter *
-try_requery (MuQuery *self, const char* searchexpr, gboolean threads,
+try_requery (MuQuery *self, const char* searchexpr, MuQueryFlags flags,
 	     MuMsgFieldId sortfieldid, gboolean revert, int maxnum,
 	     GError **err)
 {
@@ -351,38 +370,124 @@ try_requery (MuQuery *self, const char* searchexpr, gboolean threads,
 		 * impossible */
 		self->db().reopen();
 		MU_WRITE_LOG ("reopening db after modification");
-		return mu_query_run (self, searchexpr, threads, sortfieldid,
+		return mu_query_run (self, searchexpr, flags, sortfieldid,
 				     revert, maxnum, err);
 
 	} MU_XAPIAN_CATCH_BLOCK_G_ERROR_RETURN (err, MU_ERROR_XAPIAN, 0);
 }
 
 
+static const Xapian::Query
+get_query_or_matchall (MuQuery *self, const char *searchexpr, GError **err)
+{
+	/* empty or "" means "matchall" */
+	if (!mu_str_is_empty(searchexpr) &&
+	    g_strcmp0 (searchexpr, "\"\"") != 0) /* NULL or "" or """" */
+		return get_query (self, searchexpr, err);
+	else
+		return Xapian::Query::MatchAll;
+}
+
+
 static Xapian::Enquire
-get_enquire (MuQuery *self, const char *searchexpr, gboolean threads,
-	     MuMsgFieldId sortfieldid, gboolean revert, GError **err)
+get_enquire_for_query (MuQuery *self, const Xapian::Query& query,
+		       MuQueryFlags flags, MuMsgFieldId sortfieldid,
+		       gboolean revert)
 {
 	Xapian::Enquire enq (self->db());
 
+	/* let the matcher drop the duplicates, so they don't count
+	 * for maxnum either */
+	if (flags & MU_QUERY_FLAG_SKIP_DUPS)
+		enq.set_collapse_key (MU_MSG_DUP_KEY_SLOT);
+
 	if (sortfieldid != MU_MSG_FIELD_ID_NONE)
-		enq.set_sort_by_value ((Xapian::valueno)sortfieldid,
+		enq.set_sort_by_value ((Xapian::valueno)
+				       mu_msg_field_sort_slot (sortfieldid),
 				       revert ? true : false);
 
-	/* empty or "" means "matchall" */
-	if (!mu_str_is_empty(searchexpr) &&
-	    g_strcmp0 (searchexpr, "\"\"") != 0) /* NULL or "" or """" */
-			enq.set_query(get_query (self, searchexpr, err));
-		else
-			enq.set_query(Xapian::Query::MatchAll);
-
+	enq.set_query(query);
 	enq.set_cutoff(0,0);
 
 	return enq;
 }
 
 
+static Xapian::Enquire
+get_enquire (MuQuery *self, const char *searchexpr, MuQueryFlags flags,
+	     MuMsgFieldId sortfieldid, gboolean revert, GError **err)
+{
+	return get_enquire_for_query
+		(self, get_query_or_matchall (self, searchexpr, err),
+		 flags, sortfieldid, revert);
+}
+
+
+/* in a date-ordered database (see mu_store_reorder_by_date), the
+ * docids go up with the dates, except for the 'late' messages. So,
+ * when we want the newest maxnum messages, we don't need to sort all
+ * of the matches by date; we can let Xapian go through them by
+ * descending docid, and stop after the first maxnum + late ones, which
+ * must include the newest maxnum (see MU_MSG_ITER_FLAG_NEWEST_BY_DOCID)
+ *
+ * if there are many late messages, it's cheaper to sort; a run of
+ * mu_store_reorder_by_date puts them in order again */
+#define NEWEST_BY_DOCID_MAX_LATE 10000
+
+static bool
+newest_by_docid (MuQuery *self, MuQueryFlags flags, MuMsgFieldId sortfieldid,
+		 gboolean revert, int maxnum)
+{
+	if ((flags & MU_QUERY_FLAG_THREADS) || maxnum <= 0 || !revert ||
+	    sortfieldid != MU_MSG_FIELD_ID_DATE)
+		return false;
+
+	if (self->db().get_metadata (MU_STORE_DOCID_ORDER_KEY) != "date")
+		return false;
+
+	return self->db().get_termfreq (MU_MSG_LATE_TERM) <=
+		NEWEST_BY_DOCID_MAX_LATE;
+}
+
+
+static Xapian::Enquire
+get_enquire_by_docid (MuQuery *self, const char *searchexpr,
+		      MuQueryFlags flags, GError **err)
+{
+	Xapian::Enquire enq (self->db());
+
+	if (flags & MU_QUERY_FLAG_SKIP_DUPS)
+		enq.set_collapse_key (MU_MSG_DUP_KEY_SLOT);
+
+	/* without weights, the matcher can stop as soon as it has
+	 * enough matches */
+	enq.set_weighting_scheme (Xapian::BoolWeight());
+	enq.set_docid_order (Xapian::Enquire::DESCENDING);
+	enq.set_query (get_query_or_matchall (self, searchexpr, err));
+
+	return enq;
+}
+
+
+static MuMsgIterFlags
+msg_iter_flags (MuQueryFlags flags)
+{
+	unsigned iflags;
+
+	iflags = MU_MSG_ITER_FLAG_NONE;
+	if (flags & MU_QUERY_FLAG_THREADS)
+		iflags |= MU_MSG_ITER_FLAG_THREADS;
+	if (flags & MU_QUERY_FLAG_GROUP_SUBJECTS)
+		iflags |= MU_MSG_ITER_FLAG_GROUP_SUBJECTS;
+	if (flags & MU_QUERY_FLAG_SORT_BY_ACTIVITY)
+		iflags |= MU_MSG_ITER_FLAG_SORT_BY_ACTIVITY;
+
+	return (MuMsgIterFlags)iflags;
+}
+
+
 MuMsgIter*
-mu_query_run (MuQuery *self, const char* searchexpr, gboolean threads,
+mu_query_run (MuQuery *self, const char* searchexpr, MuQueryFlags flags,
 	      MuMsgFieldId sortfieldid, gboolean revert, int maxnum,
 	      GError **err)
 {
@@ -393,15 +498,30 @@ mu_query_run (MuQuery *self, const char* searchexpr, gboolean threads,
 			      NULL);
 	try {
 		MuMsgIter *iter;
-		Xapian::Enquire enq (get_enquire(self, searchexpr, threads,
-						 sortfieldid, revert, err));
+		gboolean threads;
+		unsigned iflags;
+		bool by_docid;
+
+		by_docid = newest_by_docid (self, flags, sortfieldid, revert,
+					    maxnum);
+		Xapian::Enquire enq (by_docid ?
+				     get_enquire_by_docid (self, searchexpr,
+							   flags, err) :
+				     get_enquire (self, searchexpr, flags,
+						  sortfieldid, revert, err));
+
+		threads = (flags & MU_QUERY_FLAG_THREADS) ? TRUE : FALSE;
+		iflags	= msg_iter_flags (flags);
+		if (by_docid)
+			iflags |= MU_MSG_ITER_FLAG_NEWEST_BY_DOCID;
 
 		/* get the 'real' maxnum if it was specified as < 0 */
 		maxnum <= 0 ? self->db().get_doccount() : maxnum;
 
 		iter = mu_msg_iter_new (
 			reinterpret_cast<XapianEnquire*>(&enq),
-			maxnum,	threads,
+			reinterpret_cast<XapianDatabase*>(&self->db()),
+			maxnum,	(MuMsgIterFlags)iflags,
 			/* in we were *not* using threads, no further sorting
 			 * is needed since Xapian already sorted */
 			threads ? sortfieldid : MU_MSG_FIELD_ID_NONE,
@@ -409,7 +529,7 @@ mu_query_run (MuQuery *self, const char* searchexpr, gboolean threads,
 
 		if (err && *err && (*err)->code == MU_ERROR_XAPIAN_MODIFIED) {
 			g_clear_error (err);
-			return try_requery (self, searchexpr, threads,
+			return try_requery (self, searchexpr, flags,
 					    sortfieldid,
 					    revert, maxnum, err);
 		} else
@@ -419,6 +539,624 @@ mu_query_run (MuQuery *self, const char* searchexpr, gboolean threads,
 }
 
 
+/*
+ * paged threads: we go through the matches by date, and collect the
+ * thread-ids (see mu-msg-fields.h) we haven't seen before; then, we
+ * get the complete threads for those with a second query.
+ *
+ * the continuation token is the date and docid of the last match we
+ * looked at, as "<date>:<docid>"; Xapian orders matches with the same
+ * date by docid, so together they tell us where to continue.
+ */
+struct PageCursor {
+	PageCursor (): docid (0) {}
+	bool is_set () const { return docid != 0; }
+
+	std::string	date;
+	Xapian::docid	docid;
+};
+
+/* for a page, we look at a window of the matches after the cursor,
+ * with this many matches for each thread we want, but at least
+ * PAGE_SCAN_MIN_WINDOW */
+#define PAGE_SCAN_MATCHES_PER_THREAD	8
+#define PAGE_SCAN_MIN_WINDOW		256
+
+static bool
+parse_page_token (const char *token, PageCursor& cursor)
+{
+	const char *colon;
+	char *end;
+	unsigned long docid;
+
+	colon = strrchr (token, ':');
+	if (!colon || !colon[1])
+		return false;
+
+	docid = strtoul (colon + 1, &end, 10);
+	if (*end || docid == 0)
+		return false;
+
+	cursor.date  = std::string (token, colon - token);
+	cursor.docid = (Xapian::docid)docid;
+
+	return true;
+}
+
+
+/* does the match with @date, @docid come after @cursor, in the order
+ * in which we look at the matches? */
+static bool
+is_after_cursor (const PageCursor& cursor, const std::string& date,
+		 Xapian::docid docid, bool revert)
+{
+	if (!cursor.is_set())
+		return true;
+	if (date != cursor.date)
+		return revert ? date < cursor.date : date > cursor.date;
+
+	return docid > cursor.docid;
+}
+
+
+/* restrict the query to the matches at or after the cursor; messages
+ * without a date have no value, which sorts before any date */
+static const Xapian::Query
+page_query (const Xapian::Query& query, const PageCursor& cursor,
+	    bool revert)
+{
+	const Xapian::valueno slot ((Xapian::valueno)MU_MSG_FIELD_ID_DATE);
+
+	if (!cursor.is_set() || (!revert && cursor.date.empty()))
+		return query;
+	else if (!revert)
+		return Xapian::Query (Xapian::Query::OP_FILTER, query,
+				      Xapian::Query (Xapian::Query::OP_VALUE_GE,
+						     slot, cursor.date));
+
+	/* the dateless ones come last */
+	const Xapian::Query nodate (Xapian::Query::OP_AND_NOT,
+				    Xapian::Query::MatchAll,
+				    Xapian::Query (Xapian::Query::OP_VALUE_GE,
+						   slot, std::string()));
+	if (cursor.date.empty())
+		return Xapian::Query (Xapian::Query::OP_FILTER, query, nodate);
+	else
+		return Xapian::Query
+			(Xapian::Query::OP_FILTER, query,
+			 Xapian::Query (Xapian::Query::OP_OR,
+					Xapian::Query
+					(Xapian::Query::OP_VALUE_LE, slot,
+					 cursor.date), nodate));
+}
+
+
+/* the date and thread-id of a match */
+struct PageMatch {
+	Xapian::docid	docid;
+	std::string	date, threadid;
+};
+
+struct PageMatchDocidLess {
+	PageMatchDocidLess (const std::vector<PageMatch>& matches):
+		_matches(matches) {}
+	bool operator() (guint32 a, guint32 b) const {
+		return _matches[a].docid < _matches[b].docid;
+	}
+private:
+	const std::vector<PageMatch>& _matches;
+};
+
+
+/* get the date and thread-id for the matches in @mset (in the same
+ * order); like read_thread_input in mu-msg-iter.cc, we read them from
+ * the streams of values, which is much cheaper than getting the
+ * documents */
+static std::vector<PageMatch>
+get_page_matches (Xapian::Database& db, const Xapian::MSet& mset)
+{
+	const Xapian::valueno slots[] = {
+		(Xapian::valueno)MU_MSG_FIELD_ID_DATE, MU_MSG_THREAD_ID_SLOT };
+	std::vector<PageMatch> matches (mset.size());
+	std::vector<guint32> order (mset.size());
+
+	for (guint32 u = 0; u != mset.size(); ++u) {
+		matches[u].docid = *mset[u];
+		order[u]	 = u;
+	}
+	std::sort (order.begin(), order.end(), PageMatchDocidLess (matches));
+
+	for (unsigned s = 0; s != G_N_ELEMENTS(slots); ++s) {
+
+		Xapian::ValueIterator cur (db.valuestream_begin (slots[s]));
+		const Xapian::ValueIterator end (db.valuestream_end (slots[s]));
+
+		for (std::vector<guint32>::const_iterator u = order.begin();
+		     u != order.end() && cur != end; ++u) {
+
+			PageMatch *match (&matches[*u]);
+
+			cur.skip_to (match->docid);
+			if (cur == end || cur.get_docid() != match->docid)
+				continue;
+			if (s == 0)
+				match->date = *cur;
+			else
+				match->threadid = *cur;
+		}
+	}
+
+	return matches;
+}
+
+
+static std::string
+thread_term (const std::string& threadid)
+{
+	return std::string (1, MU_MSG_THREAD_ID_PREFIX) + threadid;
+}
+
+
+static const Xapian::Query
+threads_query (const Xapian::Query& query,
+	       const std::vector<std::string>& terms)
+{
+	return Xapian::Query (Xapian::Query::OP_FILTER, query,
+			      Xapian::Query (Xapian::Query::OP_OR,
+					     terms.begin(), terms.end()));
+}
+
+
+/* check the candidate threads: the ones that have a match before
+ * @start were already on an earlier page; move the others to
+ * @accepted */
+static void
+check_candidates (Xapian::Database& db, const Xapian::Query& query,
+		  const PageCursor& start, bool revert,
+		  std::vector<std::string>& candidates,
+		  std::vector<std::string>& accepted)
+{
+	std::vector<std::string> terms;
+	std::set<std::string> earlier;
+	Xapian::Enquire enq (db);
+
+	for (std::vector<std::string>::const_iterator cur =
+		     candidates.begin(); cur != candidates.end(); ++cur)
+		terms.push_back (thread_term (*cur));
+
+	if (start.is_set()) {
+		std::vector<PageMatch> matches;
+
+		enq.set_query (threads_query (query, terms));
+		enq.set_weighting_scheme (Xapian::BoolWeight());
+		matches = get_page_matches
+			(db, enq.get_mset (0, db.get_doccount()));
+
+		for (std::vector<PageMatch>::const_iterator m =
+			     matches.begin(); m != matches.end(); ++m)
+			if (!is_after_cursor (start, m->date, m->docid,
+					      revert))
+				earlier.insert (m->threadid);
+	}
+
+	for (std::vector<std::string>::const_iterator cur =
+		     candidates.begin(); cur != candidates.end(); ++cur)
+		if (earlier.find (*cur) == earlier.end())
+			accepted.push_back (*cur);
+
+	candidates.clear ();
+}
+
+
+/* find the threads for the next page; returns the thread-ids, and
+ * updates the cursor to the last match we looked at, or unsets it
+ * when there are no more matches.
+ *
+ * we only look at one window of matches after the cursor; as Xapian
+ * only keeps the first ones of those while matching, this does not
+ * sort all of the matches. If the window has fewer than @maxthreads
+ * new threads, the page has fewer threads, and the next one continues
+ * after the window */
+static std::vector<std::string>
+find_page_threads (Xapian::Database& db, const Xapian::Query& query,
+		   PageCursor& cursor, bool revert, size_t maxthreads)
+{
+	const PageCursor start (cursor);
+	std::vector<std::string> accepted, candidates;
+	std::vector<PageMatch> matches;
+	std::set<std::string> seen;
+	Xapian::Enquire enq (db);
+	Xapian::doccount window;
+	size_t u;
+	bool full;
+
+	enq.set_query (page_query (query, start, revert));
+	enq.set_weighting_scheme (Xapian::BoolWeight());
+	enq.set_sort_by_value ((Xapian::valueno)MU_MSG_FIELD_ID_DATE, revert);
+	enq.set_docid_order (Xapian::Enquire::ASCENDING);
+
+	window = std::max ((Xapian::doccount)maxthreads *
+			   PAGE_SCAN_MATCHES_PER_THREAD,
+			   (Xapian::doccount)PAGE_SCAN_MIN_WINDOW);
+	for (;;) {
+		matches = get_page_matches (db, enq.get_mset (0, window));
+		full	= matches.size() == window;
+
+		/* the window starts with the matches with the
+		 * cursor's date that we saw before; we only need a
+		 * bigger one if there's nothing else in it */
+		u = 0;
+		while (u != matches.size() &&
+		       !is_after_cursor (start, matches[u].date,
+					 matches[u].docid, revert))
+			++u;
+		if (u != matches.size() || !full)
+			break;
+
+		window *= 2;
+	}
+
+	for (; u != matches.size(); ++u) {
+
+		const PageMatch& match (matches[u]);
+
+		cursor.date  = match.date;
+		cursor.docid = match.docid;
+
+		/* without a thread-id, the database is from before we
+		 * had them; it needs a rebuild */
+		if (match.threadid.empty() ||
+		    !seen.insert (match.threadid).second)
+			continue;
+
+		candidates.push_back (match.threadid);
+		if (accepted.size() + candidates.size() < maxthreads)
+			continue;
+
+		check_candidates (db, query, start, revert,
+				  candidates, accepted);
+		if (accepted.size() == maxthreads)
+			return accepted;
+	}
+
+	if (!candidates.empty())
+		check_candidates (db, query, start, revert, candidates,
+				  accepted);
+
+	if (!full)
+		cursor = PageCursor(); /* no more pages */
+
+	return accepted;
+}
+
+
+static MuMsgIter*
+run_paged (MuQuery *self, const char *searchexpr, MuQueryFlags flags,
+	   MuMsgFieldId sortfieldid, gboolean revert, size_t maxthreads,
+	   PageCursor& cursor, GError **err)
+{
+	const Xapian::Query query
+		(get_query_or_matchall (self, searchexpr, err));
+	std::vector<std::string> threadids, terms;
+
+	try {
+		threadids = find_page_threads (self->db(), query, cursor,
+					       revert ? true : false,
+					       maxthreads);
+	} catch (const Xapian::DatabaseModifiedError &dbmex) {
+		mu_util_g_set_error (err, MU_ERROR_XAPIAN_MODIFIED,
+				     "database was modified; please reopen");
+		return 0;
+	}
+
+	for (std::vector<std::string>::const_iterator cur =
+		     threadids.begin(); cur != threadids.end(); ++cur)
+		terms.push_back (thread_term (*cur));
+	if (terms.empty()) /* no message has this one; matches nothing */
+		terms.push_back (thread_term (std::string()));
+
+	/* the complete threads */
+	Xapian::Enquire enq (get_enquire_for_query
+			     (self, threads_query (query, terms),
+			      flags, sortfieldid, revert));
+
+	return mu_msg_iter_new (reinterpret_cast<XapianEnquire*>(&enq),
+				reinterpret_cast<XapianDatabase*>(&self->db()),
+				self->db().get_doccount(),
+				msg_iter_flags (flags), sortfieldid, revert,
+				err);
+}
+
+
+MuMsgIter*
+mu_query_run_paged (MuQuery *self, const char* searchexpr,
+		    MuQueryFlags flags, MuMsgFieldId sortfieldid,
+		    gboolean revert, int maxthreads, const char *token,
+		    char **next_token, GError **err)
+{
+	g_return_val_if_fail (self, NULL);
+	g_return_val_if_fail (searchexpr, NULL);
+	g_return_val_if_fail (flags & MU_QUERY_FLAG_THREADS, NULL);
+	g_return_val_if_fail (maxthreads > 0, NULL);
+	g_return_val_if_fail (next_token, NULL);
+
+	*next_token = NULL;
+
+	/* the pages go by date; other orders would need all
+	 * matches */
+	if (sortfieldid != MU_MSG_FIELD_ID_DATE) {
+		mu_util_g_set_error (err, MU_ERROR_IN_PARAMETERS,
+				     "paged threads can only be sorted "
+				     "by date");
+		return NULL;
+	}
+
+	try {
+		MuMsgIter *iter;
+		PageCursor start, cursor;
+
+		if (token && !parse_page_token (token, start)) {
+			mu_util_g_set_error (err, MU_ERROR_IN_PARAMETERS,
+					     "invalid page token '%s'", token);
+			return NULL;
+		}
+
+		cursor = start;
+		iter   = run_paged (self, searchexpr, flags, sortfieldid,
+				    revert, (size_t)maxthreads, cursor, err);
+
+		/* see try_requery */
+		if (err && *err && (*err)->code == MU_ERROR_XAPIAN_MODIFIED) {
+			g_clear_error (err);
+			self->db().reopen();
+			MU_WRITE_LOG ("reopening db after modification");
+			cursor = start;
+			iter   = run_paged (self, searchexpr, flags,
+					    sortfieldid, revert,
+					    (size_t)maxthreads, cursor, err);
+		}
+
+		if (iter && cursor.is_set())
+			*next_token = g_strdup_printf
+				("%s:%u", cursor.date.c_str(),
+				 (unsigned)cursor.docid);
+
+		return iter;
+
+	} MU_XAPIAN_CATCH_BLOCK_G_ERROR_RETURN (err, MU_ERROR_XAPIAN, 0);
+}
+
+
+/*
+ * match spy that counts the values of some field for all the matches
+ * of a query; this is much like Xapian's ValueCountMatchSpy, but it
+ * knows about how mu stores its values (dates as strings, flags as
+ * bitmasks, lists as comma-separated strings)
+ */
+class MuFacetSpy : public Xapian::MatchSpy {
+public:
+	MuFacetSpy (const std::string& name, MuMsgFieldId mfid,
+		    size_t datelen):
+		_name(name), _mfid(mfid), _datelen(datelen) {}
+
+	void operator() (const Xapian::Document &doc, double wt) {
+
+		const std::string val
+			(doc.get_value ((Xapian::valueno)_mfid));
+		if (val.empty())
+			return;
+
+		switch (mu_msg_field_type (_mfid)) {
+		case MU_MSG_FIELD_TYPE_TIME_T:
+			/* YYYYMMDDHHMMSS */
+			++_counts[std::string(val, 0, _datelen)];
+			break;
+		case MU_MSG_FIELD_TYPE_STRING_LIST:
+			count_list (val);
+			break;
+		case MU_MSG_FIELD_TYPE_INT:
+			count_number ((gint64)Xapian::sortable_unserialise(val));
+			break;
+		default:
+			++_counts[val];
+		}
+	}
+
+	const std::string& name() const { return _name; }
+
+	/* call func for each of the values */
+	void foreach (MuQueryFacetForeachFunc func, gpointer user_data) {
+
+		std::vector<std::pair<std::string,unsigned> >
+			vals (_counts.begin(), _counts.end());
+
+		/* dates are in chronological order (as the map
+		 * already has them); the rest by count */
+		if (_mfid != MU_MSG_FIELD_ID_DATE)
+			std::stable_sort (vals.begin(), vals.end(),
+					  cmp_count);
+
+		for (std::vector<std::pair<std::string,unsigned> >::
+			     const_iterator cur = vals.begin();
+		     cur != vals.end(); ++cur)
+			func (_name.c_str(),
+			      _mfid == MU_MSG_FIELD_ID_DATE ?
+			      date_str (cur->first).c_str() :
+			      cur->first.c_str(),
+			      cur->second, user_data);
+	}
+
+private:
+	static bool cmp_count (const std::pair<std::string,unsigned>& p1,
+			       const std::pair<std::string,unsigned>& p2) {
+		return p1.second > p2.second;
+	}
+
+	/* YYYY[MM[DD]] => YYYY[-MM[-DD]] */
+	static std::string date_str (const std::string& val) {
+		std::string str (val, 0, 4);
+		if (val.length() >= 6)
+			str += "-" + std::string(val, 4, 2);
+		if (val.length() >= 8)
+			str += "-" + std::string(val, 6, 2);
+		return str;
+	}
+
+	void count_list (const std::string& val) {
+		size_t b, e;
+		for (b = 0; b < val.length(); b = e + 1) {
+			e = val.find (',', b);
+			if (e == std::string::npos)
+				e = val.length();
+			if (e > b)
+				++_counts[std::string(val, b, e - b)];
+		}
+	}
+
+	void count_number (gint64 num) {
+		if (_mfid == MU_MSG_FIELD_ID_PRIO) {
+			++_counts[mu_msg_prio_name((MuMsgPrio)num)];
+			return;
+		}
+		/* flags; count each separately */
+		for (unsigned u = 1; u <= MU_FLAG_UNREAD; u <<= 1)
+			if (num & u)
+				++_counts[mu_flag_name((MuFlags)u)];
+	}
+
+	const std::string			_name;
+	const MuMsgFieldId			_mfid;
+	const size_t				_datelen;
+	std::map<std::string,unsigned>		_counts;
+};
+
+
+static MuFacetSpy*
+facet_spy_new (const char *facet, GError **err)
+{
+	MuMsgFieldId mfid;
+	size_t datelen;
+	char **parts;
+
+	parts = g_strsplit (facet, ":", 2);
+
+	mfid = mu_msg_field_id_from_name (parts[0], FALSE);
+	if (mfid == MU_MSG_FIELD_ID_NONE && strlen (parts[0]) == 1)
+		mfid = mu_msg_field_id_from_shortcut (parts[0][0], FALSE);
+
+	datelen = 6; /* YYYYMM */
+	if (mfid == MU_MSG_FIELD_ID_DATE && parts[1]) {
+		if (g_strcmp0 (parts[1], "year") == 0)
+			datelen = 4;
+		else if (g_strcmp0 (parts[1], "month") == 0)
+			datelen = 6;
+		else if (g_strcmp0 (parts[1], "day") == 0)
+			datelen = 8;
+		else
+			mfid = MU_MSG_FIELD_ID_NONE;
+	} else if (parts[1])
+		mfid = MU_MSG_FIELD_ID_NONE;
+
+	g_strfreev (parts);
+
+	if (mfid == MU_MSG_FIELD_ID_NONE ||
+	    mfid == MU_MSG_FIELD_ID_SIZE ||
+	    !mu_msg_field_xapian_value (mfid)) {
+		mu_util_g_set_error (err, MU_ERROR_IN_PARAMETERS,
+				     "invalid facet '%s'", facet);
+		return NULL;
+	}
+
+	return new MuFacetSpy (facet, mfid, datelen);
+}
+
+
+/* owns the spies */
+struct FacetSpies: public std::vector<MuFacetSpy*> {
+	~FacetSpies () {
+		for (iterator cur = begin(); cur != end(); ++cur)
+			delete *cur;
+	}
+};
+
+
+static gboolean
+get_facet_spies (const char *facets, FacetSpies& spies, GError **err)
+{
+	char **parts, **cur;
+	gboolean rv;
+
+	parts = g_strsplit (facets, ",", -1);
+	for (cur = parts, rv = TRUE; *cur && rv; ++cur) {
+		MuFacetSpy *spy;
+		g_strstrip (*cur);
+		if (!**cur)
+			continue;
+		if ((spy = facet_spy_new (*cur, err)))
+			spies.push_back (spy);
+		else
+			rv = FALSE;
+	}
+	g_strfreev (parts);
+
+	if (rv && spies.empty()) {
+		mu_util_g_set_error (err, MU_ERROR_IN_PARAMETERS,
+				     "no facets specified");
+		rv = FALSE;
+	}
+
+	return rv;
+}
+
+
+gboolean
+mu_query_facets (MuQuery *self, const char *searchexpr, const char *facets,
+		 MuQueryFacetForeachFunc func, gpointer user_data,
+		 GError **err)
+{
+	g_return_val_if_fail (self, FALSE);
+	g_return_val_if_fail (searchexpr, FALSE);
+	g_return_val_if_fail (facets, FALSE);
+	g_return_val_if_fail (func, FALSE);
+
+	try {
+		FacetSpies spies;
+		FacetSpies::iterator cur;
+
+		if (!get_facet_spies (facets, spies, err))
+			return FALSE;
+
+		Xapian::Enquire enq (get_enquire(self, searchexpr,
+						 MU_QUERY_FLAG_NONE,
+						 MU_MSG_FIELD_ID_NONE,
+						 FALSE, err));
+		for (cur = spies.begin(); cur != spies.end(); ++cur)
+			enq.add_matchspy (*cur);
+
+		/* we don't need the matches themselves; but make sure
+		 * the spies get to see all of them */
+		enq.get_mset (0, 0, self->db().get_doccount());
+
+		for (cur = spies.begin(); cur != spies.end(); ++cur)
+			(*cur)->foreach (func, user_data);
+
+		return TRUE;
+
+	} catch (const Xapian::DatabaseModifiedError &dbmex) {
+		/* the spies are gone now, so simply start over */
+		try {
+			self->db().reopen();
+			MU_WRITE_LOG ("reopening db after modification");
+			return mu_query_facets (self, searchexpr, facets,
+						func, user_data, err);
+
+		} MU_XAPIAN_CATCH_BLOCK_G_ERROR_RETURN (err, MU_ERROR_XAPIAN,
+							FALSE);
+
+	} MU_XAPIAN_CATCH_BLOCK_G_ERROR_RETURN (err, MU_ERROR_XAPIAN, FALSE);
+}
+
+
 char*
 mu_query_as_string (MuQuery *self, const char *searchexpr, GError **err)
 {
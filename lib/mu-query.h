@@ -54,6 +54,19 @@ MuQuery  *mu_query_new  (MuStore *store, GError **err)
 void mu_query_destroy  (MuQuery *self);
 
 
+/**
+ * reopen the database for the query, so it sees the latest committed
+ * changes (ie., those made by some other, writable store for the
+ * same database)
+ *
+ * @param self a MuQuery instance
+ * @param err receives error information (if there is any)
+ *
+ * @return TRUE if it succeeded, FALSE otherwise
+ */
+gboolean mu_query_reopen (MuQuery *self, GError **err);
+
+
 /**
  * get a version string for the database
  *
@@ -64,13 +77,34 @@ void mu_query_destroy  (MuQuery *self);
 char* mu_query_version (MuQuery *store)
     G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
 
+enum _MuQueryFlags {
+	MU_QUERY_FLAG_NONE		= 0,
+	/* calculate message threads */
+	MU_QUERY_FLAG_THREADS		= 1 << 0,
+	/* when calculating threads, also group threads with the same
+	 * subject, for messages that lack References: */
+	MU_QUERY_FLAG_GROUP_SUBJECTS	= 1 << 1,
+	/* when calculating threads, sort the threads by their newest
+	 * message, rather than by their first one */
+	MU_QUERY_FLAG_SORT_BY_ACTIVITY	= 1 << 2,
+	/* only return one message for each set of duplicates (i.e.,
+	 * messages with the same duplicate key, see mu-msg-fields.h) */
+	MU_QUERY_FLAG_SKIP_DUPS		= 1 << 3
+};
+typedef enum _MuQueryFlags MuQueryFlags;
+
+
 /**
  * run a Xapian query; for the syntax, please refer to the mu-find
  * manpage, or http://xapian.org/docs/queryparser.html
  *
+ * in a date-ordered database (see mu_store_reorder_by_date), getting
+ * the newest @maxnum messages (without threads) does not require
+ * sorting all the matches.
+ *
  * @param self a valid MuQuery instance
  * @param expr the search expression; use "" to match all messages
- * @param threads calculate message-threads
+ * @param flags bitwise OR of MuQueryFlags
  * @param sortfield the field id to sort by or MU_MSG_FIELD_ID_NONE if
  * sorting is not desired
  * @param reverse if TRUE, sort in descending (Z-A) order, otherwise,
@@ -84,12 +118,103 @@ char* mu_query_version (MuQuery *store)
  * @return a MuMsgIter instance you can iterate over, or NULL in
  * case of error
  */
-MuMsgIter* mu_query_run (MuQuery *self, const char* expr, gboolean threads,
+MuMsgIter* mu_query_run (MuQuery *self, const char* expr, MuQueryFlags flags,
 			 MuMsgFieldId sortfieldid, gboolean ascending, int maxnum,
 			 GError **err)
     G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
 
 
+/**
+ * run a Xapian query, and get the threads for the matches one page at
+ * a time; unlike mu_query_run with MU_QUERY_FLAG_THREADS, this does
+ * not thread all the matches. Instead, it goes through the matches by
+ * date, and stops after finding @maxthreads threads (by their
+ * thread-ids; see mu-msg-fields.h) it did not return on an earlier
+ * page. The threads are returned complete, ie. with all their messages
+ * that match the query, and sorted by @sortfieldid.
+ *
+ * Since threads are only put together within a page, threads that
+ * would be joined by MU_QUERY_FLAG_GROUP_SUBJECTS, or by references
+ * that don't point to the thread root, may end up on different pages.
+ * To keep the cost of a page independent of the number of matches,
+ * only a limited window of matches is considered for each page; if
+ * the threads have many matches, a page can have fewer than
+ * @maxthreads threads, even when there are more pages.
+ *
+ * @param self a valid MuQuery instance
+ * @param expr the search expression; use "" to match all messages
+ * @param flags bitwise OR of MuQueryFlags; must include
+ * MU_QUERY_FLAG_THREADS
+ * @param sortfieldid the field id to sort by; as the pages go by date,
+ * this must be MU_MSG_FIELD_ID_DATE
+ * @param revert if TRUE, go through the matches newest first (and sort
+ * in descending order), otherwise oldest first
+ * @param maxthreads the maximum number of threads on this page (> 0)
+ * @param token NULL for the first page, or the token for the next page
+ * from the previous call
+ * @param next_token receives the token for the next page (free with
+ * g_free), or NULL if there are no more pages; note that the last page
+ * may be empty
+ * @param err receives error information (if there is any); possible
+ * errors (err->code) are MU_ERROR_IN_PARAMETERS (for an invalid token,
+ * or a sortfieldid other than the date) and MU_ERROR_XAPIAN_QUERY
+ *
+ * @return a MuMsgIter instance you can iterate over, or NULL in
+ * case of error
+ */
+MuMsgIter* mu_query_run_paged (MuQuery *self, const char* expr,
+			       MuQueryFlags flags, MuMsgFieldId sortfieldid,
+			       gboolean revert, int maxthreads,
+			       const char *token, char **next_token,
+			       GError **err)
+    G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+
+
+/**
+ * callback function for mu_query_facets; it is called once for each
+ * value of each facet, in the order the facets were specified
+ *
+ * @param facet the name of the facet, as specified (e.g. "maildir"
+ * or "date:month")
+ * @param value the value, e.g. "/inbox" or "2012-06"
+ * @param count the number of matching messages with this value
+ * @param user_data user-provided data
+ */
+typedef void (*MuQueryFacetForeachFunc) (const char *facet,
+					 const char *value,
+					 unsigned count,
+					 gpointer user_data);
+
+/**
+ * count, for each of a set of facets, the number of messages
+ * matching a query per value of that facet. This is done in the
+ * Xapian matcher, without instantiating any messages.
+ *
+ * A facet is the name (or shortcut) of a field that has a
+ * value in the database, ie. 'from', 'to', 'cc', 'subject',
+ * 'maildir', 'msgid', 'tag', 'flag', 'prio' and 'date'; for date, you
+ * can add ':year', ':month' (the default) or ':day' to specify the
+ * granularity. For string-list fields (tags) and flags, a message is
+ * counted once for each of its elements.
+ *
+ * Values are reported in descending order of their counts, except
+ * for dates, which are reported in chronological order.
+ *
+ * @param self a valid MuQuery instance
+ * @param expr the search expression; use "" to match all messages
+ * @param facets a comma-separated list of facets, e.g.
+ * "maildir,from,date:month"
+ * @param func a function to call for each facet value
+ * @param user_data user-provided data, passed to func
+ * @param err receives error information (if there is any); possible
+ * errors (err->code) are MU_ERROR_IN_PARAMETERS (for invalid facets)
+ * and MU_ERROR_XAPIAN_QUERY
+ *
+ * @return TRUE if the function succeeded, FALSE otherwise
+ */
+gboolean mu_query_facets (MuQuery *self, const char *expr,
+			  const char *facets, MuQueryFacetForeachFunc func,
+			  gpointer user_data, GError **err);
 
 
 /**
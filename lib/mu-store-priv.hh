@@ -29,6 +29,7 @@
 #include <xapian.h>
 #include <cstring>
 #include <stdexcept>
+#include <vector>
 
 #include "mu-store.h"
 #include "mu-contacts.h"
@@ -62,6 +63,7 @@ public:
 				(path, Xapian::DB_CREATE_OR_OPEN);
 
 		check_set_version ();
+		load_date_order ();
 
 		if (contacts_path) {
 			_contacts = mu_contacts_new (contacts_path);
@@ -97,7 +99,10 @@ public:
 		_processed	= 0;
 		_read_only      = read_only;
 		_ref_count      = 1;
+		_revision       = 0;
+		_changes_from	= 0;
 		_version        = NULL;
+		_date_ordered	= false;
 	}
 
 	void set_my_addresses (const char **my_addresses) {
@@ -159,6 +164,8 @@ public:
 		delete _db;
 		_db = new Xapian::WritableDatabase
 			(path(), Xapian::DB_CREATE_OR_OVERWRITE);
+		load_date_order ();
+		inc_revision ();
 
 		// clear the contacts cache
 		if (_contacts)
@@ -183,6 +190,28 @@ public:
 
 	static unsigned max_term_length() { return MAX_TERM_LENGTH; }
 
+	/* date-ordered databases (see mu_store_reorder_by_date) */
+	bool date_ordered () const { return _date_ordered; }
+	void load_date_order () {
+		_date_ordered = _db->get_metadata
+			(MU_STORE_DOCID_ORDER_KEY) == "date";
+		_order_date   = _date_ordered ?
+			_db->get_metadata (MU_STORE_ORDER_DATE_KEY) : "";
+	}
+	void save_date_order () {
+		if (_date_ordered)
+			db_writable()->set_metadata (MU_STORE_ORDER_DATE_KEY,
+						     _order_date);
+	}
+	/* add the MU_MSG_LATE_TERM to @doc if it's out of order; @olddocid
+	 * is the docid of the document it replaces, or 0 */
+	void check_date_order (Xapian::Document& doc,
+			       Xapian::docid olddocid);
+
+	/* replace the database with the one at @newpath, which must
+	 * not be in use */
+	void swap_db (const std::string& newpath);
+
 	void begin_transaction ();
 	void commit_transaction ();
 	void rollback_transaction ();
@@ -210,6 +239,36 @@ public:
 	int    set_processed (int n) { return _processed = n;}
 	int    inc_processed () { return ++_processed; }
 
+	/* changes whenever the database is modified; @docid is the
+	 * message that changed, or 0 if we don't know (or if it's
+	 * everything) */
+	guint64 revision () const { return _revision; }
+	guint64 inc_revision (unsigned docid = 0) {
+		++_revision;
+		if (docid == 0) {
+			_changes.clear ();
+			_changes_from = _revision;
+		} else {
+			if (_changes.size() == MAX_CHANGES) {
+				_changes.erase (_changes.begin(),
+						_changes.begin() + MAX_CHANGES / 2);
+				_changes_from += MAX_CHANGES / 2;
+			}
+			_changes.push_back (docid);
+		}
+		return _revision;
+	}
+
+	/* the docids changed after @revision; false if we don't know */
+	bool changes_since (guint64 revision, GArray *docids) const {
+		if (revision < _changes_from || revision > _revision)
+			return false;
+		for (size_t u = revision - _changes_from;
+		     u != _changes.size(); ++u)
+			g_array_append_val (docids, _changes[u]);
+		return true;
+	}
+
 	/* MuStore is ref-counted */
 	guint  ref   () { return ++_ref_count; }
 	guint  unref () {
@@ -224,11 +283,17 @@ public:
 	static const unsigned DEFAULT_BATCH_SIZE = 30000;
 	/* http://article.gmane.org/gmane.comp.search.xapian.general/3656 */
 	static const unsigned MAX_TERM_LENGTH = 240;
+	/* the number of changed docids we remember */
+	static const size_t MAX_CHANGES = 100000;
 
 private:
 	/* transaction handling */
 	bool   _in_transaction;
 	int    _processed;
+	guint64 _revision;
+	/* the docids changed in revisions _changes_from + 1 ... */
+	std::vector<unsigned> _changes;
+	guint64 _changes_from;
 	size_t  _batch_size;  /* batch size of a xapian transaction */
 
 	/* contacts object to cache all the contact information */
@@ -239,6 +304,9 @@ private:
 
 	Xapian::Database *_db;
 	bool _read_only;
+
+	bool _date_ordered;
+	std::string _order_date; /* newest date of the messages in order */
 	guint _ref_count;
 
 	GSList *_my_addresses;
@@ -134,6 +134,39 @@ mu_store_version (MuStore *store)
 }
 
 
+guint64
+mu_store_revision (MuStore *store)
+{
+	g_return_val_if_fail (store, 0);
+	return store->revision ();
+}
+
+
+GArray*
+mu_store_changes_since (MuStore *store, guint64 revision)
+{
+	GArray *docids;
+
+	g_return_val_if_fail (store, NULL);
+
+	docids = g_array_new (FALSE, FALSE, sizeof(unsigned));
+	if (!store->changes_since (revision, docids)) {
+		g_array_free (docids, TRUE);
+		return NULL;
+	}
+
+	return docids;
+}
+
+
+MuContacts*
+mu_store_contacts (MuStore *store)
+{
+	g_return_val_if_fail (store, NULL);
+	return store->contacts ();
+}
+
+
 gboolean
 mu_store_needs_upgrade (MuStore *store)
 {
@@ -26,6 +26,9 @@
 #include <xapian.h>
 #include <cstring>
 #include <stdexcept>
+#include <vector>
+#include <algorithm>
+#include <glib/gstdio.h>
 
 #include "mu-store.h"
 #include "mu-store-priv.hh" /* _MuStore */
@@ -37,6 +40,7 @@
 #include "mu-str.h"
 #include "mu-date.h"
 #include "mu-flags.h"
+#include "mu-maildir.h"
 #include "mu-contacts.h"
 
 void
@@ -53,6 +57,7 @@ void
 _MuStore::commit_transaction () {
 	try {
 		in_transaction (false);
+		save_date_order ();
 		db_writable()->commit_transaction();
 	} MU_XAPIAN_CATCH_BLOCK;
 }
@@ -194,6 +199,8 @@ mu_store_flush (MuStore *store)
 	try {
 		if (store->in_transaction())
 			store->commit_transaction ();
+		else
+			store->save_date_order ();
 		store->db_writable()->commit ();
 
 	} MU_XAPIAN_CATCH_BLOCK;
@@ -280,6 +287,20 @@ prio_val (MuMsgPrio prio)
 
 
 
+static void
+add_flag_terms (Xapian::Document& doc, MuFlags flags)
+{
+	const char *cur = mu_flags_to_str_s
+		(flags, (MuFlagType)MU_FLAG_TYPE_ANY);
+	g_return_if_fail (cur);
+
+	while (*cur) {
+		doc.add_term (flag_val(*cur));
+		++cur;
+	}
+}
+
+
 static void
 add_terms_values_number (Xapian::Document& doc, MuMsg *msg, MuMsgFieldId mfid)
 {
@@ -288,16 +309,9 @@ add_terms_values_number (Xapian::Document& doc, MuMsg *msg, MuMsgFieldId mfid)
 	const std::string numstr (Xapian::sortable_serialise((double)num));
 	doc.add_value ((Xapian::valueno)mfid, numstr);
 
-	if (mfid == MU_MSG_FIELD_ID_FLAGS) {
-		const char *cur = mu_flags_to_str_s
-			((MuFlags)num,(MuFlagType)MU_FLAG_TYPE_ANY);
-		g_return_if_fail (cur);
-		while (*cur) {
-			doc.add_term (flag_val(*cur));
-			++cur;
-		}
-
-	} else if (mfid == MU_MSG_FIELD_ID_PRIO)
+	if (mfid == MU_MSG_FIELD_ID_FLAGS)
+		add_flag_terms (doc, (MuFlags)num);
+	else if (mfid == MU_MSG_FIELD_ID_PRIO)
 		doc.add_term (prio_val((MuMsgPrio)num));
 }
 
@@ -568,6 +582,157 @@ add_terms_values (MuMsgFieldId mfid, MsgDoc* msgdoc)
 }
 
 
+/* store the sort keys for the fields that have them, so we can sort
+ * on them without any further processing */
+static void
+add_sort_keys (Xapian::Document& doc, MuMsg *msg)
+{
+	static const MuMsgFieldId mfids[] = {
+		MU_MSG_FIELD_ID_SUBJECT,
+		MU_MSG_FIELD_ID_FROM,
+		MU_MSG_FIELD_ID_TO
+	};
+	unsigned u;
+
+	for (u = 0; u != G_N_ELEMENTS(mfids); ++u) {
+		const char *key;
+		key = mu_msg_get_sort_key (msg, mfids[u]);
+		if (!mu_str_is_empty (key))
+			doc.add_value (mu_msg_field_sort_slot (mfids[u]), key);
+	}
+}
+
+
+/* get a hex-string hash for str; we use the same hash as for the
+ * uid-terms */
+static std::string
+hash_str (const char *str, bool skip_space)
+{
+	unsigned djbhash, bkdrhash, bkdrseed, u;
+	char hex[18];
+
+	djbhash  = 5381;
+	bkdrhash = 0;
+	bkdrseed = 1313;
+
+	for (u = 0; str[u]; ++u) {
+		if (skip_space && g_ascii_isspace (str[u]))
+			continue;
+		djbhash  = ((djbhash << 5) + djbhash) + str[u];
+		bkdrhash = bkdrhash * bkdrseed + str[u];
+	}
+
+	snprintf (hex, sizeof(hex), "%08x%08x", djbhash, bkdrhash);
+
+	return std::string (hex);
+}
+
+
+static void
+set_thread_id (Xapian::Document& doc, const char *root)
+{
+	const std::string threadid (hash_str (root, false));
+
+	doc.add_value (MU_MSG_THREAD_ID_SLOT, threadid);
+	doc.add_term (std::string(1, MU_MSG_THREAD_ID_PREFIX) + threadid);
+}
+
+
+/* the term for a message-id, as add_terms_values_str makes it */
+static std::string
+msgid_term (const char *msgid, GStringChunk *strchunk)
+{
+	const MuMsgFieldId mfid (MU_MSG_FIELD_ID_MSGID);
+	char *val;
+
+	val = g_string_chunk_insert (strchunk, msgid);
+	if (mu_msg_field_normalize (mfid))
+		val = mu_str_normalize_in_place (val, TRUE, strchunk);
+	if (mu_msg_field_xapian_escape (mfid))
+		val = mu_str_xapian_escape_in_place_try (val, TRUE, strchunk);
+
+	return prefix(mfid) + std::string(val, 0, _MuStore::MAX_TERM_LENGTH);
+}
+
+
+/* get the thread-id of the message with some message-id, or an empty
+ * string if it's not in the store */
+static std::string
+get_thread_id (MuStore *store, const char *msgid, GStringChunk *strchunk)
+{
+	const std::string term (msgid_term (msgid, strchunk));
+	Xapian::Database *db (store->db_read_only());
+	Xapian::PostingIterator cur (db->postlist_begin (term));
+
+	if (cur == db->postlist_end (term))
+		return std::string();
+
+	return db->get_document (*cur).get_value (MU_MSG_THREAD_ID_SLOT);
+}
+
+
+/* add the thread-id (see mu-msg-fields.h) */
+static void
+add_thread_id (MuStore *store, Xapian::Document& doc, MuMsg *msg,
+	       GStringChunk *strchunk)
+{
+	const GSList *refs;
+	const char *root;
+
+	refs = mu_msg_get_references (msg);
+
+	/* if we have the parent (the last reference) already, we're
+	 * in its thread, even if our references don't go back to its
+	 * root (e.g. with only In-Reply-To:) */
+	if (refs) {
+		const std::string threadid
+			(get_thread_id (store, (const char*)g_slist_last
+					((GSList*)refs)->data, strchunk));
+		if (!threadid.empty()) {
+			doc.add_value (MU_MSG_THREAD_ID_SLOT, threadid);
+			doc.add_term (std::string(1, MU_MSG_THREAD_ID_PREFIX) +
+				      threadid);
+			return;
+		}
+	}
+
+	root = refs ? (const char*)refs->data : mu_msg_get_msgid (msg);
+	if (!root) /* no message-id; the thread is just this message */
+		root = mu_msg_get_path (msg);
+
+	set_thread_id (doc, root);
+}
+
+
+/* add the duplicate key (see mu-msg-fields.h) */
+static void
+add_dup_key (Xapian::Document& doc, MuMsg *msg)
+{
+	const char *msgid, *body;
+	char *norm;
+
+	msgid = mu_msg_get_msgid (msg);
+	if (!msgid) /* no message-id; we can't tell the copies apart
+		     * from different messages */
+		return;
+
+	body = NULL;
+	if (!(mu_msg_get_flags(msg) & MU_FLAG_ENCRYPTED)) {
+		body = mu_msg_get_body_text (msg, MU_MSG_OPTION_NONE);
+		if (!body)
+			body = mu_msg_get_body_html (msg, MU_MSG_OPTION_NONE);
+	}
+
+	norm = body ? mu_str_normalize (body, TRUE, NULL) : NULL;
+	const std::string dupkey (hash_str (msgid, false) +
+				  hash_str (norm ? norm : "", true));
+	g_free (norm);
+
+	doc.add_value (MU_MSG_DUP_KEY_SLOT, dupkey);
+	doc.add_term (std::string(1, MU_MSG_DUP_KEY_PREFIX) + dupkey);
+}
+
+
 static const std::string&
 xapian_pfx (MuMsgContact *contact)
 {
@@ -660,6 +825,9 @@ new_doc_from_message (MuStore *store, MuMsg *msg)
 	docinfo._strchunk = g_string_chunk_new (MU_STRING_CHUNK_SIZE);
 
 	mu_msg_field_foreach ((MuMsgFieldForeachFunc)add_terms_values, &docinfo);
+	add_sort_keys (doc, msg);
+	add_thread_id (store, doc, msg, docinfo._strchunk);
+	add_dup_key (doc, msg);
 
 	/* determine whether this is 'personal' email, ie. one of my
 	 * e-mail addresses is explicitly mentioned -- it's not a
@@ -699,11 +867,19 @@ mu_store_add_msg (MuStore *store, MuMsg *msg, GError **err)
 			store->begin_transaction();
 
 		doc.add_term (term);
+		if (store->date_ordered()) {
+			Xapian::PostingIterator old
+				(store->db_read_only()->postlist_begin (term));
+			store->check_date_order
+				(doc, old == store->db_read_only()->postlist_end
+				 (term) ? 0 : *old);
+		}
 
 		// MU_WRITE_LOG ("adding: %s", term.c_str());
 
 		/* note, this will replace any other messages for this path */
 		id = store->db_writable()->replace_document (term, doc);
+		store->inc_revision (id);
 
 		if (store->inc_processed() % store->batch_size() == 0)
 			store->commit_transaction();
@@ -735,8 +911,10 @@ mu_store_update_msg (MuStore *store, unsigned docid, MuMsg *msg, GError **err)
 		const std::string term
 			(store->get_uid_term(mu_msg_get_path(msg)));
 		doc.add_term (term);
+		store->check_date_order (doc, docid);
 
 		store->db_writable()->replace_document (docid, doc);
+		store->inc_revision (docid);
 
 		if (store->inc_processed() % store->batch_size() == 0)
 			store->commit_transaction();
@@ -753,6 +931,95 @@ mu_store_update_msg (MuStore *store, unsigned docid, MuMsg *msg, GError **err)
 
 
 
+static void
+remove_terms_with_prefix (Xapian::Document& doc, const std::string& pfx)
+{
+	std::vector<std::string> terms;
+	Xapian::TermIterator cur (doc.termlist_begin());
+
+	/* the terms are sorted, so those with pfx are together */
+	for (cur.skip_to (pfx); cur != doc.termlist_end() &&
+		     (*cur).compare (0, pfx.length(), pfx) == 0; ++cur)
+		terms.push_back (*cur);
+
+	for (std::vector<std::string>::const_iterator term = terms.begin();
+	     term != terms.end(); ++term)
+		doc.remove_term (*term);
+}
+
+
+MuFlags
+mu_store_move_msg (MuStore *store, unsigned docid, const char *path,
+		   const char *maildir, GError **err)
+{
+	g_return_val_if_fail (store, MU_FLAG_INVALID);
+	g_return_val_if_fail (docid != 0, MU_FLAG_INVALID);
+	g_return_val_if_fail (path, MU_FLAG_INVALID);
+	g_return_val_if_fail (maildir, MU_FLAG_INVALID);
+
+	try {
+		Xapian::Document doc
+			(store->db_read_only()->get_document (docid));
+		GStringChunk *strchunk;
+		MuFlags flags;
+
+		if (!store->in_transaction())
+			store->begin_transaction();
+
+		remove_terms_with_prefix (doc, prefix(MU_MSG_FIELD_ID_UID));
+		remove_terms_with_prefix (doc, prefix(MU_MSG_FIELD_ID_PATH));
+		remove_terms_with_prefix (doc, prefix(MU_MSG_FIELD_ID_MAILDIR));
+		remove_terms_with_prefix (doc, prefix(MU_MSG_FIELD_ID_FLAGS));
+
+		strchunk = g_string_chunk_new (1024);
+		add_terms_values_str (doc,
+				      g_string_chunk_insert (strchunk, path),
+				      MU_MSG_FIELD_ID_PATH, strchunk);
+		add_terms_values_str (doc,
+				      g_string_chunk_insert (strchunk, maildir),
+				      MU_MSG_FIELD_ID_MAILDIR, strchunk);
+		g_string_chunk_free (strchunk);
+		doc.add_term (store->get_uid_term (path));
+
+		/* the content flags stay; the others are in the path */
+		flags = (MuFlags)Xapian::sortable_unserialise
+			(doc.get_value (MU_MSG_FIELD_ID_FLAGS));
+		flags = (MuFlags)((flags & (MU_FLAG_SIGNED|MU_FLAG_ENCRYPTED|
+					    MU_FLAG_HAS_ATTACH)) |
+				  mu_maildir_get_flags_from_path (path));
+		if ((flags & MU_FLAG_NEW) || !(flags & MU_FLAG_SEEN))
+			flags = (MuFlags)(flags | MU_FLAG_UNREAD);
+
+		doc.add_value ((Xapian::valueno)MU_MSG_FIELD_ID_FLAGS,
+			       Xapian::sortable_serialise((double)flags));
+		add_flag_terms (doc, flags);
+
+		/* without message-id or references, the thread-id
+		 * comes from the path */
+		if (doc.get_value (MU_MSG_FIELD_ID_MSGID).empty() &&
+		    doc.get_value (MU_MSG_FIELD_ID_REFS).empty()) {
+			remove_terms_with_prefix
+				(doc, std::string(1, MU_MSG_THREAD_ID_PREFIX));
+			set_thread_id (doc, path);
+		}
+
+		store->db_writable()->replace_document (docid, doc);
+		store->inc_revision (docid);
+
+		if (store->inc_processed() % store->batch_size() == 0)
+			store->commit_transaction();
+
+		return flags;
+
+	} MU_XAPIAN_CATCH_BLOCK_G_ERROR (err, MU_ERROR_XAPIAN_STORE_FAILED);
+
+	/* no rollback: nothing was replaced for this message, and the
+	 * transaction has the earlier moves, whose files have already
+	 * been moved */
+	return MU_FLAG_INVALID;
+}
+
+
 unsigned
 mu_store_add_path (MuStore *store, const char *path, const char *maildir,
 		   GError **err)
@@ -792,8 +1059,15 @@ mu_store_remove_path (MuStore *store, const char *msgpath)
 	try {
 		const std::string term
 			(store->get_uid_term(msgpath));
-
-		store->db_writable()->delete_document (term);
+		Xapian::PostingIterator cur
+			(store->db_read_only()->postlist_begin (term));
+
+		/* if there's no such message, nothing changes */
+		if (cur != store->db_read_only()->postlist_end (term)) {
+			const Xapian::docid docid (*cur);
+			store->db_writable()->delete_document (term);
+			store->inc_revision (docid);
+		}
 		store->inc_processed();
 
 		return TRUE;
@@ -802,6 +1076,197 @@ mu_store_remove_path (MuStore *store, const char *msgpath)
 }
 
 
+
+void
+_MuStore::check_date_order (Xapian::Document& doc, Xapian::docid olddocid)
+{
+	if (!_date_ordered)
+		return;
+
+	const std::string date (doc.get_value (MU_MSG_FIELD_ID_DATE));
+
+	/* a replaced message keeps its docid; so it's only still in
+	 * order if it was before, and its date did not change */
+	if (olddocid != 0) {
+		const Xapian::Document olddoc (_db->get_document (olddocid));
+		Xapian::TermIterator term (olddoc.termlist_begin());
+
+		term.skip_to (MU_MSG_LATE_TERM);
+		if ((term == olddoc.termlist_end() ||
+		     *term != MU_MSG_LATE_TERM) &&
+		    olddoc.get_value (MU_MSG_FIELD_ID_DATE) == date)
+			return;
+
+	} else if (date >= _order_date) {
+		/* a new message gets a docid higher than all others */
+		_order_date = date;
+		return;
+	}
+
+	doc.add_term (MU_MSG_LATE_TERM);
+}
+
+
+/* remove a (closed) xapian database; it's just a directory with some
+ * files */
+static void
+remove_db_dir (const char *path)
+{
+	GDir *dir;
+	const char *name;
+
+	dir = g_dir_open (path, 0, NULL);
+	if (!dir)
+		return;
+
+	while ((name = g_dir_read_name (dir))) {
+		gchar *fullpath;
+		fullpath = g_build_filename (path, name, NULL);
+		if (g_unlink (fullpath) != 0)
+			g_warning ("failed to remove %s", fullpath);
+		g_free (fullpath);
+	}
+
+	g_dir_close (dir);
+	g_rmdir (path);
+}
+
+
+void
+_MuStore::swap_db (const std::string& newpath)
+{
+	const std::string oldpath (_path + ".old");
+	bool swapped;
+
+	db_writable()->close ();
+	delete _db;
+	_db = 0;
+
+	swapped = g_rename (path(), oldpath.c_str()) == 0;
+	if (swapped && g_rename (newpath.c_str(), path()) != 0) {
+		g_rename (oldpath.c_str(), path()); /* put it back */
+		swapped = false;
+	}
+	remove_db_dir (swapped ? oldpath.c_str() : newpath.c_str());
+
+	_db = new Xapian::WritableDatabase (path(), Xapian::DB_CREATE_OR_OPEN);
+	load_date_order ();
+	inc_revision ();
+
+	if (!swapped)
+		throw MuStoreError (MU_ERROR_FILE,
+				    "failed to replace " + _path);
+}
+
+
+/* the date (as a number, so it sorts) and the docid of a message */
+typedef std::pair<guint64, Xapian::docid> DateDocid;
+
+/* get the dates and docids for all messages, sorted by date; for
+ * messages with the same date, by docid. Messages without a date
+ * come first. */
+static void
+get_date_order (const Xapian::Database& db, std::vector<DateDocid>& order)
+{
+	const Xapian::valueno slot ((Xapian::valueno)MU_MSG_FIELD_ID_DATE);
+	Xapian::ValueIterator val (db.valuestream_begin (slot));
+
+	order.reserve (db.get_doccount());
+
+	/* the value stream only has the messages with a date; both
+	 * are in docid order */
+	for (Xapian::PostingIterator doc = db.postlist_begin ("");
+	     doc != db.postlist_end (""); ++doc) {
+
+		guint64 date;
+
+		if (val != db.valuestream_end (slot) &&
+		    val.get_docid() == *doc) {
+			date = g_ascii_strtoull ((*val).c_str(), NULL, 10);
+			++val;
+		} else
+			date = 0;
+
+		order.push_back (DateDocid (date, *doc));
+	}
+
+	std::sort (order.begin(), order.end());
+}
+
+
+/* copy all messages to a new database at @newpath, in date order */
+static void
+copy_in_date_order (MuStore *store, const std::string& newpath)
+{
+	const Xapian::Database& db (*store->db_read_only());
+	std::vector<DateDocid> order;
+	std::vector<Xapian::docid> late;
+	std::string lastdate;
+
+	get_date_order (db, order);
+	for (Xapian::PostingIterator cur = db.postlist_begin (MU_MSG_LATE_TERM);
+	     cur != db.postlist_end (MU_MSG_LATE_TERM); ++cur)
+		late.push_back (*cur);
+
+	Xapian::WritableDatabase newdb (newpath,
+					Xapian::DB_CREATE_OR_OVERWRITE);
+	for (Xapian::TermIterator key = db.metadata_keys_begin ();
+	     key != db.metadata_keys_end (); ++key)
+		newdb.set_metadata (*key, db.get_metadata (*key));
+
+	newdb.begin_transaction ();
+	for (size_t u = 0; u != order.size(); ++u) {
+
+		Xapian::Document doc (db.get_document (order[u].second));
+
+		/* they're all in order now */
+		if (std::binary_search (late.begin(), late.end(),
+					order[u].second))
+			doc.remove_term (MU_MSG_LATE_TERM);
+
+		lastdate = doc.get_value (MU_MSG_FIELD_ID_DATE);
+		newdb.add_document (doc);
+
+		if ((u + 1) % store->batch_size() == 0) {
+			newdb.commit_transaction ();
+			newdb.begin_transaction ();
+		}
+	}
+	newdb.commit_transaction ();
+
+	newdb.set_metadata (MU_STORE_DOCID_ORDER_KEY, "date");
+	newdb.set_metadata (MU_STORE_ORDER_DATE_KEY, lastdate);
+	newdb.commit ();
+	newdb.close ();
+}
+
+
+gboolean
+mu_store_reorder_by_date (MuStore *store, GError **err)
+{
+	g_return_val_if_fail (store, FALSE);
+	g_return_val_if_fail (!mu_store_is_read_only (store), FALSE);
+
+	const std::string newpath (std::string(store->path()) + ".reorder");
+
+	try {
+		try {
+			mu_store_flush (store);
+			copy_in_date_order (store, newpath);
+			store->swap_db (newpath);
+
+			return TRUE;
+
+		} MU_STORE_CATCH_BLOCK_RETURN(err,FALSE);
+
+	} MU_XAPIAN_CATCH_BLOCK_G_ERROR (err, MU_ERROR_XAPIAN_STORE_FAILED);
+
+	remove_db_dir (newpath.c_str());
+
+	return FALSE;
+}
+
+
 gboolean
 mu_store_set_timestamp (MuStore *store, const char* msgpath,
 			time_t stamp, GError **err)
@@ -23,6 +23,7 @@
 #include <glib.h>
 #include <inttypes.h>
 #include <mu-msg.h>
+#include <mu-contacts.h>
 #include <mu-util.h> /* for MuError, MuError */
 
 G_BEGIN_DECLS
@@ -167,6 +168,48 @@ unsigned mu_store_count (MuStore *store, GError **err);
 const char* mu_store_version (MuStore *store);
 
 
+/**
+ * get the revision of the database, ie. a number that changes
+ * whenever the database is modified through this store (adding,
+ * updating, removing messages or clearing it). It can be used to
+ * determine whether earlier query results are still valid.
+ *
+ * @param store a valid MuStore
+ *
+ * @return the revision
+ */
+guint64 mu_store_revision (MuStore *store);
+
+
+/**
+ * get the docids of the messages that were added, updated or removed
+ * through this store after some revision (see mu_store_revision)
+ *
+ * @param store a valid MuStore
+ * @param revision an earlier revision
+ *
+ * @return a GArray of docids (unsigned), in the order in which they
+ * changed (a docid may be in there more than once), or NULL if we
+ * don't know what changed, e.g. after mu_store_clear or after too many
+ * changes; free with g_array_free
+ */
+GArray* mu_store_changes_since (MuStore *store, guint64 revision)
+	G_GNUC_WARN_UNUSED_RESULT;
+
+
+/**
+ * get the contacts of a writable store; they are kept up to date
+ * when messages are added to the store, and written to the contacts
+ * cache when the store is destroyed
+ *
+ * @param store a valid MuStore
+ *
+ * @return the contacts (owned by the store; don't destroy them), or
+ * NULL if the store has none
+ */
+MuContacts* mu_store_contacts (MuStore *store);
+
+
 /**
  * try to flush/commit all outstanding work
  *
@@ -204,6 +247,25 @@ unsigned mu_store_update_msg (MuStore *store, unsigned docid, MuMsg *msg,
 			      GError **err);
 
 
+/**
+ * update the path, maildir and flags of a message in the store after
+ * its file has been moved (see mu_msg_move_file_to_maildir), without
+ * indexing the message again. The content flags (e.g., signed) stay
+ * the same; the others follow from the new path. If this fails, the
+ * earlier moves (in the same transaction) are not undone.
+ *
+ * @param store a valid store
+ * @param docid the docid of the message
+ * @param path the new path of the message
+ * @param maildir the new maildir of the message, e.g. "/archive"
+ * @param err receives error information, if any
+ *
+ * @return the new flags of the message, or MU_FLAG_INVALID in case of
+ * error
+ */
+MuFlags mu_store_move_msg (MuStore *store, unsigned docid, const char *path,
+			   const char *maildir, GError **err);
+
 /**
  * store an email message in the XapianStore; similar to
  * mu_store_store, but instead takes a path as parameter instead of a
@@ -375,6 +437,26 @@ gboolean mu_store_needs_upgrade (MuStore *store);
 gboolean mu_store_clear (MuStore *store, GError **err);
 
 
+/**
+ * rewrite the database with the messages in date order, so that their
+ * docids go up with their dates; after this, queries for the newest
+ * messages can stop early, rather than sorting all matches (see
+ * mu_query_run). Messages that are added later with an older date
+ * than the ones before them are marked as such (see
+ * mu-msg-fields.h); running this again puts them in order, too.
+ *
+ * The database is copied to a new one, which then replaces the old
+ * one; so this needs as much free space as the database takes, and
+ * no other process should have the database open.
+ *
+ * @param store a writable MuStore object
+ * @param err to receive error info or NULL. err->code is MuError value
+ *
+ * @return TRUE if it succeeded, FALSE otherwise
+ */
+gboolean mu_store_reorder_by_date (MuStore *store, GError **err);
+
+
 /**
  * check if the database is locked for writing
  *
@@ -385,6 +385,21 @@ mu_str_subject_normalize (const gchar* str)
 }
 
 
+gchar*
+mu_str_collate_key (const gchar *str)
+{
+	gchar *down, *key;
+
+	g_return_val_if_fail (str, NULL);
+
+	down = g_utf8_strdown (str, -1);
+	key  = g_utf8_collate_key (down, -1);
+	g_free (down);
+
+	return key;
+}
+
+
 struct _CheckPrefix {
 	const char *str;
 	gboolean   match;
@@ -693,28 +708,47 @@ mu_str_fullpath_s (const char* path, const char* name)
 }
 
 
-char*
-mu_str_escape_c_literal (const gchar* str, gboolean in_quotes)
-{
-	const char* cur;
-	GString *tmp;
+/* the characters we need to escape in C string literals */
+static const gboolean C_LITERAL_ESCAPE[256] = {
+	['\\'] = TRUE,
+	['"']  = TRUE
+};
 
-	g_return_val_if_fail (str, NULL);
+void
+mu_str_append_c_literal (GString *gstr, const gchar* str, gboolean in_quotes)
+{
+	const char *cur, *run;
 
-	tmp = g_string_sized_new (2 * strlen(str));
+	g_return_if_fail (gstr);
+	g_return_if_fail (str);
 
 	if (in_quotes)
-		g_string_append_c (tmp, '"');
-
-	for (cur = str; *cur; ++cur)
-		switch (*cur) {
-		case '\\': tmp = g_string_append   (tmp, "\\\\"); break;
-		case '"':  tmp = g_string_append   (tmp, "\\\""); break;
-		default:   tmp = g_string_append_c (tmp, *cur);
+		g_string_append_c (gstr, '"');
+
+	/* append the runs of characters that need no escaping in one
+	 * go */
+	for (run = cur = str; *cur; ++cur)
+		if (G_UNLIKELY (C_LITERAL_ESCAPE[(guchar)*cur])) {
+			g_string_append_len (gstr, run, cur - run);
+			g_string_append_c (gstr, '\\');
+			run = cur; /* the char itself starts the next run */
 		}
+	g_string_append_len (gstr, run, cur - run);
 
 	if (in_quotes)
-		g_string_append_c (tmp, '"');
+		g_string_append_c (gstr, '"');
+}
+
+
+char*
+mu_str_escape_c_literal (const gchar* str, gboolean in_quotes)
+{
+	GString *tmp;
+
+	g_return_val_if_fail (str, NULL);
+
+	tmp = g_string_sized_new (strlen(str) + 8);
+	mu_str_append_c_literal (tmp, str, in_quotes);
 
 	return g_string_free (tmp, FALSE);
 }
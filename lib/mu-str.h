@@ -232,6 +232,17 @@ const char* mu_str_fullpath_s (const char* path, const char* name);
 char* mu_str_escape_c_literal (const gchar* str, gboolean in_quotes)
         G_GNUC_WARN_UNUSED_RESULT;
 
+/**
+ * like mu_str_escape_c_literal, but append the escaped string to a
+ * GString, without any further allocation
+ *
+ * @param gstr a GString to append to
+ * @param str a non-NULL str
+ * @param in_quotes whether the result should be enclosed in ""
+ */
+void mu_str_append_c_literal (GString *gstr, const gchar* str,
+			      gboolean in_quotes);
+
 
 
 /**
@@ -336,6 +347,19 @@ void mu_str_free_list (GSList *lst);
 const gchar* mu_str_subject_normalize (const gchar* str);
 
 
+/**
+ * get a key for sorting @str case-insensitively in the current
+ * locale; two such keys can be compared with strcmp, which gives the
+ * same result as (but is much faster than) comparing the lower-cased
+ * strings with g_utf8_collate
+ *
+ * @param str a utf8-string
+ *
+ * @return a newly allocated sort key; free with g_free
+ */
+gchar* mu_str_collate_key (const gchar *str) G_GNUC_WARN_UNUSED_RESULT;
+
+
 /**
  * take a list of strings, and return the concatenation of their
  * quoted forms
@@ -18,11 +18,13 @@
 **
 */
 #include <math.h>   /* for log, ceil */
-#include <string.h> /* for memset */
+#include <stdio.h>  /* for snprintf */
+#include <string.h> /* for strlen */
 
 #include "mu-threader.h"
 #include "mu-container.h"
 #include "mu-str.h"
+#include "mu-date.h"
 
 /* msg threading implementation based on JWZ's algorithm, as described in:
  *    http://www.jwz.org/doc/threading.html
@@ -30,10 +32,10 @@
  * the implementation follows the terminology from that doc, so should
  * be understandable from that... I did change things a bit though
  *
- * the end result of the threading operation is a hashtable which maps
- * docids (ie., Xapian documents == messages) to 'thread paths'; a
- * thread path is a string denoting the 2-dimensional place of a
- * message in a list of messages,
+ * the end result of the threading operation is an array of the
+ * messages in thread order, with their place in the thread; we can
+ * turn that place into a 'thread path', a string denoting the
+ * 2-dimensional place of a message in a list of messages,
  *
  * Msg1                        => 00000
  * Msg2                        => 00001
@@ -48,189 +50,258 @@
  *
  */
 
-/* step 1 */ static GHashTable* create_containers (MuMsgIter *iter);
-/* step 2 */ static MuContainer *find_root_set (GHashTable *ids);
-static MuContainer* prune_empty_containers (MuContainer *root);
-/* static void group_root_set_by_subject (GSList *root_set); */
-GHashTable* create_doc_id_thread_path_hash (MuContainer *root,
-					    size_t match_num);
+/* step 1 */ static MuContainers* create_containers (const MuThreaderMsg *msgs,
+						     size_t matchnum);
+/* step 2 */ static guint32 find_root_set (MuContainers *containers);
+static guint32 prune_empty_containers (MuContainers *containers,
+				       guint32 root_set);
+/* step 5 */ static guint32 group_root_set_by_subject
+(MuContainers *containers, const MuThreaderMsg *msgs, guint32 root_set);
+static GArray* calculate_aggregates (const MuThreaderMsg *msgs, GArray **nodes,
+				     MuThreaderFlags flags);
 
 /* msg threading algorithm, based on JWZ's algorithm,
  * http://www.jwz.org/doc/threading.html */
-GHashTable*
-mu_threader_calculate (MuMsgIter *iter, size_t matchnum,
-		       MuMsgFieldId sortfield, gboolean revert)
+GArray*
+mu_threader_calculate (const MuThreaderMsg *msgs, size_t matchnum,
+		       MuThreaderFlags flags, GArray **aggrs)
 {
-	GHashTable *id_table, *thread_ids;
-	MuContainer *root_set;
+	MuContainers *containers;
+	GArray *nodes;
+	guint32 root_set;
 
-	g_return_val_if_fail (iter, FALSE);
-	g_return_val_if_fail (mu_msg_field_id_is_valid (sortfield) ||
-			      sortfield == MU_MSG_FIELD_ID_NONE,
-			      FALSE);
+	g_return_val_if_fail (msgs || matchnum == 0, NULL);
+	g_return_val_if_fail (aggrs, NULL);
 
 	/* step 1 */
-	id_table = create_containers (iter);
+	containers = create_containers (msgs, matchnum);
 
 	/* step 2 -- the root_set is the list of children without parent */
-	root_set = find_root_set (id_table);
+	root_set = find_root_set (containers);
 
 	/* step 3: skip until the end; we still need to containers */
 
 	/* step 4: prune empty containers */
-	root_set = prune_empty_containers (root_set);
-
-	/* sort root set */
-	if (sortfield != MU_MSG_FIELD_ID_NONE)
-		root_set = mu_container_sort (root_set, sortfield, revert,
-					      NULL);
+	root_set = prune_empty_containers (containers, root_set);
 
 	/* step 5: group root set by subject */
-	/* group_root_set_by_subject (root_set); */
+	if (root_set && (flags & MU_THREADER_FLAG_GROUP_SUBJECTS))
+		root_set = group_root_set_by_subject (containers, msgs,
+						      root_set);
 
-	/* sort */
-	mu_msg_iter_reset (iter); /* go all the way back */
+	/* sort root set */
+	if (root_set && (flags & MU_THREADER_FLAG_SORT))
+		root_set = mu_containers_sort
+			(containers, root_set,
+			 (flags & MU_THREADER_FLAG_REVERT) ? TRUE : FALSE);
 
-	/* finally, deliver the docid => thread-path hash */
-	thread_ids = mu_container_thread_info_hash_new (root_set,
-							matchnum);
+	/* finally, deliver the messages in thread order */
+	nodes = mu_containers_thread_nodes_new (containers, root_set);
 
-	g_hash_table_destroy (id_table); /* step 3*/
+	mu_containers_destroy (containers); /* step 3*/
 
-	return thread_ids;
+	/* and get the per-thread information; this may re-order the
+	 * threads */
+	*aggrs = calculate_aggregates (msgs, &nodes, flags);
+
+	return nodes;
 }
 
-G_GNUC_UNUSED static void
-check_dup (const char *msgid, MuContainer *c, GHashTable *hash)
+
+/* get a format string for the segments of a thread path, that is the
+ * minimum size to fit up to matchnum matches */
+static void
+thread_segment_format_string (size_t matchnum, char *frmt, size_t len)
 {
-	if (g_hash_table_lookup (hash, c)) {
-		g_warning ("ALREADY!!");
-		mu_container_dump (c, FALSE);
-		g_assert (0);
-	} else
-		g_hash_table_insert (hash, c, GUINT_TO_POINTER(TRUE));
+	unsigned digitnum;
+
+	/* get the number of digits needed in a hex-representation of
+	 * matchnum */
+	digitnum = (unsigned) (ceil (log(matchnum)/log(16)));
+	snprintf (frmt, len, "%%0%ux", digitnum);
 }
 
 
-G_GNUC_UNUSED static void
-assert_no_duplicates (GHashTable *ids)
+const char*
+mu_threader_path (GArray *nodes, guint32 node, size_t matchnum,
+		  GStringChunk *chunk)
 {
-	GHashTable *hash;
+	char frmt[16], segm[16];
+	guint32 cur, u, *ordinals;
+	MuThreadNode *n;
+	GString *path;
+	const char *str;
+
+	g_return_val_if_fail (nodes, NULL);
+	g_return_val_if_fail (node < nodes->len, NULL);
+	g_return_val_if_fail (chunk, NULL);
+
+	thread_segment_format_string (matchnum, frmt, sizeof(frmt));
+
+	/* walk up to the root, and then write the segments top-down */
+	n	 = &g_array_index (nodes, MuThreadNode, node);
+	ordinals = g_new (guint32, n->level + 1);
+	for (u = 0, cur = node; cur != MU_THREAD_NODE_NONE; cur = n->parent) {
+		n = &g_array_index (nodes, MuThreadNode, cur);
+		ordinals[u++] = n->ordinal;
+	}
+
+	path = g_string_sized_new (u * 8);
+	while (u-- > 0) {
+		snprintf (segm, sizeof(segm), frmt, ordinals[u]);
+		g_string_append (path, segm);
+		if (u > 0)
+			g_string_append_c (path, ':');
+	}
 
-	hash = g_hash_table_new (g_direct_hash, g_direct_equal);
+	str = g_string_chunk_insert_len (chunk, path->str, path->len);
 
-	g_hash_table_foreach (ids, (GHFunc)check_dup, hash);
+	g_string_free (path, TRUE);
+	g_free (ordinals);
 
-	g_hash_table_destroy (hash);
+	return str;
 }
 
 
 /* a referred message is a message that is refered by some other
  * message */
-static MuContainer*
-find_or_create_referred (GHashTable *id_table, const char *msgid,
+static guint32
+find_or_create_referred (MuContainers *containers, const char *msgid,
 			 gboolean *created)
 {
-	MuContainer *c;
+	guint32 c;
 
-	g_return_val_if_fail (msgid, NULL);
+	g_return_val_if_fail (msgid, MU_CONTAINER_NONE);
 
-	c = g_hash_table_lookup (id_table, msgid);
+	c = mu_containers_lookup (containers, msgid);
 	*created = !c;
-	if (!c) {
-		c = mu_container_new (NULL, 0, msgid);
-		g_hash_table_insert (id_table, (gpointer)msgid, c);
-		/* assert_no_duplicates (id_table); */
-	}
-
+	if (!c)
+		c = mu_containers_add (containers, 0, 0, NULL, msgid);
 
 	return c;
 }
 
 /* find a container for the given msgid; if it does not exist yet,
  * create a new one, and register it */
-static MuContainer*
-find_or_create (GHashTable *id_table, MuMsg *msg, guint docid)
+static guint32
+find_or_create (MuContainers *containers, const MuThreaderMsg *msg,
+		guint32 match)
 {
 	MuContainer *c;
-	const char* msgid;
+	guint32 id;
 
-	g_return_val_if_fail (msg, NULL);
-	g_return_val_if_fail (docid != 0, NULL);
+	g_return_val_if_fail (msg->docid != 0, MU_CONTAINER_NONE);
 
-	msgid = mu_msg_get_msgid (msg);
-	if (!msgid)
-		msgid = mu_msg_get_path (msg); /* fake it */
+	/* msgid is the path if the message has no message-id; if we
+	 * don't have that either, we can't register the message */
+	if (!msg->msgid)
+		return mu_containers_add (containers, msg->docid, match,
+					  msg->sortkey, NULL);
 
-	c = g_hash_table_lookup (id_table, msgid);
+	id = mu_containers_lookup (containers, msg->msgid);
 
 	/* If id_table contains an empty MuContainer for this ID: * *
 	 * Store this message in the MuContainer's message slot. */
-	if (c) {
-		if (!c->msg) {
-			c->msg	  = mu_msg_ref (msg);
-			c->docid  = docid;
-			return c;
+	if (id) {
+		c = mu_containers_get (containers, id);
+		if (!c->docid) {
+			c->docid   = msg->docid;
+			c->match   = match;
+			c->sortkey = msg->sortkey;
+			return id;
 		} else {
 			/* special case, not in the JWZ algorithm: the
 			 * container exists already and has a message; this
 			 * means that we are seeing *another message* with a
 			 * message-id we already saw... create this message,
 			 * and mark it as a duplicate, and a child of the one
-			 * we saw before; use its path as a fake message-id
+			 * we saw before; we don't register it, as nothing
+			 * can refer to it
 			 * */
-			MuContainer *c2;
-			const char* fake_msgid;
+			guint32 id2;
+
+			id2 = mu_containers_add (containers, msg->docid, match,
+						 msg->sortkey, NULL);
+			mu_containers_get (containers, id2)->flags =
+				MU_CONTAINER_FLAG_DUP;
+			mu_containers_append_children (containers, id, id2);
+
+			return MU_CONTAINER_NONE; /* don't process this
+						   * message further */
+		}
+	} else /* Else: Create a new MuContainer object holding
+		  this message; Index the MuContainer by
+		  Message-ID in id_table. */
+		return mu_containers_add (containers, msg->docid, match,
+					  msg->sortkey, msg->msgid);
+}
 
-			fake_msgid = mu_msg_get_path (msg);
 
-			c2	  = mu_container_new (msg, docid, fake_msgid);
-			c2->flags = MU_CONTAINER_FLAG_DUP;
-			c	  = mu_container_append_children (c, c2);
+/* find the top-level ancestor of a container, by following the
+ * parent pointers */
+static guint32
+find_root (MuContainers *containers, guint32 c)
+{
+	guint32 parent;
 
-			g_hash_table_insert (id_table, (gpointer)fake_msgid, c2);
+	while ((parent = mu_containers_get (containers, c)->parent))
+		c = parent;
 
-			return NULL; /* don't process this message further */
-		}
-	} else { /* Else: Create a new MuContainer object holding
-		    this message; Index the MuContainer by
-		    Message-ID in id_table. */
-		c = mu_container_new (msg, docid, msgid);
-		g_hash_table_insert (id_table, (gpointer)msgid, c);
-		/* assert_no_duplicates (id_table); */
-
-		return c;
-	}
+	return c;
+}
+
+
+/* is @anc a (strict) ancestor of @c? */
+static gboolean
+is_ancestor (MuContainers *containers, guint32 anc, guint32 c)
+{
+	for (c = mu_containers_get (containers, c)->parent; c;
+	     c = mu_containers_get (containers, c)->parent)
+		if (c == anc)
+			return TRUE;
+
+	return FALSE;
 }
 
+
+/* check whether we can make @child a child of @parent without
+ * introducing a loop. Since @child must be parentless, it cannot be a
+ * descendant of @parent, and it is an ancestor of @parent only if
+ * it's the root of @parent's tree. @root caches that root between
+ * calls; it's set to MU_CONTAINER_NONE when unknown */
 static gboolean
-child_elligible (MuContainer *parent, MuContainer *child, gboolean created)
+child_elligible (MuContainers *containers, guint32 parent, guint32 child,
+		 gboolean created, guint32 *root)
 {
 	if (!parent || !child)
 		return FALSE;
-	if (child->parent)
+	if (mu_containers_get (containers, child)->parent)
 		return FALSE;
-	/* if (created) */
-	/* 	return TRUE; */
-	if (mu_container_reachable (parent, child))
-		return FALSE;
-	if (mu_container_reachable (child, parent))
+	if (child == parent)
 		return FALSE;
+	/* a container we just created has no children, so it cannot
+	 * be an ancestor of anything */
+	if (created)
+		return TRUE;
 
-	return TRUE;
+	if (!*root)
+		*root = find_root (containers, parent);
+
+	return *root != child;
 }
 
 
 
 static void /* 1B */
-handle_references (GHashTable *id_table, MuContainer *c)
+handle_references (MuContainers *containers, guint32 c,
+		   const MuThreaderMsg *msg)
 {
-	const GSList *refs, *cur;
-	MuContainer *parent;
+	const char *ref;
+	MuContainer *cont;
+	guint32 parent, root, u;
 	gboolean created;
 
-	refs = mu_msg_get_references (c->msg);
-	if (!refs)
+	if (msg->refnum == 0)
 		return; /* nothing to do */
 
 	/* For each element in the message's References field:
@@ -241,11 +312,12 @@ handle_references (GHashTable *id_table, MuContainer *c)
 
 	/* go over over our list of refs, until 1 before the last... */
 	created = FALSE;
-	for (parent = NULL, cur = refs; cur; cur = g_slist_next (cur)) {
+	root	= MU_CONTAINER_NONE; /* the root of parent's tree, if known */
+	for (parent = MU_CONTAINER_NONE, u = 0, ref = msg->refs;
+	     u != msg->refnum; ++u, ref += strlen (ref) + 1) {
 
-		MuContainer *child;
-		child = find_or_create_referred (id_table, (gchar*)cur->data,
-						 &created);
+		guint32 child;
+		child = find_or_create_referred (containers, ref, &created);
 
 		/*Link the References field's MuContainers together in
 		 * the order implied by the References header.
@@ -256,10 +328,20 @@ handle_references (GHashTable *id_table, MuContainer *c)
 		 search down the children of B to see if A is
 		 reachable, and also search down the children of A to
 		 see if B is reachable. If either is already reachable
-		 as a child of the other, don't add the link. */
+		 as a child of the other, don't add the link.
+
+		 We don't search down the children, but rather walk up
+		 the parent pointers; see child_elligible.
 
-		if (child_elligible (parent, child, created))
-			parent = mu_container_append_children (parent, child);
+		 If we add the link, child ends up in the same tree as
+		 parent, so the root we found stays valid. */
+
+		if (child_elligible (containers, parent, child, created,
+				     &root))
+			parent = mu_containers_append_children
+				(containers, parent, child);
+		else
+			root = MU_CONTAINER_NONE;
 
 		parent = child;
 	}
@@ -283,105 +365,106 @@ handle_references (GHashTable *id_table, MuContainer *c)
 	   Note that at all times, the various ``parent'' and ``child'' fields
 	   must be kept inter-consistent. */
 
-           /* optimization: if the the message was newly added, it's by
-	    * definition not reachable yet */
-
-	if (parent && c && !(c->child && mu_container_reachable (c->child, parent))) {
+	/* c must not become a child of its own descendant; if c has
+	 * no children (the usual case), that cannot happen */
+	cont = mu_containers_get (containers, c);
+	if (parent && !(cont->child && is_ancestor (containers, c, parent))) {
 
 		/* if c already has a parent, remove c from its parent children
 		   and reparent it, as now we know who is c's parent reliably */
-		if (c->parent) {
-			mu_container_remove_child(c->parent, c);
-			c->next = c->last = c->parent = NULL;
+		if (cont->parent) {
+			mu_containers_remove_child (containers, cont->parent, c);
+			cont->next = cont->last = cont->parent =
+				MU_CONTAINER_NONE;
 		}
 
-		parent = mu_container_append_children (parent, c);
+		mu_containers_append_children (containers, parent, c);
 	}
 }
 
 
 
 /* step 1: create the containers, connect them, and fill the id_table */
-static GHashTable*
-create_containers (MuMsgIter *iter)
+static MuContainers*
+create_containers (const MuThreaderMsg *msgs, size_t matchnum)
 {
-	GHashTable *id_table;
-	id_table = g_hash_table_new_full (g_str_hash, g_str_equal,
-					  NULL,
-					  (GDestroyNotify)mu_container_destroy);
+	MuContainers *containers;
+	guint32 match;
 
-	for (mu_msg_iter_reset (iter); !mu_msg_iter_is_done (iter);
-	     mu_msg_iter_next (iter)) {
+	containers = mu_containers_new (matchnum);
 
-		MuContainer *c;
-		MuMsg *msg;
-		unsigned docid;
+	for (match = 0; match != matchnum; ++match) {
 
-		/* 1.A */
-		msg   = mu_msg_iter_get_msg_floating (iter); /* don't unref */
-		docid = mu_msg_iter_get_docid (iter);
+		guint32 c;
 
-		c = find_or_create (id_table, msg, docid);
+		/* 1.A */
+		c = find_or_create (containers, &msgs[match], match);
 
 		/* 1.B and C */
 		if (c)
-			handle_references (id_table, c);
+			handle_references (containers, c, &msgs[match]);
 	}
 
-	return id_table;
+	return containers;
 }
 
 
 
-static void
-filter_root_set (const gchar *msgid, MuContainer *c, MuContainer **root_set)
+/* 2.  Walk over the containers, and gather a list of the MuContainer
+   objects that have no parents; we do that in the order in which we
+   created them */
+static guint32
+find_root_set (MuContainers *containers)
 {
-	/* ignore children */
-	if (c->parent)
-		return;
+	guint32 root_set, u;
 
-	/* ignore duplicates */
-	if (c->flags & MU_CONTAINER_FLAG_DUP)
-		return;
+	for (root_set = MU_CONTAINER_NONE, u = 1;
+	     u <= mu_containers_num (containers); ++u) {
 
-	if (*root_set == NULL) {
-		*root_set = c;
-		return;
-	} else
-		*root_set = mu_container_append_siblings (*root_set, c);
-}
+		MuContainer *c;
+		c = mu_containers_get (containers, u);
 
+		/* ignore children */
+		if (c->parent)
+			continue;
 
-/* 2.  Walk over the elements of id_table, and gather a list of the
-   MuContainer objects that have no parents, but do have children */
-static MuContainer*
-find_root_set (GHashTable *ids)
-{
-	MuContainer *root_set;
+		/* ignore duplicates */
+		if (c->flags & MU_CONTAINER_FLAG_DUP)
+			continue;
 
-	root_set = NULL;
-	g_hash_table_foreach (ids, (GHFunc)filter_root_set, &root_set);
+		if (!root_set)
+			root_set = u;
+		else
+			root_set = mu_containers_append_siblings
+				(containers, root_set, u);
+	}
 
 	return root_set;
 }
 
 
 static gboolean
-prune_maybe (MuContainer *c)
+prune_maybe (MuContainers *containers, guint32 id)
 {
-	MuContainer *cur;
+	MuContainer *c;
+	guint32 cur;
+
+	for (cur = mu_containers_get (containers, id)->child; cur;
+	     cur = mu_containers_get (containers, cur)->next) {
+
+		MuContainerFlag flags;
+		flags = mu_containers_get (containers, cur)->flags;
 
-	for (cur = c->child; cur; cur = cur->next) {
-		if (cur->flags & MU_CONTAINER_FLAG_DELETE)
-			c = mu_container_remove_child (c, cur);
-		else if (cur->flags & MU_CONTAINER_FLAG_SPLICE)
-			c = mu_container_splice_children (c, cur);
+		if (flags & MU_CONTAINER_FLAG_DELETE)
+			mu_containers_remove_child (containers, id, cur);
+		else if (flags & MU_CONTAINER_FLAG_SPLICE)
+			mu_containers_splice_children (containers, id, cur);
 	}
 
-	g_return_val_if_fail (c, FALSE);
+	c = mu_containers_get (containers, id);
 
 	/* don't touch containers with messages */
-	if (c->msg)
+	if (c->docid)
 		return TRUE;
 
 	/* A. If it is an msg-less container with no children, mark it
@@ -400,7 +483,7 @@ prune_maybe (MuContainer *c)
 	 * promote them to the root set -- unless there is
 	 * only one child, in which case, do.
 	 */
-	if (c->child->next) /* ie., > 1 child */
+	if (mu_containers_get (containers, c->child)->next) /* ie., > 1 child */
 		return TRUE;
 
 	c->flags |= MU_CONTAINER_FLAG_SPLICE;
@@ -409,29 +492,413 @@ prune_maybe (MuContainer *c)
 }
 
 
-static MuContainer*
-prune_empty_containers (MuContainer *root_set)
+static guint32
+prune_empty_containers (MuContainers *containers, guint32 root_set)
 {
-	MuContainer *cur;
+	guint32 cur;
 
-	mu_container_foreach (root_set,
-			      (MuContainerForeachFunc)prune_maybe,
-			      NULL);
+	mu_containers_foreach (containers, root_set,
+			       (MuContainersForeachFunc)prune_maybe,
+			       NULL);
 
 	/* and prune the root_set itself... */
-	for (cur = root_set; cur; cur = cur->next) {
+	for (cur = root_set; cur;
+	     cur = mu_containers_get (containers, cur)->next) {
+
+		MuContainer *c;
+		c = mu_containers_get (containers, cur);
+
+		if (c->flags & MU_CONTAINER_FLAG_DELETE)
+			root_set = mu_containers_remove_sibling
+				(containers, root_set, cur);
+
+		else if (c->flags & MU_CONTAINER_FLAG_SPLICE) {
+			guint32 newchild;
+			newchild = c->child;
+			c->child = MU_CONTAINER_NONE;
+			root_set = mu_containers_append_siblings
+				(containers, root_set, newchild);
+		}
+	}
+
+	return root_set;
+}
+
+
+
+/* a member of the root set, with its subject */
+struct _SubjectRoot {
+	guint32		 id;
+	const char	*subject; /* normalized, or NULL */
+	gboolean	 reply;	  /* whether the subject was normalized,
+				   * ie. it's something like 'Re: ...' */
+};
+typedef struct _SubjectRoot SubjectRoot;
+
+
+/* get the subject of a root container; that's the subject of its
+ * message, or, for an empty container, the one of its first child */
+static void
+get_root_subject (MuContainers *containers, const MuThreaderMsg *msgs,
+		  SubjectRoot *root)
+{
+	MuContainer *c;
+	const char *subject;
+
+	root->subject = NULL;
+	root->reply   = FALSE;
+
+	c = mu_containers_get (containers, root->id);
+	if (!c->docid && c->child)
+		c = mu_containers_get (containers, c->child);
+	if (!c->docid || !(subject = msgs[c->match].subject))
+		return;
+
+	root->subject = mu_str_subject_normalize (subject);
+	root->reply   = (root->subject != subject);
+
+	/* don't group messages without a subject */
+	if (!*root->subject)
+		root->subject = NULL;
+}
+
+
+/* when there are multiple roots with the same subject, which should
+ * the others be grouped under? JWZ prefers an empty container, and
+ * otherwise a non-reply */
+static gboolean
+is_better_group (MuContainers *containers, const SubjectRoot *root,
+		 const SubjectRoot *group)
+{
+	gboolean root_empty, group_empty;
+
+	root_empty  = !mu_containers_get (containers, root->id)->docid;
+	group_empty = !mu_containers_get (containers, group->id)->docid;
+
+	if (root_empty != group_empty)
+		return root_empty;
+
+	return group->reply && !root->reply;
+}
 
-		if (cur->flags & MU_CONTAINER_FLAG_DELETE)
-			root_set = mu_container_remove_sibling (root_set, cur);
 
-		else if (cur->flags & MU_CONTAINER_FLAG_SPLICE) {
-			MuContainer *newchild;
-			newchild = cur->child;
-			cur->child = NULL;
-			root_set = mu_container_append_siblings (root_set,
-								 newchild);
+/* put @root in the group with top-level container @group */
+static void
+add_to_group (MuContainers *containers, guint32 group, gboolean group_reply,
+	      const SubjectRoot *root)
+{
+	MuContainer *c;
+	gboolean group_empty;
+	guint32 dummy;
+
+	c	    = mu_containers_get (containers, root->id);
+	group_empty = !mu_containers_get (containers, group)->docid;
+
+	if (group_empty && !c->docid) {
+		/* both are empty; adopt the root's children, and drop
+		 * the root itself */
+		if (c->child) {
+			guint32 child;
+			child	 = c->child;
+			c->child = MU_CONTAINER_NONE;
+			mu_containers_append_children (containers, group,
+						       child);
 		}
+		mu_containers_get (containers, root->id)->flags |=
+			MU_CONTAINER_FLAG_DELETE;
+
+	} else if (group_empty || (c->docid && root->reply && !group_reply))
+		/* the root becomes a child of the group */
+		mu_containers_append_children (containers, group, root->id);
+
+	else {
+		/* otherwise, they become siblings under a new empty
+		 * container; note that this may move the arena */
+		dummy = mu_containers_add (containers, 0, 0, NULL, NULL);
+		mu_containers_append_children (containers, dummy, group);
+		mu_containers_append_children (containers, dummy, root->id);
+	}
+}
+
+
+/* 5. group the root set by subject, so threads of which (some of) the
+ * messages lost their References: header are put together; see JWZ's
+ * document. We do this in linear time: we first find, for each
+ * subject, the root the others should be grouped with; then we group
+ * them, and finally, we rebuild the root set, in the original order */
+static guint32
+group_root_set_by_subject (MuContainers *containers, const MuThreaderMsg *msgs,
+			   guint32 root_set)
+{
+	GArray *roots;
+	GHashTable *groups;
+	guint32 cur, u, lastid;
+
+	roots  = g_array_new (FALSE, FALSE, sizeof(SubjectRoot));
+	groups = g_hash_table_new (g_str_hash, g_str_equal);
+
+	/* find the subjects, and for each subject, the root with the
+	 * best group for it */
+	for (cur = root_set; cur; cur = mu_containers_get (containers,
+							    cur)->next) {
+		SubjectRoot root;
+		guint group;
+
+		root.id = cur;
+		get_root_subject (containers, msgs, &root);
+		g_array_append_val (roots, root);
+
+		if (!root.subject)
+			continue;
+
+		/* the hash values are the indices in roots + 1 */
+		group = GPOINTER_TO_UINT
+			(g_hash_table_lookup (groups, root.subject));
+		if (!group || is_better_group
+		    (containers, &root,
+		     &g_array_index (roots, SubjectRoot, group - 1)))
+			g_hash_table_insert (groups, (gpointer)root.subject,
+					     GUINT_TO_POINTER(roots->len));
+	}
+
+	/* unlink the root set; we'll rebuild it below */
+	for (u = 0; u != roots->len; ++u) {
+		MuContainer *c;
+		c = mu_containers_get (containers,
+				       g_array_index (roots, SubjectRoot, u).id);
+		c->next = c->last = MU_CONTAINER_NONE;
+	}
+
+	/* containers we create now, are the empty parents for groups */
+	lastid = mu_containers_num (containers);
+
+	for (u = 0; u != roots->len; ++u) {
+		SubjectRoot *root, *grouproot;
+		guint32 group, parent;
+
+		root = &g_array_index (roots, SubjectRoot, u);
+		if (!root->subject)
+			continue;
+
+		grouproot = &g_array_index
+			(roots, SubjectRoot,
+			 GPOINTER_TO_UINT (g_hash_table_lookup
+					   (groups, root->subject)) - 1);
+		if (grouproot == root)
+			continue;
+
+		/* the group root may have gotten a new parent */
+		group  = grouproot->id;
+		parent = mu_containers_get (containers, group)->parent;
+		if (parent)
+			group = parent;
+
+		add_to_group (containers, group, grouproot->reply, root);
 	}
 
+	/* rebuild the root set, with the new parents in the place of
+	 * the group roots */
+	for (root_set = MU_CONTAINER_NONE, u = 0; u != roots->len; ++u) {
+
+		MuContainer *c;
+		guint32 id;
+
+		id = g_array_index (roots, SubjectRoot, u).id;
+		c  = mu_containers_get (containers, id);
+
+		if (c->flags & MU_CONTAINER_FLAG_DELETE)
+			continue;
+		else if (c->parent) {
+			/* only keep the new parents */
+			if (c->parent <= lastid ||
+			    mu_containers_get (containers,
+					       c->parent)->child != id)
+				continue;
+			id = c->parent;
+		}
+
+		root_set = root_set ?
+			mu_containers_append_siblings (containers, root_set,
+						       id) : id;
+	}
+
+	g_hash_table_destroy (groups);
+	g_array_free (roots, TRUE);
+
 	return root_set;
 }
+
+
+
+/* a thread, ie. a root and its descendants; since the nodes are in
+ * thread order, those are the nodes start .. start + len - 1 */
+struct _ThreadSpan {
+	guint32		start, len;
+	guint64		oldest, newest; /* YYYYMMDDHHMMSS */
+};
+typedef struct _ThreadSpan ThreadSpan;
+
+
+static time_t
+date_to_time_t (guint64 date)
+{
+	char str[24];
+
+	if (date == 0)
+		return 0;
+
+	snprintf (str, sizeof(str), "%014" G_GUINT64_FORMAT, date);
+	return mu_date_str_to_time_t (str, FALSE/*utc*/);
+}
+
+
+static int
+cmp_activity (const guint32 *a, const guint32 *b, ThreadSpan *spans)
+{
+	guint64 d1, d2;
+
+	d1 = spans[*a].newest;
+	d2 = spans[*b].newest;
+
+	return d1 < d2 ? -1 : (d1 > d2 ? 1 : 0);
+}
+
+static int
+cmp_activity_revert (const guint32 *a, const guint32 *b, ThreadSpan *spans)
+{
+	return cmp_activity (b, a, spans);
+}
+
+
+/* put the threads in the given order; the nodes of each thread stay
+ * together, so we only need to shift their parent-indices, and
+ * renumber the roots */
+static GArray*
+reorder_threads (GArray *nodes, GArray *spans, const guint32 *order)
+{
+	GArray *sorted;
+	guint32 u, v;
+
+	sorted = g_array_sized_new (FALSE, FALSE, sizeof(MuThreadNode),
+				    nodes->len);
+
+	for (u = 0; u != spans->len; ++u) {
+
+		ThreadSpan *span;
+		guint32 start;
+
+		span  = &g_array_index (spans, ThreadSpan, order[u]);
+		start = sorted->len;
+
+		g_array_append_vals (sorted, &g_array_index (nodes, MuThreadNode,
+							     span->start),
+				     span->len);
+
+		for (v = start; v != sorted->len; ++v) {
+			MuThreadNode *node;
+			node = &g_array_index (sorted, MuThreadNode, v);
+			if (node->parent == MU_THREAD_NODE_NONE)
+				node->ordinal = u;
+			else
+				node->parent = node->parent - span->start +
+					start;
+		}
+	}
+
+	g_array_free (nodes, TRUE);
+
+	return sorted;
+}
+
+
+/* calculate the aggregates for each thread, in one pass over the
+ * nodes; to count the participants, we remember for each sender the
+ * last thread we saw it in */
+static GArray*
+calculate_aggregates (const MuThreaderMsg *msgs, GArray **nodes,
+		      MuThreaderFlags flags)
+{
+	GArray *aggrs, *spans;
+	GHashTable *senders;
+	ThreadSpan *span;
+	MuMsgIterThreadAggr *aggr;
+	guint32 u;
+
+	aggrs	= g_array_new (FALSE, TRUE, sizeof(MuMsgIterThreadAggr));
+	spans	= g_array_new (FALSE, TRUE, sizeof(ThreadSpan));
+	senders = g_hash_table_new (g_str_hash, g_str_equal);
+
+	span = NULL;
+	aggr = NULL;
+	for (u = 0; u != (*nodes)->len; ++u) {
+
+		MuThreadNode *node;
+		const MuThreaderMsg *msg;
+
+		node = &g_array_index (*nodes, MuThreadNode, u);
+		if (node->level == 0) { /* a new thread */
+			g_array_set_size (spans, spans->len + 1);
+			g_array_set_size (aggrs, aggrs->len + 1);
+			span = &g_array_index (spans, ThreadSpan,
+					       spans->len - 1);
+			aggr = &g_array_index (aggrs, MuMsgIterThreadAggr,
+					       aggrs->len - 1);
+			span->start = u;
+		}
+
+		++span->len;
+		node->thread = spans->len - 1;
+
+		if (node->match == MU_THREAD_NODE_NONE)
+			continue;
+
+		msg = &msgs[node->match];
+
+		++aggr->msgnum;
+		if (msg->flags & MU_FLAG_UNREAD)
+			++aggr->unread;
+		if (msg->flags & MU_FLAG_FLAGGED)
+			++aggr->flagged;
+		aggr->size += msg->size;
+
+		if (msg->date && (!span->oldest || msg->date < span->oldest))
+			span->oldest = msg->date;
+		if (msg->date > span->newest)
+			span->newest = msg->date;
+
+		if (msg->from && GPOINTER_TO_UINT
+		    (g_hash_table_lookup (senders, msg->from)) != spans->len) {
+			g_hash_table_insert (senders, (gpointer)msg->from,
+					     GUINT_TO_POINTER(spans->len));
+			++aggr->participants;
+		}
+	}
+
+	for (u = 0; u != aggrs->len; ++u) {
+		span = &g_array_index (spans, ThreadSpan, u);
+		aggr = &g_array_index (aggrs, MuMsgIterThreadAggr, u);
+		aggr->oldest = date_to_time_t (span->oldest);
+		aggr->newest = date_to_time_t (span->newest);
+	}
+
+	if ((flags & MU_THREADER_FLAG_SORT_BY_ACTIVITY) && spans->len > 1) {
+		guint32 *order;
+		order = g_new (guint32, spans->len);
+		for (u = 0; u != spans->len; ++u)
+			order[u] = u;
+		/* this is a stable sort, so threads with the same
+		 * date stay in the same order */
+		g_qsort_with_data (order, spans->len, sizeof(guint32),
+				   (flags & MU_THREADER_FLAG_REVERT) ?
+				   (GCompareDataFunc)cmp_activity_revert :
+				   (GCompareDataFunc)cmp_activity,
+				   spans->data);
+		*nodes = reorder_threads (*nodes, spans, order);
+		g_free (order);
+	}
+
+	g_hash_table_destroy (senders);
+	g_array_free (spans, TRUE);
+
+	return aggrs;
+}
@@ -27,28 +27,108 @@
 
 G_BEGIN_DECLS
 
+#define MU_THREAD_NODE_NONE ((guint32)-1)
+
+/* the place of a message (or of a missing message that has replies)
+ * in the thread structure */
+struct _MuThreadNode {
+	guint32			parent;  /* index of the parent node, or
+					  * MU_THREAD_NODE_NONE */
+	guint32			ordinal; /* place among the siblings */
+	guint32			level;   /* thread-depth -- [0...] */
+	guint32			match;   /* index of the message in the
+					  * matches, or MU_THREAD_NODE_NONE
+					  * if the message is missing */
+	guint32			thread;  /* index of the thread's
+					  * aggregates */
+	MuMsgIterThreadProp	prop;
+};
+typedef struct _MuThreadNode MuThreadNode;
+
+
+/* the input for the threader: the bits of a message it needs, as read
+ * from the message's value slots (see mu-msg-iter.cc). The strings are
+ * not owned by the threader, and must remain valid while threading */
+struct _MuThreaderMsg {
+	unsigned	 docid;
+	guint32		 refnum;  /* number of references */
+
+	/* for the thread aggregates */
+	guint64		 date;    /* as a number YYYYMMDDHHMMSS, or 0 */
+	guint32		 flags;   /* MuFlags */
+	guint32		 size;
+	const char	*from;    /* the sender, or NULL */
+
+	const char	*msgid;   /* the message-id, or (if there is
+				   * none) the path */
+	const char	*refs;    /* the references, as refnum
+				   * consecutive 0-terminated strings,
+				   * or NULL */
+	const char	*sortkey; /* a value that sorts with strcmp, or
+				   * NULL */
+	const char	*subject; /* the subject (only needed when
+				   * grouping by subject), or NULL */
+};
+typedef struct _MuThreaderMsg MuThreaderMsg;
+
+
+enum _MuThreaderFlags {
+	MU_THREADER_FLAG_NONE		  = 0,
+	/* sort by the sortkey of the messages */
+	MU_THREADER_FLAG_SORT		  = 1 << 0,
+	/* revert the sorting order */
+	MU_THREADER_FLAG_REVERT		  = 1 << 1,
+	/* put threads with the same (normalized) subject together, for
+	 * messages without a References: header */
+	MU_THREADER_FLAG_GROUP_SUBJECTS	  = 1 << 2,
+	/* sort the threads by the date of their newest message (the
+	 * messages within the threads are still sorted by their
+	 * sortkey) */
+	MU_THREADER_FLAG_SORT_BY_ACTIVITY = 1 << 3
+};
+typedef enum _MuThreaderFlags MuThreaderFlags;
+
+
 /**
- * takes an iter and the total number of matches, and from this
- * generates a hash-table with information about the thread structure
- * of these matches.
+ * takes a table describing the matches, and from this generates
+ * information about the thread structure of these matches.
  *
  * the algorithm to find this structure is based on JWZ's
  * message-threading algorithm, as descrbed in:
  *     http://www.jwz.org/doc/threading.html
  *
- * the returned hashtable maps the Xapian docid of iter (msg) to a ptr
- * to a MuMsgIterThreadInfo structure (see mu-msg-iter.h)
+ * the result is an array of MuThreadNode, in thread order; ie., each
+ * message comes right after its parent (or its preceding sibling's
+ * last descendant).
+ *
+ * @param msgs the matches, in the order of the query results; the
+ * match-field of the nodes refers to this table
+ * @param matches the number of matches in the table
+ * @param flags bitwise OR of MuThreaderFlags
+ * @param aggrs receives a GArray of MuMsgIterThreadAggr, with the
+ * aggregates for each thread; the thread-field of the nodes refers to
+ * this array. Free with g_array_free when done with it.
+ *
+ * @return a GArray of MuThreadNode; free with g_array_free when done
+ * with it
+ */
+GArray *mu_threader_calculate (const MuThreaderMsg *msgs, size_t matches,
+			       MuThreaderFlags flags, GArray **aggrs);
+
+
+/**
+ * get the thread path for a node, ie. a string denoting its place in
+ * the threads, such as "01:03:00"; see mu-threader.c
  *
- * @param iter an iter; note this function will mu_msgi_iter_reset this iterator
- * @param matches the number of matches in the set *
- * @param sortfield the field to sort results by, or
- * MU_MSG_FIELD_ID_NONE if no sorting should be performed
- * @param revert if TRUE, if revert the sorting order
+ * @param nodes the array from mu_threader_calculate
+ * @param node the index of a node in it
+ * @param matches the number of matches
+ * @param chunk a GStringChunk to store the path in
  *
- * @return a hashtable; free with g_hash_table_destroy when done with it
+ * @return the thread path, owned by chunk
  */
-GHashTable *mu_threader_calculate (MuMsgIter *iter, size_t matches,
-				   MuMsgFieldId sortfield, gboolean revert);
+const char* mu_threader_path (GArray *nodes, guint32 node, size_t matches,
+			      GStringChunk *chunk);
 
 
 G_END_DECLS
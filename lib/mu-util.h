@@ -402,6 +402,12 @@ typedef gpointer XapianEnquire;
 /* metadata key for the xapian 'schema' version */
 #define MU_STORE_VERSION_KEY "db_version"
 
+/* metadata keys for date-ordered databases (see
+ * mu_store_reorder_by_date): whether the database is ordered by date,
+ * and the newest date of the messages that are in order */
+#define MU_STORE_DOCID_ORDER_KEY "docid_order"
+#define MU_STORE_ORDER_DATE_KEY  "order_date"
+
 
 /**
  * log something in the log file; note, we use G_LOG_LEVEL_INFO
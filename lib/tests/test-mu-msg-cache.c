@@ -0,0 +1,229 @@
+/* -*-mode: c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-*/
+/*
+** Copyright (C) 2012 Dirk-Jan C. Binnema <djcb@djcbsoftware.nl>
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of the GNU General Public License as published by the
+** Free Software Foundation; either version 3, or (at your option) any
+** later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software Foundation,
+** Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+**
+*/
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif /*HAVE_CONFIG_H*/
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <utime.h>
+
+#include "mu-msg-cache.h"
+#include "mu-store.h"
+#include "test-mu-common.h"
+
+static MuStore *STORE = NULL;
+static gchar *MSGDIR = NULL;
+
+
+/* copy a message from the test maildir, and add it to the store */
+static unsigned
+add_msg (const char *name, char **path)
+{
+	gchar *src, *data;
+	gsize len;
+	unsigned docid;
+
+	src = g_strdup_printf ("%s/cur/%s", MU_TESTMAILDIR, name);
+	g_assert (g_file_get_contents (src, &data, &len, NULL));
+	g_free (src);
+
+	*path = g_strdup_printf ("%s/cur/%s", MSGDIR, name);
+	g_assert (g_file_set_contents (*path, data, len, NULL));
+	g_free (data);
+
+	docid = mu_store_add_path (STORE, *path, "/", NULL);
+	g_assert_cmpuint (docid, !=, MU_STORE_INVALID_DOCID);
+
+	return docid;
+}
+
+
+/* load the message file, and check we can use it */
+static void
+load_unload (MuMsgCache *cache, unsigned docid)
+{
+	MuMsg *msg;
+
+	msg = mu_store_get_msg (STORE, docid, NULL);
+	g_assert (msg);
+
+	g_assert (mu_msg_cache_load (cache, msg, NULL));
+	g_assert (mu_msg_get_header (msg, "Return-Path"));
+	mu_msg_cache_unload (cache, msg);
+
+	mu_msg_unref (msg);
+}
+
+
+static void
+test_mu_msg_cache_load (void)
+{
+	MuMsgCache *cache;
+	unsigned docid, hits, misses;
+	size_t size;
+	char *path;
+	struct utimbuf times;
+
+	docid = add_msg ("1220863042.12663_1.mindcrime!2,S", &path);
+	cache = mu_msg_cache_new (1024 * 1024);
+
+	load_unload (cache, docid);
+	mu_msg_cache_stats (cache, &hits, &misses, &size);
+	g_assert_cmpuint (hits, ==, 0);
+	g_assert_cmpuint (misses, ==, 1);
+	g_assert_cmpuint (size, >, 0);
+
+	load_unload (cache, docid);
+	mu_msg_cache_stats (cache, &hits, &misses, NULL);
+	g_assert_cmpuint (hits, ==, 1);
+	g_assert_cmpuint (misses, ==, 1);
+
+	/* when the file changes, we parse it again */
+	times.actime  = times.modtime = 12345;
+	g_assert (utime (path, &times) == 0);
+	load_unload (cache, docid);
+	mu_msg_cache_stats (cache, &hits, &misses, NULL);
+	g_assert_cmpuint (hits, ==, 1);
+	g_assert_cmpuint (misses, ==, 2);
+
+	mu_msg_cache_destroy (cache);
+	g_free (path);
+}
+
+
+static void
+test_mu_msg_cache_prefetch (void)
+{
+	MuMsgCache *cache;
+	unsigned docid, hits;
+	size_t size;
+	char *path;
+
+	docid = add_msg ("1220863060.12663_3.mindcrime!2,S", &path);
+	cache = mu_msg_cache_new (1024 * 1024);
+
+	g_assert (mu_msg_cache_prefetch (cache, path, NULL));
+	mu_msg_cache_stats (cache, NULL, NULL, &size);
+	g_assert_cmpuint (size, >, 0);
+
+	load_unload (cache, docid);
+	mu_msg_cache_stats (cache, &hits, NULL, NULL);
+	g_assert_cmpuint (hits, ==, 1);
+
+	g_assert (!mu_msg_cache_prefetch (cache, "/foo/bar/non-existent",
+					  NULL));
+
+	mu_msg_cache_destroy (cache);
+	g_free (path);
+}
+
+
+static void
+test_mu_msg_cache_evict (void)
+{
+	MuMsgCache *cache;
+	unsigned docid1, docid2, hits;
+	size_t size1, size2;
+	char *path1, *path2;
+	struct stat statbuf;
+
+	docid1 = add_msg ("1220863087.12663_5.mindcrime!2,S", &path1);
+	docid2 = add_msg ("1220863087.12663_19.mindcrime!2,S", &path2);
+
+	/* find out how big they are */
+	cache = mu_msg_cache_new (1024 * 1024);
+	g_assert (mu_msg_cache_prefetch (cache, path1, NULL));
+	mu_msg_cache_stats (cache, NULL, NULL, &size1);
+	g_assert (mu_msg_cache_prefetch (cache, path2, NULL));
+	mu_msg_cache_stats (cache, NULL, NULL, &size2);
+	size2 -= size1;
+	mu_msg_cache_destroy (cache);
+
+	/* the sizes are those of the files */
+	g_assert (g_stat (path1, &statbuf) == 0);
+	g_assert_cmpuint (size1, ==, (size_t)statbuf.st_size);
+
+	/* room for only one of them */
+	cache = mu_msg_cache_new (MAX (size1, size2));
+	load_unload (cache, docid1);
+	load_unload (cache, docid2);
+	load_unload (cache, docid1);
+	mu_msg_cache_stats (cache, &hits, NULL, NULL);
+	g_assert_cmpuint (hits, ==, 0);
+	load_unload (cache, docid1);
+	mu_msg_cache_stats (cache, &hits, NULL, NULL);
+	g_assert_cmpuint (hits, ==, 1);
+	mu_msg_cache_destroy (cache);
+
+	/* too big for the cache */
+	cache = mu_msg_cache_new (16);
+	load_unload (cache, docid1);
+	load_unload (cache, docid1);
+	mu_msg_cache_stats (cache, &hits, NULL, &size1);
+	g_assert_cmpuint (hits, ==, 0);
+	g_assert_cmpuint (size1, ==, 0);
+	mu_msg_cache_destroy (cache);
+
+	g_free (path1);
+	g_free (path2);
+}
+
+
+int
+main (int argc, char *argv[])
+{
+	int rv;
+	gchar *tmpdir, *xpath, *curdir;
+
+	g_test_init (&argc, &argv, NULL);
+
+	tmpdir = test_mu_common_get_random_tmpdir ();
+	MSGDIR = g_strdup_printf ("%s/maildir", tmpdir);
+	xpath  = g_strdup_printf ("%s/xapian", tmpdir);
+	curdir = g_strdup_printf ("%s/cur", MSGDIR);
+	g_assert (g_mkdir_with_parents (curdir, 0700) == 0);
+	g_free (curdir);
+
+	STORE = mu_store_new_writable (xpath, NULL, FALSE, NULL);
+	g_assert (STORE);
+
+	g_test_add_func ("/mu-msg-cache/test-mu-msg-cache-load",
+			 test_mu_msg_cache_load);
+	g_test_add_func ("/mu-msg-cache/test-mu-msg-cache-prefetch",
+			 test_mu_msg_cache_prefetch);
+	g_test_add_func ("/mu-msg-cache/test-mu-msg-cache-evict",
+			 test_mu_msg_cache_evict);
+
+	g_log_set_handler (NULL,
+			   G_LOG_LEVEL_MASK | G_LOG_FLAG_FATAL| G_LOG_FLAG_RECURSION,
+			   (GLogFunc)black_hole, NULL);
+
+	rv = g_test_run ();
+
+	mu_store_unref (STORE);
+	g_free (MSGDIR);
+	g_free (xpath);
+	g_free (tmpdir);
+
+	return rv;
+}
@@ -440,6 +440,50 @@ test_mu_msg_comp_unix_programmer (void)
 	mu_msg_unref (msg);
 }
 
+static gboolean
+append_contact (MuMsgContact *contact, GString *gstr)
+{
+	g_string_append_printf (gstr, "%s|%s|%d;",
+				mu_msg_contact_name (contact) ?
+				mu_msg_contact_name (contact) : "-",
+				mu_msg_contact_address (contact),
+				mu_msg_contact_type (contact));
+	return TRUE;
+}
+
+
+/* the address lists as they are in the store */
+static void
+test_mu_msg_contacts_str (void)
+{
+	GString *gstr;
+
+	gstr = g_string_new (NULL);
+
+	mu_msg_contact_foreach_str
+		("Foo Bar <foo@bar.cuux>, \"Bar, \\\"Cuux\\\"\" "
+		 "<cuux@bar.cuux>,baz@bar.cuux , M\xc3\xbc <mu@example.com>",
+		 MU_MSG_CONTACT_TYPE_CC,
+		 (MuMsgContactForeachFunc)append_contact, gstr);
+	g_assert_cmpstr (gstr->str, ==,
+			 "Foo Bar|foo@bar.cuux|2;"
+			 "Bar, \"Cuux\"|cuux@bar.cuux|2;"
+			 "-|baz@bar.cuux|2;"
+			 "M\xc3\xbc|mu@example.com|2;");
+
+	g_string_truncate (gstr, 0);
+	mu_msg_contact_foreach_str
+		("<foo@bar.cuux>", MU_MSG_CONTACT_TYPE_FROM,
+		 (MuMsgContactForeachFunc)append_contact, gstr);
+	mu_msg_contact_foreach_str
+		(NULL, MU_MSG_CONTACT_TYPE_FROM,
+		 (MuMsgContactForeachFunc)append_contact, gstr);
+	g_assert_cmpstr (gstr->str, ==, "-|foo@bar.cuux|1;");
+
+	g_string_free (gstr, TRUE);
+}
+
+
 int
 main (int argc, char *argv[])
 {
@@ -472,6 +516,8 @@ main (int argc, char *argv[])
 			 test_mu_msg_umlaut);
 	g_test_add_func ("/mu-msg/mu-msg-comp-unix-programmer",
 			 test_mu_msg_comp_unix_programmer);
+	g_test_add_func ("/mu-msg/mu-msg-contacts-str",
+			 test_mu_msg_contacts_str);
 
 	g_log_set_handler (NULL,
 			   G_LOG_LEVEL_MASK | G_LOG_FLAG_FATAL|
@@ -0,0 +1,247 @@
+/* -*-mode: c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-*/
+/*
+** Copyright (C) 2012 Dirk-Jan C. Binnema <djcb@djcbsoftware.nl>
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of the GNU General Public License as published by the
+** Free Software Foundation; either version 3, or (at your option) any
+** later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software Foundation,
+** Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+**
+*/
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif /*HAVE_CONFIG_H*/
+
+#include <glib.h>
+#include <string.h>
+#include "mu-query-cache.h"
+#include "test-mu-common.h"
+
+
+static GArray*
+get_items (unsigned num)
+{
+	GArray *items;
+	unsigned u;
+
+	items = mu_query_cache_items_new (num);
+	for (u = 0; u != num; ++u) {
+		MuMsgIterThreadInfo ti;
+		memset (&ti, 0, sizeof(ti));
+		ti.threadpath = g_strdup_printf ("%u", u);
+		ti.level      = 0;
+		ti.prop       = MU_MSG_ITER_THREAD_PROP_ROOT;
+		mu_query_cache_items_append (items, u + 1, &ti);
+		g_free (ti.threadpath);
+	}
+
+	return items;
+}
+
+
+static void
+test_mu_query_cache_lookup (void)
+{
+	MuQueryCache *cache;
+	const GArray *items;
+	unsigned hits, misses;
+
+	cache = mu_query_cache_new (1024 * 1024);
+
+	g_assert (!mu_query_cache_lookup (cache, 1, "foo",
+					  MU_MSG_FIELD_ID_DATE,
+					  TRUE, MU_QUERY_FLAG_THREADS, 500));
+	g_assert (mu_query_cache_insert (cache, 1, "foo",
+					 MU_MSG_FIELD_ID_DATE, TRUE,
+					 MU_QUERY_FLAG_THREADS, 500,
+					 get_items (10)));
+
+	items = mu_query_cache_lookup (cache, 1, "foo",
+				       MU_MSG_FIELD_ID_DATE,
+				       TRUE, MU_QUERY_FLAG_THREADS, 500);
+	g_assert (items);
+	g_assert_cmpuint (items->len, ==, 10);
+	g_assert_cmpuint (g_array_index (items, MuQueryCacheItem, 3).docid,
+			  ==, 4);
+	g_assert_cmpstr (g_array_index (items, MuQueryCacheItem,
+					3).ti.threadpath, ==, "3");
+
+	/* different parameters */
+	g_assert (!mu_query_cache_lookup (cache, 1, "foo",
+					  MU_MSG_FIELD_ID_DATE,
+					  FALSE, MU_QUERY_FLAG_THREADS, 500));
+	g_assert (!mu_query_cache_lookup (cache, 1, "foo",
+					  MU_MSG_FIELD_ID_SUBJECT,
+					  TRUE, MU_QUERY_FLAG_THREADS, 500));
+	g_assert (!mu_query_cache_lookup (cache, 1, "foo",
+					  MU_MSG_FIELD_ID_DATE, TRUE,
+					  MU_QUERY_FLAG_THREADS |
+					  MU_QUERY_FLAG_GROUP_SUBJECTS, 500));
+
+	/* new revision */
+	g_assert (!mu_query_cache_lookup (cache, 2, "foo",
+					  MU_MSG_FIELD_ID_DATE,
+					  TRUE, MU_QUERY_FLAG_THREADS, 500));
+
+	mu_query_cache_stats (cache, &hits, &misses, NULL);
+	g_assert_cmpuint (hits, ==, 1);
+	g_assert_cmpuint (misses, ==, 5);
+
+	mu_query_cache_destroy (cache);
+}
+
+
+static void
+test_mu_query_cache_evict (void)
+{
+	MuQueryCache *cache;
+	size_t size;
+
+	/* room for two of these, but not three */
+	cache = mu_query_cache_new (2 * 1000 * sizeof(MuQueryCacheItem) +
+				    8 * 1000);
+
+	g_assert (mu_query_cache_insert (cache, 1, "a", MU_MSG_FIELD_ID_DATE,
+					 FALSE, MU_QUERY_FLAG_NONE, 0, get_items (1000)));
+	g_assert (mu_query_cache_insert (cache, 1, "b", MU_MSG_FIELD_ID_DATE,
+					 FALSE, MU_QUERY_FLAG_NONE, 0, get_items (1000)));
+	/* 'a' is now the most recently used */
+	g_assert (mu_query_cache_lookup (cache, 1, "a", MU_MSG_FIELD_ID_DATE,
+					 FALSE, MU_QUERY_FLAG_NONE, 0));
+	g_assert (mu_query_cache_insert (cache, 1, "c", MU_MSG_FIELD_ID_DATE,
+					 FALSE, MU_QUERY_FLAG_NONE, 0, get_items (1000)));
+
+	g_assert (mu_query_cache_lookup (cache, 1, "a", MU_MSG_FIELD_ID_DATE,
+					 FALSE, MU_QUERY_FLAG_NONE, 0));
+	g_assert (!mu_query_cache_lookup (cache, 1, "b", MU_MSG_FIELD_ID_DATE,
+					  FALSE, MU_QUERY_FLAG_NONE, 0));
+	g_assert (mu_query_cache_lookup (cache, 1, "c", MU_MSG_FIELD_ID_DATE,
+					 FALSE, MU_QUERY_FLAG_NONE, 0));
+
+	/* too big */
+	g_assert (!mu_query_cache_insert (cache, 1, "d", MU_MSG_FIELD_ID_DATE,
+					  FALSE, MU_QUERY_FLAG_NONE, 0, get_items (5000)));
+
+	mu_query_cache_stats (cache, NULL, NULL, &size);
+	g_assert_cmpuint (size, <=, 2 * 1000 * sizeof(MuQueryCacheItem) +
+			  8 * 1000);
+
+	mu_query_cache_clear (cache);
+	mu_query_cache_stats (cache, NULL, NULL, &size);
+	g_assert_cmpuint (size, ==, 0);
+
+	mu_query_cache_destroy (cache);
+}
+
+
+static GArray*
+get_items_for_docids (const unsigned *docids, unsigned num)
+{
+	GArray *items;
+	unsigned u;
+
+	items = mu_query_cache_items_new (num);
+	for (u = 0; u != num; ++u) {
+		MuMsgIterThreadInfo ti;
+		memset (&ti, 0, sizeof(ti));
+		ti.threadpath = g_strdup_printf ("%u", docids[u]);
+		mu_query_cache_items_append (items, docids[u], &ti);
+		g_free (ti.threadpath);
+	}
+
+	return items;
+}
+
+
+static void
+each_diff (MuQueryCacheDiffOp op, const MuQueryCacheItem *item,
+	   unsigned after, GString *gstr)
+{
+	char opchar;
+
+	switch (op) {
+	case MU_QUERY_CACHE_DIFF_REMOVE: opchar = 'r'; break;
+	case MU_QUERY_CACHE_DIFF_UPDATE: opchar = 'u'; break;
+	case MU_QUERY_CACHE_DIFF_MOVE:	 opchar = 'm'; break;
+	default:			 opchar = 'i'; break;
+	}
+
+	if (gstr->len)
+		g_string_append_c (gstr, ' ');
+
+	if (op == MU_QUERY_CACHE_DIFF_REMOVE)
+		g_string_append_printf (gstr, "%c%u", opchar, item->docid);
+	else
+		g_string_append_printf (gstr, "%c%u:%u", opchar, item->docid,
+					after);
+}
+
+
+static void
+test_mu_query_cache_diff (void)
+{
+	GArray *olditems, *newitems, *changed;
+	GString *gstr;
+	unsigned changes[] = { 4, 7, 2 };
+	unsigned olddocids[] = { 1, 2, 3, 4, 5, 6 };
+	unsigned newdocids[] = { 6, 1, 7, 3, 4, 5 };
+
+	olditems = get_items_for_docids (olddocids, G_N_ELEMENTS(olddocids));
+	newitems = get_items_for_docids (newdocids, G_N_ELEMENTS(newdocids));
+	changed  = g_array_new (FALSE, FALSE, sizeof(unsigned));
+	g_array_append_vals (changed, changes, G_N_ELEMENTS(changes));
+
+	/* 2 is gone; 6 moved to the front; 7 is new; 4 changed, but
+	 * stays where it is */
+	gstr = g_string_new (NULL);
+	g_assert_cmpuint (mu_query_cache_items_diff
+			  (olditems, newitems, changed,
+			   (MuQueryCacheDiffFunc)each_diff, gstr), ==, 4);
+	g_assert_cmpstr (gstr->str, ==, "r2 m6:0 i7:1 u4:3");
+
+	/* nothing changed */
+	g_string_truncate (gstr, 0);
+	g_array_set_size (changed, 0);
+	g_assert_cmpuint (mu_query_cache_items_diff
+			  (newitems, newitems, changed,
+			   (MuQueryCacheDiffFunc)each_diff, gstr), ==, 0);
+	g_assert_cmpstr (gstr->str, ==, "");
+
+	g_string_free (gstr, TRUE);
+	g_array_free (changed, TRUE);
+	mu_query_cache_items_free (olditems);
+	mu_query_cache_items_free (newitems);
+}
+
+
+int
+main (int argc, char *argv[])
+{
+	int rv;
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add_func ("/mu-query-cache/test-mu-query-cache-lookup",
+			 test_mu_query_cache_lookup);
+	g_test_add_func ("/mu-query-cache/test-mu-query-cache-evict",
+			 test_mu_query_cache_evict);
+	g_test_add_func ("/mu-query-cache/test-mu-query-cache-diff",
+			 test_mu_query_cache_diff);
+
+	g_log_set_handler (NULL,
+			   G_LOG_LEVEL_MASK | G_LOG_FLAG_FATAL| G_LOG_FLAG_RECURSION,
+			   (GLogFunc)black_hole, NULL);
+
+	rv = g_test_run ();
+
+	return rv;
+}
@@ -25,6 +25,7 @@
 
 #include <glib.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
 
@@ -186,6 +187,41 @@ test_mu_str_esc_to_list (void)
 	}
 }
 
+static void
+test_mu_str_escape_c_literal (void)
+{
+	int i;
+	GString *gstr;
+	struct {
+		const char*	str;
+		const char*	esc;
+	} strs [] = {
+		{ "", "\"\"" },
+		{ "foo", "\"foo\"" },
+		{ "\"foo\"", "\"\\\"foo\\\"\"" },
+		{ "a\\b", "\"a\\\\b\"" },
+		{ "\\\"", "\"\\\\\\\"\"" },
+		{ "caf\xc3\xa9 \"x\"", "\"caf\xc3\xa9 \\\"x\\\"\"" }
+	};
+
+	gstr = g_string_new ("> ");
+	for (i = 0; i != G_N_ELEMENTS(strs); ++i) {
+		gchar *esc;
+
+		esc = mu_str_escape_c_literal (strs[i].str, TRUE);
+		g_assert_cmpstr (esc, ==, strs[i].esc);
+		g_free (esc);
+
+		/* appending gives the same */
+		g_string_truncate (gstr, 2);
+		mu_str_append_c_literal (gstr, strs[i].str, TRUE);
+		g_assert (g_str_has_prefix (gstr->str, "> "));
+		g_assert_cmpstr (gstr->str + 2, ==, strs[i].esc);
+	}
+	g_string_free (gstr, TRUE);
+}
+
+
 static void
 test_mu_str_xapian_escape (void)
 {
@@ -389,6 +425,35 @@ test_mu_str_subject_normalize (void)
 }
 
 
+static int
+cmp_collate_keys (const char *s1, const char *s2)
+{
+	char *k1, *k2;
+	int diff;
+
+	k1 = mu_str_collate_key (s1);
+	k2 = mu_str_collate_key (s2);
+
+	diff = strcmp (k1, k2);
+
+	g_free (k1);
+	g_free (k2);
+
+	return diff;
+}
+
+
+static void
+test_mu_str_collate_key (void)
+{
+	g_assert_cmpint (cmp_collate_keys ("abc", "abd"), <, 0);
+	g_assert_cmpint (cmp_collate_keys ("ABC", "abd"), <, 0);
+	g_assert_cmpint (cmp_collate_keys ("abd", "ABC"), >, 0);
+	g_assert_cmpint (cmp_collate_keys ("Foo", "foo"), ==, 0);
+	g_assert_cmpint (cmp_collate_keys ("", "a"), <, 0);
+}
+
+
 
 static void
 test_mu_term_fixups (void)
@@ -446,6 +511,8 @@ main (int argc, char *argv[])
 	g_test_add_func ("/mu-str/mu-str-normalize-02",
 			 test_mu_str_normalize_02);
 
+	g_test_add_func ("/mu-str/mu-str-escape-c-literal",
+			 test_mu_str_escape_c_literal);
 	g_test_add_func ("/mu-str/mu-str-xapian-escape",
 			 test_mu_str_xapian_escape);
 	g_test_add_func ("/mu-str/mu-str-xapian-escape-non-ascii",
@@ -473,6 +540,8 @@ main (int argc, char *argv[])
 
 	g_test_add_func ("/mu-str/mu_str_subject_normalize",
 			 test_mu_str_subject_normalize);
+	g_test_add_func ("/mu-str/mu_str_collate_key",
+			 test_mu_str_collate_key);
 
 	/* mu_str_xapian_fixup_terms */
 	g_test_add_func ("/mu-str/mu_term_fixups",
@@ -29,6 +29,8 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "mu-msg.h"
 #include "mu-str.h"
@@ -43,6 +45,7 @@
 #include "mu-util.h"
 #include "mu-cmd.h"
 #include "mu-threader.h"
+#include "mu-server-output.h"
 
 typedef gboolean (OutputFunc) (MuMsg *msg, MuMsgIter *iter,
 			       MuConfig *opts, GError **err);
@@ -113,6 +116,7 @@ run_query (MuQuery *xapian, const gchar *query, MuConfig *opts,  GError **err)
 {
 	MuMsgIter *iter;
 	MuMsgFieldId sortid;
+	unsigned flags;
 
 	sortid = MU_MSG_FIELD_ID_NONE;
 	if (opts->sortfield) {
@@ -121,7 +125,17 @@ run_query (MuQuery *xapian, const gchar *query, MuConfig *opts,  GError **err)
 			return FALSE;
 	}
 
-	iter = mu_query_run (xapian, query, opts->threads, sortid,
+	flags = MU_QUERY_FLAG_NONE;
+	if (opts->threads)
+		flags |= MU_QUERY_FLAG_THREADS;
+	if (opts->threads && opts->group_subjects)
+		flags |= MU_QUERY_FLAG_GROUP_SUBJECTS;
+	if (opts->threads && opts->sort_by_activity)
+		flags |= MU_QUERY_FLAG_SORT_BY_ACTIVITY;
+	if (opts->skip_dups)
+		flags |= MU_QUERY_FLAG_SKIP_DUPS;
+
+	iter = mu_query_run (xapian, query, (MuQueryFlags)flags, sortid,
 			     opts->reverse, -1, err);
 	return iter;
 }
@@ -316,34 +330,51 @@ ansi_reset_maybe (MuMsgFieldId mfid, gboolean color)
 }
 
 
+/* get a field either from msg or, if msg is NULL, directly from the
+ * iter (see mu_msg_iter_set_fields) */
 static const char*
-display_field (MuMsg *msg, MuMsgFieldId mfid)
+field_string (MuMsg *msg, MuMsgIter *iter, MuMsgFieldId mfid)
+{
+	return msg ? mu_msg_get_field_string (msg, mfid) :
+		mu_msg_iter_get_field_str (iter, mfid);
+}
+
+static gint64
+field_numeric (MuMsg *msg, MuMsgIter *iter, MuMsgFieldId mfid)
+{
+	return msg ? mu_msg_get_field_numeric (msg, mfid) :
+		mu_msg_iter_get_field_numeric (iter, mfid);
+}
+
+
+static const char*
+display_field (MuMsg *msg, MuMsgIter *iter, MuMsgFieldId mfid)
 {
 	gint64 val;
 
 	switch (mu_msg_field_type(mfid)) {
 	case MU_MSG_FIELD_TYPE_STRING: {
 		const gchar *str;
-		str = mu_msg_get_field_string (msg, mfid);
+		str = field_string (msg, iter, mfid);
 		return str ? str : "";
 	}
 	case MU_MSG_FIELD_TYPE_INT:
 
 		if (mfid == MU_MSG_FIELD_ID_PRIO) {
-			val = mu_msg_get_field_numeric (msg, mfid);
+			val = field_numeric (msg, iter, mfid);
 			return mu_msg_prio_name ((MuMsgPrio)val);
  		} else if (mfid == MU_MSG_FIELD_ID_FLAGS) {
-			val = mu_msg_get_field_numeric (msg, mfid);
+			val = field_numeric (msg, iter, mfid);
 			return mu_str_flags_s ((MuFlags)val);
 		} else  /* as string */
-			return mu_msg_get_field_string (msg, mfid);
+			return field_string (msg, iter, mfid);
 
 	case MU_MSG_FIELD_TYPE_TIME_T:
-		val = mu_msg_get_field_numeric (msg, mfid);
+		val = field_numeric (msg, iter, mfid);
 		return mu_date_str_s ("%c", (time_t)val);
 
 	case MU_MSG_FIELD_TYPE_BYTESIZE:
-		val = mu_msg_get_field_numeric (msg, mfid);
+		val = field_numeric (msg, iter, mfid);
 		return mu_str_size_s ((unsigned)val);
 	default:
 		g_return_val_if_reached (NULL);
@@ -378,8 +409,7 @@ static void
 thread_indent (MuMsgIter *iter)
 {
 	const MuMsgIterThreadInfo *ti;
-	const char* threadpath;
-	int i;
+	guint i;
 	gboolean is_root, first_child, empty_parent, is_dup;
 
 	ti = mu_msg_iter_get_thread_info (iter);
@@ -389,21 +419,13 @@ thread_indent (MuMsgIter *iter)
 		return;
 	}
 
-	threadpath = ti->threadpath;
-	/* fputs (threadpath, stdout); */
-	/* fputs ("  ", stdout); */
-
 	is_root      = ti->prop & MU_MSG_ITER_THREAD_PROP_ROOT;
 	first_child  = ti->prop & MU_MSG_ITER_THREAD_PROP_FIRST_CHILD;
 	empty_parent = ti->prop & MU_MSG_ITER_THREAD_PROP_EMPTY_PARENT;
 	is_dup       = ti->prop & MU_MSG_ITER_THREAD_PROP_DUP;
 
-	/* FIXME: count the colons... */
-	for (i = 0; *threadpath; ++threadpath)
-		i += (*threadpath == ':') ? 1 : 0;
-
 	/* indent */
-	while (i --> 0)
+	for (i = ti->level; i > 0; --i)
 		fputs ("  ", stdout);
 
 	if (!is_root) {
@@ -415,7 +437,7 @@ thread_indent (MuMsgIter *iter)
 
 
 static void
-output_plain_fields (MuMsg *msg, const char *fields,
+output_plain_fields (MuMsg *msg, MuMsgIter *iter, const char *fields,
 		     gboolean color, gboolean threads)
 {
 	const char* myfields;
@@ -434,7 +456,7 @@ output_plain_fields (MuMsg *msg, const char *fields,
 		else {
 			ansi_color_maybe (mfid, color);
 			nonempty += mu_util_fputs_encoded
-			  (display_field (msg, mfid), stdout);
+			  (display_field (msg, iter, mfid), stdout);
 			ansi_reset_maybe (mfid, color);
 		}
 	}
@@ -443,6 +465,7 @@ output_plain_fields (MuMsg *msg, const char *fields,
 		fputs ("\n", stdout);
 }
 
+/* note: msg can be NULL here, see use_iter_fields */
 static gboolean
 output_plain (MuMsg *msg, MuMsgIter *iter, MuConfig *opts, GError **err)
 {
@@ -452,7 +475,8 @@ output_plain (MuMsg *msg, MuMsgIter *iter, MuConfig *opts, GError **err)
 	if (opts->threads)
 		thread_indent (iter);
 
-	output_plain_fields (msg, opts->fields, !opts->nocolor, opts->threads);
+	output_plain_fields (msg, iter, opts->fields, !opts->nocolor,
+			     opts->threads);
 
 	if (opts->summary_len > 0)
 		print_summary (msg, opts);
@@ -545,24 +569,71 @@ output_finish (MuConfig *opts)
 }
 
 
+/* for plain output, when we only need fields that are stored as
+ * values in the database, we can get those directly from the iter,
+ * without instantiating messages; if so, declare the fields and
+ * return TRUE */
+static gboolean
+use_iter_fields (MuMsgIter *iter, MuConfig *opts)
+{
+	MuMsgFieldId mfids[MU_MSG_FIELD_ID_NUM];
+	unsigned num;
+	const char *cur;
+
+	if (opts->format != MU_CONFIG_FORMAT_PLAIN ||
+	    opts->summary_len > 0 || opts->after != 0)
+		return FALSE;
+
+	/* we always need the path, to check if the message is
+	 * readable */
+	mfids[0] = MU_MSG_FIELD_ID_PATH;
+	num	 = 1;
+
+	for (cur = opts->fields; *cur; ++cur) {
+		MuMsgFieldId mfid;
+		mfid = mu_msg_field_id_from_shortcut (*cur, FALSE);
+		if (mfid == MU_MSG_FIELD_ID_NONE ||
+		    (!mu_msg_field_xapian_value (mfid) &&
+		     !mu_msg_field_xapian_contact (mfid)))
+			continue; /* not a field; printed as-is */
+		if (!mu_msg_field_xapian_value (mfid) ||
+		    mu_msg_field_type (mfid) == MU_MSG_FIELD_TYPE_STRING_LIST)
+			return FALSE;
+		if (num < G_N_ELEMENTS(mfids))
+			mfids[num++] = mfid;
+	}
+
+	return mu_msg_iter_set_fields (iter, mfids, num);
+}
+
+
 static gboolean
 output_query_results (MuMsgIter *iter, MuConfig *opts, GError **err)
 {
 	unsigned count;
-	gboolean rv;
+	gboolean rv, iter_fields;
 	OutputFunc *output_func;
 
 	output_func = output_prepare (opts, err);
 	if (!output_func)
 		return FALSE;
 
+	iter_fields = use_iter_fields (iter, opts);
+
 	for (count = 0, rv = TRUE; !mu_msg_iter_is_done(iter);
 	     mu_msg_iter_next (iter)) {
 
 		MuMsg *msg;
 
-		msg = get_message (iter, opts->after);
-		if (!msg)
+		if (iter_fields) {
+			/* see mu_msg_is_readable */
+			const char *path;
+			path = mu_msg_iter_get_field_str
+				(iter, MU_MSG_FIELD_ID_PATH);
+			if (!path || access (path, R_OK) != 0)
+				continue;
+			msg = NULL;
+		} else if (!(msg = get_message (iter, opts->after)))
 			break;
 
 		rv = output_func (msg, iter, opts, err);
@@ -601,6 +672,91 @@ process_query (MuQuery *xapian, const gchar *query, MuConfig *opts, GError **err
 }
 
 
+struct _FacetData {
+	GString		*gstr;
+	char		*facet;   /* the current facet */
+	MuConfigFormat   format;
+};
+typedef struct _FacetData FacetData;
+
+static void
+facet_finish (FacetData *fdata)
+{
+	if (!fdata->facet)
+		return;
+
+	if (fdata->format == MU_CONFIG_FORMAT_SEXP)
+		g_string_append (fdata->gstr, "))\n");
+
+	fputs (fdata->gstr->str, stdout);
+	g_string_truncate (fdata->gstr, 0);
+
+	g_free (fdata->facet);
+	fdata->facet = NULL;
+}
+
+
+static void
+each_facet_value (const char *facet, const char *value, unsigned count,
+		  FacetData *fdata)
+{
+	gboolean first;
+
+	first = FALSE;
+	if (g_strcmp0 (facet, fdata->facet) != 0) {
+		facet_finish (fdata);
+		fdata->facet = g_strdup (facet);
+		first = TRUE;
+	}
+
+	if (fdata->format == MU_CONFIG_FORMAT_SEXP) {
+		char *fstr, *vstr;
+		fstr = mu_str_escape_c_literal (facet, TRUE);
+		vstr = mu_str_escape_c_literal (value, TRUE);
+		if (first)
+			g_string_append_printf (fdata->gstr,
+						"(:facet %s :values (", fstr);
+		g_string_append_printf (fdata->gstr, "%s(%s . %u)",
+					first ? "" : " ", vstr, count);
+		g_free (fstr);
+		g_free (vstr);
+	} else {
+		if (first)
+			g_string_append_printf (fdata->gstr, "%s\n", facet);
+		g_string_append_printf (fdata->gstr, "%10u  %s\n",
+					count, value);
+	}
+}
+
+
+static gboolean
+print_facets (MuQuery *xapian, const gchar *query, MuConfig *opts,
+	      GError **err)
+{
+	FacetData fdata;
+	gboolean rv;
+
+	if (opts->format != MU_CONFIG_FORMAT_PLAIN &&
+	    opts->format != MU_CONFIG_FORMAT_SEXP) {
+		mu_util_g_set_error (err, MU_ERROR_IN_PARAMETERS,
+				     "--facet requires --format=plain or sexp");
+		return FALSE;
+	}
+
+	fdata.gstr   = g_string_sized_new (1024);
+	fdata.facet  = NULL;
+	fdata.format = opts->format;
+
+	rv = mu_query_facets (xapian, query, opts->facets,
+			      (MuQueryFacetForeachFunc)each_facet_value,
+			      &fdata, err);
+	facet_finish (&fdata);
+	g_string_free (fdata.gstr, TRUE);
+
+	return rv;
+}
+
+
 static gboolean
 execute_find (MuStore *store, MuConfig *opts, GError **err)
 {
@@ -620,6 +776,8 @@ execute_find (MuStore *store, MuConfig *opts, GError **err)
 
 	if (opts->format == MU_CONFIG_FORMAT_XQUERY)
 		rv = print_xapian_query (oracle, query_str, err);
+	else if (opts->facets)
+		rv = print_facets (oracle, query_str, opts, err);
 	else
 		rv = process_query (oracle, query_str, opts, err);
 
@@ -710,3 +868,273 @@ mu_cmd_find (MuStore *store, MuConfig *opts, GError **err)
 	else
 		return MU_OK;
 }
+
+
+/* 'find' through 'mu server --socket' *********************************/
+
+static int
+connect_to_server (const char *path, GError **err)
+{
+	struct sockaddr_un addr;
+	int sock;
+
+	if (strlen (path) >= sizeof(addr.sun_path)) {
+		mu_util_g_set_error (err, MU_ERROR_IN_PARAMETERS,
+				     "socket path too long: '%s'", path);
+		return -1;
+	}
+
+	memset (&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy (addr.sun_path, path);
+
+	sock = socket (AF_UNIX, SOCK_STREAM, 0);
+	if (sock != -1 &&
+	    connect (sock, (struct sockaddr*)&addr, sizeof(addr)) == 0)
+		return sock;
+
+	mu_util_g_set_error (err, MU_ERROR_FILE_CANNOT_OPEN,
+			     "cannot connect to the server at '%s': %s",
+			     path, strerror (errno));
+	if (sock != -1)
+		close (sock);
+
+	return -1;
+}
+
+
+static gboolean
+write_all (int fd, const char *buf, size_t len, GError **err)
+{
+	while (len > 0) {
+		ssize_t n;
+		n = write (fd, buf, len);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			mu_util_g_set_error (err, MU_ERROR_FILE_CANNOT_WRITE,
+					     "error writing to the server: %s",
+					     strerror (errno));
+			return FALSE;
+		}
+		buf += n;
+		len -= (size_t)n;
+	}
+
+	return TRUE;
+}
+
+
+/* read the next expression from the server, without the newline that
+ * follows it (see mu-server-output.h); anything outside the frames
+ * (such as the welcome message) is skipped. Returns NULL in case of
+ * error, or at the end of the input. */
+static char*
+read_server_expr (int fd, GString *input, GError **err)
+{
+	char buf[16 * 1024];
+	ssize_t n;
+
+	while (1) {
+
+		const char *pre, *post;
+
+		pre  = memchr (input->str, MU_SERVER_COOKIE_PRE, input->len);
+		post = pre ? memchr (pre, MU_SERVER_COOKIE_POST,
+				     input->len - (pre - input->str)) : NULL;
+		if (post) {
+			gsize start, len;
+			start = post + 1 - input->str;
+			len   = (gsize)strtoul (pre + 1, NULL, 16);
+			if (len > 0 && input->len >= start + len) {
+				char *expr;
+				expr = g_strndup (input->str + start, len - 1);
+				g_string_erase (input, 0, start + len);
+				return expr;
+			}
+		}
+
+		n = read (fd, buf, sizeof(buf));
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+
+		g_string_append_len (input, buf, n);
+	}
+
+	mu_util_g_set_error (err, MU_ERROR_FILE_CANNOT_READ,
+			     "lost the connection to the server");
+	return NULL;
+}
+
+
+/* append a parameter for a framed command, ie. name:value\0 */
+static void
+append_frame_param (GString *args, const char *name, const char *value)
+{
+	g_string_append (args, name);
+	g_string_append_c (args, ':');
+	g_string_append_len (args, value, strlen (value) + 1);
+}
+
+
+/* the 'find' command for the server, for the search options; we send
+ * it as a frame (see mu-server(1)), so we need not quote the query */
+static GString*
+get_server_find_cmd (MuConfig *opts, GError **err)
+{
+	GString *args, *cmd;
+	char *query;
+
+	if (!(query = get_query (opts, err)))
+		return NULL;
+
+	args = g_string_sized_new (256);
+	g_string_append_len (args, "find", strlen ("find") + 1);
+	append_frame_param (args, "query", query);
+	g_free (query);
+
+	if (opts->sortfield) {
+		MuMsgFieldId sortid;
+		sortid = sort_field_from_string (opts->sortfield, err);
+		if (sortid == MU_MSG_FIELD_ID_NONE) {
+			g_string_free (args, TRUE);
+			return NULL;
+		}
+		append_frame_param (args, "sortfield",
+				    mu_msg_field_name (sortid));
+	}
+
+	if (opts->reverse)
+		append_frame_param (args, "reverse", "true");
+	if (opts->threads)
+		append_frame_param (args, "threads", "true");
+	if (opts->threads && opts->group_subjects)
+		append_frame_param (args, "group-subjects", "true");
+	if (opts->threads && opts->sort_by_activity)
+		append_frame_param (args, "sort-by-activity", "true");
+	if (opts->skip_dups)
+		append_frame_param (args, "skip-dups", "true");
+
+	cmd = g_string_sized_new (args->len + 16);
+	g_string_append_printf (cmd, "%c%x%c", MU_SERVER_COOKIE_PRE,
+				(unsigned)args->len, MU_SERVER_COOKIE_POST);
+	g_string_append_len (cmd, args->str, args->len);
+	g_string_append (cmd, "quit\n");
+
+	g_string_free (args, TRUE);
+
+	return cmd;
+}
+
+
+/* handle an expression from the server; returns FALSE when there's
+ * nothing more to expect */
+static gboolean
+handle_server_expr (const char *expr, unsigned *count, gboolean *done,
+		    GError **err)
+{
+	if (g_str_has_prefix (expr, "(:erase "))
+		return TRUE;
+
+	if (g_str_has_prefix (expr, "(:found ")) {
+		*count = (unsigned)strtoul (expr + strlen ("(:found "),
+					    NULL, 10);
+		*done  = TRUE;
+		return FALSE;
+	}
+
+	if (g_str_has_prefix (expr, "(:error ")) {
+		/* (:error <code> :message "<message>") */
+		GSList *lst;
+		lst = mu_str_esc_to_list (expr + 1, NULL);
+		if (g_slist_length (lst) == 4) {
+			char *msg;
+			msg = (char*)g_slist_nth_data (lst, 3);
+			msg[strlen (msg) - 1] = '\0'; /* the ')' */
+			mu_util_g_set_error
+				(err, (MuError)atoi ((char*)g_slist_nth_data
+						     (lst, 1)), "%s", msg);
+		} else
+			mu_util_g_set_error (err, MU_ERROR, "%s", expr);
+		mu_str_free_list (lst);
+		return FALSE;
+	}
+
+	/* a message, already with its newline */
+	if (expr[0] == '(')
+		fputs (expr, stdout);
+
+	return TRUE;
+}
+
+
+MuError
+mu_cmd_find_via_daemon (MuConfig *opts, GError **err)
+{
+	const char *path;
+	char *expr;
+	GString *cmd, *input;
+	unsigned count;
+	gboolean done;
+	int sock;
+
+	g_return_val_if_fail (opts, MU_ERROR_INTERNAL);
+	g_return_val_if_fail (opts->cmd == MU_CONFIG_CMD_FIND,
+			      MU_ERROR_INTERNAL);
+
+	/* the server sends us the sexps, which we pass on as they
+	 * are */
+	if (opts->format != MU_CONFIG_FORMAT_SEXP || opts->exec ||
+	    opts->facets) {
+		mu_util_g_set_error (err, MU_ERROR_IN_PARAMETERS,
+				     "--via-daemon only supports "
+				     "--format=sexp");
+		return MU_ERROR_IN_PARAMETERS;
+	}
+
+	if (!opts->params[1]) {
+		mu_util_g_set_error (err, MU_ERROR_IN_PARAMETERS,
+				     "missing query");
+		return MU_ERROR_IN_PARAMETERS;
+	}
+
+	if (!(cmd = get_server_find_cmd (opts, err)))
+		return MU_G_ERROR_CODE (err);
+
+	path = opts->socket ? opts->socket :
+		mu_runtime_path (MU_RUNTIME_PATH_SOCKET);
+	if ((sock = connect_to_server (path, err)) == -1) {
+		g_string_free (cmd, TRUE);
+		return MU_G_ERROR_CODE (err);
+	}
+
+	count = 0;
+	done  = FALSE;
+	input = g_string_sized_new (16 * 1024);
+
+	if (write_all (sock, cmd->str, cmd->len, err))
+		while ((expr = read_server_expr (sock, input, err))) {
+			gboolean more;
+			more = handle_server_expr (expr, &count, &done, err);
+			g_free (expr);
+			if (!more)
+				break;
+		}
+
+	g_string_free (input, TRUE);
+	g_string_free (cmd, TRUE);
+	close (sock);
+
+	if (!done)
+		return MU_G_ERROR_CODE (err);
+
+	if (count == 0) {
+		mu_util_g_set_error (err, MU_ERROR_NO_MATCHES,
+				     "no matches for search expression");
+		return MU_ERROR_NO_MATCHES;
+	}
+
+	return MU_OK;
+}
@@ -336,6 +336,27 @@ cmd_index (MuIndex *midx, MuConfig *opts, MuIndexStats *stats, GError **err)
 }
 
 
+static MuError
+reorder_by_date (MuStore *store, MuConfig *opts, GError **err)
+{
+	time_t t;
+
+	if (!opts->quiet)
+		g_print ("putting messages in date order [%s]\n",
+			 mu_runtime_path (MU_RUNTIME_PATH_XAPIANDB));
+
+	t = time (NULL);
+	if (!mu_store_reorder_by_date (store, err))
+		return MU_G_ERROR_CODE(err);
+
+	if (!opts->quiet)
+		show_time ((unsigned)(time(NULL)-t),
+			   mu_store_count (store, NULL), !opts->nocolor);
+
+	return MU_OK;
+}
+
+
 static MuIndex*
 init_mu_index (MuStore *store, MuConfig *opts, GError **err)
 {
@@ -400,5 +421,8 @@ mu_cmd_index (MuStore *store, MuConfig *opts, GError **err)
 
 	mu_index_destroy (midx);
 
+	if (rv == MU_OK && opts->date_order && !MU_CAUGHT_SIGNAL)
+		rv = reorder_by_date (store, opts, err);
+
 	return rv;
 }
@@ -28,6 +28,12 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include <glib/gprintf.h>
 
@@ -46,16 +52,20 @@
 #include "mu-cmd.h"
 #include "mu-maildir.h"
 #include "mu-query.h"
+#include "mu-query-cache.h"
+#include "mu-msg-cache.h"
 #include "mu-index.h"
 #include "mu-msg-part.h"
 #include "mu-contacts.h"
 
+#include "mu-server-output.h"
+
 /* signal handling *****************************************************/
 /*
  * when we receive SIGINT, SIGHUP, SIGTERM, set MU_CAUGHT_SIGNAL to
  * TRUE
  * */
-static gboolean MU_TERMINATE;
+static volatile gboolean MU_TERMINATE;
 
 static void
 sig_handler (int sig)
@@ -83,58 +93,147 @@ install_sig_handler (void)
 /************************************************************************/
 
 
+/* requests ************************************************************/
+
 /*
- * Markers for/after the lenght cookie that precedes the expression we
- * write to output. We use octal 376, 377 (ie, 0xfe, 0xff) as they
- * will never occur in utf8 */
+ * a request, ie. a command line from the client. When it has an
+ * id:<number> parameter, the responses carry that same id (as :id
+ * <number>), and the request can be cancelled.
+ */
+struct _ServerContext;
+typedef struct _ServerContext ServerContext;
+
+struct _Request {
+	GSList		*args;	   /* the command and its parameters */
+	GError		*err;	   /* error parsing the line, if any */
+	gboolean	 has_id;
+	unsigned	 id;
+	gboolean	 is_find, is_index, is_quit;
+	gboolean	 detached; /* the indexer owns it */
+	volatile gint	 cancelled;
+	ServerContext	*client;   /* where its output goes */
+};
+typedef struct _Request Request;
+
+/* the request the current thread (the worker, or the indexer) is
+ * running, if any */
+#if GLIB_CHECK_VERSION(2,32,0)
+static GPrivate CURRENT_REQUEST = G_PRIVATE_INIT (NULL);
+#define get_current_request()	((Request*)g_private_get (&CURRENT_REQUEST))
+#define set_current_request(R)	g_private_set (&CURRENT_REQUEST, (R))
+#else
+static GStaticPrivate CURRENT_REQUEST = G_STATIC_PRIVATE_INIT;
+#define get_current_request()					\
+	((Request*)g_static_private_get (&CURRENT_REQUEST))
+#define set_current_request(R)					\
+	g_static_private_set (&CURRENT_REQUEST, (R), NULL)
+#endif /*GLIB_CHECK_VERSION(2,32,0)*/
+
+/* mutexes and conditions; GLib 2.32 changed the API for those */
+#if GLIB_CHECK_VERSION(2,32,0)
+static GMutex*
+mutex_new (void)
+{
+	GMutex *mutex;
+
+	mutex = g_slice_new (GMutex);
+	g_mutex_init (mutex);
+
+	return mutex;
+}
+
+static void
+mutex_free (GMutex *mutex)
+{
+	g_mutex_clear (mutex);
+	g_slice_free (GMutex, mutex);
+}
+
+static GCond*
+cond_new (void)
+{
+	GCond *cond;
+
+	cond = g_slice_new (GCond);
+	g_cond_init (cond);
+
+	return cond;
+}
+
+static void
+cond_free (GCond *cond)
+{
+	g_cond_clear (cond);
+	g_slice_free (GCond, cond);
+}
+
+/* wait for @cond, for at most @msecs milliseconds */
+static void
+cond_wait_msecs (GCond *cond, GMutex *mutex, int msecs)
+{
+	g_cond_wait_until (cond, mutex, g_get_monotonic_time () +
+			   (gint64)msecs * G_TIME_SPAN_MILLISECOND);
+}
+#else
+#define mutex_new()	g_mutex_new ()
+#define mutex_free(M)	g_mutex_free (M)
+#define cond_new()	g_cond_new ()
+#define cond_free(C)	g_cond_free (C)
+
+static void
+cond_wait_msecs (GCond *cond, GMutex *mutex, int msecs)
+{
+	GTimeVal end;
+
+	g_get_current_time (&end);
+	g_time_val_add (&end, (glong)msecs * 1000);
+	g_cond_timed_wait (cond, mutex, &end);
+}
+#endif /*GLIB_CHECK_VERSION(2,32,0)*/
+
+/* whether the current command should stop what it's doing */
+static gboolean
+is_cancelled (void)
+{
+	Request *req;
+
+	if (MU_TERMINATE)
+		return TRUE;
+
+	req = get_current_request ();
+	return req && g_atomic_int_get (&req->cancelled);
+}
 
 
-#define COOKIE_PRE  '\376'
-#define COOKIE_POST '\377'
+/* output **************************************************************/
+
+/* the commands format their expressions straight into the output
+ * buffer of the client of the request; the client's writer thread
+ * writes them when they take OUTPUT_FLUSH_SIZE bytes, when the oldest
+ * of them is OUTPUT_LATENCY_MS old, and at the end of each command */
+#define OUTPUT_FLUSH_SIZE (64 * 1024)
+#define OUTPUT_LATENCY_MS 50
+
+static void append_output (ServerContext *ctx, const char *prefix,
+			   const char *frm, va_list args);
 
 static void G_GNUC_PRINTF(1, 2)
 print_expr (const char* frm, ...)
 {
-	char *expr;
 	va_list ap;
-	ssize_t rv;
-	size_t exprlen, lenlen;
-	char cookie[16];
-	static int outfd = 0;
+	Request *req;
+	char prefix[32];
 
-	if (outfd == 0)
-		outfd = fileno (stdout);
+	req = get_current_request ();
+	g_return_if_fail (req);
 
-	expr    = NULL;
+	/* echo the id of the request, if any */
+	if (req->has_id)
+		g_snprintf (prefix, sizeof(prefix), "(:id %u", req->id);
 
 	va_start (ap, frm);
-	exprlen = g_vasprintf (&expr, frm, ap);
+	append_output (req->client, req->has_id ? prefix : NULL, frm, ap);
 	va_end (ap);
-
-	/* this cookie tells the frontend where to expect the next
-	 * expression */
-
-	cookie[0] = COOKIE_PRE;
-	lenlen = sprintf(cookie + 1, "%x",
-			 (unsigned)exprlen + 1); /* + 1 for \n */
-	cookie[lenlen + 1] = COOKIE_POST;
-
-	/* write the cookie, ie.
-	 *   COOKIE_PRE <len-of-following-sexp-in-hex> COOKIE_POST
-	 */
-	rv = write (outfd, cookie, lenlen + 2);
-	if (rv != -1) {
-		rv = write (outfd, expr, exprlen);
-		g_free (expr);
-	}
-	if (rv != -1)
-		rv = write (outfd, "\n", 1);
-	if (rv == -1) {
-		g_critical ("%s: write() failed: %s",
-			   __FUNCTION__, strerror(errno));
-		/* terminate ourselves */
-		raise (SIGTERM);
-	}
 }
 
 
@@ -166,35 +265,111 @@ print_and_clear_g_error (GError **err)
 }
 
 
-static GSList*
-read_line_as_list (GError **err)
+/* read more input from fd, in a single read(2), into @input; we read
+ * (at most) @want bytes, or 4096, if that's more. Returns FALSE at the
+ * end of the input, in case of error, or when we're terminated */
+static gboolean
+read_more (int fd, GString *input, gsize want)
 {
-	char *line;
-	GSList *lst;
-	GString *gstr;
+	gsize len;
+	ssize_t n;
 
-	line = NULL;
-	gstr = g_string_sized_new (512);
+	len  = input->len;
+	want = MAX (want, 4096);
+	g_string_set_size (input, len + want);
 
-	fputs (";; mu> ", stdout);
+	do
+		n = read (fd, input->str + len, want);
+	while (n == -1 && errno == EINTR && !MU_TERMINATE);
 
-	do {
-		int kar;
+	g_string_set_size (input, n > 0 ? len + (gsize)n : len);
 
-		kar = fgetc (stdin);
-		if (kar == '\n' || kar == EOF)
-			break;
-		else
-			gstr = g_string_append_c (gstr, (char)kar);
+	return n > 0 && !MU_TERMINATE;
+}
 
-	} while (1);
 
-	line = g_string_free (gstr, FALSE);
-	lst = mu_str_esc_to_list (line, err);
+/* read the next line from fd; the input is read in blocks, and
+ * what's after the line is kept in @input for the next time. Returns
+ * NULL at the end of the input, or when we're terminated */
+static char*
+read_line (int fd, GString *input)
+{
+	char *eol, *line;
 
-	g_free (line);
+	while (!(eol = memchr (input->str, '\n', input->len))) {
+		if (read_more (fd, input, 0))
+			continue;
+		/* EOF/error; the last line may not have a newline */
+		if (input->len > 0 && !MU_TERMINATE) {
+			line = g_strdup (input->str);
+			g_string_truncate (input, 0);
+			return line;
+		}
+		return NULL;
+	}
 
-	return lst;
+	line = g_strndup (input->str, eol - input->str);
+	g_string_erase (input, 0, eol - input->str + 1);
+
+	return line;
+}
+
+
+/* the maximum size of a framed command */
+#define MAX_FRAME_SIZE (64 * 1024 * 1024)
+
+/* read a framed command from fd, ie.
+ *     COOKIE_PRE <len in hex> COOKIE_POST <len bytes>
+ * like the output, where the bytes are the command and its parameters,
+ * each terminated by a '\0', e.g. "find\0query:from:jim\0maxnum:10\0".
+ * As the length is known, nothing needs to be escaped, and we can read
+ * the frame with a single read(2).
+ *
+ * Returns the command and its parameters, or NULL in case of error
+ * (with err set) or at the end of the input (with err not set) */
+static GSList*
+read_frame (int fd, GString *input, GError **err)
+{
+	char *post, *end, *payload;
+	gsize len, hdrlen, u;
+	GSList *args;
+
+	while (!(post = memchr (input->str, MU_SERVER_COOKIE_POST,
+				input->len))) {
+		if (input->len > 16)
+			goto badframe;
+		if (!read_more (fd, input, 0))
+			return NULL;
+	}
+
+	len = (gsize)g_ascii_strtoull (input->str + 1, &end, 16);
+	if (end != post || !g_ascii_isxdigit (input->str[1]) ||
+	    len == 0 || len > MAX_FRAME_SIZE)
+		goto badframe;
+
+	/* get the rest of the frame, in one go if we can */
+	hdrlen = post - input->str + 1;
+	while (input->len < hdrlen + len)
+		if (!read_more (fd, input, hdrlen + len - input->len))
+			return NULL;
+
+	payload = input->str + hdrlen;
+	if (payload[len - 1] != '\0')
+		goto badframe;
+
+	for (args = NULL, u = 0; u < len; u += strlen (payload + u) + 1)
+		args = g_slist_prepend (args, g_strdup (payload + u));
+	g_string_erase (input, 0, hdrlen + len);
+
+	return g_slist_reverse (args);
+
+badframe:
+	/* we don't know where the next command starts; drop what we
+	 * have */
+	g_string_truncate (input, 0);
+	mu_util_g_set_error (err, MU_ERROR_IN_PARAMETERS,
+			     "invalid command frame");
+	return NULL;
 }
 
 
@@ -266,7 +441,7 @@ get_docid_from_msgid (MuQuery *query, const char *str, GError **err)
 	MuMsgIter *iter;
 
 	querystr = g_strdup_printf ("msgid:%s", str);
-	iter = mu_query_run (query, querystr, FALSE,
+	iter = mu_query_run (query, querystr, MU_QUERY_FLAG_NONE,
 			     MU_MSG_FIELD_ID_NONE, FALSE, 1, err);
 	g_free (querystr);
 
@@ -300,7 +475,7 @@ get_docids_from_msgids (MuQuery *query, const char *str, GError **err)
 	GSList *lst;
 
 	querystr = g_strdup_printf ("msgid:%s", str);
-	iter = mu_query_run (query, querystr, FALSE,
+	iter = mu_query_run (query, querystr, MU_QUERY_FLAG_NONE,
 			     MU_MSG_FIELD_ID_NONE, FALSE,-1 /*unlimited*/,
 			     err);
 	g_free (querystr);
@@ -361,11 +536,259 @@ determine_docid (MuQuery *query, GSList *args, GError **err)
 #define EQSTR(S1,S2) (g_strcmp0((S1),(S2))==0)
 
 
+/* the last threaded 'find' with 'diff', so we can send only the
+ * differences when it's run again (see cmd_find) */
+struct _LastFind {
+	char		*query;
+	MuQueryFlags	 flags;
+	MuMsgFieldId	 sortfield;
+	gboolean	 reverse;
+	int		 maxnum;
+	char		*fields;
+	guint64		 revision;
+	GArray		*items; /* MuQueryCacheItem */
+};
+typedef struct _LastFind LastFind;
+
+/* the fields to include in the sexps for 'find' (see cmd_find); if
+ * num == 0, we include all the header fields */
+struct _SexpFields {
+	MuMsgFieldId	mfids[MU_MSG_FIELD_ID_NUM];
+	unsigned	num;
+};
+typedef struct _SexpFields SexpFields;
+
+/*
+ * what the clients of the server share. Normally, there is only one
+ * client, on stdin/stdout; with --socket, there can be any number,
+ * each with its own ServerContext.
+ *
+ * while indexing, the indexer thread uses the (writable) store, and
+ * commits in batches; 'find', 'view', 'facets' and 'ping' use the
+ * client's read-only rostore/roquery instead, which it reopens when
+ * there were commits since it last looked. Other commands wait for
+ * the indexer to finish its batch.
+ *
+ * with --socket, the clients always use their read-only database for
+ * those commands, so they can run them at the same time; the other
+ * commands are run one at a time, and are committed right away.
+ */
+struct _ServerShared {
+	MuStore		*store;
+	MuQuery		*query;
+	MuQueryCache	*qcache; /* NULL if there is no cache */
+	gboolean	 daemon; /* serving clients on a socket */
+
+	/* the parsed messages; the prefetcher parses the paths we
+	 * push to the prefetch queue. NULL if there's no cache */
+	MuMsgCache	*mcache;
+	GAsyncQueue	*prefetch;
+	GThread		*prefetcher;
+
+	GThread			*indexer;
+	struct _ServerContext	*indexer_ctx; /* the client that
+						 * started it */
+	volatile gint	 indexing;
+	volatile gint	 commits; /* the number of commits so far */
+
+	/* the (writable) store can only be used by the thread that
+	 * has it (store_busy); the others wait for store_cond */
+	GMutex		*store_lock;
+	GCond		*store_cond;
+	gboolean	 store_busy;
+	guint		 store_waiters;
+	guint		 store_turns; /* times a waiter got it */
+};
+typedef struct _ServerShared ServerShared;
+
 struct _ServerContext {
-	MuStore *store;
-	MuQuery *query;
+	ServerShared	*shared;
+	MuStore		*store;	 /* these are from shared */
+	MuQuery		*query;
+	MuQueryCache	*qcache;
+	LastFind	*last;   /* NULL if there is none */
+	GArray		*found;	 /* the docids (unsigned) of the last
+				  * find, for prefetching */
+
+	int		 infd, outfd;
+	GAsyncQueue	*requests; /* for the worker */
+
+	/* the commands add their expressions to output; the writer
+	 * swaps it with spare, and writes that */
+	MuServerOutput	*output, *spare;
+	GMutex		*outlock;  /* for output and the flags below */
+	GCond		*outcond;  /* wakes up the writer */
+	gboolean	 outflush, outstop;
+	GSList		*active;   /* Request; queued or running */
+
+	MuStore		*rostore;
+	MuQuery		*roquery;
+	gint		 commits;  /* ...when we (re)opened roquery */
+	gboolean	 ro;	   /* the worker uses rostore/roquery */
+
+	/* for the clients on a socket */
+	GThread		*thread;
+	volatile gint	 done;
 };
-typedef struct _ServerContext ServerContext;
+
+#define STORE(CTX) ((CTX)->ro ? (CTX)->rostore : (CTX)->store)
+#define QUERY(CTX) ((CTX)->ro ? (CTX)->roquery : (CTX)->query)
+
+/* take the (writable) store; wait until no-one else has it */
+static void
+lock_store (ServerContext *ctx)
+{
+	ServerShared *shared;
+
+	shared = ctx->shared;
+	g_mutex_lock (shared->store_lock);
+
+	++shared->store_waiters;
+	while (shared->store_busy)
+		g_cond_wait (shared->store_cond, shared->store_lock);
+	--shared->store_waiters;
+
+	shared->store_busy = TRUE;
+	++shared->store_turns;
+
+	g_mutex_unlock (shared->store_lock);
+}
+
+static void
+unlock_store (ServerContext *ctx)
+{
+	ServerShared *shared;
+
+	shared = ctx->shared;
+	g_mutex_lock (shared->store_lock);
+
+	shared->store_busy = FALSE;
+	g_cond_broadcast (shared->store_cond);
+
+	g_mutex_unlock (shared->store_lock);
+}
+
+/* let the threads waiting for the store have it, one after the
+ * other; then, take it back */
+static void
+yield_store (ServerContext *ctx)
+{
+	ServerShared *shared;
+	guint turns;
+
+	shared = ctx->shared;
+	g_mutex_lock (shared->store_lock);
+
+	if (shared->store_waiters > 0) {
+		turns = shared->store_turns + shared->store_waiters;
+		shared->store_busy = FALSE;
+		g_cond_broadcast (shared->store_cond);
+
+		while (shared->store_busy || shared->store_turns < turns)
+			g_cond_wait (shared->store_cond, shared->store_lock);
+
+		shared->store_busy = TRUE;
+	}
+
+	g_mutex_unlock (shared->store_lock);
+}
+
+/* protects shared->indexer and shared->indexer_ctx */
+G_LOCK_DEFINE_STATIC (indexer);
+
+
+static gboolean
+write_failed (ServerContext *ctx)
+{
+	/* a client on the socket went away; stop reading its
+	 * commands */
+	if (ctx->shared->daemon) {
+		shutdown (ctx->infd, SHUT_RDWR);
+		return FALSE;
+	}
+
+	g_critical ("%s: write() failed: %s", __FUNCTION__, strerror(errno));
+
+	/* terminate ourselves; the signal goes to the main thread,
+	 * as the others block it */
+	kill (getpid (), SIGTERM);
+
+	return FALSE;
+}
+
+
+/* add an expression to the output; wake up the writer if it was
+ * waiting for the first one, or if the output is due now */
+static void
+append_output (ServerContext *ctx, const char *prefix, const char *frm,
+	       va_list args)
+{
+	gboolean wake;
+
+	g_mutex_lock (ctx->outlock);
+
+	wake = mu_server_output_due_in (ctx->output) < 0;
+	mu_server_output_vappend (ctx->output, prefix, frm, args);
+	if (wake || mu_server_output_due_in (ctx->output) == 0)
+		g_cond_signal (ctx->outcond);
+
+	g_mutex_unlock (ctx->outlock);
+}
+
+
+/* write the output now, rather than waiting for more; at the end of a
+ * command */
+static void
+flush_output (ServerContext *ctx)
+{
+	g_mutex_lock (ctx->outlock);
+	ctx->outflush = TRUE;
+	g_cond_signal (ctx->outcond);
+	g_mutex_unlock (ctx->outlock);
+}
+
+
+static gpointer
+writer_thread (ServerContext *ctx)
+{
+	gboolean ok, stop;
+
+	ok = TRUE;
+	g_mutex_lock (ctx->outlock);
+	do {
+		MuServerOutput *output;
+		int due;
+
+		stop = ctx->outstop;
+		due  = mu_server_output_due_in (ctx->output);
+		if (!stop && !ctx->outflush && due != 0) {
+			if (due < 0)
+				g_cond_wait (ctx->outcond, ctx->outlock);
+			else
+				cond_wait_msecs (ctx->outcond, ctx->outlock,
+						 due);
+			continue;
+		}
+
+		/* write what we have, while the commands add their
+		 * expressions to the other buffer */
+		output	      = ctx->output;
+		ctx->output   = ctx->spare;
+		ctx->spare    = output;
+		ctx->outflush = FALSE;
+		g_mutex_unlock (ctx->outlock);
+
+		/* this empties the buffer, even if writing fails */
+		if (!mu_server_output_flush (output) && ok)
+			ok = write_failed (ctx);
+
+		g_mutex_lock (ctx->outlock);
+
+	} while (!stop);
+	g_mutex_unlock (ctx->outlock);
+
+	return NULL;
+}
 
 /*************************************************************************/
 /* implementation for the commands -- for each command <x>, there is a
@@ -550,16 +973,38 @@ struct _SexpData {
 	GString *gstr;
 	gboolean personal;
 	time_t after;
+
+	/* for the contacts changed since some revision, which we
+	 * print in chunks */
+	gboolean chunked, reset;
+	unsigned num;	   /* the contacts in gstr */
+	guint64 revision;  /* the current one */
 };
 typedef struct _SexpData SexpData;
 
+/* the maximum number of contacts per (:contacts ...) when printing
+ * them in chunks */
+#define CONTACTS_CHUNK_SIZE 1000
+
+static void
+print_contacts_chunk (SexpData *sdata, gboolean last)
+{
+	if (last)
+		print_expr ("(:contacts (%s) :revision %" G_GUINT64_FORMAT "%s)",
+			    sdata->gstr->str, sdata->revision,
+			    sdata->reset ? " :reset t" : "");
+	else
+		print_expr ("(:contacts (%s) :more t)", sdata->gstr->str);
+
+	sdata->num = 0;
+	g_string_truncate (sdata->gstr, 0);
+}
+
 
 static void
 each_contact_sexp (const char *email, const char *name, gboolean personal,
 		   time_t tstamp, SexpData *sdata)
 {
-	char *escmail;
-
 	/* (maybe) only include 'personal' contacts */
 	if (sdata->personal && !personal)
 		return;
@@ -573,18 +1018,18 @@ each_contact_sexp (const char *email, const char *name, gboolean personal,
 	if (!email || !strstr (email, "@"))
 		return;
 
-	escmail = mu_str_escape_c_literal (email, TRUE);
-
 	if (name) {
-		char *escname;
-		escname = mu_str_escape_c_literal (name, TRUE);
-		g_string_append_printf (sdata->gstr, "(:name %s :mail %s)\n",
-					escname, escmail);
-		g_free (escname);
+		g_string_append (sdata->gstr, "(:name ");
+		mu_str_append_c_literal (sdata->gstr, name, TRUE);
+		g_string_append (sdata->gstr, " :mail ");
 	} else
-		g_string_append_printf (sdata->gstr, "(:mail %s)\n", escmail);
+		g_string_append (sdata->gstr, "(:mail ");
+
+	mu_str_append_c_literal (sdata->gstr, email, TRUE);
+	g_string_append (sdata->gstr, ")\n");
 
-	g_free (escmail);
+	if (sdata->chunked && ++sdata->num == CONTACTS_CHUNK_SIZE)
+		print_contacts_chunk (sdata, FALSE);
 }
 
 
@@ -605,6 +1050,7 @@ contacts_to_sexp (MuContacts *contacts, gboolean personal, time_t after)
 
 	sdata.personal = personal;
 	sdata.after    = after;
+	sdata.chunked  = FALSE;
 
 	/* make a guess for the initial size */
 	sdata.gstr = g_string_sized_new (mu_contacts_count(contacts) * 128);
@@ -618,11 +1064,51 @@ contacts_to_sexp (MuContacts *contacts, gboolean personal, time_t after)
 }
 
 
+/* print the contacts that changed since @revision in chunks of (up
+ * to) CONTACTS_CHUNK_SIZE contacts; see cmd_contacts */
+static void
+print_contacts_since (MuContacts *contacts, guint64 revision,
+		      gboolean personal, time_t after)
+{
+	SexpData sdata;
+
+	sdata.personal = personal;
+	sdata.after    = after;
+	sdata.chunked  = TRUE;
+	sdata.num      = 0;
+	sdata.revision = mu_contacts_revision (contacts);
+	sdata.gstr     = g_string_sized_new (CONTACTS_CHUNK_SIZE * 64);
+
+	/* if we don't know what changed since @revision, we get all
+	 * the contacts, and the client should forget the ones it had */
+	sdata.reset = !mu_contacts_foreach_since
+		(contacts, revision, (MuContactsForeachFunc)each_contact_sexp,
+		 &sdata, NULL);
+
+	print_contacts_chunk (&sdata, TRUE);
+	g_string_free (sdata.gstr, TRUE);
+}
+
+
+/*
+ * 'contacts' gets the contacts from the store, which keeps them in
+ * memory and updates them when messages are added. Parameters are
+ * 'personal:true' to get only the personal contacts, and 'after:'
+ * to only get the contacts seen after some time_t.
+ *
+ * without a 'revision:' parameter, returns all of them in a single
+ * (:contacts (<contact> ...)). With 'revision:<revision>', we only
+ * return the contacts that changed after that revision (or all of
+ * them for 'revision:0'), in chunks of (:contacts (<contact> ...)
+ * :more t); the last chunk has no :more, but instead the current
+ * :revision, to use in the next request. If it also has :reset t, we
+ * did not know what changed since the given revision, and sent all
+ * the contacts; the client should then forget the others it had.
+ */
 static MuError
 cmd_contacts (ServerContext *ctx, GSList *args, GError **err)
 {
 	MuContacts *contacts;
-	char *sexp;
 	gboolean personal;
 	time_t after;
 	const char *str;
@@ -631,53 +1117,180 @@ cmd_contacts (ServerContext *ctx, GSList *args, GError **err)
 	str = get_string_from_args (args, "after", TRUE, NULL);
 	after = str ? (time_t)atoi(str) : 0;
 
-	contacts = mu_contacts_new
-		(mu_runtime_path (MU_RUNTIME_PATH_CONTACTS));
+	contacts = mu_store_contacts (ctx->store);
 	if (!contacts) {
 		print_error (MU_ERROR_INTERNAL,
 			     "failed to open contacts cache");
 		return MU_OK;
 	}
 
-	/* dump the contacts cache as a giant sexp */
-	sexp = contacts_to_sexp (contacts, personal, after);
-	print_expr ("%s\n", sexp);
-	g_free (sexp);
+	str = get_string_from_args (args, "revision", TRUE, NULL);
+	if (str)
+		print_contacts_since (contacts,
+				      g_ascii_strtoull (str, NULL, 10),
+				      personal, after);
+	else {
+		/* dump the contacts cache as a giant sexp */
+		char *sexp;
+		sexp = contacts_to_sexp (contacts, personal, after);
+		print_expr ("%s\n", sexp);
+		g_free (sexp);
+	}
 
-	mu_contacts_destroy (contacts);
 	return MU_OK;
 }
 
 
 
+/* put the sexp for a message in the 'find' results in buf, with only
+ * the given fields, or all the header fields if fields is NULL; we
+ * re-use the buffer for all the messages */
+static const char*
+msg_sexp (GString *buf, MuMsg *msg, unsigned docid,
+	  const MuMsgIterThreadInfo *ti, const SexpFields *fields)
+{
+	g_string_truncate (buf, 0);
+
+	if (fields)
+		mu_msg_append_sexp_fields (msg, buf, docid, ti, fields->mfids,
+					   fields->num);
+	else
+		mu_msg_append_sexp (msg, buf, docid, ti,
+				    MU_MSG_OPTION_HEADERS_ONLY);
+
+	return buf->str;
+}
+
+/* enough for the headers of most messages */
+#define SEXP_BUF_SIZE 2048
+
+
+/* declare the fields for the messages in iter, so we can get them
+ * without a MuMsg; we always need the path, to see if the message is
+ * readable. Tags are not stored as a value (see
+ * mu_msg_iter_append_sexp_fields) */
+static void
+set_iter_fields (MuMsgIter *iter, const SexpFields *fields)
+{
+	MuMsgFieldId mfids[MU_MSG_FIELD_ID_NUM];
+	unsigned u, num;
+
+	mfids[0] = MU_MSG_FIELD_ID_PATH;
+	for (u = 0, num = 1; u != fields->num; ++u)
+		if (fields->mfids[u] != MU_MSG_FIELD_ID_PATH &&
+		    fields->mfids[u] != MU_MSG_FIELD_ID_TAGS)
+			mfids[num++] = fields->mfids[u];
+
+	mu_msg_iter_set_fields (iter, mfids, num);
+}
+
+
+/* is the current message of iter readable? */
+static gboolean
+iter_msg_is_readable (MuMsgIter *iter, const SexpFields *fields)
+{
+	const char *path;
+
+	if (!fields)
+		return mu_msg_is_readable
+			(mu_msg_iter_get_msg_floating (iter));
+
+	path = mu_msg_iter_get_field_str (iter, MU_MSG_FIELD_ID_PATH);
+	return path && access (path, R_OK) == 0;
+}
+
+
+/* put the sexp for the current message of iter in buf; with fields,
+ * we get the values straight from the iterator, as collect_items
+ * does, and only need a MuMsg for all the headers */
+static const char*
+iter_msg_sexp (GString *buf, MuMsgIter *iter, unsigned docid,
+	       const MuMsgIterThreadInfo *ti, const SexpFields *fields)
+{
+	if (!fields)
+		return msg_sexp (buf, mu_msg_iter_get_msg_floating (iter),
+				 docid, ti, NULL);
+
+	g_string_truncate (buf, 0);
+	mu_msg_iter_append_sexp_fields (iter, buf, docid, ti, fields->mfids,
+					fields->num);
+	return buf->str;
+}
+
+
+/* print the sexps for the messages in iter; if items is non-NULL,
+ * add the docid/thread-info for each of them, for the query cache */
 static unsigned
-print_sexps (MuMsgIter *iter, gboolean threads, unsigned maxnum)
+print_sexps (MuMsgIter *iter, gboolean threads, unsigned maxnum,
+	     const SexpFields *fields, GArray *items)
 {
 	unsigned u;
-	u = 0;
+	GString *buf;
 
-	while (!mu_msg_iter_is_done (iter) && u < maxnum && !MU_TERMINATE) {
+	u   = 0;
+	buf = g_string_sized_new (SEXP_BUF_SIZE);
 
-		MuMsg *msg;
-		msg = mu_msg_iter_get_msg_floating (iter);
+	if (fields)
+		set_iter_fields (iter, fields);
 
-		if (mu_msg_is_readable (msg)) {
-			char *sexp;
+	while (!mu_msg_iter_is_done (iter) && u < maxnum &&
+	       !is_cancelled ()) {
+
+		if (iter_msg_is_readable (iter, fields)) {
+			unsigned docid;
 			const MuMsgIterThreadInfo* ti;
 
+			docid = mu_msg_iter_get_docid (iter);
 			ti = threads ? mu_msg_iter_get_thread_info (iter) : NULL;
-			sexp = mu_msg_to_sexp (msg, mu_msg_iter_get_docid (iter),
-					       ti, MU_MSG_OPTION_HEADERS_ONLY);
-			print_expr ("%s", sexp);
-			g_free (sexp);
+			print_expr ("%s", iter_msg_sexp (buf, iter, docid, ti,
+							 fields));
+			if (items)
+				mu_query_cache_items_append (items, docid, ti);
 			++u;
 		}
 		mu_msg_iter_next (iter);
 	}
+
+	g_string_free (buf, TRUE);
 	return u;
 }
 
 
+/* print the sexps for a cached query result */
+static unsigned
+print_cached_sexps (MuStore *store, const GArray *items, gboolean threads,
+		    const SexpFields *fields)
+{
+	unsigned u, n;
+	GString *buf;
+
+	buf = g_string_sized_new (SEXP_BUF_SIZE);
+	for (u = n = 0; u != items->len && !is_cancelled (); ++u) {
+
+		MuMsg *msg;
+		const MuQueryCacheItem *item;
+
+		item = &g_array_index (items, MuQueryCacheItem, u);
+		msg  = mu_store_get_msg (store, item->docid, NULL);
+		if (!msg)
+			continue;
+
+		if (mu_msg_is_readable (msg)) {
+			print_expr
+				("%s", msg_sexp
+				 (buf, msg, item->docid,
+				  threads && item->ti.threadpath ?
+				  &item->ti : NULL, fields));
+			++n;
+		}
+		mu_msg_unref (msg);
+	}
+
+	g_string_free (buf, TRUE);
+	return n;
+}
+
+
 static MuError
 save_part (MuMsg *msg, unsigned docid,
 	   unsigned index, GSList *args, GError **err)
@@ -796,6 +1409,24 @@ action_type (const char *actionstr)
 		return INVALID_ACTION;
 }
 
+/* when we have a message cache, get the parsed message file for msg
+ * from there (if it has it), and put it back when we're done */
+static void
+load_msg_file (ServerContext *ctx, MuMsg *msg)
+{
+	/* if this fails, we'll get the error when using the message */
+	if (ctx->shared->mcache)
+		mu_msg_cache_load (ctx->shared->mcache, msg, NULL);
+}
+
+static void
+unload_msg_file (ServerContext *ctx, MuMsg *msg)
+{
+	if (ctx->shared->mcache)
+		mu_msg_cache_unload (ctx->shared->mcache, msg);
+}
+
+
 /* 'extract' extracts some mime part from a message */
 static MuError
 cmd_extract (ServerContext *ctx, GSList *args, GError **err)
@@ -825,6 +1456,7 @@ cmd_extract (ServerContext *ctx, GSList *args, GError **err)
 		return MU_OK;
 	}
 
+	load_msg_file (ctx, msg);
 	switch (action) {
 	case SAVE: rv = save_part (msg, docid, index, args, err); break;
 	case OPEN: rv = open_part (msg, docid, index, err); break;
@@ -835,23 +1467,98 @@ cmd_extract (ServerContext *ctx, GSList *args, GError **err)
 	if (rv != MU_OK)
 		print_and_clear_g_error (err);
 
+	unload_msg_file (ctx, msg);
 	mu_msg_unref (msg);
 	return MU_OK;
 }
 
-/* parse the find parameters, and return the values as out params */
-static MuError
-get_find_params (GSList *args, gboolean *threads, MuMsgFieldId *sortfield,
-		 gboolean *reverse, int *maxnum, GError **err)
+struct _FacetData {
+	GString		*gstr;
+	char		*facet; /* the current facet */
+};
+typedef struct _FacetData FacetData;
+
+static void
+each_facet_value (const char *facet, const char *value, unsigned count,
+		  FacetData *fdata)
 {
-	const char *maxnumstr, *sortfieldstr;
+	char *escval;
+
+	if (g_strcmp0 (facet, fdata->facet) != 0) {
+		char *escfacet;
+		escfacet = mu_str_escape_c_literal (facet, TRUE);
+		g_string_append_printf (fdata->gstr, "%s(:facet %s :values (",
+					fdata->facet ? "))" : "", escfacet);
+		g_free (escfacet);
+		g_free (fdata->facet);
+		fdata->facet = g_strdup (facet);
+	}
 
-	/* maximum number of results */
-	maxnumstr = get_string_from_args (args, "maxnum", TRUE, NULL);
-	*maxnum = maxnumstr ? atoi (maxnumstr) : 0;
+	escval = mu_str_escape_c_literal (value, TRUE);
+	g_string_append_printf (fdata->gstr, "(%s . %u)", escval, count);
+	g_free (escval);
+}
+
+/*
+ * 'facets' counts the number of messages matching 'query' for each
+ * value of the comma-separated list of fields in 'facets' (see
+ * mu_query_facets); the messages themselves are not returned
+ *
+ * returns:
+ * => (:facets ((:facet "maildir" :values (("/inbox" . 12) ...)) ...))
+ */
+static MuError
+cmd_facets (ServerContext *ctx, GSList *args, GError **err)
+{
+	const char *querystr, *facets;
+	FacetData fdata;
+
+	GET_STRING_OR_ERROR_RETURN (args, "query", &querystr, err);
+	GET_STRING_OR_ERROR_RETURN (args, "facets", &facets, err);
+
+	fdata.gstr  = g_string_sized_new (1024);
+	fdata.facet = NULL;
+
+	if (!mu_query_facets (QUERY(ctx), querystr, facets,
+			      (MuQueryFacetForeachFunc)each_facet_value,
+			      &fdata, err))
+		print_and_clear_g_error (err);
+	else
+		print_expr ("(:facets (%s%s))", fdata.gstr->str,
+			    fdata.facet ? "))" : "");
+
+	g_free (fdata.facet);
+	g_string_free (fdata.gstr, TRUE);
+
+	return MU_OK;
+}
+
+
+/* parse the find parameters, and return the values as out params */
+static MuError
+get_find_params (GSList *args, MuQueryFlags *qflags, MuMsgFieldId *sortfield,
+		 gboolean *reverse, int *maxnum, GError **err)
+{
+	const char *maxnumstr, *sortfieldstr;
+	unsigned flags;
+
+	/* maximum number of results */
+	maxnumstr = get_string_from_args (args, "maxnum", TRUE, NULL);
+	*maxnum = maxnumstr ? atoi (maxnumstr) : 0;
 
-	/* whether to show threads or not */
-	*threads = get_bool_from_args (args, "threads", TRUE, NULL);
+	/* whether to show threads or not, and if so, whether to group
+	 * them by subject */
+	flags = MU_QUERY_FLAG_NONE;
+	if (get_bool_from_args (args, "threads", TRUE, NULL)) {
+		flags |= MU_QUERY_FLAG_THREADS;
+		if (get_bool_from_args (args, "group-subjects", TRUE, NULL))
+			flags |= MU_QUERY_FLAG_GROUP_SUBJECTS;
+		if (get_bool_from_args (args, "sort-by-activity", TRUE, NULL))
+			flags |= MU_QUERY_FLAG_SORT_BY_ACTIVITY;
+	}
+	if (get_bool_from_args (args, "skip-dups", TRUE, NULL))
+		flags |= MU_QUERY_FLAG_SKIP_DUPS;
+	*qflags	 = (MuQueryFlags)flags;
 	*reverse = get_bool_from_args (args, "reverse", TRUE, NULL);
 
 	/* field to sort by */
@@ -871,6 +1578,362 @@ get_find_params (GSList *args, gboolean *threads, MuMsgFieldId *sortfield,
 }
 
 
+static void
+last_find_destroy (LastFind *last)
+{
+	if (!last)
+		return;
+
+	g_free (last->query);
+	g_free (last->fields);
+	mu_query_cache_items_free (last->items);
+	g_slice_free (LastFind, last);
+}
+
+
+/* remember this find; takes ownership of items */
+static void
+set_last_find (ServerContext *ctx, const char *querystr, MuQueryFlags qflags,
+	       MuMsgFieldId sortfield, gboolean reverse, int maxnum,
+	       const char *fieldsstr, guint64 revision, GArray *items)
+{
+	LastFind *last;
+
+	last_find_destroy (ctx->last);
+
+	last		= g_slice_new (LastFind);
+	last->query	= g_strdup (querystr);
+	last->flags	= qflags;
+	last->sortfield = sortfield;
+	last->reverse	= reverse;
+	last->maxnum	= maxnum;
+	last->fields	= g_strdup (fieldsstr);
+	last->revision	= revision;
+	last->items	= items;
+
+	ctx->last = last;
+}
+
+
+static gboolean
+is_last_find (ServerContext *ctx, const char *querystr, MuQueryFlags qflags,
+	      MuMsgFieldId sortfield, gboolean reverse, int maxnum,
+	      const char *fieldsstr)
+{
+	const LastFind *last;
+
+	last = ctx->last;
+
+	return last && g_strcmp0 (last->query, querystr) == 0 &&
+		last->flags == qflags && last->sortfield == sortfield &&
+		last->reverse == reverse && last->maxnum == maxnum &&
+		g_strcmp0 (last->fields, fieldsstr) == 0;
+}
+
+
+static GArray*
+copy_items (const GArray *items)
+{
+	GArray *copy;
+	guint u;
+
+	copy = mu_query_cache_items_new (items->len);
+	for (u = 0; u != items->len; ++u) {
+		const MuQueryCacheItem *item;
+		item = &g_array_index (items, MuQueryCacheItem, u);
+		mu_query_cache_items_append (copy, item->docid, &item->ti);
+	}
+
+	return copy;
+}
+
+
+/* get the docid/thread-info for (at most) maxnum readable messages
+ * in iter, like print_sexps would print them */
+static GArray*
+collect_items (MuMsgIter *iter, unsigned maxnum)
+{
+	GArray *items;
+	MuMsgFieldId pathfield;
+
+	/* we only need the path, not the whole message */
+	pathfield = MU_MSG_FIELD_ID_PATH;
+	mu_msg_iter_set_fields (iter, &pathfield, 1);
+
+	items = mu_query_cache_items_new (0);
+	while (!mu_msg_iter_is_done (iter) && items->len < maxnum &&
+	       !is_cancelled ()) {
+
+		const char *path;
+
+		path = mu_msg_iter_get_field_str (iter, MU_MSG_FIELD_ID_PATH);
+		if (path && access (path, R_OK) == 0)
+			mu_query_cache_items_append
+				(items, mu_msg_iter_get_docid (iter),
+				 mu_msg_iter_get_thread_info (iter));
+
+		mu_msg_iter_next (iter);
+	}
+
+	return items;
+}
+
+
+struct _DiffData {
+	MuStore			*store;
+	const SexpFields	*fields;
+	GString			*buf;
+};
+typedef struct _DiffData DiffData;
+
+static void
+print_diff (MuQueryCacheDiffOp op, const MuQueryCacheItem *item,
+	    unsigned after, DiffData *ddata)
+{
+	MuMsg *msg;
+	char *sexp;
+	const char *msgsexp;
+
+	switch (op) {
+	case MU_QUERY_CACHE_DIFF_REMOVE:
+		print_expr ("(:remove %u)", item->docid);
+		return;
+	case MU_QUERY_CACHE_DIFF_MOVE:
+		sexp = mu_msg_thread_info_to_sexp (&item->ti);
+		print_expr ("(:reorder %u :after %u :thread %s)",
+			    item->docid, after, sexp);
+		g_free (sexp);
+		return;
+	default:
+		break;
+	}
+
+	msg = mu_store_get_msg (ddata->store, item->docid, NULL);
+	if (!msg)
+		return;
+
+	msgsexp = msg_sexp (ddata->buf, msg, item->docid, &item->ti,
+			    ddata->fields);
+	if (op == MU_QUERY_CACHE_DIFF_UPDATE)
+		print_expr ("(:update %s :move nil)", msgsexp);
+	else
+		print_expr ("(:insert %s :after %u)", msgsexp, after);
+
+	mu_msg_unref (msg);
+}
+
+
+/* remember the docids of the messages we found, so we can prefetch
+ * the neighbours of the ones that are viewed (see cmd_view); with
+ * append, we add them to the earlier ones (for the pages of
+ * find_paged) */
+static void
+set_found (ServerContext *ctx, const GArray *items, gboolean append)
+{
+	guint u;
+
+	if (!ctx->shared->mcache)
+		return;
+
+	if (!ctx->found)
+		ctx->found = g_array_new (FALSE, FALSE, sizeof(unsigned));
+	if (!append)
+		g_array_set_size (ctx->found, 0);
+
+	for (u = 0; u != items->len; ++u)
+		g_array_append_val
+			(ctx->found,
+			 g_array_index (items, MuQueryCacheItem, u).docid);
+}
+
+
+/* 'find' with threads and 'diff', for the same query as the last
+ * one: only send what changed. Returns FALSE if we can't do that, and
+ * need to send the full results. */
+static gboolean
+find_diff (ServerContext *ctx, const char *querystr, MuQueryFlags qflags,
+	   MuMsgFieldId sortfield, gboolean reverse, int maxnum,
+	   const char *fieldsstr, const SexpFields *fields, GError **err)
+{
+	MuMsgIter *iter;
+	GArray *changed, *items;
+	guint64 revision;
+	DiffData ddata;
+
+	if (!is_last_find (ctx, querystr, qflags, sortfield, reverse, maxnum,
+			   fieldsstr))
+		return FALSE;
+
+	revision = mu_store_revision (ctx->store);
+	changed	 = mu_store_changes_since (ctx->store, ctx->last->revision);
+	if (!changed)
+		return FALSE;
+
+	/* nothing changed; nothing to send */
+	if (changed->len == 0) {
+		print_expr ("(:found %u :diff t)", ctx->last->items->len);
+		g_array_free (changed, TRUE);
+		return TRUE;
+	}
+
+	iter = mu_query_run (ctx->query, querystr, qflags, sortfield,
+			     reverse, -1, err);
+	if (!iter) {
+		g_array_free (changed, TRUE);
+		print_and_clear_g_error (err);
+		return TRUE;
+	}
+
+	items = collect_items (iter, maxnum > 0 ? maxnum : G_MAXINT32);
+	mu_msg_iter_destroy (iter);
+
+	ddata.store  = ctx->store;
+	ddata.fields = fields;
+	ddata.buf    = g_string_sized_new (SEXP_BUF_SIZE);
+	mu_query_cache_items_diff (ctx->last->items, items, changed,
+				   (MuQueryCacheDiffFunc)print_diff, &ddata);
+	g_string_free (ddata.buf, TRUE);
+	print_expr ("(:found %u :diff t)", items->len);
+
+	set_found (ctx, items, FALSE);
+	set_last_find (ctx, querystr, qflags, sortfield, reverse, maxnum,
+		       fieldsstr, revision, items);
+	g_array_free (changed, TRUE);
+
+	return TRUE;
+}
+
+
+/* 'find' with threads and 'maxthreads'; we only return (at most)
+ * maxthreads threads, and a token for the next page, if any. These
+ * results are not cached. */
+static MuError
+find_paged (ServerContext *ctx, const char *querystr, MuQueryFlags qflags,
+	    MuMsgFieldId sortfield, gboolean reverse, int maxthreads,
+	    const char *page, const SexpFields *fields, GError **err)
+{
+	MuMsgIter *iter;
+	unsigned foundnum;
+	char *next;
+	GArray *items;
+
+	iter = mu_query_run_paged (QUERY(ctx), querystr, qflags, sortfield,
+				   reverse, maxthreads, page, &next, err);
+	if (!iter) {
+		print_and_clear_g_error (err);
+		return MU_OK;
+	}
+
+	/* the next pages are added to the first one */
+	if (!page)
+		print_expr ("(:erase t)");
+
+	items	 = mu_query_cache_items_new (0);
+	foundnum = print_sexps (iter, TRUE, G_MAXINT32, fields, items);
+	set_found (ctx, items, page != NULL);
+	mu_query_cache_items_free (items);
+	if (next)
+		print_expr ("(:found %u :page \"%s\")", foundnum, next);
+	else
+		print_expr ("(:found %u)", foundnum);
+
+	g_free (next);
+	mu_msg_iter_destroy (iter);
+
+	return MU_OK;
+}
+
+
+/* the fields we can include in the 'find' results, with the names
+ * we use for them in the sexps */
+static MuMsgFieldId
+sexp_field_from_name (const char *name)
+{
+	MuMsgFieldId mfid;
+
+	if (g_str_has_prefix (name, ":"))
+		++name;
+
+	/* the names in the sexps, where they differ from the field
+	 * names */
+	if (EQSTR (name, "message-id"))
+		name = "msgid";
+	else if (EQSTR (name, "priority"))
+		name = "prio";
+	else if (EQSTR (name, "flags"))
+		name = "flag";
+	else if (EQSTR (name, "tags"))
+		name = "tag";
+
+	mfid = mu_msg_field_id_from_name (name, FALSE);
+	switch (mfid) {
+	case MU_MSG_FIELD_ID_SUBJECT:
+	case MU_MSG_FIELD_ID_FROM:
+	case MU_MSG_FIELD_ID_TO:
+	case MU_MSG_FIELD_ID_CC:
+	case MU_MSG_FIELD_ID_BCC:
+	case MU_MSG_FIELD_ID_DATE:
+	case MU_MSG_FIELD_ID_SIZE:
+	case MU_MSG_FIELD_ID_MSGID:
+	case MU_MSG_FIELD_ID_PATH:
+	case MU_MSG_FIELD_ID_MAILDIR:
+	case MU_MSG_FIELD_ID_PRIO:
+	case MU_MSG_FIELD_ID_FLAGS:
+	case MU_MSG_FIELD_ID_TAGS:
+		return mfid;
+	default:
+		return MU_MSG_FIELD_ID_NONE;
+	}
+}
+
+
+/* parse the 'fields' parameter for 'find', which is either a
+ * comma-separated list (e.g. "from,subject,date") or a list like
+ * "(:from :subject :date)" */
+static MuError
+get_sexp_fields (const char *fieldsstr, SexpFields *fields, GError **err)
+{
+	gchar **names, **cur;
+	unsigned u;
+
+	fields->num = 0;
+	names = g_strsplit_set (fieldsstr, ", ()", -1);
+
+	for (cur = names; *cur; ++cur) {
+
+		MuMsgFieldId mfid;
+
+		if (!**cur)
+			continue;
+
+		mfid = sexp_field_from_name (*cur);
+		if (mfid == MU_MSG_FIELD_ID_NONE) {
+			mu_util_g_set_error (err, MU_ERROR_IN_PARAMETERS,
+					     "not a valid field: '%s'", *cur);
+			g_strfreev (names);
+			return MU_G_ERROR_CODE(err);
+		}
+
+		/* ignore duplicates */
+		for (u = 0; u != fields->num; ++u)
+			if (fields->mfids[u] == mfid)
+				break;
+		if (u == fields->num)
+			fields->mfids[fields->num++] = mfid;
+	}
+
+	g_strfreev (names);
+
+	if (fields->num == 0) {
+		mu_util_g_set_error (err, MU_ERROR_IN_PARAMETERS,
+				     "no fields in '%s'", fieldsstr);
+		return MU_G_ERROR_CODE(err);
+	}
+
+	return MU_OK;
+}
+
+
 /*
  * 'find' finds a list of messages matching some query, and takes a
  * parameter 'query' with the search query, and (optionally) a
@@ -879,28 +1942,99 @@ get_find_params (GSList *args, gboolean *threads, MuMsgFieldId *sortfield,
  * returns:
  * => list of s-expressions, each describing a message =>
  * (:found <number of found messages>)
+ *
+ * if the same query was run before, and the database did not change
+ * since, the results are taken from the query cache.
+ *
+ * when threading, instead of 'maxnum' we can pass 'maxthreads', to get
+ * only that many threads (see mu_query_run_paged); if there are more,
+ * we get (:found <number> :page "<token>"), and we can get the next
+ * page by passing the token as 'page'.
+ *
+ * when threading with 'diff', and the query is the same as the last
+ * one, we don't send the full results again, but only the changes
+ * since, ie. (:remove <docid>), (:update <msg> :move nil),
+ * (:insert <msg> :after <docid>) and (:reorder <docid> :after <docid>
+ * :thread <thread-info>), followed by (:found <number> :diff t).
+ *
+ * with 'fields', e.g. fields:from,subject,date or
+ * fields:"(:from :subject :date)", the message sexps only have the
+ * :docid and (when threading) the :thread, and those fields, and only
+ * those are read from the database.
  */
 static MuError
 cmd_find (ServerContext *ctx, GSList *args, GError **err)
 {
 	MuMsgIter *iter;
 	unsigned foundnum;
-	int maxnum;
-	gboolean threads, reverse;
+	int maxnum, maxthreads;
+	gboolean threads, reverse, diff;
+	MuQueryFlags qflags;
 	MuMsgFieldId sortfield;
-	const char *querystr;
+	const char *querystr, *maxthreadsstr, *fieldsstr;
+	const GArray *cached;
+	SexpFields sfields, *fields;
+	GArray *items;
+	MuQueryCache *qcache;
+	guint64 revision;
 
 	GET_STRING_OR_ERROR_RETURN (args, "query", &querystr, err);
-	if (get_find_params (args, &threads, &sortfield,
+	if (get_find_params (args, &qflags, &sortfield,
 			     &reverse, &maxnum, err) != MU_OK) {
 		print_and_clear_g_error (err);
 		return MU_OK;
 	}
+	threads = (qflags & MU_QUERY_FLAG_THREADS) ? TRUE : FALSE;
+
+	fieldsstr = get_string_from_args (args, "fields", TRUE, NULL);
+	fields	  = NULL;
+	if (fieldsstr) {
+		if (get_sexp_fields (fieldsstr, &sfields, err) != MU_OK) {
+			print_and_clear_g_error (err);
+			return MU_OK;
+		}
+		fields = &sfields;
+	}
+
+	maxthreadsstr = get_string_from_args (args, "maxthreads", TRUE, NULL);
+	maxthreads    = maxthreadsstr ? atoi (maxthreadsstr) : 0;
+	if (threads && maxthreads > 0)
+		return find_paged (ctx, querystr, qflags, sortfield, reverse,
+				   maxthreads,
+				   get_string_from_args (args, "page", TRUE,
+							 NULL), fields, err);
+
+	/* while indexing, we don't use the cache or diffs, as the
+	 * read-only database lags behind the revisions of the store */
+	qcache = ctx->ro ? NULL : ctx->qcache;
+	diff   = threads && !ctx->ro &&
+		get_bool_from_args (args, "diff", TRUE, NULL);
+	if (diff && find_diff (ctx, querystr, qflags, sortfield, reverse,
+			       maxnum, fieldsstr, fields, err))
+		return MU_OK;
+
+	revision = ctx->ro ? 0 : mu_store_revision (ctx->store);
+	cached	 = qcache ?
+		mu_query_cache_lookup (qcache, revision, querystr,
+				       sortfield, reverse, qflags,
+				       maxnum) : NULL;
+	if (cached) {
+		print_expr ("(:erase t)");
+		foundnum = print_cached_sexps (ctx->store, cached, threads,
+					       fields);
+		print_expr ("(:found %u)", foundnum);
+		set_found (ctx, cached, FALSE);
+		if (diff)
+			set_last_find (ctx, querystr, qflags, sortfield,
+				       reverse, maxnum, fieldsstr, revision,
+				       copy_items (cached));
+		return MU_OK;
+	}
 
 	/* note: when we're threading, we get *all* matching messages,
 	 * and then only return maxnum; this is so that we maximimize
 	 * the change of all messages in a thread showing up */
-	iter = mu_query_run (ctx->query, querystr, threads,
+	iter = mu_query_run (QUERY(ctx), querystr, qflags,
 			     sortfield, reverse,
 			     threads ? -1 : maxnum, err);
 	if (!iter) {
@@ -913,11 +2047,32 @@ cmd_find (ServerContext *ctx, GSList *args, GError **err)
 	 * will ensure that the output of two finds will not be
 	 * mixed. */
 	print_expr ("(:erase t)");
+	items	 = qcache || diff || ctx->shared->mcache ?
+		mu_query_cache_items_new (0) : NULL;
 	foundnum = print_sexps (iter, threads,
-				maxnum > 0 ? maxnum : G_MAXINT32);
+				maxnum > 0 ? maxnum : G_MAXINT32, fields, items);
 	print_expr ("(:found %u)", foundnum);
 	mu_msg_iter_destroy (iter);
 
+	if (items)
+		set_found (ctx, items, FALSE);
+
+	if (diff && !is_cancelled ()) {
+		set_last_find (ctx, querystr, qflags, sortfield, reverse,
+			       maxnum, fieldsstr, revision,
+			       qcache ? copy_items (items) : items);
+		if (!qcache)
+			return MU_OK; /* items are owned by ctx->last */
+	}
+
+	/* don't cache interrupted results */
+	if (qcache && !is_cancelled ())
+		mu_query_cache_insert (qcache, revision, querystr,
+				       sortfield, reverse, qflags, maxnum,
+				       items);
+	else
+		mu_query_cache_items_free (items);
+
 	return MU_OK;
 }
 
@@ -962,23 +2117,56 @@ cmd_guile (ServerContext *ctx, GSList *args, GError **err)
 
 
 
+/* commit the index in batches of this many messages; after each, the
+ * read-only database is reopened. In between, after each
+ * INDEX_YIELD_SIZE messages, the worker can use the store if it's
+ * waiting for it */
+#define INDEX_BATCH_SIZE 500
+#define INDEX_YIELD_SIZE 50
+
+struct _IndexJob {
+	ServerContext	*ctx;
+	Request		*req;
+	char		*path;
+};
+typedef struct _IndexJob IndexJob;
+
+static GThread* start_thread (GThreadFunc func, gpointer data);
+static void finish_request (ServerContext *ctx, Request *req);
+
+
 static MuError
-index_msg_cb (MuIndexStats *stats, void *user_data)
+index_msg_cb (MuIndexStats *stats, ServerContext *ctx)
 {
-	if (MU_TERMINATE)
+	if (is_cancelled ())
 		return MU_STOP;
 
-	if (stats->_processed % 1000)
+	if (stats->_processed % INDEX_YIELD_SIZE)
 		return MU_OK;
 
-	print_expr ("(:info index :status running "
-		    ":processed %u :updated %u)",
-		   stats->_processed, stats->_updated);
+	if (stats->_processed % INDEX_BATCH_SIZE == 0) {
+		print_expr ("(:info index :status running "
+			    ":processed %u :updated %u)",
+			    stats->_processed, stats->_updated);
+
+		/* commit this batch, so the queries can see it */
+		mu_store_flush (ctx->store);
+		g_atomic_int_inc (&ctx->shared->commits);
+	}
+
+	yield_store (ctx);
 
 	return MU_OK;
 }
 
 
+static MuError
+cleanup_cb (MuIndexStats *stats, void *user_data)
+{
+	return is_cancelled () ? MU_STOP : MU_OK;
+}
+
+
 static void
 set_my_addresses (MuStore *store, const char *addrstr)
 {
@@ -1015,14 +2203,15 @@ get_checked_path (const char *path)
 
 
 static MuError
-index_and_cleanup (MuIndex *index, const char *path, GError **err)
+index_and_cleanup (ServerContext *ctx, MuIndex *index, const char *path,
+		   GError **err)
 {
 	MuError rv;
 	MuIndexStats stats, stats2;
 
 	mu_index_stats_clear (&stats);
 	rv = mu_index_run (index, path, FALSE, &stats,
-			   index_msg_cb, NULL, NULL);
+			   (MuIndexMsgCallback)index_msg_cb, NULL, ctx);
 
 	if (rv != MU_OK && rv != MU_STOP) {
 		mu_util_g_set_error (err, MU_ERROR_INTERNAL, "indexing failed");
@@ -1030,51 +2219,138 @@ index_and_cleanup (MuIndex *index, const char *path, GError **err)
 	}
 
 	mu_index_stats_clear (&stats2);
-	rv = mu_index_cleanup (index, &stats2, NULL, NULL, err);
-	if (rv != MU_OK && rv != MU_STOP) {
-		mu_util_g_set_error (err, MU_ERROR_INTERNAL, "cleanup failed");
-		return rv;
+	if (!is_cancelled ()) {
+		rv = mu_index_cleanup (index, &stats2, cleanup_cb, NULL, err);
+		if (rv != MU_OK && rv != MU_STOP) {
+			mu_util_g_set_error (err, MU_ERROR_INTERNAL,
+					     "cleanup failed");
+			return rv;
+		}
 	}
 
-	print_expr ("(:info index :status complete "
+	print_expr ("(:info index :status %s "
 		    ":processed %u :updated %u :cleaned-up %u)",
+		    is_cancelled () ? "stopped" : "complete",
 		    stats._processed, stats._updated, stats2._cleaned_up);
 
 	return rv;
 }
 
+
+/* the indexer thread */
+static gpointer
+index_thread (IndexJob *job)
+{
+	ServerContext *ctx;
+	MuIndex *index;
+	GError *err;
+
+	ctx = job->ctx;
+	set_current_request (job->req);
+
+	lock_store (ctx);
+
+	err = NULL;
+	if ((index = mu_index_new (ctx->store, &err))) {
+		index_and_cleanup (ctx, index, job->path, &err);
+		mu_index_destroy (index);
+	}
+	if (err)
+		print_and_clear_g_error (&err);
+
+	mu_store_flush (ctx->store);
+	g_atomic_int_inc (&ctx->shared->commits);
+	g_atomic_int_set (&ctx->shared->indexing, FALSE);
+
+	unlock_store (ctx);
+
+	if (job->req->has_id && g_atomic_int_get (&job->req->cancelled))
+		print_expr ("(:cancelled t)");
+
+	set_current_request (NULL);
+	flush_output (ctx);
+	finish_request (ctx, job->req);
+
+	g_free (job->path);
+	g_slice_free (IndexJob, job);
+
+	return NULL;
+}
+
+
+/* open the read-only database for the queries; if that fails (e.g.,
+ * because the database is still empty), the queries just wait for
+ * the store */
+static void
+open_read_only (ServerContext *ctx)
+{
+	if (ctx->roquery)
+		return;
+
+	/* we see everything committed so far; for later commits, we
+	 * need to reopen */
+	ctx->commits = g_atomic_int_get (&ctx->shared->commits);
+	ctx->rostore = mu_store_new_read_only
+		(mu_runtime_path (MU_RUNTIME_PATH_XAPIANDB), NULL);
+	if (ctx->rostore)
+		ctx->roquery = mu_query_new (ctx->rostore, NULL);
+}
+
+
 /*
  * 'index' (re)indexs maildir at path:<path>, and responds with (:info
  * index ... ) messages while doing so (see the code)
+ *
+ * the indexing happens in the background; in the meantime, other
+ * commands keep working. Indexing can be stopped with 'cancel
+ * index:true' (or 'cancel id:<id>')
  */
 static MuError
 cmd_index (ServerContext *ctx, GSList *args, GError **err)
 {
-	MuIndex *index;
+	IndexJob *job;
 	const char *argpath;
 	char *path;
 
-	index = NULL;
+	g_return_val_if_fail (get_current_request (), MU_ERROR_INTERNAL);
 
 	GET_STRING_OR_ERROR_RETURN (args, "path", &argpath, err);
 	if (!(path = get_checked_path (argpath)))
-		goto leave;
+		return MU_OK;
+
+	G_LOCK (indexer);
+
+	if (g_atomic_int_get (&ctx->shared->indexing)) {
+		G_UNLOCK (indexer);
+		g_free (path);
+		print_error (MU_ERROR_INTERNAL, "already indexing");
+		return MU_OK;
+	}
 
 	set_my_addresses (ctx->store, get_string_from_args
 			  (args, "my-addresses", TRUE, NULL));
 
-	if (!(index = mu_index_new (ctx->store, err)))
-		goto leave;
+	/* the read-only database should see what we have so far */
+	mu_store_flush (ctx->store);
+	g_atomic_int_inc (&ctx->shared->commits);
+	open_read_only (ctx);
 
-	index_and_cleanup (index, path, err);
+	/* the previous indexer is done */
+	if (ctx->shared->indexer)
+		g_thread_join (ctx->shared->indexer);
 
-leave:
-	g_free (path);
+	job	  = g_slice_new (IndexJob);
+	job->ctx  = ctx;
+	job->path = path;
+	job->req  = get_current_request ();
+	job->req->detached = TRUE;
 
-	if (err && *err)
-		print_and_clear_g_error (err);
+	g_atomic_int_set (&ctx->shared->indexing, TRUE);
+	ctx->shared->indexer	 = start_thread ((GThreadFunc)index_thread,
+						 job);
+	ctx->shared->indexer_ctx = ctx;
 
-	mu_index_destroy (index);
+	G_UNLOCK (indexer);
 
 	return MU_OK;
 }
@@ -1285,33 +2561,280 @@ leave:
 }
 
 
+/* for the flags of a moved message */
+struct _MovedFlags {
+	GString	*buf;
+	MuFlags	 flags;
+	gboolean any;
+};
+typedef struct _MovedFlags MovedFlags;
 
-/* 'ping' takes no parameters, and provides information about this mu
- * server using a (:pong ...) message (details: see code below)
- */
-static MuError
-cmd_ping (ServerContext *ctx, GSList *args, GError **err)
+static void
+each_moved_flag (MuFlags flag, MovedFlags *mflags)
 {
-	unsigned doccount;
-	doccount = mu_store_count (ctx->store, err);
+	if (!(flag & mflags->flags))
+		return;
 
-	if (doccount == (unsigned)-1)
-		return print_and_clear_g_error (err);
+	if (mflags->any)
+		g_string_append_c (mflags->buf, ' ');
+
+	g_string_append (mflags->buf, mu_flag_name (flag));
+	mflags->any = TRUE;
+}
+
+
+/* move the file for a single message, and update its path, maildir
+ * and flags in the store; append a (:docid .. :path .. :flags ..)
+ * to 'moved' */
+static gboolean
+move_one (ServerContext *ctx, unsigned docid, const char *maildir,
+	  const char *flagstr, GString *moved, gboolean *different_mdir,
+	  GError **err)
+{
+	MuMsg *msg;
+	MuFlags flags;
+	MovedFlags mflags;
+	char *newpath;
+
+	if (!(msg = mu_store_get_msg (ctx->store, docid, err)))
+		return FALSE;
+
+	if (!maildir)
+		maildir = mu_msg_get_maildir (msg);
+	else if (g_strcmp0 (maildir, mu_msg_get_maildir (msg)) != 0)
+		*different_mdir = TRUE;
+
+	flags	= flagstr ? get_flags (mu_msg_get_path(msg), flagstr) :
+		mu_msg_get_flags (msg);
+	newpath = NULL;
+
+	if (flags == MU_FLAG_INVALID)
+		mu_util_g_set_error (err, MU_ERROR_IN_PARAMETERS,
+				     "invalid flags");
+	else if ((newpath = mu_msg_move_file_to_maildir
+		  (msg, maildir, flags, TRUE, err)))
+		/* no need to parse the message again; we only update
+		 * what changed */
+		flags = mu_store_move_msg (ctx->store, docid, newpath,
+					   maildir, err);
+	mu_msg_unref (msg);
+
+	if (!newpath || flags == MU_FLAG_INVALID) {
+		g_free (newpath);
+		return FALSE;
+	}
+
+	g_string_append_printf (moved, "(:docid %u :path ", docid);
+	mu_str_append_c_literal (moved, newpath, TRUE);
+	g_string_append (moved, " :flags (");
+
+	mflags.buf   = moved;
+	mflags.flags = flags;
+	mflags.any   = FALSE;
+	mu_flags_foreach ((MuFlagsForeachFunc)each_moved_flag, &mflags);
+
+	g_string_append (moved, "))");
+	g_free (newpath);
+
+	return TRUE;
+}
+
+
+static void
+append_move_failure (GString *failed, const char *what, GError **err)
+{
+	if (failed->len > 0)
+		g_string_append_c (failed, ' ');
+
+	g_string_append_printf (failed, "(%s :error %u :message ", what,
+				err && *err ? (*err)->code : MU_ERROR_INTERNAL);
+	mu_str_append_c_literal (failed, err && *err ? (*err)->message :
+				 "unknown error", TRUE);
+	g_string_append_c (failed, ')');
+
+	g_clear_error (err);
+}
+
+
+/* get the docids for all 'docid:' and 'msgid:' parameters; for a
+ * message-id, that's all the messages with that message-id (see
+ * move_msgid_maybe) */
+static GArray*
+get_move_docids (ServerContext *ctx, GSList *args, GString *failed,
+		 gboolean *msgids, GError **err)
+{
+	GArray *docids;
+
+	docids	= g_array_new (FALSE, FALSE, sizeof(unsigned));
+	*msgids = FALSE;
+
+	for (; args; args = g_slist_next (args)) {
+
+		const char *arg;
+		unsigned docid;
+
+		arg = (const char*)args->data;
+		if (g_str_has_prefix (arg, "docid:")) {
+			docid = atoi (arg + strlen ("docid:"));
+			g_array_append_val (docids, docid);
+
+		} else if (g_str_has_prefix (arg, "msgid:")) {
+
+			GSList *lst, *cur;
+
+			*msgids = TRUE;
+			lst = get_docids_from_msgids
+				(ctx->query, arg + strlen ("msgid:"), err);
+			if (!lst) {
+				char *what, *msgid;
+				msgid = mu_str_escape_c_literal
+					(arg + strlen ("msgid:"), TRUE);
+				what  = g_strdup_printf (":msgid %s", msgid);
+				append_move_failure (failed, what, err);
+				g_free (what);
+				g_free (msgid);
+				continue;
+			}
+
+			for (cur = lst; cur; cur = g_slist_next (cur)) {
+				docid = GPOINTER_TO_SIZE (cur->data);
+				g_array_append_val (docids, docid);
+			}
+			g_slist_free (lst);
+		}
+	}
+
+	return docids;
+}
+
+
+/*
+ * 'move-many' moves a number of messages to a different maildir
+ * and/or changes their flags, like 'move' does for a single
+ * message. Parameters are any number of 'docid:' and 'msgid:'
+ * parameters for the messages, a 'maildir:' for the target maildir
+ * and a 'flags:' parameter for the new flags (or flag-delta). As with
+ * 'move', 'maildir:' cannot be used with 'msgid:'.
+ *
+ * The messages are not parsed again; only their path, maildir and
+ * flags are updated in the store, which commits them all at once.
+ *
+ * returns a single (:moved (<moved-message> ...) :move <t|nil>
+ * [:failed (<failure> ...)]), where each moved message is a
+ * (:docid <docid> :path <new-path> :flags (<flags>)), and each
+ * failure a (:docid <docid> :error <code> :message <message>) (or
+ * :msgid instead of :docid, when the message-id was not found)
+ */
+static MuError
+cmd_move_many (ServerContext *ctx, GSList *args, GError **err)
+{
+	const char *maildir, *flagstr;
+	GArray *docids;
+	GString *moved, *failed;
+	gboolean msgids, different_mdir;
+	unsigned u;
+
+	maildir	= get_string_from_args (args, "maildir", TRUE, err);
+	flagstr = get_string_from_args (args, "flags", TRUE, err);
+	if (!maildir && !flagstr) {
+		print_error (MU_ERROR_IN_PARAMETERS,
+			     "neither maildir nor flags specified");
+		return MU_OK;
+	}
+
+	moved  = g_string_sized_new (SEXP_BUF_SIZE);
+	failed = g_string_sized_new (256);
+
+	docids = get_move_docids (ctx, args, failed, &msgids, err);
+	if (msgids && maildir) {
+		print_error (MU_ERROR_IN_PARAMETERS,
+			     "maildir cannot be used with msgid");
+		goto leave;
+	}
+
+	different_mdir = FALSE;
+	for (u = 0; u != docids->len && !is_cancelled (); ++u) {
+
+		unsigned docid;
+		gsize len;
+
+		docid = g_array_index (docids, unsigned, u);
+		len   = moved->len;
+		if (len > 0)
+			g_string_append_c (moved, ' ');
+
+		if (!move_one (ctx, docid, maildir, flagstr, moved,
+			       &different_mdir, err)) {
+			char what[32];
+			g_string_truncate (moved, len);
+			g_snprintf (what, sizeof(what), ":docid %u", docid);
+			append_move_failure (failed, what, err);
+		}
+	}
+
+	/* commit all the changes at once */
+	mu_store_flush (ctx->store);
+
+	/* as with 'move', :move t is a hint to the frontend that it
+	 * could remove the headers */
+	print_expr ("(:moved (%s) :move %s%s%s%s)", moved->str,
+		    different_mdir ? "t" : "nil",
+		    failed->len > 0 ? " :failed (" : "", failed->str,
+		    failed->len > 0 ? ")" : "");
+leave:
+	g_array_free (docids, TRUE);
+	g_string_free (moved, TRUE);
+	g_string_free (failed, TRUE);
+
+	return MU_OK;
+}
+
+
+
+/* 'ping' takes no parameters, and provides information about this mu
+ * server using a (:pong ...) message (details: see code below)
+ */
+static MuError
+cmd_ping (ServerContext *ctx, GSList *args, GError **err)
+{
+	unsigned doccount, hits, misses, mhits, mmisses;
+	size_t cachesize, mcachesize;
+
+	doccount = mu_store_count (STORE(ctx), err);
+
+	if (doccount == (unsigned)-1)
+		return print_and_clear_g_error (err);
+
+	hits = misses = 0;
+	cachesize     = 0;
+	if (ctx->qcache)
+		mu_query_cache_stats (ctx->qcache, &hits, &misses,
+				      &cachesize);
+
+	mhits = mmisses = 0;
+	mcachesize	= 0;
+	if (ctx->shared->mcache)
+		mu_msg_cache_stats (ctx->shared->mcache, &mhits, &mmisses,
+				    &mcachesize);
 
 	print_expr ("(:pong \"" PACKAGE_NAME "\" "
 		    " :props (:crypto %s :guile %s "
 		    "  :version \"" VERSION "\" "
-		    "  :doccount %u))",
+		    "  :doccount %u"
+		    "  :query-cache (:hits %u :misses %u :size %u)"
+		    "  :msg-cache (:hits %u :misses %u :size %u)))",
 		    mu_util_supports (MU_FEATURE_CRYPTO) ? "t" : "nil",
 		    mu_util_supports (MU_FEATURE_GUILE|MU_FEATURE_GNUPLOT)
 		    ? "t" : "nil",
-		    doccount);
+		    doccount, hits, misses, (unsigned)cachesize,
+		    mhits, mmisses, (unsigned)mcachesize);
 
 	return MU_OK;
 }
 
 
-/* 'quit' takes no parameters, terminates this mu server */
+/* 'quit' takes no parameters, terminates this mu server (or, with
+ * --socket, the session of this client) */
 static MuError
 cmd_quit (ServerContext *ctx, GSList *args , GError **err)
 {
@@ -1439,8 +2962,51 @@ get_view_msg_opts (GSList *args)
 	return opts;
 }
 
+static void
+prefetch_docid (ServerContext *ctx, unsigned docid)
+{
+	MuMsg *msg;
+	const char *path;
+
+	if (!(msg = mu_store_get_msg (STORE(ctx), docid, NULL)))
+		return;
+
+	if ((path = mu_msg_get_path (msg)))
+		g_async_queue_push (ctx->shared->prefetch, g_strdup (path));
+
+	mu_msg_unref (msg);
+}
+
+
+/* the messages around the one that's being viewed in the results of
+ * the last find are likely to be viewed next (e.g., when going
+ * through the headers one by one); let the prefetcher parse them */
+static void
+prefetch_neighbours (ServerContext *ctx, unsigned docid)
+{
+	GArray *found;
+	guint u;
+
+	if (!ctx->shared->mcache || !(found = ctx->found))
+		return;
+
+	for (u = 0; u != found->len; ++u)
+		if (g_array_index (found, unsigned, u) == docid)
+			break;
+
+	/* the next one first, then the previous one */
+	if (u + 1 < found->len)
+		prefetch_docid (ctx, g_array_index (found, unsigned, u + 1));
+	if (u > 0 && u < found->len)
+		prefetch_docid (ctx, g_array_index (found, unsigned, u - 1));
+}
+
+
 /* 'view' gets a full (including body etc.) sexp for some message,
  * identified by either docid: or msgid:; return a (:view <sexp>)
+ *
+ * when we have a message cache, we take the parsed message from
+ * there, and then prefetch its neighbours in the last find.
  */
 static MuError
 cmd_view (ServerContext *ctx, GSList *args, GError **err)
@@ -1460,12 +3026,12 @@ cmd_view (ServerContext *ctx, GSList *args, GError **err)
 		docid = 0;
 		msg   = mu_msg_new_from_file (path, NULL, err);
 	} else {
-		docid = determine_docid (ctx->query, args, err);
+		docid = determine_docid (QUERY(ctx), args, err);
 		if (docid == MU_STORE_INVALID_DOCID) {
 			print_and_clear_g_error (err);
 			return MU_OK;
 		}
-		msg = mu_store_get_msg (ctx->store, docid, err);
+		msg = mu_store_get_msg (STORE(ctx), docid, err);
 	}
 
 	if (!msg) {
@@ -1473,12 +3039,21 @@ cmd_view (ServerContext *ctx, GSList *args, GError **err)
 		return MU_OK;
 	}
 
+	if (docid != 0)
+		load_msg_file (ctx, msg);
+
 	sexp = mu_msg_to_sexp (msg, docid, NULL, opts);
+
+	if (docid != 0)
+		unload_msg_file (ctx, msg);
 	mu_msg_unref (msg);
 
 	print_expr ("(:view %s)\n", sexp);
 	g_free (sexp);
 
+	if (docid != 0)
+		prefetch_neighbours (ctx, docid);
+
 	return MU_OK;
 }
 
@@ -1501,11 +3076,13 @@ handle_args (ServerContext *ctx, GSList *args, GError **err)
 		{ "compose",	cmd_compose },
 		{ "contacts",   cmd_contacts },
 		{ "extract",    cmd_extract },
+		{ "facets",     cmd_facets },
 		{ "find",	cmd_find },
 		{ "guile",      cmd_guile },
 		{ "index",	cmd_index },
 		{ "mkdir",	cmd_mkdir },
 		{ "move",	cmd_move },
+		{ "move-many",  cmd_move_many },
 		{ "ping",	cmd_ping },
 		{ "quit",	cmd_quit },
 		{ "remove",	cmd_remove },
@@ -1531,52 +3108,658 @@ handle_args (ServerContext *ctx, GSList *args, GError **err)
 
 
 
-MuError
-mu_cmd_server (MuStore *store, MuConfig *opts/*unused*/, GError **err)
+/* create a request for a command and its parameters; takes ownership
+ * of args and err */
+static Request*
+request_new_from_args (GSList *args, GError *err)
 {
-	ServerContext ctx;
-	gboolean do_quit;
+	Request *req;
+	const char *cmd, *idstr;
+
+	req	  = g_slice_new0 (Request);
+	req->args = args;
+	req->err  = err;
+	if (!req->args || req->err)
+		return req;
+
+	cmd	      = (const char*)req->args->data;
+	req->is_find  = EQSTR (cmd, "find");
+	req->is_index = EQSTR (cmd, "index");
+	req->is_quit  = EQSTR (cmd, "quit");
+
+	idstr = get_string_from_args (g_slist_next (req->args), "id",
+				      TRUE, NULL);
+	if (idstr) {
+		char *end;
+		req->id	    = (unsigned)strtoul (idstr, &end, 10);
+		req->has_id = TRUE;
+		if (!*idstr || *end)
+			mu_util_g_set_error (&req->err, MU_ERROR_IN_PARAMETERS,
+					     "invalid id '%s'", idstr);
+	}
 
-	g_return_val_if_fail (store, MU_ERROR_INTERNAL);
+	return req;
+}
 
-	ctx.store = store;
-	ctx.query = mu_query_new (store, err);
-	if (!ctx.query)
-		return MU_G_ERROR_CODE (err);
 
-	install_sig_handler ();
+static Request*
+request_new (const char *line)
+{
+	GSList *args;
+	GError *err;
+
+	err  = NULL;
+	args = mu_str_esc_to_list (line, &err);
 
-	g_print (";; welcome to " PACKAGE_STRING "\n");
+	return request_new_from_args (args, err);
+}
+
+
+/* read the next request from fd; this is either a line, or a frame
+ * (see read_frame), which starts with COOKIE_PRE, which never occurs
+ * in utf8. At the end of the input, or when we're terminated, we get
+ * a 'quit' */
+static Request*
+read_request (int fd, GString *input)
+{
+	char *line;
+	Request *req;
 
-	/*  the main REPL */
-	do_quit = FALSE;
-	while (!MU_TERMINATE && !do_quit) {
+	if (input->len == 0 && !read_more (fd, input, 0))
+		return request_new ("quit");
 
+	if (input->str[0] == MU_SERVER_COOKIE_PRE) {
 		GSList *args;
-		GError *my_err = NULL;
+		GError *err;
+		err  = NULL;
+		args = read_frame (fd, input, &err);
+		return (args || err) ? request_new_from_args (args, err) :
+			request_new ("quit");
+	}
+
+	line = read_line (fd, input);
+	req  = request_new (line ? line : "quit");
+	g_free (line);
+
+	return req;
+}
+
+
+static void
+request_destroy (Request *req)
+{
+	if (!req)
+		return;
+
+	mu_str_free_list (req->args);
+	g_clear_error (&req->err);
+
+	g_slice_free (Request, req);
+}
+
+
+G_LOCK_DEFINE_STATIC (active);
+
+enum _CancelWhat {
+	CANCEL_ID,	/* the request with some id */
+	CANCEL_FINDS,	/* all 'find' requests with an id */
+	CANCEL_INDEX,	/* the 'index' request */
+	CANCEL_ALL
+};
+typedef enum _CancelWhat CancelWhat;
+
+static void
+cancel_requests (ServerContext *ctx, CancelWhat what, unsigned id)
+{
+	GSList *cur;
+
+	G_LOCK (active);
+	for (cur = ctx->active; cur; cur = g_slist_next (cur)) {
+
+		Request *req;
+		gboolean cancel;
+
+		req = (Request*)cur->data;
+		switch (what) {
+		case CANCEL_ID:	   cancel = req->has_id && req->id == id; break;
+		case CANCEL_FINDS: cancel = req->has_id && req->is_find; break;
+		case CANCEL_INDEX: cancel = req->is_index; break;
+		default:	   cancel = TRUE;
+		}
+		if (cancel)
+			g_atomic_int_set (&req->cancelled, TRUE);
+	}
+	G_UNLOCK (active);
+}
+
+
+/* 'cancel' stops the request with id:<id>, or, with index:true, the
+ * indexing (even if some other client started it); it's handled
+ * right away, and does not respond */
+static void
+cmd_cancel (ServerContext *ctx, Request *req)
+{
+	if (req->has_id)
+		cancel_requests (ctx, CANCEL_ID, req->id);
+
+	if (get_bool_from_args (req->args, "index", TRUE, NULL)) {
+		G_LOCK (indexer);
+		if (ctx->shared->indexer_ctx)
+			cancel_requests (ctx->shared->indexer_ctx,
+					 CANCEL_INDEX, 0);
+		G_UNLOCK (indexer);
+	}
+}
+
+
+static void
+queue_request (ServerContext *ctx, Request *req)
+{
+	/* a new 'find' supersedes the earlier ones */
+	if (req->is_find && req->has_id && !req->err)
+		cancel_requests (ctx, CANCEL_FINDS, 0);
+
+	req->client = ctx;
+
+	G_LOCK (active);
+	ctx->active = g_slist_prepend (ctx->active, req);
+	G_UNLOCK (active);
+
+	g_async_queue_push (ctx->requests, req);
+}
+
+
+static void
+finish_request (ServerContext *ctx, Request *req)
+{
+	G_LOCK (active);
+	ctx->active = g_slist_remove (ctx->active, req);
+	G_UNLOCK (active);
+
+	request_destroy (req);
+}
+
+
+/* whether the request can use the read-only database; with a single
+ * client, only while we're indexing */
+static gboolean
+use_read_only (ServerContext *ctx, Request *req)
+{
+	const char *cmd;
+	gint commits;
+
+	if (!ctx->shared->daemon && !g_atomic_int_get (&ctx->shared->indexing))
+		return FALSE;
+
+	cmd = (const char*)req->args->data;
+	if (!EQSTR (cmd, "find") && !EQSTR (cmd, "view") &&
+	    !EQSTR (cmd, "facets") && !EQSTR (cmd, "ping"))
+		return FALSE;
+
+	open_read_only (ctx);
+	if (!ctx->roquery)
+		return FALSE;
+
+	/* see what was committed since last time */
+	commits = g_atomic_int_get (&ctx->shared->commits);
+	if (commits != ctx->commits) {
+		ctx->commits = commits;
+		mu_query_reopen (ctx->roquery, NULL);
+	}
+
+	return TRUE;
+}
+
+
+static void
+run_request (ServerContext *ctx, Request *req)
+{
+	GError *err;
+
+	set_current_request (req);
+
+	err = NULL;
+	if (!req->args || req->err)
+		print_and_clear_g_error (&req->err);
+	else if (!is_cancelled () || req->is_quit) {
+
+		ctx->ro = use_read_only (ctx, req);
+		if (!ctx->ro)
+			lock_store (ctx);
+
+		switch (handle_args (ctx, req->args, &err)) {
+		case MU_OK:
+		case MU_STOP: break;
+		default: /* some error occurred */
+			print_and_clear_g_error (&err);
+		}
+
+		if (!ctx->ro) {
+			/* the other clients should see the changes */
+			if (ctx->shared->daemon) {
+				mu_store_flush (ctx->store);
+				g_atomic_int_inc (&ctx->shared->commits);
+			}
+			unlock_store (ctx);
+		}
+		ctx->ro = FALSE;
+	}
+
+	/* the indexer takes care of its own request */
+	if (!req->detached && req->has_id &&
+	    g_atomic_int_get (&req->cancelled))
+		print_expr ("(:cancelled t)");
+
+	set_current_request (NULL);
+	flush_output (ctx);
+}
+
+
+/* the worker runs the requests one at a time, in the order they
+ * came in, until it gets 'quit' */
+static gpointer
+worker_thread (ServerContext *ctx)
+{
+	gboolean quit;
+
+	do {
+		Request *req;
 
-		/* args will receive a the command as a list of
-		 * strings. returning NULL indicates an error */
-		args   = read_line_as_list (&my_err);
-		if (!args || my_err) {
-			print_and_clear_g_error (&my_err);
+		req  = (Request*)g_async_queue_pop (ctx->requests);
+		run_request (ctx, req);
+		quit = req->is_quit;
+
+		if (!req->detached)
+			finish_request (ctx, req);
+
+	} while (!quit);
+
+	return NULL;
+}
+
+
+/* start a thread; it blocks the signals we handle, so those go to
+ * the main thread, which is the one reading the input */
+static GThread*
+start_thread (GThreadFunc func, gpointer data)
+{
+	GThread *thread;
+	sigset_t sigs, oldsigs;
+
+	sigemptyset (&sigs);
+	sigaddset (&sigs, SIGINT);
+	sigaddset (&sigs, SIGHUP);
+	sigaddset (&sigs, SIGTERM);
+	sigaddset (&sigs, SIGPIPE);
+	pthread_sigmask (SIG_BLOCK, &sigs, &oldsigs);
+
+#if GLIB_CHECK_VERSION(2,32,0)
+	thread = g_thread_new (NULL, func, data);
+#else
+	thread = g_thread_create (func, data, TRUE, NULL);
+#endif /*GLIB_CHECK_VERSION(2,32,0)*/
+
+	pthread_sigmask (SIG_SETMASK, &oldsigs, NULL);
+
+	return thread;
+}
+
+
+/* stop the indexer, if this client started it, and wait for it */
+static void
+stop_indexer (ServerContext *ctx)
+{
+	GThread *indexer;
+
+	indexer = NULL;
+
+	G_LOCK (indexer);
+	if (ctx->shared->indexer_ctx == ctx) {
+		cancel_requests (ctx, CANCEL_ALL, 0);
+		indexer = ctx->shared->indexer;
+		ctx->shared->indexer	 = NULL;
+		ctx->shared->indexer_ctx = NULL;
+	}
+	G_UNLOCK (indexer);
+
+	/* not while holding the lock, as the indexer may be waiting
+	 * for the store, held by a 'index' command waiting for it */
+	if (indexer)
+		g_thread_join (indexer);
+}
+
+
+/* serve a client: read its commands, and queue them for the worker,
+ * except for 'cancel', which we handle right away; until it quits,
+ * or the input ends */
+static void
+serve (ServerContext *ctx)
+{
+	GThread *worker, *writer;
+	GString *input;
+	gboolean interactive;
+
+	ctx->requests = g_async_queue_new ();
+	ctx->output   = mu_server_output_new (ctx->outfd,
+					      OUTPUT_FLUSH_SIZE,
+					      OUTPUT_LATENCY_MS);
+	ctx->spare    = mu_server_output_new (ctx->outfd,
+					      OUTPUT_FLUSH_SIZE,
+					      OUTPUT_LATENCY_MS);
+	ctx->outlock  = mutex_new ();
+	ctx->outcond  = cond_new ();
+	worker = start_thread ((GThreadFunc)worker_thread, ctx);
+	writer = start_thread ((GThreadFunc)writer_thread, ctx);
+
+	/* the prompt is only for people typing commands; it would get
+	 * in the way of the output otherwise */
+	interactive = isatty (ctx->infd);
+
+	input = g_string_sized_new (4096);
+	while (1) {
+
+		Request *req;
+		gboolean quit;
+
+		if (interactive) {
+			fputs (";; mu> ", stdout);
+			fflush (stdout);
+		}
+
+		/* at the end of the input, or when we're terminated,
+		 * we quit */
+		req = read_request (ctx->infd, input);
+
+		if (req->args && !req->err &&
+		    EQSTR ((const char*)req->args->data, "cancel")) {
+			cmd_cancel (ctx, req);
+			request_destroy (req);
 			continue;
 		}
 
-		switch (handle_args (&ctx, args, &my_err)) {
-		case MU_OK: break;
-		case MU_STOP:
-			do_quit = TRUE;
+		quit = req->is_quit;
+		queue_request (ctx, req);
+		if (quit)
+			break;
+	}
+	g_string_free (input, TRUE);
+
+	g_thread_join (worker);
+
+	/* stop indexing, if we're still at it */
+	stop_indexer (ctx);
+
+	g_mutex_lock (ctx->outlock);
+	ctx->outstop = TRUE;
+	g_cond_signal (ctx->outcond);
+	g_mutex_unlock (ctx->outlock);
+	g_thread_join (writer);
+
+	mu_server_output_destroy (ctx->output);
+	mu_server_output_destroy (ctx->spare);
+	cond_free (ctx->outcond);
+	mutex_free (ctx->outlock);
+	g_async_queue_unref (ctx->requests);
+}
+
+
+static ServerContext*
+client_new (ServerShared *shared, int infd, int outfd)
+{
+	ServerContext *ctx;
+
+	ctx = g_slice_new0 (ServerContext);
+
+	ctx->shared = shared;
+	ctx->store  = shared->store;
+	ctx->query  = shared->query;
+	ctx->qcache = shared->qcache;
+	ctx->infd   = infd;
+	ctx->outfd  = outfd;
+
+	return ctx;
+}
+
+
+static void
+client_destroy (ServerContext *ctx)
+{
+	mu_query_destroy (ctx->roquery);
+	if (ctx->rostore)
+		mu_store_unref (ctx->rostore);
+	last_find_destroy (ctx->last);
+	if (ctx->found)
+		g_array_free (ctx->found, TRUE);
+
+	g_slice_free (ServerContext, ctx);
+}
+
+
+/* the thread for a client on the socket */
+static gpointer
+client_thread (ServerContext *ctx)
+{
+	static const char welcome[] = ";; welcome to " PACKAGE_STRING "\n";
+
+	if (write (ctx->outfd, welcome, sizeof(welcome) - 1) > 0)
+		serve (ctx);
+
+	g_atomic_int_set (&ctx->done, TRUE);
+
+	return NULL;
+}
+
+
+/* join the clients that are done (or, if all is TRUE, all of them),
+ * and return the remaining ones */
+static GSList*
+reap_clients (GSList *clients, gboolean all)
+{
+	GSList *cur, *next;
+
+	for (cur = clients; cur; cur = next) {
+
+		ServerContext *ctx;
+
+		next = g_slist_next (cur);
+		ctx  = (ServerContext*)cur->data;
+
+		if (!all && !g_atomic_int_get (&ctx->done))
+			continue;
+
+		g_thread_join (ctx->thread);
+		close (ctx->infd);
+		client_destroy (ctx);
+		clients = g_slist_delete_link (clients, cur);
+	}
+
+	return clients;
+}
+
+
+/* create a unix socket at path, only accessible by us, and listen on
+ * it; returns the socket, or -1 in case of error */
+static int
+listen_on (const char *path, GError **err)
+{
+	struct sockaddr_un addr;
+	struct stat statbuf;
+	mode_t oldmask;
+	int sock, rv;
+
+	if (strlen (path) >= sizeof(addr.sun_path)) {
+		mu_util_g_set_error (err, MU_ERROR_IN_PARAMETERS,
+				     "socket path too long: '%s'", path);
+		return -1;
+	}
+
+	memset (&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy (addr.sun_path, path);
+
+	sock = socket (AF_UNIX, SOCK_STREAM, 0);
+	if (sock == -1) {
+		mu_util_g_set_error (err, MU_ERROR_FILE,
+				     "cannot create socket: %s",
+				     strerror (errno));
+		return -1;
+	}
+
+	/* a socket left behind by an earlier server; as we have the
+	 * store, no other server can be using it */
+	if (lstat (path, &statbuf) == 0 && S_ISSOCK (statbuf.st_mode))
+		unlink (path);
+
+	oldmask = umask (0077);
+	rv	= bind (sock, (struct sockaddr*)&addr, sizeof(addr));
+	umask (oldmask);
+
+	if (rv != 0 || listen (sock, 16) != 0) {
+		mu_util_g_set_error (err, MU_ERROR_FILE_CANNOT_CREATE,
+				     "cannot listen on '%s': %s", path,
+				     strerror (errno));
+		close (sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+
+/* serve any number of clients on the socket at path, each in its own
+ * thread, until we're terminated */
+static MuError
+serve_socket (ServerShared *shared, const char *path, GError **err)
+{
+	int sock;
+	GSList *clients, *cur;
+
+	sock = listen_on (path, err);
+	if (sock == -1)
+		return MU_G_ERROR_CODE (err);
+
+	clients = NULL;
+	while (!MU_TERMINATE) {
+
+		int fd;
+		ServerContext *ctx;
+
+		fd = accept (sock, NULL, NULL);
+		if (fd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			g_warning ("accept failed: %s", strerror (errno));
 			break;
-		default: /* some error occurred */
-			print_and_clear_g_error (&my_err);
 		}
 
-		mu_str_free_list (args);
+		clients = reap_clients (clients, FALSE);
+
+		ctx	    = client_new (shared, fd, fd);
+		ctx->thread = start_thread ((GThreadFunc)client_thread, ctx);
+		clients	    = g_slist_prepend (clients, ctx);
 	}
 
-	mu_store_flush   (ctx.store);
-	mu_query_destroy (ctx.query);
+	close (sock);
+	unlink (path);
+
+	/* end the input of the clients that are still there; they
+	 * quit as they would at the end of their input */
+	for (cur = clients; cur; cur = g_slist_next (cur))
+		shutdown (((ServerContext*)cur->data)->infd, SHUT_RD);
+	reap_clients (clients, TRUE);
 
 	return MU_OK;
 }
+
+
+/* pushed to the prefetch queue to stop the prefetcher */
+static char PREFETCH_STOP[] = "";
+
+/* parse the messages in the prefetch queue, and put them in the
+ * message cache */
+static gpointer
+prefetcher_thread (ServerShared *shared)
+{
+	char *path;
+
+	while ((path = (char*)g_async_queue_pop (shared->prefetch)) !=
+	       PREFETCH_STOP) {
+		if (!MU_TERMINATE)
+			mu_msg_cache_prefetch (shared->mcache, path, NULL);
+		g_free (path);
+	}
+
+	return NULL;
+}
+
+
+MuError
+mu_cmd_server (MuStore *store, MuConfig *opts, GError **err)
+{
+	ServerShared shared;
+	MuError rv;
+
+	g_return_val_if_fail (store, MU_ERROR_INTERNAL);
+
+#if !GLIB_CHECK_VERSION(2,32,0)
+	if (!g_thread_supported ())
+		g_thread_init (NULL);
+#endif /*!GLIB_CHECK_VERSION(2,32,0)*/
+
+	memset (&shared, 0, sizeof(shared));
+	shared.store = store;
+	shared.query = mu_query_new (store, err);
+	if (!shared.query)
+		return MU_G_ERROR_CODE (err);
+
+	shared.store_lock = mutex_new ();
+	shared.store_cond = cond_new ();
+
+	/* query cache size is in MB; 0 means 'no cache' */
+	shared.qcache = opts->query_cache_size > 0 ?
+		mu_query_cache_new
+		((size_t)opts->query_cache_size * 1024 * 1024) : NULL;
+	shared.daemon = opts->socket ? TRUE : FALSE;
+
+	/* likewise for the message cache */
+	if (opts->msg_cache_size > 0) {
+		shared.mcache	  = mu_msg_cache_new
+			((size_t)opts->msg_cache_size * 1024 * 1024);
+		shared.prefetch	  = g_async_queue_new ();
+		shared.prefetcher = start_thread
+			((GThreadFunc)prefetcher_thread, &shared);
+	}
+
+	install_sig_handler ();
+
+	if (shared.daemon)
+		rv = serve_socket (&shared, opts->socket, err);
+	else {
+		ServerContext *ctx;
+
+		/* the expressions don't go through stdout */
+		g_print (";; welcome to " PACKAGE_STRING "\n");
+		fflush (stdout);
+
+		ctx = client_new (&shared, STDIN_FILENO, fileno (stdout));
+		serve (ctx);
+		client_destroy (ctx);
+		rv = MU_OK;
+	}
+
+	if (shared.prefetcher) {
+		g_async_queue_push (shared.prefetch, PREFETCH_STOP);
+		g_thread_join (shared.prefetcher);
+		g_async_queue_unref (shared.prefetch);
+	}
+
+	mu_store_flush   (shared.store);
+	mu_query_destroy (shared.query);
+	mu_query_cache_destroy (shared.qcache);
+	mu_msg_cache_destroy (shared.mcache);
+
+	cond_free (shared.store_cond);
+	mutex_free (shared.store_lock);
+
+	return rv;
+}
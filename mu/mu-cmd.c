@@ -617,7 +617,10 @@ mu_cmd_execute (MuConfig *opts, GError **err)
 	case MU_CONFIG_CMD_EXTRACT: merr = mu_cmd_extract (opts, err); break;
 
 	case MU_CONFIG_CMD_FIND:
-		merr = with_store (mu_cmd_find, opts, TRUE, err);      break;
+		merr = opts->via_daemon ?
+			mu_cmd_find_via_daemon (opts, err) :
+			with_store (mu_cmd_find, opts, TRUE, err);
+		break;
 	case MU_CONFIG_CMD_INDEX:
 		merr = with_store (mu_cmd_index, opts, FALSE, err);    break;
 	case MU_CONFIG_CMD_ADD:
@@ -80,6 +80,21 @@ MuError mu_cmd_index   (MuStore *store, MuConfig *opt, GError **err);
 MuError mu_cmd_find (MuStore *store, MuConfig *opts, GError **err);
 
 
+/**
+ * execute the 'find' command through a running 'mu server --socket'
+ * (see opts->socket), rather than opening the database; only
+ * --format=sexp is supported
+ *
+ * @param opts configuration options
+ * @param err receives error information, or NULL
+ *
+ * @return MU_OK (0) if the command succeeds,
+ * MU_EXITCODE_NO_MATCHES if the command succeeds but there no
+ * matches, some error code for all other errors
+ */
+MuError mu_cmd_find_via_daemon (MuConfig *opts, GError **err);
+
+
 /**
  * execute the 'extract' command
  *
@@ -150,6 +150,9 @@ config_options_group_index (void)
 		 "index even already indexed messages (false)", NULL},
 		{"rebuild", 0, 0, G_OPTION_ARG_NONE, &MU_CONFIG.rebuild,
 		 "rebuild the database from scratch (false)", NULL},
+		{"date-order", 0, 0, G_OPTION_ARG_NONE, &MU_CONFIG.date_order,
+		 "after indexing, put the database in date order (false)",
+		 NULL},
 		{"my-address", 0, 0, G_OPTION_ARG_STRING_ARRAY,
 		 &MU_CONFIG.my_addresses,
 		 "my e-mail address (regexp); can be used multiple times",
@@ -209,6 +212,20 @@ config_options_group_find (void)
 		 "field to sort on", "<field>"},
 		{"threads", 't', 0, G_OPTION_ARG_NONE, &MU_CONFIG.threads,
 		 "show message threads", NULL},
+		{"group-subjects", 0, 0, G_OPTION_ARG_NONE,
+		 &MU_CONFIG.group_subjects,
+		 "with --threads, also group messages by subject (false)",
+		 NULL},
+		{"sort-by-activity", 0, 0, G_OPTION_ARG_NONE,
+		 &MU_CONFIG.sort_by_activity,
+		 "with --threads, sort threads by their newest message (false)",
+		 NULL},
+		{"skip-dups", 0, 0, G_OPTION_ARG_NONE, &MU_CONFIG.skip_dups,
+		 "show only one of each set of duplicate messages (false)",
+		 NULL},
+		{"facet", 0, 0, G_OPTION_ARG_STRING, &MU_CONFIG.facets,
+		 "count the matches per value of some fields "
+		 "(e.g. 'maildir,from,date:month')", "<facets>"},
 		{"bookmark", 'b', 0, G_OPTION_ARG_STRING, &MU_CONFIG.bookmark,
 		 "use a bookmarked query", "<bookmark>"},
 		{"reverse", 'z', 0, G_OPTION_ARG_NONE, &MU_CONFIG.reverse,
@@ -225,6 +242,12 @@ config_options_group_find (void)
 		{"after", 0, 0, G_OPTION_ARG_INT, &MU_CONFIG.after,
 		 "only show messages whose m_time > T (t_time)",
 		 "<timestamp>"},
+		{"via-daemon", 0, 0, G_OPTION_ARG_NONE, &MU_CONFIG.via_daemon,
+		 "let a running 'mu server --socket' do the search (false)",
+		 NULL},
+		{"socket", 0, 0, G_OPTION_ARG_FILENAME, &MU_CONFIG.socket,
+		 "with --via-daemon, the server's socket "
+		 "(<muhome>/mu-server.sock)", "<path>"},
 		{NULL, 0, 0, 0, NULL, NULL, NULL}
 	};
 
@@ -429,9 +452,24 @@ config_options_group_server (void)
 	GOptionEntry entries[] = {
 		{"maildir", 'm', 0, G_OPTION_ARG_FILENAME, &MU_CONFIG.maildir,
 		 "top of the maildir", "<maildir>"},
+		{"msg-cache-size", 0, 0, G_OPTION_ARG_INT,
+		 &MU_CONFIG.msg_cache_size,
+		 "maximum total size of the message files to keep "
+		 "parsed in MB (16); 0 disables it", "<size>"},
+		{"query-cache-size", 0, 0, G_OPTION_ARG_INT,
+		 &MU_CONFIG.query_cache_size,
+		 "maximum size of the query cache in MB (16); "
+		 "0 disables it", "<size>"},
+		{"socket", 0, 0, G_OPTION_ARG_FILENAME, &MU_CONFIG.socket,
+		 "serve any number of clients on a unix socket, "
+		 "rather than one on stdin/stdout", "<path>"},
 		{NULL, 0, 0, 0, NULL, NULL, NULL}
 	};
 
+	/* set the defaults before, because 0 is a valid size */
+	MU_CONFIG.msg_cache_size   = 16;
+	MU_CONFIG.query_cache_size = 16;
+
 	og = g_option_group_new("server",
 				"Options for the 'server' command",
 				"", NULL, NULL);
@@ -719,6 +757,7 @@ mu_config_uninit (MuConfig *opts)
 	g_free (opts->maildir);
 	g_free (opts->linksdir);
 	g_free (opts->targetdir);
+	g_free (opts->socket);
 
 	g_strfreev (opts->params);
 
@@ -111,6 +111,8 @@ struct _MuConfig {
 	gboolean        nocleanup;	/* don't cleanup del'd mails from db */
 	gboolean        reindex;	/* re-index existing mails */
 	gboolean        rebuild;	/* empty the database before indexing */
+	gboolean	date_order;	/* put the database in date order
+					 * after indexing */
 	gboolean        autoupgrade;    /* automatically upgrade db
 					 * when needed */
 	int             xbatchsize;     /* batchsize for xapian
@@ -126,6 +128,16 @@ struct _MuConfig {
 	gchar	        *sortfield;	/* field to sort by (string) */
 	gboolean	 reverse;	/* sort in revers order (z->a) */
 	gboolean	 threads;       /* show message threads */
+	gboolean	 group_subjects; /* group threads by subject */
+	gboolean	 sort_by_activity; /* sort threads by their
+					    * newest message */
+	gboolean	 skip_dups;	/* don't show duplicate messages */
+	gchar		*facets;	/* comma-sep'd list of facets
+					 * to count, instead of
+					 * showing the matches */
+	gboolean	 via_daemon;	/* ask a 'mu server --socket'
+					 * instead of opening the
+					 * database */
 
 	gboolean	 summary;	/* OBSOLETE: use summary_len */
 	int	         summary_len;   /* max # of lines for summary */
@@ -176,6 +188,16 @@ struct _MuConfig {
 	gboolean	 overwrite;	/* should we overwrite same-named files */
 	gboolean         play;          /* after saving, try to 'play'
 					 * (open) the attmnt using xdgopen */
+	/* options for the server */
+	int		 msg_cache_size;   /* max size of the message
+					    * files to keep parsed in
+					    * MB, or 0 */
+	int		 query_cache_size; /* max size of the query
+					    * cache in MB, or 0 */
+	gchar		*socket;	/* serve clients on this unix
+					 * socket (and 'find
+					 * --via-daemon') */
+
 	/* options for mu-script */
 	gchar           *script;        /* script to run */
 };
@@ -0,0 +1,294 @@
+/* -*-mode: c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-*/
+
+/*
+** Copyright (C) 2012 Dirk-Jan C. Binnema <djcb@djcbsoftware.nl>
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of the GNU General Public License as published by the
+** Free Software Foundation; either version 3, or (at your option) any
+** later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software Foundation,
+** Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+**
+*/
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif /*HAVE_CONFIG_H*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
+
+#include "mu-server-output.h"
+
+/* not all systems define IOV_MAX */
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif /*IOV_MAX*/
+
+/* one buffered expression; the expression itself (followed by a
+ * newline) lives in the buffer */
+struct _Frame {
+	char	cookie[12]; /* COOKIE_PRE <len in hex> COOKIE_POST */
+	guint8	cookielen;
+	gsize	offset, len;
+};
+typedef struct _Frame Frame;
+
+struct _MuServerOutput {
+	int	 fd;
+	GString	*buf;	 /* the expressions */
+	GArray	*frames; /* Frame */
+	size_t	 flushsize;
+	double	 latency; /* in seconds */
+	GTimer	*timer;	 /* started when the first frame is added */
+
+	guint64	 exprs, writes, bytes;
+};
+
+
+MuServerOutput*
+mu_server_output_new (int fd, size_t flushsize, unsigned latency)
+{
+	MuServerOutput *self;
+
+	g_return_val_if_fail (fd >= 0, NULL);
+
+	self = g_slice_new0 (MuServerOutput);
+
+	self->fd	= fd;
+	self->flushsize = flushsize;
+	self->latency	= latency / 1000.0;
+	self->buf	= g_string_sized_new (flushsize + 1024);
+	self->frames	= g_array_sized_new (FALSE, FALSE, sizeof(Frame), 256);
+	self->timer	= g_timer_new ();
+
+	return self;
+}
+
+
+void
+mu_server_output_destroy (MuServerOutput *self)
+{
+	if (!self)
+		return;
+
+	mu_server_output_flush (self);
+
+	g_string_free (self->buf, TRUE);
+	g_array_free (self->frames, TRUE);
+	g_timer_destroy (self->timer);
+
+	g_slice_free (MuServerOutput, self);
+}
+
+
+/* write the iovecs, taking care of partial writes; we update them
+ * in-place */
+static gboolean
+write_iovecs (MuServerOutput *self, struct iovec *iov, int iovnum)
+{
+	while (iovnum > 0) {
+
+		ssize_t rv;
+		size_t n;
+
+		rv = writev (self->fd, iov, MIN (iovnum, IOV_MAX));
+		if (rv == -1) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return FALSE;
+		}
+
+		++self->writes;
+		self->bytes += (guint64)rv;
+
+		/* skip what was written */
+		for (n = (size_t)rv; iovnum > 0 && n >= iov->iov_len; --iovnum) {
+			n -= iov->iov_len;
+			++iov;
+		}
+		if (iovnum > 0) {
+			iov->iov_base = (char*)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	return TRUE;
+}
+
+
+gboolean
+mu_server_output_flush (MuServerOutput *self)
+{
+	struct iovec *iov;
+	unsigned u;
+	gboolean rv;
+
+	g_return_val_if_fail (self, FALSE);
+
+	if (self->frames->len == 0)
+		return TRUE;
+
+	/* the cookie, and the expression + newline for each frame */
+	iov = g_new (struct iovec, 2 * self->frames->len);
+	for (u = 0; u != self->frames->len; ++u) {
+		Frame *frame;
+		frame = &g_array_index (self->frames, Frame, u);
+		iov[2*u].iov_base     = frame->cookie;
+		iov[2*u].iov_len      = frame->cookielen;
+		iov[2*u + 1].iov_base = self->buf->str + frame->offset;
+		iov[2*u + 1].iov_len  = frame->len;
+	}
+
+	rv = write_iovecs (self, iov, 2 * self->frames->len);
+	g_free (iov);
+
+	g_string_truncate (self->buf, 0);
+	g_array_set_size (self->frames, 0);
+
+	return rv;
+}
+
+
+/* format the expression (followed by a newline) at the end of the
+ * buffer, without any intermediate string; the prefix (if any) takes
+ * the place of the opening parenthesis of the expression */
+static gsize
+append_expr (GString *buf, const char *prefix, const char *frm,
+	     va_list args)
+{
+	gsize offset, start, room;
+	va_list args2;
+	int len;
+
+	offset = buf->len;
+	if (prefix)
+		g_string_append (buf, prefix);
+
+	start = buf->len;
+	room  = buf->allocated_len - start;
+
+	G_VA_COPY (args2, args);
+	len = g_vsnprintf (buf->str + start, room, frm, args2);
+	va_end (args2);
+
+	/* +2 for the newline and the '\0' */
+	if ((gsize)len + 2 > room) {
+		g_string_set_size (buf, start + len + 1);
+		g_vsnprintf (buf->str + start, len + 1, frm, args);
+	}
+
+	g_string_set_size (buf, start + len);
+
+	/* ie., "(:id 5" + "(:foo 1)" => "(:id 5 :foo 1)" */
+	if (prefix && buf->str[start] == '(')
+		buf->str[start] = ' ';
+	else if (prefix) /* not a list; it can't get the prefix */
+		g_string_erase (buf, offset, start - offset);
+
+	g_string_append_c (buf, '\n');
+
+	return buf->len - offset;
+}
+
+
+void
+mu_server_output_vappend (MuServerOutput *self, const char *prefix,
+			  const char *frm, va_list args)
+{
+	Frame frame;
+
+	g_return_if_fail (self);
+	g_return_if_fail (frm);
+
+	if (self->frames->len == 0)
+		g_timer_start (self->timer);
+
+	frame.offset = self->buf->len;
+	frame.len    = append_expr (self->buf, prefix, frm, args);
+
+	/* this cookie tells the frontend where to expect the next
+	 * expression; the length includes the newline */
+	frame.cookie[0] = MU_SERVER_COOKIE_PRE;
+	frame.cookielen = 1 + g_snprintf (frame.cookie + 1,
+					  sizeof(frame.cookie) - 2, "%x",
+					  (unsigned)frame.len);
+	frame.cookie[frame.cookielen++] = MU_SERVER_COOKIE_POST;
+
+	g_array_append_val (self->frames, frame);
+	++self->exprs;
+}
+
+
+int
+mu_server_output_due_in (MuServerOutput *self)
+{
+	double left;
+
+	g_return_val_if_fail (self, -1);
+
+	if (self->frames->len == 0)
+		return -1;
+	if (self->buf->len >= self->flushsize)
+		return 0;
+
+	left = self->latency - g_timer_elapsed (self->timer, NULL);
+
+	return left > 0 ? (int)(left * 1000) + 1 : 0;
+}
+
+
+gboolean
+mu_server_output_vprint (MuServerOutput *self, const char *frm, va_list args)
+{
+	g_return_val_if_fail (self, FALSE);
+	g_return_val_if_fail (frm, FALSE);
+
+	mu_server_output_vappend (self, NULL, frm, args);
+
+	if (mu_server_output_due_in (self) == 0)
+		return mu_server_output_flush (self);
+
+	return TRUE;
+}
+
+
+gboolean
+mu_server_output_print (MuServerOutput *self, const char *frm, ...)
+{
+	va_list args;
+	gboolean rv;
+
+	va_start (args, frm);
+	rv = mu_server_output_vprint (self, frm, args);
+	va_end (args);
+
+	return rv;
+}
+
+
+void
+mu_server_output_stats (MuServerOutput *self, guint64 *exprs,
+			guint64 *writes, guint64 *bytes)
+{
+	g_return_if_fail (self);
+
+	if (exprs)
+		*exprs = self->exprs;
+	if (writes)
+		*writes = self->writes;
+	if (bytes)
+		*bytes = self->bytes;
+}
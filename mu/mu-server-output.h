@@ -0,0 +1,149 @@
+/* -*-mode: c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-*/
+
+/*
+** Copyright (C) 2012 Dirk-Jan C. Binnema <djcb@djcbsoftware.nl>
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of the GNU General Public License as published by the
+** Free Software Foundation; either version 3, or (at your option) any
+** later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software Foundation,
+** Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+**
+*/
+
+#ifndef __MU_SERVER_OUTPUT_H__
+#define __MU_SERVER_OUTPUT_H__
+
+#include <glib.h>
+#include <stdarg.h>
+
+G_BEGIN_DECLS
+
+/*
+ * MuServerOutput writes the expressions for 'mu server' to some file
+ * descriptor. Each expression is preceded by a 'cookie' with its
+ * length, ie.
+ *     COOKIE_PRE <len-of-following-sexp-in-hex> COOKIE_POST
+ * and followed by a newline.
+ *
+ * The expressions are formatted directly into an output buffer, and
+ * written together with a single writev(2) when the buffer is full
+ * enough, when the oldest expression in it has waited long enough, or
+ * when the output is flushed explicitly (e.g., before waiting for the
+ * next command).
+ */
+struct _MuServerOutput;
+typedef struct _MuServerOutput MuServerOutput;
+
+/* markers for/after the length cookie that precedes the expressions;
+ * we use octal 376, 377 (ie, 0xfe, 0xff) as they will never occur in
+ * utf8 */
+#define MU_SERVER_COOKIE_PRE  '\376'
+#define MU_SERVER_COOKIE_POST '\377'
+
+/**
+ * create a new server output
+ *
+ * @param fd the file descriptor to write to
+ * @param flushsize write the buffered expressions when they take this
+ * many bytes or more
+ * @param latency write the buffered expressions when the oldest of them
+ * has been waiting for this many milliseconds (checked when adding
+ * expressions), or 0 to write each expression right away
+ *
+ * @return a new MuServerOutput; free with mu_server_output_destroy
+ */
+MuServerOutput* mu_server_output_new (int fd, size_t flushsize,
+				      unsigned latency)
+	G_GNUC_WARN_UNUSED_RESULT;
+
+/**
+ * flush and destroy a server output
+ *
+ * @param self a MuServerOutput, or NULL
+ */
+void mu_server_output_destroy (MuServerOutput *self);
+
+/**
+ * add an expression to the output
+ *
+ * @param self a MuServerOutput
+ * @param frm printf-style format string for the expression
+ * @param ... parameters for the format string
+ *
+ * @return TRUE if it succeeded, FALSE if writing failed
+ */
+gboolean mu_server_output_print (MuServerOutput *self, const char *frm, ...)
+	G_GNUC_PRINTF(2,3);
+
+/**
+ * add an expression to the output
+ *
+ * @param self a MuServerOutput
+ * @param frm printf-style format string for the expression
+ * @param args parameters for the format string
+ *
+ * @return TRUE if it succeeded, FALSE if writing failed
+ */
+gboolean mu_server_output_vprint (MuServerOutput *self, const char *frm,
+				  va_list args);
+
+/**
+ * add an expression to the output, without writing anything; see
+ * mu_server_output_due_in for when to write it
+ *
+ * @param self a MuServerOutput
+ * @param prefix a string that replaces the opening parenthesis of the
+ * expression (e.g., "(:id 5" turns "(:foo 1)" into "(:id 5 :foo 1)"),
+ * or NULL; it's left out if the expression does not start with a
+ * parenthesis
+ * @param frm printf-style format string for the expression
+ * @param args parameters for the format string
+ */
+void mu_server_output_vappend (MuServerOutput *self, const char *prefix,
+			       const char *frm, va_list args);
+
+/**
+ * get the time until the buffered expressions should be written,
+ * ie., until the oldest of them has waited for the latency (see
+ * mu_server_output_new)
+ *
+ * @param self a MuServerOutput
+ *
+ * @return the time in milliseconds, 0 if they should be written now
+ * (including when they take flushsize bytes or more), or -1 if
+ * there's nothing buffered
+ */
+int mu_server_output_due_in (MuServerOutput *self);
+
+/**
+ * write all buffered expressions
+ *
+ * @param self a MuServerOutput
+ *
+ * @return TRUE if it succeeded, FALSE if writing failed
+ */
+gboolean mu_server_output_flush (MuServerOutput *self);
+
+/**
+ * get some statistics about the output
+ *
+ * @param self a MuServerOutput
+ * @param exprs receives the number of expressions, or NULL
+ * @param writes receives the number of writev calls, or NULL
+ * @param bytes receives the number of bytes written, or NULL
+ */
+void mu_server_output_stats (MuServerOutput *self, guint64 *exprs,
+			     guint64 *writes, guint64 *bytes);
+
+G_END_DECLS
+
+#endif /*__MU_SERVER_OUTPUT_H__*/
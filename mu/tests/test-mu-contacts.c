@@ -177,6 +177,179 @@ test_mu_contacts_01 (void)
 }
 
 
+static void
+test_mu_contacts_02 (void)
+{
+	MuContacts *contacts;
+	gchar *tmpdir, *contactsfile;
+	GSList *clist;
+
+	tmpdir = test_mu_common_get_random_tmpdir();
+	g_assert (g_mkdir_with_parents (tmpdir, 0700) == 0);
+	contactsfile = g_strdup_printf ("%s%ccontacts", tmpdir,
+					G_DIR_SEPARATOR);
+
+	contacts = mu_contacts_new (contactsfile);
+	g_assert (contacts);
+	g_assert_cmpuint (mu_contacts_count (contacts), ==, 0);
+
+	/* these used to map to the same key */
+	g_assert (mu_contacts_add (contacts, "a_b@example.com", "Ab",
+				   FALSE, 1000));
+	g_assert (mu_contacts_add (contacts, "a-b@example.com", "A B",
+				   TRUE, 1000));
+	/* the address is case-insensitive */
+	g_assert (mu_contacts_add (contacts, "A-B@Example.com", "Anne B",
+				   TRUE, 2000));
+	g_assert (!mu_contacts_add (contacts, "a-b@example.com", "Old",
+				    TRUE, 1500));
+	g_assert_cmpuint (mu_contacts_count (contacts), ==, 2);
+	mu_contacts_destroy (contacts);
+
+	/* now, from the cache file */
+	contacts = mu_contacts_new (contactsfile);
+	g_assert (contacts);
+	g_assert_cmpuint (mu_contacts_count (contacts), ==, 2);
+
+	clist = accumulate_contacts (contacts, NULL);
+	g_assert_cmpint (g_slist_length (clist), ==, 2);
+	g_assert (has_contact (clist, "Ab", TRUE));
+	g_assert (has_contact (clist, "Anne B", TRUE));
+	g_assert (!has_contact (clist, "Old", TRUE));
+	g_slist_foreach (clist, (GFunc)contact_destroy, NULL);
+	g_slist_free (clist);
+
+	/* update one from the cache file, and add a new one */
+	g_assert (mu_contacts_add (contacts, "a_b@example.com", "A. B.",
+				   FALSE, 3000));
+	g_assert (mu_contacts_add (contacts, "c@example.com", NULL,
+				   FALSE, 3000));
+	g_assert_cmpuint (mu_contacts_count (contacts), ==, 3);
+	mu_contacts_destroy (contacts);
+
+	contacts = mu_contacts_new (contactsfile);
+	g_assert (contacts);
+	clist = accumulate_contacts (contacts, "example");
+	g_assert_cmpint (g_slist_length (clist), ==, 3);
+	g_assert (has_contact (clist, "A. B.", TRUE));
+	g_assert (!has_contact (clist, "Ab", TRUE));
+	g_assert (has_contact (clist, "c@example.com", FALSE));
+	g_slist_foreach (clist, (GFunc)contact_destroy, NULL);
+	g_slist_free (clist);
+
+	mu_contacts_clear (contacts);
+	g_assert_cmpuint (mu_contacts_count (contacts), ==, 0);
+	mu_contacts_destroy (contacts);
+
+	g_free (contactsfile);
+	g_free (tmpdir);
+}
+
+
+/* another MuContacts sees the changes in the journal, before the
+ * one that made them is destroyed; and it leaves the journal alone */
+static void
+test_mu_contacts_journal (void)
+{
+	MuContacts *writer, *reader;
+	gchar *tmpdir, *contactsfile, *journal;
+	GSList *clist;
+
+	tmpdir = test_mu_common_get_random_tmpdir();
+	g_assert (g_mkdir_with_parents (tmpdir, 0700) == 0);
+	contactsfile = g_strdup_printf ("%s%ccontacts", tmpdir,
+					G_DIR_SEPARATOR);
+	journal = g_strdup_printf ("%s.journal", contactsfile);
+
+	writer = mu_contacts_new (contactsfile);
+	g_assert (writer);
+	g_assert (mu_contacts_add (writer, "a@example.com", "A", FALSE,
+				   1000));
+	g_assert (mu_contacts_add (writer, "b@example.com", NULL, TRUE,
+				   1000));
+	g_assert (access (journal, F_OK) == 0);
+
+	reader = mu_contacts_new (contactsfile);
+	g_assert (reader);
+	g_assert_cmpuint (mu_contacts_count (reader), ==, 2);
+	clist = accumulate_contacts (reader, NULL);
+	g_assert (has_contact (clist, "A", TRUE));
+	g_assert (has_contact (clist, "b@example.com", FALSE));
+	g_slist_foreach (clist, (GFunc)contact_destroy, NULL);
+	g_slist_free (clist);
+	mu_contacts_destroy (reader);
+
+	/* the reader did not change anything */
+	g_assert (access (journal, F_OK) == 0);
+	g_assert (access (contactsfile, F_OK) != 0);
+
+	/* the writer keeps appending to it */
+	g_assert (mu_contacts_add (writer, "c@example.com", "C", FALSE,
+				   2000));
+	reader = mu_contacts_new (contactsfile);
+	g_assert_cmpuint (mu_contacts_count (reader), ==, 3);
+	mu_contacts_destroy (reader);
+
+	/* the writer replaces the journal with the cache file */
+	mu_contacts_destroy (writer);
+	g_assert (access (journal, F_OK) != 0);
+	g_assert (access (contactsfile, F_OK) == 0);
+
+	reader = mu_contacts_new (contactsfile);
+	g_assert_cmpuint (mu_contacts_count (reader), ==, 3);
+	mu_contacts_destroy (reader);
+
+	/* likewise, when the cache file is in the old format: the
+	 * reader converts it, but leaves the journal alone */
+	g_free (journal);
+	g_free (contactsfile);
+	contactsfile = g_strdup_printf ("%s%ccontacts-old", tmpdir,
+					G_DIR_SEPARATOR);
+	journal = g_strdup_printf ("%s.journal", contactsfile);
+	g_assert (g_file_set_contents (contactsfile,
+				       "[old@example.com]\n"
+				       "email=old@example.com\n"
+				       "name=Old\n"
+				       "tstamp=500\n"
+				       "personal=false\n", -1, NULL));
+
+	writer = mu_contacts_new (contactsfile);
+	g_assert (writer);
+	g_assert (mu_contacts_add (writer, "a@example.com", "A", FALSE,
+				   1000));
+
+	reader = mu_contacts_new (contactsfile);
+	g_assert (reader);
+	g_assert_cmpuint (mu_contacts_count (reader), ==, 2);
+	mu_contacts_destroy (reader);
+	g_assert (access (journal, F_OK) == 0);
+
+	/* the converted cache file, plus the journal */
+	g_assert (mu_contacts_add (writer, "b@example.com", "B", FALSE,
+				   2000));
+	reader = mu_contacts_new (contactsfile);
+	g_assert_cmpuint (mu_contacts_count (reader), ==, 3);
+	clist = accumulate_contacts (reader, NULL);
+	g_assert (has_contact (clist, "Old", TRUE));
+	g_assert (has_contact (clist, "B", TRUE));
+	g_slist_foreach (clist, (GFunc)contact_destroy, NULL);
+	g_slist_free (clist);
+	mu_contacts_destroy (reader);
+	g_assert (access (journal, F_OK) == 0);
+
+	mu_contacts_destroy (writer);
+	g_assert (access (journal, F_OK) != 0);
+
+	reader = mu_contacts_new (contactsfile);
+	g_assert_cmpuint (mu_contacts_count (reader), ==, 3);
+	mu_contacts_destroy (reader);
+
+	g_free (journal);
+	g_free (contactsfile);
+	g_free (tmpdir);
+}
+
+
 int
 main (int argc, char *argv[])
 {
@@ -184,6 +357,9 @@ main (int argc, char *argv[])
 
 	g_test_init (&argc, &argv, NULL);
 	g_test_add_func ("/mu-contacts/test-mu-contacts-01", test_mu_contacts_01);
+	g_test_add_func ("/mu-contacts/test-mu-contacts-02", test_mu_contacts_02);
+	g_test_add_func ("/mu-contacts/test-mu-contacts-journal",
+			 test_mu_contacts_journal);
 
 	g_log_set_handler (NULL,
 			   G_LOG_LEVEL_MASK | G_LOG_FLAG_FATAL| G_LOG_FLAG_RECURSION,
@@ -30,6 +30,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <locale.h>
+#include <time.h>
 
 #include "test-mu-common.h"
 #include "mu-query.h"
@@ -130,7 +131,8 @@ run_and_count_matches (const char *xpath, const char *query)
 	}
 
 
-	iter = mu_query_run (mquery, query, FALSE, MU_MSG_FIELD_ID_NONE,
+	iter = mu_query_run (mquery, query, MU_QUERY_FLAG_NONE,
+			     MU_MSG_FIELD_ID_NONE,
 			     FALSE, -1, NULL);
 	mu_query_destroy (mquery);
 	g_assert (iter);
@@ -295,7 +297,8 @@ test_mu_query_accented_chars_01 (void)
 	query = mu_query_new (store, NULL);
 	mu_store_unref (store);
 
-	iter = mu_query_run (query, "fünkÿ", FALSE, MU_MSG_FIELD_ID_NONE,
+	iter = mu_query_run (query, "fünkÿ", MU_QUERY_FLAG_NONE,
+			     MU_MSG_FIELD_ID_NONE,
 			     FALSE, -1, NULL);
 	err = NULL;
 	msg = mu_msg_iter_get_msg_floating (iter); /* don't unref */
@@ -575,6 +578,109 @@ test_mu_query_tags_02 (void)
 }
 
 
+static void
+test_mu_query_iter_fields (void)
+{
+	MuQuery  *mquery;
+	MuStore *store;
+	MuMsgIter *iter;
+	unsigned count;
+	MuMsgFieldId mfids[] = {
+		MU_MSG_FIELD_ID_SUBJECT,
+		MU_MSG_FIELD_ID_DATE,
+		MU_MSG_FIELD_ID_FLAGS
+	};
+
+	store = mu_store_new_read_only (DB_PATH1, NULL);
+	g_assert (store);
+	mquery = mu_query_new (store, NULL);
+	g_assert (mquery);
+	mu_store_unref (store);
+
+	iter = mu_query_run (mquery, "", MU_QUERY_FLAG_NONE,
+			     MU_MSG_FIELD_ID_NONE,
+			     FALSE, -1, NULL);
+	g_assert (iter);
+	g_assert (mu_msg_iter_set_fields (iter, mfids, G_N_ELEMENTS(mfids)));
+
+	/* the values we get from the iter should be the same as
+	 * the ones from the message */
+	for (count = 0; !mu_msg_iter_is_done (iter);
+	     mu_msg_iter_next (iter), ++count) {
+		MuMsg *msg;
+		msg = mu_msg_iter_get_msg_floating (iter);
+		g_assert_cmpstr (mu_msg_iter_get_field_str
+				 (iter, MU_MSG_FIELD_ID_SUBJECT), ==,
+				 mu_msg_get_subject (msg));
+		g_assert_cmpuint (mu_msg_iter_get_field_numeric
+				  (iter, MU_MSG_FIELD_ID_DATE), ==,
+				  mu_msg_get_date (msg));
+		g_assert_cmpuint (mu_msg_iter_get_field_numeric
+				  (iter, MU_MSG_FIELD_ID_FLAGS), ==,
+				  mu_msg_get_flags (msg));
+	}
+	g_assert_cmpuint (count, ==, 18);
+
+	mu_msg_iter_destroy (iter);
+	mu_query_destroy (mquery);
+}
+
+
+static void
+each_facet_value (const char *facet, const char *value, unsigned count,
+		  GHashTable *hash)
+{
+	g_assert_cmpstr (facet, ==, "maildir");
+	g_hash_table_insert (hash, g_strdup (value), GUINT_TO_POINTER(count));
+}
+
+
+static void
+test_mu_query_facets (void)
+{
+	MuQuery  *mquery;
+	MuStore *store;
+	GHashTable *hash;
+	GError *err;
+
+	err = NULL;
+	store = mu_store_new_read_only (DB_PATH2, &err);
+	g_assert (store);
+	mquery = mu_query_new (store, &err);
+	g_assert (mquery);
+	mu_store_unref (store);
+
+	hash = g_hash_table_new_full (g_str_hash, g_str_equal,
+				      (GDestroyNotify)g_free, NULL);
+
+	g_assert (mu_query_facets (mquery, "", "maildir",
+				   (MuQueryFacetForeachFunc)each_facet_value,
+				   hash, &err));
+	g_assert (!err);
+	g_assert_cmpuint (g_hash_table_size (hash), ==, 3);
+	g_assert_cmpuint (GPOINTER_TO_UINT(g_hash_table_lookup (hash, "/bar")),
+			  ==, 7);
+	g_assert_cmpuint (GPOINTER_TO_UINT(g_hash_table_lookup (hash, "/Foo")),
+			  ==, 3);
+	g_assert_cmpuint (GPOINTER_TO_UINT(g_hash_table_lookup
+					   (hash, "/wom_bat")), ==, 3);
+
+	/* invalid facets */
+	g_assert (!mu_query_facets (mquery, "", "body",
+				    (MuQueryFacetForeachFunc)each_facet_value,
+				    hash, &err));
+	g_assert (err && err->code == MU_ERROR_IN_PARAMETERS);
+	g_clear_error (&err);
+	g_assert (!mu_query_facets (mquery, "", "date:week",
+				    (MuQueryFacetForeachFunc)each_facet_value,
+				    hash, &err));
+	g_clear_error (&err);
+
+	g_hash_table_destroy (hash);
+	mu_query_destroy (mquery);
+}
+
+
 static void
 test_mu_query_preprocess (void)
 {
@@ -597,7 +703,317 @@ test_mu_query_preprocess (void)
 
 
 
+/* index @maildir into the database under @muhome, with some extra
+ * arguments for 'mu index' */
+static void
+index_maildir (const char *muhome, const char *maildir, const char *args)
+{
+	gchar *cmdline;
 
+	cmdline = g_strdup_printf ("%s index --muhome=%s --maildir=%s"
+				   " --quiet %s", MU_PROGRAM, muhome, maildir,
+				   args);
+	if (g_test_verbose())
+		g_printerr ("\n%s\n", cmdline);
+
+	g_assert (g_spawn_command_line_sync (cmdline, NULL, NULL,
+					     NULL, NULL));
+	g_free (cmdline);
+}
+
+
+static gchar*
+create_maildir (void)
+{
+	gchar *mdir, *dir;
+	unsigned u;
+	const char *subdirs[] = {"cur", "new", "tmp"};
+
+	mdir = test_mu_common_get_random_tmpdir ();
+	for (u = 0; u != G_N_ELEMENTS(subdirs); ++u) {
+		dir = g_build_filename (mdir, subdirs[u], NULL);
+		g_assert (g_mkdir_with_parents (dir, 0700) == 0);
+		g_free (dir);
+	}
+
+	return mdir;
+}
+
+
+/* write message <num>@dated.msg.id, @secs seconds after the start of
+ * 2009 */
+static void
+write_dated_msg (const char *mdir, unsigned num, unsigned secs)
+{
+	static const char *months[] = {
+		"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+		"Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+	};
+	gchar *path, *name, *msg;
+	struct tm tm;
+	time_t t;
+
+	t = (time_t)1230768000 + secs; /* 2009-01-01 00:00:00 UTC */
+	gmtime_r (&t, &tm);
+
+	name = g_strdup_printf ("%u:2,S", num);
+	path = g_build_filename (mdir, "cur", name, NULL);
+	msg  = g_strdup_printf ("From: Alice <alice@example.com>\n"
+				"To: Bob <bob@example.com>\n"
+				"Subject: message %u\n"
+				"Date: %d %s %d %02d:%02d:%02d +0000\n"
+				"Message-Id: <%u@dated.msg.id>\n"
+				"\n"
+				"hello\n",
+				num, tm.tm_mday, months[tm.tm_mon],
+				tm.tm_year + 1900, tm.tm_hour, tm.tm_min,
+				tm.tm_sec, num);
+	g_assert (g_file_set_contents (path, msg, -1, NULL));
+
+	g_free (msg);
+	g_free (path);
+	g_free (name);
+}
+
+
+static MuQuery*
+query_new (const char *xpath)
+{
+	MuStore *store;
+	MuQuery *mquery;
+
+	store = mu_store_new_read_only (xpath, NULL);
+	g_assert (store);
+	mquery = mu_query_new (store, NULL);
+	g_assert (mquery);
+	mu_store_unref (store);
+
+	return mquery;
+}
+
+
+/* get the message-ids of the newest @maxnum messages, separated by
+ * spaces */
+static gchar*
+get_newest (MuQuery *mquery, int maxnum)
+{
+	MuMsgIter *iter;
+	GString *gstr;
+
+	iter = mu_query_run (mquery, "", MU_QUERY_FLAG_NONE,
+			     MU_MSG_FIELD_ID_DATE, TRUE, maxnum, NULL);
+	g_assert (iter);
+
+	gstr = g_string_sized_new (64);
+	for (; !mu_msg_iter_is_done (iter); mu_msg_iter_next (iter))
+		g_string_append_printf
+			(gstr, "%s%s", gstr->len ? " " : "",
+			 mu_msg_get_msgid (mu_msg_iter_get_msg_floating (iter)));
+	mu_msg_iter_destroy (iter);
+
+	return g_string_free (gstr, FALSE);
+}
+
+
+/* in a date-ordered database, the newest messages should be the same
+ * as when sorting by date, also after adding messages out of order */
+static void
+test_mu_query_date_order (void)
+{
+	gchar *mdir, *muhome, *xpath, *newest;
+	MuQuery *mquery;
+	MuStore *store;
+	char *order;
+	unsigned u;
+
+	/* 0..5 are from hours 0, 5, 4, 3, 2, 1 */
+	mdir = create_maildir ();
+	for (u = 0; u != 6; ++u)
+		write_dated_msg (mdir, u, ((u * 5) % 6) * 3600);
+
+	muhome = test_mu_common_get_random_tmpdir ();
+	index_maildir (muhome, mdir, "--date-order");
+	xpath  = g_build_filename (muhome, "xapian", NULL);
+
+	store = mu_store_new_read_only (xpath, NULL);
+	g_assert (store);
+	order = mu_store_get_metadata (store, MU_STORE_DOCID_ORDER_KEY, NULL);
+	g_assert_cmpstr (order, ==, "date");
+	g_free (order);
+	mu_store_unref (store);
+
+	/* 6 and 8 are the newest; 7 is older than some of the others */
+	write_dated_msg (mdir, 6, 10 * 3600);
+	write_dated_msg (mdir, 7, 9000);
+	write_dated_msg (mdir, 8, 20 * 3600);
+	index_maildir (muhome, mdir, "--reindex");
+
+	mquery = query_new (xpath);
+
+	newest = get_newest (mquery, 3);
+	g_assert_cmpstr (newest, ==,
+			 "8@dated.msg.id 6@dated.msg.id 1@dated.msg.id");
+	g_free (newest);
+
+	newest = get_newest (mquery, 6);
+	g_assert_cmpstr (newest, ==,
+			 "8@dated.msg.id 6@dated.msg.id 1@dated.msg.id "
+			 "2@dated.msg.id 3@dated.msg.id 7@dated.msg.id");
+	g_free (newest);
+
+	newest = get_newest (mquery, 100);
+	g_assert_cmpstr (newest, ==,
+			 "8@dated.msg.id 6@dated.msg.id 1@dated.msg.id "
+			 "2@dated.msg.id 3@dated.msg.id 7@dated.msg.id "
+			 "4@dated.msg.id 5@dated.msg.id 0@dated.msg.id");
+	g_free (newest);
+
+	mu_query_destroy (mquery);
+	g_free (xpath);
+	g_free (muhome);
+	g_free (mdir);
+}
+
+
+/* compare getting the newest 500 messages from a date-ordered database
+ * with sorting them by date; use MU_BENCH_MSG_NUM to set the number of
+ * messages, e.g. MU_BENCH_MSG_NUM=2000000 */
+static void
+test_mu_query_perf_date_order (void)
+{
+	gchar *mdir, *muhome[2], *newest[2];
+	const char *numstr;
+	unsigned num, u;
+	double secs[2];
+	GTimer *timer;
+
+	numstr = g_getenv ("MU_BENCH_MSG_NUM");
+	num    = numstr ? (unsigned)atoi (numstr) : 20000;
+
+	/* the dates are shuffled, so the docids are not in date order
+	 * unless we reorder them */
+	mdir = create_maildir ();
+	for (u = 0; u != num; ++u)
+		write_dated_msg (mdir, u, (unsigned)(((guint64)u * 7919) % num));
+
+	timer = g_timer_new ();
+	for (u = 0; u != G_N_ELEMENTS(muhome); ++u) {
+
+		gchar *xpath;
+		MuQuery *mquery;
+
+		muhome[u] = test_mu_common_get_random_tmpdir ();
+		index_maildir (muhome[u], mdir, u == 0 ? "" : "--date-order");
+
+		xpath  = g_build_filename (muhome[u], "xapian", NULL);
+		mquery = query_new (xpath);
+
+		g_timer_start (timer);
+		newest[u] = get_newest (mquery, 500);
+		secs[u]	  = g_timer_elapsed (timer, NULL);
+
+		mu_query_destroy (mquery);
+		g_free (xpath);
+	}
+
+	g_assert_cmpstr (newest[0], ==, newest[1]);
+	g_test_minimized_result (secs[1], "newest 500 of %u messages: "
+				 "sorting by date: %.3fs, in date order: %.3fs",
+				 num, secs[0], secs[1]);
+
+	for (u = 0; u != G_N_ELEMENTS(muhome); ++u) {
+		g_free (newest[u]);
+		g_free (muhome[u]);
+	}
+	g_timer_destroy (timer);
+	g_free (mdir);
+}
+
+
+
+/* compare the header sexps for the messages in the test database,
+ * allocated per message (mu_msg_to_sexp) and appended to a re-used
+ * buffer (mu_msg_append_sexp); use MU_BENCH_ROUNDS to set the number
+ * of times we go through the messages */
+static void
+test_mu_query_perf_sexp (void)
+{
+	MuQuery *mquery;
+	MuMsgIter *iter;
+	GPtrArray *msgs;
+	GString *buf;
+	GTimer *timer;
+	const char *roundsstr;
+	unsigned rounds, r, u;
+	double secs[2];
+	gsize bytes;
+
+	roundsstr = g_getenv ("MU_BENCH_ROUNDS");
+	rounds	  = roundsstr ? (unsigned)atoi (roundsstr) : 2000;
+
+	mquery = query_new (DB_PATH1);
+	iter   = mu_query_run (mquery, "", MU_QUERY_FLAG_NONE,
+			       MU_MSG_FIELD_ID_NONE, FALSE, -1, NULL);
+	g_assert (iter);
+
+	msgs = g_ptr_array_new_with_free_func ((GDestroyNotify)mu_msg_unref);
+	for (; !mu_msg_iter_is_done (iter); mu_msg_iter_next (iter))
+		g_ptr_array_add (msgs, mu_msg_ref
+				 (mu_msg_iter_get_msg_floating (iter)));
+	mu_msg_iter_destroy (iter);
+	g_assert_cmpuint (msgs->len, >, 0);
+
+	/* both give the same sexps */
+	buf = g_string_sized_new (2048);
+	for (u = 0; u != msgs->len; ++u) {
+		char *sexp;
+		sexp = mu_msg_to_sexp (g_ptr_array_index (msgs, u), u + 1,
+				       NULL, MU_MSG_OPTION_HEADERS_ONLY);
+		g_string_truncate (buf, 0);
+		g_assert (mu_msg_append_sexp (g_ptr_array_index (msgs, u),
+					      buf, u + 1, NULL,
+					      MU_MSG_OPTION_HEADERS_ONLY));
+		g_assert_cmpstr (sexp, ==, buf->str);
+		g_free (sexp);
+	}
+
+	timer = g_timer_new ();
+	bytes = 0;
+	for (r = 0; r != rounds; ++r)
+		for (u = 0; u != msgs->len; ++u) {
+			char *sexp;
+			sexp = mu_msg_to_sexp (g_ptr_array_index (msgs, u),
+					       u + 1, NULL,
+					       MU_MSG_OPTION_HEADERS_ONLY);
+			bytes += strlen (sexp);
+			g_free (sexp);
+		}
+	secs[0] = g_timer_elapsed (timer, NULL);
+
+	g_timer_start (timer);
+	for (r = 0; r != rounds; ++r)
+		for (u = 0; u != msgs->len; ++u) {
+			g_string_truncate (buf, 0);
+			mu_msg_append_sexp (g_ptr_array_index (msgs, u), buf,
+					    u + 1, NULL,
+					    MU_MSG_OPTION_HEADERS_ONLY);
+			bytes -= buf->len;
+		}
+	secs[1] = g_timer_elapsed (timer, NULL);
+	g_assert_cmpuint (bytes, ==, 0);
+
+	g_test_minimized_result
+		(secs[1], "header sexps for %u messages: "
+		 "%.0f/s allocated, %.0f/s in a re-used buffer",
+		 rounds * msgs->len,
+		 rounds * msgs->len / MAX(secs[0], 1e-6),
+		 rounds * msgs->len / MAX(secs[1], 1e-6));
+
+	g_timer_destroy (timer);
+	g_string_free (buf, TRUE);
+	g_ptr_array_free (msgs, TRUE);
+	mu_query_destroy (mquery);
+}
 
 int
 main (int argc, char *argv[])
@@ -650,6 +1066,19 @@ main (int argc, char *argv[])
 			 test_mu_query_tags);
 	g_test_add_func ("/mu-query/test-mu-query-tags_02",
 			 test_mu_query_tags_02);
+	g_test_add_func ("/mu-query/test-mu-query-iter-fields",
+			 test_mu_query_iter_fields);
+	g_test_add_func ("/mu-query/test-mu-query-facets",
+			 test_mu_query_facets);
+	g_test_add_func ("/mu-query/test-mu-query-date-order",
+			 test_mu_query_date_order);
+
+	if (g_test_perf ())
+		g_test_add_func ("/mu-query/test-mu-query-perf-date-order",
+				 test_mu_query_perf_date_order);
+	if (g_test_perf ())
+		g_test_add_func ("/mu-query/test-mu-query-perf-sexp",
+				 test_mu_query_perf_sexp);
 
 	if (!g_test_verbose())
 	    g_log_set_handler (NULL,
@@ -0,0 +1,981 @@
+/* -*-mode: c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-*/
+
+/*
+** Copyright (C) 2012 Dirk-Jan C. Binnema <djcb@djcbsoftware.nl>
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of the GNU General Public License as published by the
+** Free Software Foundation; either version 3, or (at your option) any
+** later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software Foundation,
+** Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+**
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /*HAVE_CONFIG_H*/
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "test-mu-common.h"
+#include "mu-server-output.h"
+
+static gchar *MU_HOME = NULL;
+
+
+static gchar*
+fill_database (const char *testdir)
+{
+	gchar *cmdline, *tmpdir;
+
+	tmpdir = test_mu_common_get_random_tmpdir();
+	cmdline = g_strdup_printf ("%s index --muhome=%s --maildir=%s"
+				   " --quiet",
+				   MU_PROGRAM, tmpdir, testdir);
+	if (g_test_verbose())
+		g_printerr ("\n%s\n", cmdline);
+
+	g_assert (g_spawn_command_line_sync (cmdline, NULL, NULL,
+					     NULL, NULL));
+	g_free (cmdline);
+
+	return tmpdir;
+}
+
+
+static void
+free_exprs (GSList *exprs)
+{
+	g_slist_foreach (exprs, (GFunc)g_free, NULL);
+	g_slist_free (exprs);
+}
+
+
+/* split server output into its expressions, checking the length
+ * cookies; anything outside the frames (the welcome message, the
+ * prompts) is skipped. Returns a list of expressions (without the
+ * trailing newline), or NULL if the framing is broken */
+static GSList*
+parse_frames (const char *output, gsize len)
+{
+	GSList *exprs;
+	const char *cur, *end;
+
+	exprs = NULL;
+	cur   = output;
+	end   = output + len;
+
+	while (cur < end) {
+
+		char *post;
+		unsigned long exprlen;
+
+		if (*cur != MU_SERVER_COOKIE_PRE) {
+			++cur;
+			continue;
+		}
+
+		exprlen = strtoul (cur + 1, &post, 16);
+		if (*post != MU_SERVER_COOKIE_POST ||
+		    exprlen == 0 || post + 1 + exprlen > end ||
+		    post[exprlen] != '\n') {
+			free_exprs (exprs);
+			return NULL;
+		}
+
+		exprs = g_slist_prepend (exprs,
+					 g_strndup (post + 1, exprlen - 1));
+		cur = post + 1 + exprlen;
+	}
+
+	return g_slist_reverse (exprs);
+}
+
+
+/* read everything that's available from a non-blocking fd */
+static gchar*
+read_all (int fd, gsize *len)
+{
+	GString *gstr;
+	char buf[4096];
+	ssize_t n;
+
+	gstr = g_string_sized_new (sizeof(buf));
+	while ((n = read (fd, buf, sizeof(buf))) > 0)
+		g_string_append_len (gstr, buf, n);
+
+	*len = gstr->len;
+	return g_string_free (gstr, FALSE);
+}
+
+
+static void
+append (MuServerOutput *output, const char *prefix, const char *frm, ...)
+{
+	va_list args;
+
+	va_start (args, frm);
+	mu_server_output_vappend (output, prefix, frm, args);
+	va_end (args);
+}
+
+
+static void
+test_mu_server_output_framing (void)
+{
+	MuServerOutput *output;
+	int fds[2];
+	gchar *big, *str;
+	gsize len;
+	GSList *exprs;
+	guint64 num, writes, bytes;
+
+	g_assert (pipe (fds) == 0);
+	g_assert (fcntl (fds[0], F_SETFL, O_NONBLOCK) == 0);
+
+	/* a long latency, so only the size or flushing triggers
+	 * writing */
+	output = mu_server_output_new (fds[1], 1024, 60 * 1000);
+	g_assert (output);
+
+	g_assert (mu_server_output_print (output, "(:foo %d)", 1));
+	g_assert (mu_server_output_print (output, "(:bar \"%s\")", "baz"));
+
+	/* nothing written yet */
+	mu_server_output_stats (output, &num, &writes, &bytes);
+	g_assert_cmpuint (num, ==, 2);
+	g_assert_cmpuint (writes, ==, 0);
+	g_assert_cmpuint (bytes, ==, 0);
+
+	/* this one is bigger than the buffer; all three go out in one
+	 * write */
+	big = g_strnfill (5000, 'x');
+	g_assert (mu_server_output_print (output, "(:big \"%s\")", big));
+	mu_server_output_stats (output, &num, &writes, NULL);
+	g_assert_cmpuint (num, ==, 3);
+	g_assert_cmpuint (writes, ==, 1);
+
+	g_assert_cmpint (mu_server_output_due_in (output), ==, -1);
+
+	/* the prefix takes the place of the '(' */
+	append (output, "(:id 7", "(:found %u)", 3);
+	g_assert_cmpint (mu_server_output_due_in (output), >, 0);
+	append (output, "(:id 7", "%s", "no-list");
+	g_assert (mu_server_output_flush (output));
+	mu_server_output_destroy (output);
+
+	str   = read_all (fds[0], &len);
+	exprs = parse_frames (str, len);
+	g_assert (exprs);
+
+	g_assert_cmpuint (g_slist_length (exprs), ==, 5);
+	g_assert_cmpstr ((char*)g_slist_nth_data (exprs, 0), ==, "(:foo 1)");
+	g_assert_cmpstr ((char*)g_slist_nth_data (exprs, 1), ==,
+			 "(:bar \"baz\")");
+	g_assert_cmpuint (strlen ((char*)g_slist_nth_data (exprs, 2)), ==,
+			  strlen ("(:big \"\")") + 5000);
+	g_assert_cmpstr ((char*)g_slist_nth_data (exprs, 3), ==,
+			 "(:id 7 :found 3)");
+	g_assert_cmpstr ((char*)g_slist_nth_data (exprs, 4), ==, "no-list");
+
+	free_exprs (exprs);
+	g_free (str);
+	g_free (big);
+
+	close (fds[0]);
+	close (fds[1]);
+}
+
+
+/* run 'mu server', feeding it @cmds */
+static gchar*
+run_server (const char *muhome, const char *cmds, gsize *len)
+{
+	gchar *cmdline, *output;
+	char *argv[] = { "/bin/sh", "-c", NULL, NULL };
+
+	cmdline = g_strdup_printf ("printf '%s' | %s server --muhome=%s",
+				   cmds, MU_PROGRAM, muhome);
+	if (g_test_verbose())
+		g_printerr ("\n%s\n", cmdline);
+
+	argv[2] = cmdline;
+	g_assert (g_spawn_sync (NULL, argv, NULL, G_SPAWN_STDERR_TO_DEV_NULL,
+				NULL, NULL, &output, NULL, NULL, NULL));
+	g_free (cmdline);
+
+	*len = strlen (output);
+	return output;
+}
+
+
+static unsigned
+count_headers (GSList *exprs)
+{
+	unsigned num;
+
+	for (num = 0; exprs; exprs = g_slist_next (exprs))
+		if (g_str_has_prefix ((char*)exprs->data, "(\n\t:docid"))
+			++num;
+	return num;
+}
+
+
+static void
+test_mu_server_find (void)
+{
+	gchar *output, *found;
+	gsize len;
+	GSList *exprs;
+	unsigned num;
+
+	output = run_server (MU_HOME,
+			     "ping\\nfind query:\"\"\\nquit\\n", &len);
+	exprs  = parse_frames (output, len);
+	g_assert (exprs);
+
+	g_assert (g_str_has_prefix ((char*)exprs->data, "(:pong"));
+
+	num   = count_headers (exprs);
+	found = g_strdup_printf ("(:found %u)", num);
+	g_assert_cmpuint (num, >, 0);
+	g_assert (g_slist_find_custom (exprs, found, (GCompareFunc)strcmp));
+	g_assert_cmpstr ((char*)g_slist_last (exprs)->data, ==, ";; quiting");
+
+	g_free (found);
+	free_exprs (exprs);
+	g_free (output);
+}
+
+
+/* with 'fields', we only get those fields for each message */
+static void
+test_mu_server_find_fields (void)
+{
+	gchar *output;
+	gsize len;
+	GSList *exprs, *cur;
+	unsigned num;
+
+	output = run_server (MU_HOME,
+			     "find query:subject:atoms fields:subject,date\\n"
+			     "find query:subject:atoms fields:bogus\\n"
+			     "quit\\n", &len);
+	exprs  = parse_frames (output, len);
+	g_assert (exprs);
+
+	num = 0;
+	for (cur = exprs; cur; cur = g_slist_next (cur)) {
+
+		const char *expr;
+		expr = (const char*)cur->data;
+
+		if (!g_str_has_prefix (expr, "(\n\t:docid"))
+			continue;
+
+		g_assert (strstr (expr, "\t:subject "));
+		g_assert (strstr (expr, "\t:date ("));
+		g_assert (!strstr (expr, "\t:from "));
+		g_assert (!strstr (expr, "\t:path "));
+		++num;
+	}
+	g_assert_cmpuint (num, ==, 1);
+
+	/* an unknown field gives an error */
+	for (cur = exprs; cur; cur = g_slist_next (cur))
+		if (g_str_has_prefix ((char*)cur->data, "(:error"))
+			break;
+	g_assert (cur);
+
+	free_exprs (exprs);
+	g_free (output);
+}
+
+
+/* the fields come straight from the database values, but they should
+ * look the same as the ones from the message */
+static void
+test_mu_server_find_fields_values (void)
+{
+	gchar *output;
+	gsize len;
+	GSList *exprs, *cur;
+
+	output = run_server (MU_HOME,
+			     "find query:subject:atoms "
+			     "fields:from,to,prio,maildir,size\n"
+			     "quit\n", &len);
+	exprs  = parse_frames (output, len);
+	g_assert (exprs);
+
+	for (cur = exprs; cur; cur = g_slist_next (cur))
+		if (g_str_has_prefix ((char*)cur->data, "(\n\t:docid"))
+			break;
+	g_assert (cur);
+
+	g_assert (strstr ((char*)cur->data, "\t:from ((\"Richard P. Feynman\" "
+			  ". \"rpf@example.com\"))\n"));
+	g_assert (strstr ((char*)cur->data, "\t:to ((\"Democritus\" "
+			  ". \"demo@example.com\"))\n"));
+	g_assert (strstr ((char*)cur->data, "\t:priority high\n"));
+	g_assert (strstr ((char*)cur->data, "\t:maildir \"/wom_bat\"\n"));
+	g_assert (strstr ((char*)cur->data, "\t:size "));
+	g_assert (!strstr ((char*)cur->data, "\t:size 0\n"));
+
+	free_exprs (exprs);
+	g_free (output);
+}
+
+
+/* with a revision, we get the contacts that changed since then, with
+ * the current revision in the last chunk */
+static void
+test_mu_server_contacts (void)
+{
+	gchar *output;
+	gsize len;
+	GSList *exprs;
+	const char *all, *delta;
+
+	output = run_server (MU_HOME,
+			     "contacts\\ncontacts revision:0\\nquit\\n", &len);
+	exprs  = parse_frames (output, len);
+	g_assert (exprs && exprs->next);
+
+	all   = (const char*)exprs->data;
+	delta = (const char*)exprs->next->data;
+
+	g_assert (g_str_has_prefix (all, "(:contacts ((:"));
+	g_assert (!strstr (all, ":revision"));
+
+	/* there are not enough contacts for more than one chunk; as
+	 * we didn't have any, we get all of them */
+	g_assert (g_str_has_prefix (delta, "(:contacts ((:"));
+	g_assert (strstr (delta, ") :revision "));
+	g_assert (g_str_has_suffix (delta, " :reset t)"));
+	g_assert (!strstr (delta, ":more t"));
+
+	free_exprs (exprs);
+	g_free (output);
+}
+
+
+/* viewing the same message again, we don't need to parse it again */
+static void
+test_mu_server_msg_cache (void)
+{
+	gchar *output;
+	gsize len;
+	GSList *exprs, *cur;
+
+	output = run_server (MU_HOME,
+			     "view docid:1\\nview docid:1\\nping\\nquit\\n",
+			     &len);
+	exprs  = parse_frames (output, len);
+	g_assert (exprs);
+
+	for (cur = exprs; cur; cur = g_slist_next (cur))
+		if (g_str_has_prefix ((char*)cur->data, "(:pong"))
+			break;
+	g_assert (cur);
+	g_assert (strstr ((char*)cur->data,
+			  ":msg-cache (:hits 1 :misses 1 "));
+
+	free_exprs (exprs);
+	g_free (output);
+}
+
+
+/* commands can also come in frames, with their parameters separated
+ * by '\0' rather than quoted */
+static void
+test_mu_server_input_framing (void)
+{
+	gchar *output;
+	gsize len;
+	GSList *exprs, *cur;
+	gboolean pong, error;
+	unsigned num;
+
+	output = run_server
+		(MU_HOME,
+		 "\\3765\\377ping\\000"
+		 "\\37628\\377find\\000query:subject:atoms\\000"
+		 "fields:subject\\000"
+		 "\\376zz\\377quit\\000", &len);
+	exprs  = parse_frames (output, len);
+	g_assert (exprs);
+
+	pong = error = FALSE;
+	num  = 0;
+	for (cur = exprs; cur; cur = g_slist_next (cur)) {
+
+		const char *expr;
+		expr = (const char*)cur->data;
+
+		if (g_str_has_prefix (expr, "(:pong"))
+			pong = TRUE;
+		else if (g_str_has_prefix (expr, "(:error"))
+			error = TRUE; /* the invalid frame */
+		else if (g_str_has_prefix (expr, "(\n\t:docid")) {
+			g_assert (strstr (expr, "\t:subject "));
+			g_assert (!strstr (expr, "\t:from "));
+			++num;
+		}
+	}
+
+	g_assert (pong);
+	g_assert (error);
+	g_assert_cmpuint (num, ==, 1);
+	g_assert (g_slist_find_custom (exprs, "(:found 1)",
+				       (GCompareFunc)strcmp));
+
+	free_exprs (exprs);
+	g_free (output);
+}
+
+
+/* responses carry the id of the request; a 'find' with an id cancels
+ * the earlier ones, so the first one either completes or gets
+ * cancelled */
+static void
+test_mu_server_request_ids (void)
+{
+	gchar *output;
+	gsize len;
+	GSList *exprs, *cur;
+	gboolean pong, found1, found2;
+
+	output = run_server (MU_HOME,
+			     "ping id:1\\n"
+			     "find query:\"\" id:2\\n"
+			     "find query:\"\" id:3\\n"
+			     "cancel id:4\\n"
+			     "quit\\n", &len);
+	exprs  = parse_frames (output, len);
+	g_assert (exprs);
+
+	pong = found1 = found2 = FALSE;
+	for (cur = exprs; cur; cur = g_slist_next (cur)) {
+
+		const char *expr;
+		expr = (const char*)cur->data;
+
+		if (g_str_has_prefix (expr, "(:id 1 :pong"))
+			pong = TRUE;
+		else if (g_str_has_prefix (expr, "(:id 2 :found") ||
+			 g_str_has_prefix (expr, "(:id 2 :cancelled t)"))
+			found1 = TRUE;
+		else if (g_str_has_prefix (expr, "(:id 3 :found"))
+			found2 = TRUE;
+		else
+			g_assert (g_str_has_prefix (expr, "(:id 2 ") ||
+				  g_str_has_prefix (expr, "(:id 3 ") ||
+				  expr[0] != '(');
+	}
+
+	g_assert (pong);
+	g_assert (found1);
+	g_assert (found2);
+
+	free_exprs (exprs);
+	g_free (output);
+}
+
+
+/* read the server output from fd into gstr, until it has a complete
+ * expression starting with prefix; if prefix is NULL, read until the
+ * end */
+static gboolean
+read_until_expr (int fd, GString *gstr, const char *prefix)
+{
+	char buf[4096];
+	ssize_t n;
+	gboolean found;
+
+	found = FALSE;
+	while (!found && (n = read (fd, buf, sizeof(buf))) > 0) {
+		GSList *exprs, *cur;
+		g_string_append_len (gstr, buf, n);
+		if (!prefix)
+			continue;
+		exprs = parse_frames (gstr->str, gstr->len);
+		for (cur = exprs; cur; cur = g_slist_next (cur))
+			if (g_str_has_prefix ((char*)cur->data, prefix))
+				found = TRUE;
+		free_exprs (exprs);
+	}
+
+	return prefix ? found : TRUE;
+}
+
+
+/* read from a client socket until we have a complete expression
+ * starting with prefix */
+static gboolean
+wait_for_expr (int sock, const char *prefix)
+{
+	GString *gstr;
+	gboolean found;
+
+	gstr  = g_string_sized_new (4096);
+	found = read_until_expr (sock, gstr, prefix);
+	g_string_free (gstr, TRUE);
+
+	return found;
+}
+
+
+static void
+write_str (int fd, const char *str)
+{
+	g_assert (write (fd, str, strlen (str)) == (ssize_t)strlen (str));
+}
+
+
+/* indexing happens in the background; other commands keep working
+ * in the meantime */
+static void
+test_mu_server_index (void)
+{
+	gchar *argv[] = { MU_PROGRAM, "server", NULL, NULL };
+	gchar *cmd;
+	GString *output;
+	GPid pid;
+	int in, out, status;
+	GSList *exprs, *cur;
+	gboolean pong, found;
+
+	argv[2] = g_strdup_printf ("--muhome=%s", MU_HOME);
+	g_assert (g_spawn_async_with_pipes (NULL, argv, NULL,
+					    G_SPAWN_DO_NOT_REAP_CHILD |
+					    G_SPAWN_STDERR_TO_DEV_NULL,
+					    NULL, NULL, &pid, &in, &out, NULL,
+					    NULL));
+
+	cmd = g_strdup_printf ("index path:%s id:1\nping id:2\n",
+			       MU_TESTMAILDIR2);
+	write_str (in, cmd);
+
+	/* 'quit' would cancel the indexing, so wait until it is done */
+	output = g_string_sized_new (4096);
+	g_assert (read_until_expr (out, output, "(:id 1 :info index "
+				   ":status complete"));
+
+	write_str (in, "find query:\"\" id:3\nquit\n");
+	close (in);
+	read_until_expr (out, output, NULL);
+	close (out);
+
+	g_assert (waitpid (pid, &status, 0) == pid);
+	g_spawn_close_pid (pid);
+
+	exprs = parse_frames (output->str, output->len);
+	g_assert (exprs);
+
+	pong = found = FALSE;
+	for (cur = exprs; cur; cur = g_slist_next (cur)) {
+
+		const char *expr;
+		expr = (const char*)cur->data;
+
+		if (g_str_has_prefix (expr, "(:id 2 :pong"))
+			pong = TRUE;
+		else if (g_str_has_prefix (expr, "(:id 3 :found"))
+			found = TRUE;
+	}
+
+	g_assert (pong);
+	g_assert (found);
+
+	free_exprs (exprs);
+	g_string_free (output, TRUE);
+	g_free (cmd);
+	g_free (argv[2]);
+}
+
+
+static gboolean
+has_header (GSList *exprs, unsigned docid)
+{
+	gchar *start;
+	gboolean found;
+
+	start = g_strdup_printf ("(\n\t:docid %u\n", docid);
+	for (found = FALSE; exprs && !found; exprs = g_slist_next (exprs))
+		found = g_str_has_prefix ((char*)exprs->data, start);
+
+	g_free (start);
+	return found;
+}
+
+
+/* get the path from a header expression */
+static gchar*
+get_header_path (const char *expr)
+{
+	const char *start, *end;
+
+	start = strstr (expr, "\t:path \"");
+	g_assert (start);
+	start += strlen ("\t:path \"");
+	end    = strchr (start, '"');
+	g_assert (end);
+
+	return g_strndup (start, end - start);
+}
+
+
+/* the messages are really moved, so use a copy of the test maildir;
+ * returns the muhome for it */
+static gchar*
+fill_database_copy (gchar **tmpdir, gchar **maildir)
+{
+	gchar *cmdline;
+
+	*tmpdir	= test_mu_common_get_random_tmpdir();
+	cmdline = g_strdup_printf ("mkdir -m 0700 %s", *tmpdir);
+	g_assert (g_spawn_command_line_sync (cmdline, NULL, NULL, NULL, NULL));
+	g_free (cmdline);
+	cmdline = g_strdup_printf ("cp -R %s %s", MU_TESTMAILDIR2, *tmpdir);
+	g_assert (g_spawn_command_line_sync (cmdline, NULL, NULL, NULL, NULL));
+	g_free (cmdline);
+
+	*maildir = g_strdup_printf ("%s%ctestdir2", *tmpdir, G_DIR_SEPARATOR);
+	return fill_database (*maildir);
+}
+
+
+/* move-many moves a number of messages in one go, and reports them
+ * in a single expression */
+static void
+test_mu_server_move_many (void)
+{
+	gchar *tmpdir, *maildir, *muhome, *output;
+	const char *moved;
+	gsize len;
+	GSList *exprs;
+
+	muhome = fill_database_copy (&tmpdir, &maildir);
+
+	output = run_server (muhome,
+			     "move-many docid:1 docid:2 docid:12345 "
+			     "flags:+F\\n"
+			     "find query:flag:flagged\\nquit\\n", &len);
+	exprs  = parse_frames (output, len);
+	g_assert (exprs);
+
+	moved = (const char*)exprs->data;
+	g_assert (g_str_has_prefix (moved, "(:moved ((:docid 1 :path \""));
+	g_assert (strstr (moved, "(:docid 2 :path \""));
+	g_assert (strstr (moved, "flagged"));
+	g_assert (strstr (moved, " :move nil :failed ((:docid 12345 :error "));
+
+	/* the store has been updated */
+	g_assert (has_header (exprs, 1));
+	g_assert (has_header (exprs, 2));
+
+	free_exprs (exprs);
+	g_free (output);
+	g_free (muhome);
+	g_free (maildir);
+	g_free (tmpdir);
+}
+
+
+/* when one message in the middle of a move-many fails, the moves
+ * before and after it are still in the store */
+static void
+test_mu_server_move_many_partial (void)
+{
+	gchar *tmpdir, *maildir, *muhome, *output, *cmds, *path;
+	const char *moved;
+	gsize len;
+	GSList *exprs, *cur;
+	unsigned docid, before, after;
+	char what[64];
+
+	muhome = fill_database_copy (&tmpdir, &maildir);
+
+	/* remove the file of some message, so moving it fails */
+	output = run_server (muhome, "find query:subject:atoms\\nquit\\n",
+			     &len);
+	exprs  = parse_frames (output, len);
+	for (cur = exprs; cur; cur = g_slist_next (cur))
+		if (g_str_has_prefix ((char*)cur->data, "(\n\t:docid "))
+			break;
+	g_assert (cur);
+	docid = atoi ((char*)cur->data + strlen ("(\n\t:docid "));
+	path  = get_header_path ((char*)cur->data);
+	g_assert (g_unlink (path) == 0);
+	g_free (path);
+	free_exprs (exprs);
+	g_free (output);
+
+	before = docid == 1 ? 3 : 1;
+	after  = docid == 2 ? 3 : 2;
+	cmds   = g_strdup_printf ("move-many docid:%u docid:%u docid:%u "
+				  "flags:+F\\nfind query:flag:flagged\\n"
+				  "quit\\n", before, docid, after);
+	output = run_server (muhome, cmds, &len);
+	exprs  = parse_frames (output, len);
+	g_assert (exprs);
+
+	moved = (const char*)exprs->data;
+	g_snprintf (what, sizeof(what), "(:docid %u :path \"", before);
+	g_assert (strstr (moved, what));
+	g_snprintf (what, sizeof(what), "(:docid %u :path \"", after);
+	g_assert (strstr (moved, what));
+	g_snprintf (what, sizeof(what), ":failed ((:docid %u :error ", docid);
+	g_assert (strstr (moved, what));
+
+	/* both moves are in the store, with the new paths */
+	g_assert (has_header (exprs, before));
+	g_assert (has_header (exprs, after));
+	for (cur = exprs->next; cur; cur = g_slist_next (cur)) {
+		if (!g_str_has_prefix ((char*)cur->data, "(\n\t:docid "))
+			continue;
+		path = get_header_path ((char*)cur->data);
+		g_assert (access (path, F_OK) == 0);
+		g_free (path);
+	}
+
+	free_exprs (exprs);
+	g_free (output);
+	g_free (cmds);
+	g_free (muhome);
+	g_free (maildir);
+	g_free (tmpdir);
+}
+
+
+static int
+connect_to (const char *path)
+{
+	struct sockaddr_un addr;
+	int sock;
+
+	memset (&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	g_strlcpy (addr.sun_path, path, sizeof(addr.sun_path));
+
+	sock = socket (AF_UNIX, SOCK_STREAM, 0);
+	g_assert (sock != -1);
+	if (connect (sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		close (sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+
+/* with --socket, the server serves multiple clients at the same
+ * time, including 'mu find --via-daemon' */
+static void
+test_mu_server_socket (void)
+{
+	gchar *sockpath, *cmdline, *output;
+	gchar *argv[] = { MU_PROGRAM, "server", NULL, NULL, NULL };
+	GPid pid;
+	int sock, status;
+	unsigned u, num;
+	const char *cur;
+
+	sockpath = g_strdup_printf ("%s%cserver.sock", MU_HOME,
+				    G_DIR_SEPARATOR);
+	argv[2]	 = g_strdup_printf ("--muhome=%s", MU_HOME);
+	argv[3]	 = g_strdup_printf ("--socket=%s", sockpath);
+
+	g_assert (g_spawn_async (NULL, argv, NULL,
+				 G_SPAWN_DO_NOT_REAP_CHILD |
+				 G_SPAWN_STDOUT_TO_DEV_NULL |
+				 G_SPAWN_STDERR_TO_DEV_NULL,
+				 NULL, NULL, &pid, NULL));
+
+	/* wait for the server to listen */
+	for (u = 0, sock = -1; u != 100 && sock == -1; ++u) {
+		g_usleep (100 * 1000);
+		sock = connect_to (sockpath);
+	}
+	g_assert (sock != -1);
+
+	/* the first client stays connected... */
+	g_assert (write (sock, "ping\n", 5) == 5);
+	g_assert (wait_for_expr (sock, "(:pong"));
+
+	/* ...while the second one searches */
+	cmdline = g_strdup_printf ("%s find --muhome=%s --via-daemon "
+				   "--socket=%s --format=sexp subject:atoms",
+				   MU_PROGRAM, MU_HOME, sockpath);
+	if (g_test_verbose())
+		g_printerr ("\n%s\n", cmdline);
+	g_assert (g_spawn_command_line_sync (cmdline, &output, NULL,
+					     &status, NULL));
+	g_assert_cmpint (status, ==, 0);
+
+	for (num = 0, cur = output; (cur = strstr (cur, "(\n\t:docid")); ++cur)
+		++num;
+	g_assert_cmpuint (num, ==, 1);
+
+	/* the first client can still use the server */
+	g_assert (write (sock, "find query:subject:atoms\n", 25) == 25);
+	g_assert (wait_for_expr (sock, "(:found 1)"));
+	close (sock);
+
+	kill (pid, SIGTERM);
+	g_assert (waitpid (pid, &status, 0) == pid);
+	g_spawn_close_pid (pid);
+	g_assert (!g_file_test (sockpath, G_FILE_TEST_EXISTS));
+
+	g_free (output);
+	g_free (cmdline);
+	g_free (argv[2]);
+	g_free (argv[3]);
+	g_free (sockpath);
+}
+
+
+static void
+write_msg (const char *mdir, unsigned num)
+{
+	gchar *name, *path, *msg;
+
+	name = g_strdup_printf ("%u.bench:2,S", num);
+	path = g_build_filename (mdir, "cur", name, NULL);
+	msg  = g_strdup_printf ("From: Alice <alice@example.com>\n"
+				"To: Bob <bob@example.com>\n"
+				"Subject: message %u\n"
+				"Date: Mon, 1 Oct 2012 12:00:00 +0000\n"
+				"Message-Id: <%u@bench.msg.id>\n"
+				"\n"
+				"hello\n",
+				num, num);
+	g_assert (g_file_set_contents (path, msg, -1, NULL));
+
+	g_free (msg);
+	g_free (path);
+	g_free (name);
+}
+
+
+/* the throughput of 'mu server' for a big 'find'; use
+ * MU_BENCH_MSG_NUM to set the number of messages,
+ * e.g. MU_BENCH_MSG_NUM=100000 */
+static void
+test_mu_server_perf_find (void)
+{
+	gchar *mdir, *muhome, *output, *sub;
+	const char *numstr;
+	const char* subs[] = { "cur", "new", "tmp" };
+	unsigned num, u;
+	GSList *exprs;
+	GTimer *timer;
+	double secs;
+	gsize len;
+
+	numstr = g_getenv ("MU_BENCH_MSG_NUM");
+	num    = numstr ? (unsigned)atoi (numstr) : 20000;
+
+	mdir = test_mu_common_get_random_tmpdir ();
+	for (u = 0; u != G_N_ELEMENTS(subs); ++u) {
+		sub = g_build_filename (mdir, subs[u], NULL);
+		g_assert (g_mkdir_with_parents (sub, 0700) == 0);
+		g_free (sub);
+	}
+	for (u = 0; u != num; ++u)
+		write_msg (mdir, u);
+
+	muhome = fill_database (mdir);
+
+	timer  = g_timer_new ();
+	output = run_server (muhome, "find query:\"\"\\nquit\\n",
+			     &len);
+	secs   = g_timer_elapsed (timer, NULL);
+
+	exprs = parse_frames (output, len);
+	g_assert (exprs);
+	g_assert_cmpuint (count_headers (exprs), ==, num);
+
+	g_test_minimized_result (secs, "find for %u messages: %.3fs "
+				 "(%.0f messages/s, %.1f MB)",
+				 num, secs, num / secs, len / 1e6);
+
+	free_exprs (exprs);
+	g_free (output);
+	g_timer_destroy (timer);
+	g_free (muhome);
+	g_free (mdir);
+}
+
+
+int
+main (int argc, char *argv[])
+{
+	int rv;
+
+	g_test_init (&argc, &argv, NULL);
+
+	MU_HOME = fill_database (MU_TESTMAILDIR2);
+	g_assert (MU_HOME);
+
+	g_test_add_func ("/mu-server/test-mu-server-output-framing",
+			 test_mu_server_output_framing);
+	g_test_add_func ("/mu-server/test-mu-server-find",
+			 test_mu_server_find);
+	g_test_add_func ("/mu-server/test-mu-server-find-fields",
+			 test_mu_server_find_fields);
+	g_test_add_func ("/mu-server/test-mu-server-find-fields-values",
+			 test_mu_server_find_fields_values);
+	g_test_add_func ("/mu-server/test-mu-server-contacts",
+			 test_mu_server_contacts);
+	g_test_add_func ("/mu-server/test-mu-server-msg-cache",
+			 test_mu_server_msg_cache);
+	g_test_add_func ("/mu-server/test-mu-server-input-framing",
+			 test_mu_server_input_framing);
+	g_test_add_func ("/mu-server/test-mu-server-request-ids",
+			 test_mu_server_request_ids);
+	g_test_add_func ("/mu-server/test-mu-server-index",
+			 test_mu_server_index);
+	g_test_add_func ("/mu-server/test-mu-server-move-many",
+			 test_mu_server_move_many);
+	g_test_add_func ("/mu-server/test-mu-server-move-many-partial",
+			 test_mu_server_move_many_partial);
+	g_test_add_func ("/mu-server/test-mu-server-socket",
+			 test_mu_server_socket);
+
+	if (g_test_perf ())
+		g_test_add_func ("/mu-server/test-mu-server-perf-find",
+				 test_mu_server_perf_find);
+
+	if (!g_test_verbose())
+	    g_log_set_handler (NULL,
+			       G_LOG_LEVEL_MASK | G_LOG_FLAG_FATAL|
+			       G_LOG_FLAG_RECURSION,
+			       (GLogFunc)black_hole, NULL);
+
+	rv = g_test_run ();
+
+	g_free (MU_HOME);
+
+	return rv;
+}
@@ -57,7 +57,7 @@ fill_database (const char *testdir)
 
 /* note: this also *moves the iter* */
 static MuMsgIter*
-run_and_get_iter (const char *xpath, const char *query)
+run_and_get_iter (const char *xpath, const char *query, MuQueryFlags flags)
 {
 	MuQuery  *mquery;
 	MuStore *store;
@@ -70,7 +70,7 @@ run_and_get_iter (const char *xpath, const char *query)
 	mu_store_unref (store);
 	g_assert (query);
 
-	iter = mu_query_run (mquery, query, TRUE, MU_MSG_FIELD_ID_DATE,
+	iter = mu_query_run (mquery, query, flags, MU_MSG_FIELD_ID_DATE,
 			     FALSE, -1, NULL);
 	mu_query_destroy (mquery);
 	g_assert (iter);
@@ -110,7 +110,7 @@ test_mu_threads_01 (void)
 	xpath = fill_database (MU_TESTMAILDIR3);
 	g_assert (xpath != NULL);
 
-	iter = run_and_get_iter (xpath, "abc");
+	iter = run_and_get_iter (xpath, "abc", MU_QUERY_FLAG_THREADS);
 	g_assert (iter);
 	g_assert (!mu_msg_iter_is_done(iter));
 
@@ -180,7 +180,7 @@ test_mu_threads_rogue (void)
 	xpath = fill_database (MU_TESTMAILDIR3);
 	g_assert (xpath != NULL);
 
-	iter = run_and_get_iter (xpath, "def");
+	iter = run_and_get_iter (xpath, "def", MU_QUERY_FLAG_THREADS);
 	g_assert (iter);
 	g_assert (!mu_msg_iter_is_done(iter));
 
@@ -225,6 +225,501 @@ test_mu_threads_rogue (void)
 }
 
 
+/* the number of messages for the benchmarks; can be overridden with
+ * MU_BENCH_MSG_NUM, e.g. MU_BENCH_MSG_NUM=1000000 */
+static unsigned
+bench_msg_num (void)
+{
+	const char *str;
+
+	str = g_getenv ("MU_BENCH_MSG_NUM");
+
+	return str ? (unsigned)atoi (str) : 20000;
+}
+
+
+/* create a maildir with @num synthetic messages, in threads of
+ * @threadlen messages; each message is a reply to the one before it,
+ * and (if @refs is TRUE) has (up to) 40 of its ancestors in its
+ * References: header, like long mailing-list threads tend to have */
+static gchar*
+create_bench_maildir (unsigned num, unsigned threadlen, gboolean refs)
+{
+	gchar *mdir, *cur;
+	unsigned u;
+	GString *refstr, *msg;
+
+	mdir = test_mu_common_get_random_tmpdir ();
+	cur  = g_build_filename (mdir, "cur", NULL);
+	g_assert (g_mkdir_with_parents (cur, 0700) == 0);
+
+	refstr = g_string_sized_new (4096);
+	msg    = g_string_sized_new (8192);
+
+	for (u = 0; u != num; ++u) {
+
+		gchar *path;
+		unsigned pos, v;
+
+		pos = u % threadlen;
+		g_string_truncate (refstr, 0);
+		for (v = pos > 40 ? pos - 40 : 0; refs && v < pos; ++v)
+			g_string_append_printf (refstr, " <%u@bench.msg.id>",
+						u - pos + v);
+
+		g_string_printf (msg,
+				 "From: Bench <bench@example.com>\n"
+				 "To: List <list@example.com>\n"
+				 "Subject: %sthread %u\n"
+				 "Date: Thu, 1 Jan 2009 %02u:%02u:%02u +0000\n"
+				 "Message-Id: <%u@bench.msg.id>\n"
+				 "%s%s%s"
+				 "\n"
+				 "message %u\n",
+				 pos ? "Re: " : "", u / threadlen,
+				 (u / 3600) % 24, (u / 60) % 60, u % 60, u,
+				 refstr->len ? "References:" : "", refstr->str,
+				 refstr->len ? "\n" : "", u);
+
+		path = g_strdup_printf ("%s%c%u.bench:2,S", cur,
+					G_DIR_SEPARATOR, u);
+		g_assert (g_file_set_contents (path, msg->str, msg->len,
+					       NULL));
+		g_free (path);
+	}
+
+	g_string_free (refstr, TRUE);
+	g_string_free (msg, TRUE);
+	g_free (cur);
+
+	for (u = 0; u != 2; ++u) {
+		cur = g_build_filename (mdir, u == 0 ? "new" : "tmp", NULL);
+		g_assert (g_mkdir_with_parents (cur, 0700) == 0);
+		g_free (cur);
+	}
+
+	return mdir;
+}
+
+
+/* get the peak resident set size of this process in kB, or 0 if we
+ * can't find out */
+static unsigned
+peak_rss_kb (void)
+{
+	gchar *status, *line;
+	unsigned kb;
+
+	if (!g_file_get_contents ("/proc/self/status", &status, NULL, NULL))
+		return 0;
+
+	kb   = 0;
+	line = strstr (status, "VmHWM:");
+	if (line)
+		kb = (unsigned)strtoul (line + strlen ("VmHWM:"), NULL, 10);
+
+	g_free (status);
+
+	return kb;
+}
+
+
+static void
+bench_threads (unsigned threadlen)
+{
+	gchar *mdir, *xpath;
+	MuMsgIter *iter;
+	GTimer *timer;
+	unsigned num, count;
+	double secs;
+
+	num   = bench_msg_num ();
+	mdir  = create_bench_maildir (num, threadlen, TRUE);
+	xpath = fill_database (mdir);
+	g_assert (xpath);
+
+	timer = g_timer_new ();
+	iter  = run_and_get_iter (xpath, "", MU_QUERY_FLAG_THREADS);
+	secs  = g_timer_elapsed (timer, NULL);
+	g_test_minimized_result (secs, "threading %u messages in threads of "
+				 "%u: %.2fs, peak rss %u kB", num, threadlen,
+				 secs, peak_rss_kb ());
+
+	for (count = 0; !mu_msg_iter_is_done (iter); mu_msg_iter_next (iter))
+		++count;
+	g_assert_cmpuint (count, ==, num);
+
+	g_timer_destroy (timer);
+	mu_msg_iter_destroy (iter);
+	g_free (xpath);
+	g_free (mdir);
+}
+
+
+/* threads without References: can be put together by grouping them
+ * by subject */
+static void
+test_mu_threads_subjects (void)
+{
+	gchar *mdir, *xpath;
+	MuMsgIter *iter;
+	unsigned u;
+
+	struct {
+		const char *threadpath;
+		const char *msgid;
+		const char *subject;
+	} items [] = {
+		{"0",   "0@bench.msg.id", "thread 0"},
+		{"0:0", "1@bench.msg.id", "Re: thread 0"},
+		{"0:1", "2@bench.msg.id", "Re: thread 0"},
+		{"1",   "3@bench.msg.id", "thread 1"},
+		{"1:0", "4@bench.msg.id", "Re: thread 1"},
+		{"1:1", "5@bench.msg.id", "Re: thread 1"}
+	};
+
+	mdir  = create_bench_maildir (G_N_ELEMENTS(items), 3, FALSE);
+	xpath = fill_database (mdir);
+	g_assert (xpath);
+
+	/* without grouping, they're all separate threads */
+	iter = run_and_get_iter (xpath, "", MU_QUERY_FLAG_THREADS);
+	for (u = 0; !mu_msg_iter_is_done (iter); mu_msg_iter_next (iter), ++u)
+		g_assert_cmpuint (mu_msg_iter_get_thread_info (iter)->level,
+				  ==, 0);
+	g_assert_cmpuint (u, ==, G_N_ELEMENTS(items));
+	mu_msg_iter_destroy (iter);
+
+	iter = run_and_get_iter (xpath, "", MU_QUERY_FLAG_THREADS |
+				 MU_QUERY_FLAG_GROUP_SUBJECTS);
+	for (u = 0; !mu_msg_iter_is_done (iter); mu_msg_iter_next (iter), ++u) {
+		MuMsg *msg;
+		const MuMsgIterThreadInfo *ti;
+
+		g_assert (u < G_N_ELEMENTS(items));
+
+		ti  = mu_msg_iter_get_thread_info (iter);
+		msg = mu_msg_iter_get_msg_floating (iter); /* don't unref */
+		g_assert (ti);
+		g_assert (msg);
+
+		g_assert_cmpstr (ti->threadpath, ==, items[u].threadpath);
+		g_assert_cmpstr (mu_msg_get_msgid (msg), ==, items[u].msgid);
+		g_assert_cmpstr (mu_msg_get_subject (msg), ==,
+				 items[u].subject);
+	}
+	g_assert_cmpuint (u, ==, G_N_ELEMENTS(items));
+	mu_msg_iter_destroy (iter);
+
+	g_free (xpath);
+	g_free (mdir);
+}
+
+
+static void
+write_msg (const char *mdir, const char *name, const char *from,
+	   const char *subject, const char *date, const char *msgid,
+	   const char *refs)
+{
+	gchar *path, *msg;
+
+	path = g_build_filename (mdir, "cur", name, NULL);
+	msg  = g_strdup_printf ("From: %s\n"
+				"To: List <list@example.com>\n"
+				"Subject: %s\n"
+				"Date: %s\n"
+				"Message-Id: <%s>\n"
+				"%s%s%s"
+				"\n"
+				"hello\n",
+				from, subject, date, msgid,
+				refs ? "References: <" : "", refs ? refs : "",
+				refs ? ">\n" : "");
+	g_assert (g_file_set_contents (path, msg, -1, NULL));
+
+	g_free (msg);
+	g_free (path);
+}
+
+
+/* the thread aggregates are the same for each message in a thread;
+ * with MU_QUERY_FLAG_SORT_BY_ACTIVITY, the thread with the most recent
+ * message comes first */
+static void
+test_mu_threads_aggregates (void)
+{
+	gchar *mdir, *xpath, *dir;
+	MuMsgIter *iter;
+	unsigned u;
+	const char *subdirs[] = {"cur", "new", "tmp"};
+
+	struct {
+		const char *threadpath;
+		const char *msgid;
+		guint msgnum, unread, flagged, participants;
+		time_t span;
+	} items [] = {
+		{"0",   "b1@aggr.msg.id", 1, 0, 0, 1, 0},
+		{"1",   "a1@aggr.msg.id", 2, 1, 1, 2, 7200},
+		{"1:0", "a2@aggr.msg.id", 2, 1, 1, 2, 7200}
+	};
+
+	mdir = test_mu_common_get_random_tmpdir ();
+	for (u = 0; u != G_N_ELEMENTS(subdirs); ++u) {
+		dir = g_build_filename (mdir, subdirs[u], NULL);
+		g_assert (g_mkdir_with_parents (dir, 0700) == 0);
+		g_free (dir);
+	}
+
+	/* thread 'a' starts first, but has the most recent message */
+	write_msg (mdir, "a1:2,", "Alice <alice@example.com>", "a",
+		   "Thu, 1 Jan 2009 00:00:00 +0000", "a1@aggr.msg.id", NULL);
+	write_msg (mdir, "b1:2,S", "Bob <bob@example.com>", "b",
+		   "Thu, 1 Jan 2009 01:00:00 +0000", "b1@aggr.msg.id", NULL);
+	write_msg (mdir, "a2:2,FS", "Carol <carol@example.com>", "Re: a",
+		   "Thu, 1 Jan 2009 02:00:00 +0000", "a2@aggr.msg.id",
+		   "a1@aggr.msg.id");
+
+	xpath = fill_database (mdir);
+	g_assert (xpath);
+
+	iter = run_and_get_iter (xpath, "", MU_QUERY_FLAG_THREADS |
+				 MU_QUERY_FLAG_SORT_BY_ACTIVITY);
+	for (u = 0; !mu_msg_iter_is_done (iter); mu_msg_iter_next (iter), ++u) {
+		MuMsg *msg;
+		const MuMsgIterThreadInfo *ti;
+
+		g_assert (u < G_N_ELEMENTS(items));
+
+		ti  = mu_msg_iter_get_thread_info (iter);
+		msg = mu_msg_iter_get_msg_floating (iter); /* don't unref */
+		g_assert (ti);
+		g_assert (msg);
+
+		g_assert_cmpstr (ti->threadpath, ==, items[u].threadpath);
+		g_assert_cmpstr (mu_msg_get_msgid (msg), ==, items[u].msgid);
+
+		g_assert_cmpuint (ti->aggr.msgnum, ==, items[u].msgnum);
+		g_assert_cmpuint (ti->aggr.unread, ==, items[u].unread);
+		g_assert_cmpuint (ti->aggr.flagged, ==, items[u].flagged);
+		g_assert_cmpuint (ti->aggr.participants, ==,
+				  items[u].participants);
+		g_assert_cmpint (ti->aggr.newest - ti->aggr.oldest, ==,
+				 items[u].span);
+		g_assert_cmpuint (ti->aggr.size, >, 0);
+	}
+	g_assert_cmpuint (u, ==, G_N_ELEMENTS(items));
+	mu_msg_iter_destroy (iter);
+
+	g_free (xpath);
+	g_free (mdir);
+}
+
+
+static unsigned
+count_matches (const char *xpath, MuQueryFlags flags)
+{
+	MuMsgIter *iter;
+	unsigned n;
+
+	iter = run_and_get_iter (xpath, "", flags);
+	for (n = 0; !mu_msg_iter_is_done (iter); mu_msg_iter_next (iter))
+		++n;
+	mu_msg_iter_destroy (iter);
+
+	return n;
+}
+
+
+/* copies of the same message (same message-id and body) are left out
+ * with MU_QUERY_FLAG_SKIP_DUPS, whether we're threading or not */
+static void
+test_mu_threads_skip_dups (void)
+{
+	gchar *mdir, *xpath, *dir;
+	unsigned u;
+	const char *subdirs[] = {"cur", "new", "tmp"};
+
+	mdir = test_mu_common_get_random_tmpdir ();
+	for (u = 0; u != G_N_ELEMENTS(subdirs); ++u) {
+		dir = g_build_filename (mdir, subdirs[u], NULL);
+		g_assert (g_mkdir_with_parents (dir, 0700) == 0);
+		g_free (dir);
+	}
+
+	write_msg (mdir, "a1:2,S", "Alice <alice@example.com>", "a",
+		   "Thu, 1 Jan 2009 00:00:00 +0000", "a1@dups.msg.id", NULL);
+	write_msg (mdir, "a1-copy:2,", "Alice <alice@example.com>", "a",
+		   "Thu, 1 Jan 2009 00:00:00 +0000", "a1@dups.msg.id", NULL);
+	write_msg (mdir, "b1:2,S", "Bob <bob@example.com>", "Re: a",
+		   "Thu, 1 Jan 2009 01:00:00 +0000", "b1@dups.msg.id",
+		   "a1@dups.msg.id");
+
+	xpath = fill_database (mdir);
+	g_assert (xpath);
+
+	g_assert_cmpuint (count_matches (xpath, MU_QUERY_FLAG_NONE), ==, 3);
+	g_assert_cmpuint (count_matches (xpath, MU_QUERY_FLAG_SKIP_DUPS),
+			  ==, 2);
+	g_assert_cmpuint (count_matches (xpath, MU_QUERY_FLAG_THREADS |
+					 MU_QUERY_FLAG_SKIP_DUPS), ==, 2);
+
+	g_free (xpath);
+	g_free (mdir);
+}
+
+
+/* get the threads one page at a time; each message should show up
+ * exactly once, with its complete thread */
+static void
+test_mu_threads_paged (void)
+{
+	gchar *mdir, *xpath, *token, *next;
+	MuStore *store;
+	MuQuery *mquery;
+	GHashTable *seen;
+	unsigned pages, msgs;
+	GError *err;
+
+	/* 4 threads of 3 messages */
+	mdir  = create_bench_maildir (12, 3, TRUE);
+	xpath = fill_database (mdir);
+	g_assert (xpath);
+
+	store = mu_store_new_read_only (xpath, NULL);
+	g_assert (store);
+	mquery = mu_query_new (store, NULL);
+	g_assert (mquery);
+	mu_store_unref (store);
+
+	seen  = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	token = NULL;
+	pages = msgs = 0;
+	do {
+		MuMsgIter *iter;
+		unsigned roots;
+
+		iter = mu_query_run_paged (mquery, "", MU_QUERY_FLAG_THREADS,
+					   MU_MSG_FIELD_ID_DATE, TRUE, 3,
+					   token, &next, NULL);
+		g_assert (iter);
+
+		for (roots = 0; !mu_msg_iter_is_done (iter);
+		     mu_msg_iter_next (iter)) {
+
+			const char *msgid;
+			const MuMsgIterThreadInfo *ti;
+
+			ti = mu_msg_iter_get_thread_info (iter);
+			if (ti->level == 0)
+				++roots;
+			else
+				g_assert_cmpuint (ti->level, ==, 1);
+
+			msgid = mu_msg_get_msgid
+				(mu_msg_iter_get_msg_floating (iter));
+			g_assert (!g_hash_table_lookup (seen, msgid));
+			g_hash_table_insert (seen, g_strdup (msgid),
+					     GUINT_TO_POINTER(TRUE));
+			++msgs;
+		}
+		g_assert_cmpuint (roots, <=, 3);
+
+		/* the first page has the newest three threads */
+		if (pages == 0) {
+			g_assert_cmpuint (roots, ==, 3);
+			g_assert (g_hash_table_lookup (seen,
+						       "11@bench.msg.id"));
+			g_assert (!g_hash_table_lookup (seen,
+							"2@bench.msg.id"));
+		}
+
+		mu_msg_iter_destroy (iter);
+		g_free (token);
+		token = next;
+		++pages;
+
+	} while (token);
+
+	g_assert_cmpuint (msgs, ==, 12);
+	g_assert_cmpuint (pages, ==, 2);
+
+	/* the pages go by date */
+	err  = NULL;
+	next = NULL;
+	g_assert (!mu_query_run_paged (mquery, "", MU_QUERY_FLAG_THREADS,
+				       MU_MSG_FIELD_ID_SUBJECT, TRUE, 3,
+				       NULL, &next, &err));
+	g_assert_cmpint (err->code, ==, MU_ERROR_IN_PARAMETERS);
+	g_assert (!next);
+	g_clear_error (&err);
+
+	g_hash_table_destroy (seen);
+	mu_query_destroy (mquery);
+	g_free (xpath);
+	g_free (mdir);
+}
+
+
+static void
+test_mu_threads_perf_deep (void)
+{
+	bench_threads (1000);
+}
+
+
+static void
+test_mu_threads_perf_wide (void)
+{
+	bench_threads (10);
+}
+
+
+/* what does grouping by subject cost? we use messages without
+ * References:, so all the threads come from grouping */
+static void
+test_mu_threads_perf_subjects (void)
+{
+	gchar *mdir, *xpath;
+	MuMsgIter *iter;
+	GTimer *timer;
+	unsigned num, u, roots;
+	double secs[2];
+
+	num   = bench_msg_num ();
+	mdir  = create_bench_maildir (num, 10, FALSE);
+	xpath = fill_database (mdir);
+	g_assert (xpath);
+
+	timer = g_timer_new ();
+	for (u = 0; u != G_N_ELEMENTS(secs); ++u) {
+
+		g_timer_start (timer);
+		iter	= run_and_get_iter (xpath, "", u == 0 ?
+					    MU_QUERY_FLAG_THREADS :
+					    MU_QUERY_FLAG_THREADS |
+					    MU_QUERY_FLAG_GROUP_SUBJECTS);
+		secs[u] = g_timer_elapsed (timer, NULL);
+
+		for (roots = 0; !mu_msg_iter_is_done (iter);
+		     mu_msg_iter_next (iter))
+			if (mu_msg_iter_get_thread_info (iter)->level == 0)
+				++roots;
+		g_assert_cmpuint (roots, ==, u == 0 ? num : (num + 9) / 10);
+
+		mu_msg_iter_destroy (iter);
+	}
+
+	g_test_minimized_result (secs[1], "threading %u messages without "
+				 "References: %.2fs, grouping by subject: "
+				 "%.2fs", num, secs[0], secs[1]);
+
+	g_timer_destroy (timer);
+	g_free (xpath);
+	g_free (mdir);
+}
+
+
 
 int
 main (int argc, char *argv[])
@@ -235,6 +730,24 @@ main (int argc, char *argv[])
 
 	g_test_add_func ("/mu-query/test-mu-threads-01", test_mu_threads_01);
 	g_test_add_func ("/mu-query/test-mu-threads-rogue", test_mu_threads_rogue);
+	g_test_add_func ("/mu-query/test-mu-threads-subjects",
+			 test_mu_threads_subjects);
+	g_test_add_func ("/mu-query/test-mu-threads-aggregates",
+			 test_mu_threads_aggregates);
+	g_test_add_func ("/mu-query/test-mu-threads-skip-dups",
+			 test_mu_threads_skip_dups);
+	g_test_add_func ("/mu-query/test-mu-threads-paged",
+			 test_mu_threads_paged);
+
+	if (g_test_perf ())
+		g_test_add_func ("/mu-query/test-mu-threads-perf-deep",
+				 test_mu_threads_perf_deep);
+	if (g_test_perf ())
+		g_test_add_func ("/mu-query/test-mu-threads-perf-wide",
+				 test_mu_threads_perf_wide);
+	if (g_test_perf ())
+		g_test_add_func ("/mu-query/test-mu-threads-perf-subjects",
+				 test_mu_threads_perf_subjects);
 
 	g_log_set_handler (NULL,
 			   G_LOG_LEVEL_MASK | G_LOG_FLAG_FATAL| G_LOG_FLAG_RECURSION,
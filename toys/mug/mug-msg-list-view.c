@@ -342,7 +342,8 @@ run_query (const char *xpath, const char *query, MugMsgListView * self)
 	}
 	mu_store_unref (store);
 
-	iter = mu_query_run (xapian, query, TRUE, MU_MSG_FIELD_ID_DATE,
+	iter = mu_query_run (xapian, query, MU_QUERY_FLAG_THREADS,
+			     MU_MSG_FIELD_ID_DATE,
 			     TRUE, -1, &err);
 	mu_query_destroy (xapian);
 	if (!iter) {